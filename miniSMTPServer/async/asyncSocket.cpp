@@ -0,0 +1,238 @@
+#include "asyncSocket.hpp"
+
+#include "util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <exception>
+#include <iostream>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+AsyncSocket::AsyncSocket(Scheduler &s, FileDescriptor &&fd) : scheduler{s}, socket{std::move(fd)} {
+  socket.set_blocking(false);
+  scheduler.watch(socket.fd_num(), waiters);
+}
+
+Task<bool> AsyncSocket::fill() {
+  if (start > 0) {
+    buffer.erase(0, start);
+    scanned = scanned > start ? scanned - start : 0;
+    start = 0;
+  }
+
+  // A client pipelining without reading the replies must not grow them without bound
+  if (output.size() >= chunkSize) {
+    co_await flush();
+  }
+
+  size_t used = buffer.size();
+  buffer.resize(used + chunkSize);
+  while (!socket.closed()) {
+    bool writing = false;
+    ssize_t bytes = receive(buffer.data() + used, chunkSize, writing);
+    if (bytes >= 0) {
+      buffer.resize(used + bytes);
+      if (transcript != nullptr && bytes > 0) {
+        transcript->client(session, std::string_view{buffer}.substr(used));
+      }
+      co_return bytes > 0;
+    }
+    if (!output.empty()) {
+      // The peer may be waiting for these before it sends more
+      co_await flush();
+      continue;
+    }
+    co_await (writing ? scheduler.writable(waiters) : scheduler.readable(waiters));
+  }
+  buffer.resize(used);
+  co_return false;
+}
+
+std::optional<std::string_view> AsyncSocket::takeLine(size_t limit) {
+  if (overlong) {
+    return std::nullopt;
+  }
+  // What was searched already holds no CRLF, but its last CR may be followed by the LF still to come
+  size_t end = buffer.find("\r\n", std::max(start, scanned));
+  if (end == std::string::npos) {
+    scanned = buffer.empty() ? 0 : buffer.size() - 1;
+    overlong = buffer.size() - start > limit;
+    return std::nullopt;
+  }
+  if (end + 2 - start > limit) {
+    overlong = true;
+    return std::nullopt;
+  }
+  std::string_view line{buffer.data() + start, end + 2 - start};
+  start = end + 2;
+  scanned = start;
+  return line;
+}
+
+Task<std::optional<FileDescriptor>> AsyncSocket::accept() {
+  while (!socket.closed()) {
+    int fd = SystemCall("accept4", ::accept4(socket.fd_num(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC), EAGAIN);
+    if (fd >= 0) {
+      co_return FileDescriptor{fd};
+    }
+    co_await scheduler.readable(waiters);
+  }
+  co_return std::nullopt;
+}
+
+Task<std::optional<std::string_view>> AsyncSocket::read_line(size_t limit) {
+  while (true) {
+    if (auto line = takeLine(limit); line.has_value()) {
+      co_return line;
+    }
+    if (overlong || !co_await fill()) {
+      co_return std::nullopt;
+    }
+  }
+}
+
+Task<bool> AsyncSocket::read_body(const std::function<void(std::string_view)> &line, size_t limit) {
+  while (true) {
+    while (auto next = takeLine(limit)) {
+      if (next.value() == ".\r\n") {
+        co_return true;
+      }
+      line(next.value());
+    }
+    if (overlong || !co_await fill()) {
+      co_return false;
+    }
+  }
+}
+
+Task<> AsyncSocket::write(std::string_view data) {
+  while (!data.empty()) {
+    if (socket.closed()) {
+      throw std::runtime_error("write to a closed socket");
+    }
+    bool writing = true;
+    ssize_t bytes = transmit(data.data(), data.size(), writing);
+    if (bytes >= 0) {
+      if (transcript != nullptr && bytes > 0) {
+        transcript->server(session, data.substr(0, bytes));
+      }
+      data.remove_prefix(bytes);
+      continue;
+    }
+    co_await (writing ? scheduler.writable(waiters) : scheduler.readable(waiters));
+  }
+}
+
+ssize_t AsyncSocket::receive(char *data, size_t size, bool &writing) {
+  if (!tls) {
+    writing = false;
+    return SystemCall("read", ::read(socket.fd_num(), data, size), EAGAIN);
+  }
+
+  size_t bytes = 0;
+  ERR_clear_error();
+  int result = SSL_read_ex(tls.get(), data, size, &bytes);
+  if (result == 1) {
+    return static_cast<ssize_t>(bytes);
+  }
+  switch (SSL_get_error(tls.get(), result)) {
+    case SSL_ERROR_WANT_READ:
+      writing = false;
+      return -1;
+    case SSL_ERROR_WANT_WRITE:
+      writing = true;
+      return -1;
+    default:
+      // close_notify, or a peer gone without it, ends the stream like a FIN
+      ERR_clear_error();
+      return 0;
+  }
+}
+
+ssize_t AsyncSocket::transmit(const char *data, size_t size, bool &writing) {
+  if (!tls) {
+    writing = true;
+    return SystemCall("send", ::send(socket.fd_num(), data, size, MSG_NOSIGNAL | MSG_DONTWAIT), EAGAIN);
+  }
+
+  size_t bytes = 0;
+  ERR_clear_error();
+  int result = SSL_write_ex(tls.get(), data, size, &bytes);
+  if (result == 1) {
+    return static_cast<ssize_t>(bytes);
+  }
+  switch (SSL_get_error(tls.get(), result)) {
+    case SSL_ERROR_WANT_READ:
+      writing = false;
+      return -1;
+    case SSL_ERROR_WANT_WRITE:
+      writing = true;
+      return -1;
+    default:
+      throw std::runtime_error("SSL_write: " + tlsError());
+  }
+}
+
+Task<bool> AsyncSocket::start_tls(TlsContext &context) {
+  co_await flush();
+  buffer.clear();
+  start = 0;
+  scanned = 0;
+
+  tls = context.create();
+  if (SSL_set_fd(tls.get(), socket.fd_num()) != 1) {
+    throw std::runtime_error("SSL_set_fd: " + tlsError());
+  }
+  while (!socket.closed()) {
+    ERR_clear_error();
+    int result = SSL_do_handshake(tls.get());
+    if (result == 1) {
+      co_return true;
+    }
+    switch (SSL_get_error(tls.get(), result)) {
+      case SSL_ERROR_WANT_READ:
+        co_await scheduler.readable(waiters);
+        break;
+      case SSL_ERROR_WANT_WRITE:
+        co_await scheduler.writable(waiters);
+        break;
+      default:
+        ERR_clear_error();
+        co_return false;
+    }
+  }
+  co_return false;
+}
+
+Task<> AsyncSocket::flush() {
+  co_await write(output);
+  output.clear();
+}
+
+void AsyncSocket::close() {
+  if (!socket.closed()) {
+    if (tls && SSL_is_init_finished(tls.get())) {
+      // Best effort, a close_notify that would block is not sent
+      SSL_shutdown(tls.get());
+      ERR_clear_error();
+    }
+    scheduler.unwatch(socket.fd_num());
+    socket.close();
+    scheduler.wake(waiters);
+    if (transcript != nullptr) {
+      transcript->close(session);
+    }
+  }
+}
+
+AsyncSocket::~AsyncSocket() {
+  try {
+    close();
+  } catch (const std::exception &e) {
+    std::cerr << "Exception closing AsyncSocket: " << e.what() << std::endl;
+  }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "scheduler.hpp"
+#include "socket.hpp"
+#include "task.hpp"
+#include "tlsContext.hpp"
+#include "transcript.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+/**
+ * @brief A non-blocking socket whose operations are awaited, TCP or Unix.
+ *
+ * @details Every operation first tries its system call and only suspends the
+ * calling coroutine when it would block, so a pipelined client is served
+ * from the buffer without going back to the scheduler. The socket registers
+ * itself with the scheduler and must not move, create it inside the
+ * coroutine that uses it.
+ *
+ * After `start_tls` the same operations go through TLS. OpenSSL decrypts
+ * straight into the line buffer and encrypts straight from the data being
+ * written, there is no other plaintext copy.
+ */
+class AsyncSocket {
+private:
+  Scheduler &scheduler;
+  FileDescriptor socket;
+  Scheduler::Waiters waiters{};
+  std::string buffer{};   //!< Received bytes, the unread ones start at `start`
+  size_t start = 0;
+  size_t scanned = 0;     //!< Where the search for the next CRLF resumes
+  bool overlong = false;  //!< Set once a line went over the limit it was read with
+  std::string output{};   //!< Collected by `write_later`, sent before waiting for input
+  TlsSession tls{};       //!< Set once the connection is encrypted
+
+  Transcript *transcript = nullptr;  //!< Where the traffic is recorded, if it is
+  uint64_t session = 0;              //!< The number of this connection in `transcript`
+
+  //! Append what can be read to the buffer, false at the end of the stream
+  Task<bool> fill();
+
+  //! Bytes read, 0 at the end of the stream, or -1 if it would block, until writable when `writing` is set
+  ssize_t receive(char *data, size_t size, bool &writing);
+
+  //! Bytes written, or -1 if it would block, until writable when `writing` is set
+  ssize_t transmit(const char *data, size_t size, bool &writing);
+
+  //! The next complete line in the buffer, with its CRLF, consumed, nothing as well once it is over `limit`
+  std::optional<std::string_view> takeLine(size_t limit);
+
+public:
+  //! How much is read at once
+  static constexpr size_t chunkSize = 64 * 1024;
+
+  //! Longest command line, with its CRLF, see RFC 5321 4.5.3.1.4
+  static constexpr size_t commandLineLimit = 512;
+
+  //! Longest line of a message body, with its CRLF, see RFC 5321 4.5.3.1.6
+  static constexpr size_t textLineLimit = 1000;
+
+  AsyncSocket(Scheduler &scheduler, FileDescriptor &&socket);
+
+  /**
+   * @brief Accept a new connection on a listening socket.
+   *
+   * @return Task<std::optional<FileDescriptor>> the connection, non-blocking
+   * already and of the family of the listening socket, or nothing once the
+   * listening socket has been closed
+   */
+  Task<std::optional<FileDescriptor>> accept();
+
+  /**
+   * @brief Read one line.
+   *
+   * @param[in] limit the longest line accepted, with its CRLF
+   * @return Task<std::optional<std::string_view>> the line with its CRLF,
+   * valid until the next read, or nothing once the peer has closed or sent
+   * a longer line, see `overran`
+   */
+  Task<std::optional<std::string_view>> read_line(size_t limit = commandLineLimit);
+
+  /**
+   * @brief Read a message body up to the terminating ".".
+   * @details The lines are handed over as they are parsed, still
+   * dot-stuffed and with their CRLF, the terminating line is consumed.
+   *
+   * @param[in] line called with every line of the body
+   * @param[in] limit the longest line accepted, with its CRLF
+   * @return Task<bool> false if the peer closed before the end of the body,
+   * or sent a longer line, see `overran`
+   */
+  Task<bool> read_body(const std::function<void(std::string_view)> &line, size_t limit = textLineLimit);
+
+  //! Whether a read ended because the line was over its limit, nothing more is read then
+  bool overran() const { return overlong; }
+
+  //! Write all of `data`
+  Task<> write(std::string_view data);
+
+  /**
+   * @brief Write `data` once the coroutine would wait for input.
+   * @details The replies to pipelined commands are collected and leave in
+   * one send, instead of one segment each, when nothing is left to read.
+   *
+   * @param[in] data what to write, copied
+   */
+  void write_later(std::string_view data) { output.append(data); }
+
+  //! Write what `write_later` has collected
+  Task<> flush();
+
+  /**
+   * @brief Encrypt the connection from here on, as the server of a TLS handshake.
+   * @details What has been received and not read yet is dropped: it was
+   * sent in the clear, after the command starting TLS, see RFC 3207.
+   *
+   * @param[in] context the certificate and the session cache
+   * @return Task<bool> false if the handshake failed, the connection is of no use then
+   */
+  Task<bool> start_tls(TlsContext &context);
+
+  //! Whether the connection is encrypted
+  bool encrypted() const { return tls != nullptr; }
+
+  /**
+   * @brief Record what is read and written from here on.
+   * @details The bytes are recorded as every read returned them and every
+   * write sent them, in the clear, and the end of the connection when it is
+   * closed.
+   *
+   * @param[in] into the transcript, which must outlive the socket
+   * @param[in] number the number `Transcript::open` gave the session
+   */
+  void capture(Transcript &into, uint64_t number) {
+    transcript = &into;
+    session = number;
+  }
+
+  //! Close the socket, a coroutine waiting on it sees the end of the stream
+  void close();
+
+  //! The descriptor, e.g. to hand it over to another process
+  int fd_num() const { return socket.fd_num(); }
+
+  bool closed() const { return socket.closed(); }
+
+  ~AsyncSocket();
+
+  AsyncSocket(const AsyncSocket &other) = delete;
+  AsyncSocket &operator=(const AsyncSocket &other) = delete;
+};
@@ -0,0 +1,66 @@
+#include "framePool.hpp"
+
+#include <array>
+#include <new>
+
+/**
+ * @brief The free frames of one thread, one list per size class.
+ *
+ */
+struct FreeFrames {
+  struct Frame {
+    Frame *next;
+  };
+
+  std::array<Frame *, FramePool::largest / FramePool::granularity> heads{};
+  std::array<size_t, FramePool::largest / FramePool::granularity> counts{};
+  size_t misses = 0;
+
+  ~FreeFrames() {
+    for (Frame *head : heads) {
+      while (head != nullptr) {
+        Frame *next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  }
+};
+
+static thread_local FreeFrames freeFrames{};
+
+static size_t sizeClass(size_t size) { return (size - 1) / FramePool::granularity; }
+
+void *FramePool::allocate(size_t size) {
+  if (size > largest) {
+    return ::operator new(size);
+  }
+
+  size_t index = sizeClass(size);
+  if (FreeFrames::Frame *frame = freeFrames.heads[index]; frame != nullptr) {
+    freeFrames.heads[index] = frame->next;
+    --freeFrames.counts[index];
+    return frame;
+  }
+  ++freeFrames.misses;
+  return ::operator new((index + 1) * granularity);
+}
+
+void FramePool::deallocate(void *frame, size_t size) noexcept {
+  if (size > largest) {
+    ::operator delete(frame);
+    return;
+  }
+
+  size_t index = sizeClass(size);
+  if (freeFrames.counts[index] >= cachedFrames) {
+    ::operator delete(frame);
+    return;
+  }
+  auto *free = static_cast<FreeFrames::Frame *>(frame);
+  free->next = freeFrames.heads[index];
+  freeFrames.heads[index] = free;
+  ++freeFrames.counts[index];
+}
+
+size_t FramePool::misses() { return freeFrames.misses; }
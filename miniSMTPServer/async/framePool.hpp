@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @brief Recycles coroutine frames.
+ *
+ * @details Every `Task` frame is allocated here. Frames are rounded up to a
+ * size class of `granularity` bytes and kept on a free list of the calling
+ * thread when they are freed, so the frames of a session, e.g. one per
+ * `read_line`, are served without the global allocator once the thread is
+ * warm. Frames larger than `largest` go to the global allocator.
+ */
+class FramePool {
+public:
+  static constexpr size_t granularity = 64;    //!< Step between size classes
+  static constexpr size_t largest = 4096;      //!< Largest frame kept in the pool
+  static constexpr size_t cachedFrames = 512;  //!< Most frames a free list keeps
+
+  //! A frame of at least `size` bytes
+  static void *allocate(size_t size);
+
+  //! Give back a frame from `allocate`, `size` is the size asked for
+  static void deallocate(void *frame, size_t size) noexcept;
+
+  //! Frames taken from the global allocator by the calling thread, for the benchmarks
+  static size_t misses();
+};
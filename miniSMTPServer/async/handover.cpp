@@ -0,0 +1,94 @@
+#include "handover.hpp"
+
+#include "asyncSocket.hpp"
+#include "util.hpp"
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+/**
+ * @brief Runs a callback on a thread of its own, resuming the awaiting
+ * coroutine on the event loop once it has returned.
+ *
+ */
+struct OffLoop {
+  Scheduler &scheduler;
+  const std::function<void()> &callback;
+  std::thread thread{};
+  std::exception_ptr error{};
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    thread = std::thread{[this, handle] {
+      try {
+        callback();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      scheduler.post([this, handle] { scheduler.resume(handle); });
+    }};
+  }
+  void await_resume() {
+    thread.join();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  ~OffLoop() {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+};
+
+std::optional<Takeover> takeover(const std::string &path) {
+  UnixSocket control{};
+  try {
+    control.connect(path);
+  } catch (const unix_error &e) {
+    // A cold start, or the previous process died and left its socket behind
+    if (e.code().value() == ENOENT || e.code().value() == ECONNREFUSED) {
+      return std::nullopt;
+    }
+    throw;
+  }
+
+  std::vector<FileDescriptor> fds = control.receive_fds();
+  if (fds.empty()) {
+    throw std::runtime_error("the process serving " + path + " closed without handing over its sockets");
+  }
+
+  Takeover result{std::move(control), {}};
+  for (auto &fd : fds) {
+    result.listeners.emplace_back(std::move(fd));
+  }
+  return result;
+}
+
+Task<UnixSocket> handover(Scheduler &scheduler, std::string path, std::vector<int> listeners,
+                          std::function<void()> release) {
+  UnixSocket control{};
+  SystemCall("unlink " + path, ::unlink(path.c_str()), ENOENT);
+  control.bind(path);
+  control.listen();
+
+  AsyncSocket listener{scheduler, std::move(control)};
+  std::optional<FileDescriptor> connection = co_await listener.accept();
+  if (!connection.has_value()) {
+    throw std::runtime_error("control socket " + path + " closed");
+  }
+
+  UnixSocket successor{std::move(connection.value())};
+  successor.set_blocking(true);
+  // The sessions go on meanwhile, and so does accepting
+  OffLoop released{scheduler, release};
+  co_await released;
+  successor.send_fds(listeners);
+  co_return successor;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "scheduler.hpp"
+#include "socket.hpp"
+#include "task.hpp"
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief What a new process gets from the one it replaces.
+ *
+ */
+struct Takeover {
+  UnixSocket control;                //!< Reaches the end of the stream when the previous process has exited
+  std::vector<TCPSocket> listeners;  //!< Bound and listening, accepting can start right away
+};
+
+/**
+ * @brief Ask the process serving `path` for its listening sockets.
+ * @details The sockets stay open through the handover, so connections
+ * arriving meanwhile wait in the accept queue instead of being refused.
+ *
+ * @param[in] path the control socket of the running process
+ * @return std::optional<Takeover> the sockets, nothing when no process serves `path`
+ */
+std::optional<Takeover> takeover(const std::string &path);
+
+/**
+ * @brief Serve `path` until a new process takes the listening sockets over.
+ * @details `release` runs before the sockets are sent, to give up what the
+ * new process must not share, e.g. the relay. It runs on a thread of its
+ * own, so it may block while the sessions and the accepting go on, and must
+ * not touch what the event loop uses without a lock. The caller then stops
+ * accepting and drains its sessions, and closes the returned connection,
+ * which tells the new process it is gone, when it exits.
+ *
+ * @param[in] scheduler the scheduler running the coroutine
+ * @param[in] path where to bind the control socket, an existing socket there is replaced
+ * @param[in] listeners the listening sockets to hand over
+ * @param[in] release called off the event loop right before handing the sockets over
+ * @return Task<UnixSocket> the connection to the new process
+ */
+Task<UnixSocket> handover(Scheduler &scheduler, std::string path, std::vector<int> listeners,
+                          std::function<void()> release);
@@ -0,0 +1,178 @@
+#include "scheduler.hpp"
+
+#include "util.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief The coroutine owning a spawned task, it frees itself when done.
+ *
+ */
+struct Detached {
+  struct promise_type {
+    std::unordered_set<void *> *tasks = nullptr;  //!< Where the scheduler tracks the frame
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+        handle.promise().tasks->erase(handle.address());
+        handle.destroy();
+      }
+      void await_resume() noexcept {}
+    };
+
+    static void *operator new(size_t size) { return FramePool::allocate(size); }
+    static void operator delete(void *frame, size_t size) { FramePool::deallocate(frame, size); }
+
+    Detached get_return_object() { return Detached{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+static Detached detach(Task<> task) {
+  try {
+    co_await task;
+  } catch (const std::exception &e) {
+    std::cerr << "Task failed: " << e.what() << std::endl;
+  }
+}
+
+Scheduler::Scheduler()
+    : epoll{SystemCall("epoll_create1", ::epoll_create1(EPOLL_CLOEXEC))}
+    , notifier{SystemCall("eventfd", ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))} {
+  // No `Waiters` behind it, the loop tells it apart by the null pointer
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = nullptr;
+  SystemCall("epoll_ctl", ::epoll_ctl(epoll.fd_num(), EPOLL_CTL_ADD, notifier.fd_num(), &event));
+}
+
+void Scheduler::spawn(Task<> task) {
+  Detached detached = detach(std::move(task));
+  detached.handle.promise().tasks = &tasks;
+  tasks.insert(detached.handle.address());
+  ready.push_back(detached.handle);
+}
+
+void Scheduler::watch(int fd, Waiters &waiters) {
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = &waiters;
+  SystemCall("epoll_ctl", ::epoll_ctl(epoll.fd_num(), EPOLL_CTL_ADD, fd, &event));
+}
+
+void Scheduler::unwatch(int fd) { SystemCall("epoll_ctl", ::epoll_ctl(epoll.fd_num(), EPOLL_CTL_DEL, fd, nullptr)); }
+
+void Scheduler::wake(Waiters &waiters) {
+  for (std::coroutine_handle<> *waiter : {&waiters.reader, &waiters.writer}) {
+    if (*waiter) {
+      ready.push_back(std::exchange(*waiter, nullptr));
+    }
+  }
+}
+
+void Scheduler::post(std::function<void()> callback) {
+  {
+    std::lock_guard<std::mutex> lock{postedMutex};
+    posted.push_back(std::move(callback));
+  }
+  const uint64_t one = 1;
+  SystemCall("write eventfd", ::write(notifier.fd_num(), &one, sizeof(one)));
+}
+
+void Scheduler::after(std::chrono::steady_clock::duration delay, std::function<void()> callback) {
+  timers.emplace(std::chrono::steady_clock::now() + delay, std::move(callback));
+}
+
+void Scheduler::runCallbacks() {
+  std::vector<std::function<void()>> callbacks{};
+  {
+    std::lock_guard<std::mutex> lock{postedMutex};
+    callbacks.swap(posted);
+  }
+  for (auto &callback : callbacks) {
+    callback();
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  while (!timers.empty() && timers.begin()->first <= now) {
+    std::function<void()> callback = std::move(timers.begin()->second);
+    timers.erase(timers.begin());
+    callback();
+  }
+}
+
+void Scheduler::run() {
+  using namespace std::chrono;
+
+  stopped = false;
+  std::array<epoll_event, 256> events{};
+  while (!stopped && !tasks.empty()) {
+    runCallbacks();
+    while (!ready.empty() && !stopped) {
+      std::coroutine_handle<> handle = ready.front();
+      ready.pop_front();
+      handle.resume();
+    }
+    if (stopped || tasks.empty()) {
+      break;
+    }
+
+    int timeout = -1;
+    if (deadline.has_value()) {
+      auto left = ceil<milliseconds>(deadline.value() - steady_clock::now());
+      if (left.count() <= 0) {
+        break;
+      }
+      timeout = static_cast<int>(std::min<milliseconds::rep>(left.count(), std::numeric_limits<int>::max()));
+    }
+    if (!timers.empty()) {
+      auto left = ceil<milliseconds>(timers.begin()->first - steady_clock::now()).count();
+      left = std::clamp<milliseconds::rep>(left, 0, std::numeric_limits<int>::max());
+      timeout = timeout < 0 ? static_cast<int>(left) : std::min(timeout, static_cast<int>(left));
+    }
+
+    int count = SystemCall("epoll_wait", ::epoll_wait(epoll.fd_num(), events.data(), events.size(), timeout), EINTR);
+    // Collect every woken coroutine before resuming any, a resumed one may
+    // close a socket whose event is still in `events`
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.ptr == nullptr) {
+        // Reset the counter, the posted callbacks run on the next turn
+        uint64_t posts = 0;
+        SystemCall("read eventfd", ::read(notifier.fd_num(), &posts, sizeof(posts)), EAGAIN);
+        continue;
+      }
+      auto *waiters = static_cast<Waiters *>(events[i].data.ptr);
+      uint32_t happened = events[i].events;
+      if ((happened & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && waiters->reader) {
+        ready.push_back(std::exchange(waiters->reader, nullptr));
+      }
+      if ((happened & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && waiters->writer) {
+        ready.push_back(std::exchange(waiters->writer, nullptr));
+      }
+    }
+  }
+}
+
+Scheduler::~Scheduler() {
+  // Destroying a task closes its sockets, which unwatches them
+  std::unordered_set<void *> unfinished = std::move(tasks);
+  tasks.clear();
+  for (void *frame : unfinished) {
+    std::coroutine_handle<>::from_address(frame).destroy();
+  }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "socket.hpp"
+#include "task.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief Runs coroutines on one thread, resuming them when their file
+ * descriptors become ready.
+ *
+ * @details File descriptors are registered edge-triggered with
+ * [epoll(7)](\ref man7::epoll) for both directions. A coroutine tries its
+ * system call first and only suspends on EAGAIN, so an edge is never missed:
+ * anything arriving after the failed call raises a new one.
+ *
+ * Other threads hand work back with `post`, which wakes the loop through an
+ * [eventfd(2)](\ref man2::eventfd) watched like any other descriptor.
+ */
+class Scheduler {
+public:
+  /**
+   * @brief The coroutines waiting on one file descriptor.
+   *
+   */
+  struct Waiters {
+    std::coroutine_handle<> reader{};  //!< Resumed when the descriptor is readable
+    std::coroutine_handle<> writer{};  //!< Resumed when the descriptor is writable
+  };
+
+private:
+  FileDescriptor epoll;
+  FileDescriptor notifier;  //!< Readable once `post` has been called
+  std::deque<std::coroutine_handle<>> ready{};
+  std::unordered_set<void *> tasks{};  //!< Frames of the spawned tasks still running
+  bool stopped = false;
+  std::optional<std::chrono::steady_clock::time_point> deadline{};
+  std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> timers{};
+
+  std::mutex postedMutex{};                     //!< Guards `posted`, the only state other threads touch
+  std::vector<std::function<void()>> posted{};  //!< Handed over by `post`, run on the next turn
+
+  //! Run the posted callbacks and the timers that are due
+  void runCallbacks();
+
+  struct Readiness {
+    std::coroutine_handle<> &slot;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { slot = handle; }
+    void await_resume() const noexcept {}
+  };
+
+  struct Sleep {
+    Scheduler &scheduler;
+    std::chrono::steady_clock::duration delay;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      scheduler.after(delay, [&scheduler = scheduler, handle] { scheduler.resume(handle); });
+    }
+    void await_resume() const noexcept {}
+  };
+
+public:
+  Scheduler();
+
+  /**
+   * @brief Start `task` on the next turn of the loop.
+   * @details The scheduler owns the task from now on. An exception escaping
+   * it is logged and ends only that task.
+   *
+   */
+  void spawn(Task<> task);
+
+  //! Watch `fd`, `waiters` must stay valid until `unwatch`
+  void watch(int fd, Waiters &waiters);
+
+  //! Stop watching `fd`
+  void unwatch(int fd);
+
+  //! Resume the coroutines waiting on `waiters` on the next turn, e.g. after their descriptor was closed
+  void wake(Waiters &waiters);
+
+  //! Resume `handle` on the next turn
+  void resume(std::coroutine_handle<> handle) { ready.push_back(handle); }
+
+  /**
+   * @brief Run `callback` on the thread running the loop, on its next turn.
+   * @details The only member that may be called from another thread, e.g. by
+   * a worker handing its result back to the coroutine waiting for it.
+   *
+   * @param[in] callback what to run
+   */
+  void post(std::function<void()> callback);
+
+  //! Run `callback` on the loop once `delay` has passed, unless `run` has returned by then
+  void after(std::chrono::steady_clock::duration delay, std::function<void()> callback);
+
+  //! Suspend for `delay`, e.g. to back off from a call failing again at once
+  Sleep sleep(std::chrono::steady_clock::duration delay) { return Sleep{*this, delay}; }
+
+  //! Suspend until the descriptor of `waiters` is readable
+  Readiness readable(Waiters &waiters) { return Readiness{waiters.reader}; }
+
+  //! Suspend until the descriptor of `waiters` is writable
+  Readiness writable(Waiters &waiters) { return Readiness{waiters.writer}; }
+
+  /**
+   * @brief Resume coroutines until every spawned task has finished, `stop`
+   * is called or the deadline set by `stopAt` has passed.
+   *
+   */
+  void run();
+
+  //! Make `run` return after the current turn
+  void stop() { stopped = true; }
+
+  //! Make `run` return at `time` at the latest
+  void stopAt(std::chrono::steady_clock::time_point time) { deadline = time; }
+
+  //! Number of spawned tasks still running
+  size_t running() const { return tasks.size(); }
+
+  //! Destroy the tasks which have not finished
+  ~Scheduler();
+
+  Scheduler(const Scheduler &other) = delete;
+  Scheduler &operator=(const Scheduler &other) = delete;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "framePool.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/**
+ * @brief What the promises of every `Task` share.
+ *
+ * @details A task starts suspended and runs when it is awaited. When it
+ * finishes, it resumes its awaiter directly (symmetric transfer), so a chain
+ * of nested tasks neither grows the stack nor goes through the scheduler.
+ */
+class TaskPromise {
+private:
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      if (std::coroutine_handle<> continuation = handle.promise().continuation) {
+        return continuation;
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+public:
+  std::coroutine_handle<> continuation{};  //!< The coroutine awaiting the task
+  std::exception_ptr exception{};          //!< What the task threw, rethrown to the awaiter
+
+  static void *operator new(size_t size) { return FramePool::allocate(size); }
+  static void operator delete(void *frame, size_t size) { FramePool::deallocate(frame, size); }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+/**
+ * @brief A lazily started coroutine returning a `T`.
+ *
+ * @details `co_await task` runs the task until it finishes and returns its
+ * value, or rethrows its exception. The frame is destroyed with the `Task`.
+ */
+template <typename T = void>
+class Task {
+public:
+  struct promise_type : TaskPromise {
+    std::optional<T> value{};
+
+    Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    void return_value(T result) { value.emplace(std::move(result)); }
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle{h} {}
+
+public:
+  Task(Task &&other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  T await_resume() {
+    if (handle.promise().exception) {
+      std::rethrow_exception(handle.promise().exception);
+    }
+    return std::move(handle.promise().value.value());
+  }
+
+  ~Task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  Task(const Task &other) = delete;
+  Task &operator=(const Task &other) = delete;
+};
+
+template <>
+class Task<void> {
+public:
+  struct promise_type : TaskPromise {
+    Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    void return_void() {}
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle{h} {}
+
+public:
+  Task(Task &&other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  void await_resume() {
+    if (handle.promise().exception) {
+      std::rethrow_exception(handle.promise().exception);
+    }
+  }
+
+  ~Task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  Task(const Task &other) = delete;
+  Task &operator=(const Task &other) = delete;
+};
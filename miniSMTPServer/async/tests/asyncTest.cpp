@@ -0,0 +1,331 @@
+#include "asyncSocket.hpp"
+#include "framePool.hpp"
+#include "handover.hpp"
+#include "scheduler.hpp"
+#include "task.hpp"
+#include "transcript.hpp"
+#include "util.hpp"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+static std::pair<TCPSocket, TCPSocket> socketPair() {
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  return {TCPSocket{FileDescriptor{fds[0]}}, TCPSocket{FileDescriptor{fds[1]}}};
+}
+
+static Task<int> answer() { co_return 42; }
+
+static Task<int> sum(int count) {
+  int total = 0;
+  for (int i = 0; i < count; ++i) {
+    total += co_await answer();
+  }
+  co_return total;
+}
+
+static Task<int> failing() {
+  throw std::runtime_error("failed");
+  co_return 0;
+}
+
+TEST(Task, nestedTasksAndExceptions) {
+  Scheduler scheduler{};
+  int total = 0;
+  bool caught = false;
+  scheduler.spawn([](int &total, bool &caught) -> Task<> {
+    total = co_await sum(1000);
+    try {
+      co_await failing();
+    } catch (const std::runtime_error &) {
+      caught = true;
+    }
+  }(total, caught));
+  scheduler.run();
+
+  EXPECT_EQ(total, 42000);
+  EXPECT_TRUE(caught);
+  EXPECT_EQ(scheduler.running(), 0);
+}
+
+TEST(Scheduler, sleepResumesOnceTheDelayHasPassed) {
+  Scheduler scheduler{};
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration slept{};
+  scheduler.spawn([](Scheduler &scheduler, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::duration &slept) -> Task<> {
+    auto pause = scheduler.sleep(std::chrono::milliseconds{20});
+    co_await pause;
+    slept = std::chrono::steady_clock::now() - start;
+  }(scheduler, start, slept));
+  scheduler.run();
+
+  EXPECT_GE(slept, std::chrono::milliseconds{20});
+  EXPECT_EQ(scheduler.running(), 0);
+}
+
+TEST(FramePool, framesAreRecycled) {
+  void *frame = FramePool::allocate(100);
+  FramePool::deallocate(frame, 100);
+  // Same size class
+  EXPECT_EQ(FramePool::allocate(120), frame);
+  FramePool::deallocate(frame, 120);
+
+  void *large = FramePool::allocate(FramePool::largest + 1);
+  FramePool::deallocate(large, FramePool::largest + 1);
+}
+
+TEST(AsyncSocket, linesAndBody) {
+  auto [server, client] = socketPair();
+  Scheduler scheduler{};
+
+  std::vector<std::string> lines{};
+  std::vector<std::string> body{};
+  bool complete = false;
+  scheduler.spawn([](Scheduler &scheduler, TCPSocket connection, std::vector<std::string> &lines,
+                     std::vector<std::string> &body, bool &complete) -> Task<> {
+    AsyncSocket socket{scheduler, std::move(connection)};
+    for (int i = 0; i < 2; ++i) {
+      std::optional<std::string_view> line = co_await socket.read_line();
+      lines.emplace_back(line.value());
+      co_await socket.write("ok " + std::to_string(i) + "\r\n");
+    }
+    complete = co_await socket.read_body([&body](std::string_view line) { body.emplace_back(line); });
+    lines.emplace_back((co_await socket.read_line()).value_or("none"));
+    EXPECT_FALSE((co_await socket.read_line()).has_value());
+  }(scheduler, std::move(server), lines, body, complete));
+
+  // A pipelined client, everything arrives in one read
+  client.write("HELO\r\nMAIL FROM:<a@b.c>\r\nfirst\r\n..dot\r\n.\r\nQUIT\r\n");
+  SystemCall("shutdown", ::shutdown(client.fd_num(), SHUT_WR));
+  scheduler.run();
+
+  EXPECT_EQ(lines, (std::vector<std::string>{"HELO\r\n", "MAIL FROM:<a@b.c>\r\n", "QUIT\r\n"}));
+  EXPECT_EQ(body, (std::vector<std::string>{"first\r\n", "..dot\r\n"}));
+  EXPECT_TRUE(complete);
+  EXPECT_EQ(client.read(), "ok 0\r\nok 1\r\n");
+}
+
+TEST(AsyncSocket, linesOverTheLimitEndTheReads) {
+  auto [server, client] = socketPair();
+  Scheduler scheduler{};
+
+  std::vector<std::string> lines{};
+  bool complete = true;
+  bool overran = false;
+  scheduler.spawn([](Scheduler &scheduler, TCPSocket connection, std::vector<std::string> &lines, bool &complete,
+                     bool &overran) -> Task<> {
+    AsyncSocket socket{scheduler, std::move(connection)};
+    lines.emplace_back((co_await socket.read_line()).value_or("none"));
+    complete = co_await socket.read_body([&lines](std::string_view line) { lines.emplace_back(line); });
+    overran = socket.overran();
+    EXPECT_FALSE((co_await socket.read_line()).has_value());
+  }(scheduler, std::move(server), lines, complete, overran));
+
+  // The CRLF of the first line arrives in two reads
+  client.write("DATA\r");
+  scheduler.after(std::chrono::milliseconds{10}, [&client] {
+    client.write("\n" + std::string(AsyncSocket::textLineLimit - 2, 'x') + "\r\n" +
+                 std::string(AsyncSocket::textLineLimit - 1, 'y') + "\r\n.\r\n");
+  });
+  scheduler.run();
+
+  ASSERT_EQ(lines.size(), 2);
+  EXPECT_EQ(lines[0], "DATA\r\n");
+  EXPECT_EQ(lines[1].size(), AsyncSocket::textLineLimit);
+  EXPECT_FALSE(complete);
+  EXPECT_TRUE(overran);
+}
+
+TEST(AsyncSocket, largeWritesWaitForTheReader) {
+  auto [server, client] = socketPair();
+  Scheduler scheduler{};
+  std::string data(4 * 1024 * 1024, 'x');
+  bool done = false;
+
+  scheduler.spawn([](Scheduler &scheduler, TCPSocket connection, const std::string &data) -> Task<> {
+    AsyncSocket socket{scheduler, std::move(connection)};
+    co_await socket.write(data);
+  }(scheduler, std::move(server), data));
+  scheduler.spawn([](Scheduler &scheduler, TCPSocket connection, bool &done) -> Task<> {
+    AsyncSocket socket{scheduler, std::move(connection)};
+    // There is no line break, so the whole stream is buffered until the writer closes
+    EXPECT_FALSE((co_await socket.read_line()).has_value());
+    done = true;
+  }(scheduler, std::move(client), done));
+  scheduler.run();
+
+  EXPECT_TRUE(done);
+}
+
+TEST(AsyncSocket, acceptsOverIPv6WithTheListenerOptions) {
+  SocketOptions options{};
+  options.address = "::1";
+  options.port = 0;
+  TCPSocket socket = listenOn(options);
+  uint16_t port = socket.local_port();
+
+  // TCPSocket::connect only speaks IPv4
+  TCPSocket client{AF_INET6};
+  struct sockaddr_in6 address {};
+  address.sin6_family = AF_INET6;
+  address.sin6_port = htons(port);
+  address.sin6_addr = in6addr_loopback;
+  SystemCall("connect", ::connect(client.fd_num(), (struct sockaddr *)&address, sizeof(address)));
+
+  Scheduler scheduler{};
+  std::optional<FileDescriptor> accepted{};
+  scheduler.spawn([](Scheduler &scheduler, TCPSocket socket, std::optional<FileDescriptor> &accepted) -> Task<> {
+    AsyncSocket listener{scheduler, std::move(socket)};
+    accepted = co_await listener.accept();
+  }(scheduler, std::move(socket), accepted));
+  scheduler.run();
+
+  ASSERT_TRUE(accepted.has_value());
+  // Inherited from the listening socket
+  int nodelay = 0;
+  socklen_t length = sizeof(nodelay);
+  SystemCall("getsockopt", ::getsockopt(accepted->fd_num(), IPPROTO_TCP, TCP_NODELAY, &nodelay, &length));
+  EXPECT_EQ(nodelay, 1);
+  EXPECT_THROW(listenOn(SocketOptions{"localhost"}), std::runtime_error);
+}
+
+TEST(AsyncSocket, collectedWritesLeaveBeforeWaitingForInput) {
+  auto [server, client] = socketPair();
+  Scheduler scheduler{};
+
+  scheduler.spawn([](Scheduler &scheduler, TCPSocket connection) -> Task<> {
+    AsyncSocket socket{scheduler, std::move(connection)};
+    while (auto line = co_await socket.read_line()) {
+      socket.write_later("got " + std::string{line.value()});
+    }
+  }(scheduler, std::move(server)));
+
+  // Both lines are read before the replies leave, together
+  client.write("one\r\ntwo\r\n");
+  scheduler.stopAt(std::chrono::steady_clock::now() + std::chrono::milliseconds{50});
+  scheduler.run();
+  EXPECT_EQ(client.read(), "got one\r\ngot two\r\n");
+}
+
+TEST(Transcript, recordsWhatTheSocketReadsAndWrites) {
+  const std::string path = "/tmp/asyncTest-" + std::to_string(::getpid()) + ".transcript";
+  auto [server, client] = socketPair();
+  {
+    Transcript transcript{path};
+    Scheduler scheduler{};
+    scheduler.spawn([](Scheduler &scheduler, TCPSocket connection, Transcript &transcript) -> Task<> {
+      AsyncSocket socket{scheduler, std::move(connection)};
+      socket.capture(transcript, transcript.open("192.0.2.1", Transcript::tlsOffered));
+      while (auto line = co_await socket.read_line()) {
+        co_await socket.write("got " + std::string{line.value()});
+      }
+    }(scheduler, std::move(server), transcript));
+
+    // Longer than a one byte varint
+    const std::string large(300, 'x');
+    client.write("one\r\n");
+    scheduler.stopAt(std::chrono::steady_clock::now() + std::chrono::milliseconds{20});
+    scheduler.run();
+    client.write(large + "\r\n");
+    scheduler.stopAt(std::chrono::steady_clock::now() + std::chrono::milliseconds{20});
+    scheduler.run();
+  }
+
+  TranscriptReader reader{path};
+  std::vector<TranscriptRecord> records{};
+  while (auto record = reader.next()) {
+    records.push_back(record.value());
+  }
+  ASSERT_EQ(records.size(), 6);
+  EXPECT_EQ(records[0].kind, Segment::Open);
+  EXPECT_EQ(records[0].payload, std::string(1, Transcript::tlsOffered) + "192.0.2.1");
+  EXPECT_EQ(records[1].kind, Segment::Client);
+  EXPECT_EQ(records[1].payload, "one\r\n");
+  EXPECT_EQ(records[2].kind, Segment::Server);
+  EXPECT_EQ(records[2].payload, "got one\r\n");
+  EXPECT_EQ(records[3].payload, std::string(300, 'x') + "\r\n");
+  EXPECT_EQ(records[4].payload, "got " + std::string(300, 'x') + "\r\n");
+  EXPECT_EQ(records[5].kind, Segment::Close);
+  for (const auto &record : records) {
+    EXPECT_EQ(record.session, 1);
+  }
+  EXPECT_GE(records[3].at - records[1].at, std::chrono::milliseconds{20});
+
+  // A transcript cut in the middle of a record
+  std::filesystem::resize_file(path, reader.size() - 3);
+  TranscriptReader cut{path};
+  auto readAll = [](TranscriptReader &reader) {
+    while (reader.next().has_value()) {
+    }
+  };
+  EXPECT_THROW(readAll(cut), std::runtime_error);
+  std::ofstream{path} << "not a transcript";
+  EXPECT_THROW(TranscriptReader{path}, std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(Handover, listenerOutlivesTheProcessHandingItOver) {
+  const std::string path = "/tmp/asyncTest-" + std::to_string(::getpid()) + ".sock";
+  EXPECT_FALSE(takeover(path).has_value());
+
+  TCPSocket listener{};
+  listener.set_reuseaddr();
+  listener.bind(0);
+  listener.listen();
+  uint16_t port = listener.local_port();
+
+  Scheduler scheduler{};
+  std::optional<std::thread::id> released{};
+  std::optional<UnixSocket> successor{};
+  scheduler.spawn([](Scheduler &scheduler, std::string path, int fd, std::optional<std::thread::id> &released,
+                     std::optional<UnixSocket> &successor) -> Task<> {
+    successor = co_await handover(
+        scheduler, path, std::vector<int>(1, fd), [&released] { released = std::this_thread::get_id(); });
+  }(scheduler, path, listener.fd_num(), released, successor));
+
+  std::optional<Takeover> previous{};
+  std::thread next([&path, &previous] {
+    // The control socket is bound once the scheduler runs, retry until then
+    while (!previous.has_value()) {
+      previous = takeover(path);
+    }
+  });
+  scheduler.run();
+  next.join();
+
+  // Off the event loop, which goes on serving meanwhile
+  ASSERT_TRUE(released.has_value());
+  EXPECT_NE(released.value(), std::this_thread::get_id());
+  ASSERT_TRUE(successor.has_value());
+  ASSERT_EQ(previous->listeners.size(), 1);
+
+  // A connection made before the old process lets go is accepted by the new one
+  TCPSocket client{};
+  client.connect("127.0.0.1", port);
+  listener.close();
+  TCPSocket accepted = previous->listeners.front().accept();
+  accepted.write("hello");
+  EXPECT_EQ(client.read(5), "hello");
+
+  // Closing the connection tells the new process that the old one has exited
+  successor->close();
+  EXPECT_TRUE(previous->control.receive_fds().empty());
+  ::unlink(path.c_str());
+}
@@ -0,0 +1,109 @@
+#include "transcript.hpp"
+
+#include "util.hpp"
+
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+static constexpr std::string_view magic{"MSTX\x01", 5};
+
+static void appendVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+Transcript::Transcript(const std::string &path)
+    : file{SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))} {
+  buffer.append(magic);
+}
+
+void Transcript::record(Segment kind, uint64_t session, std::string_view payload) {
+  auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+  buffer.push_back(static_cast<char>(kind));
+  appendVarint(buffer, session);
+  appendVarint(buffer, static_cast<uint64_t>((now - last).count()));
+  appendVarint(buffer, payload.size());
+  buffer.append(payload);
+  last = now;
+  if (buffer.size() >= flushSize) {
+    flush();
+  }
+}
+
+uint64_t Transcript::open(std::string_view peer, uint8_t flags) {
+  std::string payload(1, static_cast<char>(flags));
+  payload.append(peer);
+  record(Segment::Open, ++sessions, payload);
+  return sessions;
+}
+
+void Transcript::close(uint64_t session) { record(Segment::Close, session, {}); }
+
+void Transcript::flush() {
+  file.write(std::string_view{buffer});
+  buffer.clear();
+}
+
+Transcript::~Transcript() {
+  try {
+    flush();
+  } catch (const std::exception &e) {
+    std::cerr << "Exception writing the transcript: " << e.what() << std::endl;
+  }
+}
+
+TranscriptReader::TranscriptReader(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error("cannot open " + path);
+  }
+  data.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+  if (data.compare(0, magic.size(), magic) != 0) {
+    throw std::runtime_error(path + " is not a transcript");
+  }
+  offset = magic.size();
+}
+
+uint64_t TranscriptReader::varint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (offset == data.size()) {
+      throw std::runtime_error("transcript cut short");
+    }
+    auto byte = static_cast<uint8_t>(data[offset++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return value;
+    }
+  }
+  throw std::runtime_error("transcript has a malformed varint");
+}
+
+std::optional<TranscriptRecord> TranscriptReader::next() {
+  if (offset == data.size()) {
+    return std::nullopt;
+  }
+  TranscriptRecord record{};
+  auto kind = static_cast<uint8_t>(data[offset++]);
+  if (kind > static_cast<uint8_t>(Segment::Close)) {
+    throw std::runtime_error("transcript has an unknown record");
+  }
+  record.kind = static_cast<Segment>(kind);
+  record.session = varint();
+  at += std::chrono::microseconds{varint()};
+  record.at = at;
+  uint64_t length = varint();
+  if (length > data.size() - offset) {
+    throw std::runtime_error("transcript cut short");
+  }
+  record.payload = std::string_view{data}.substr(offset, length);
+  offset += length;
+  return record;
+}
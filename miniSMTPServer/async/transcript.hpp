@@ -0,0 +1,122 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief What a transcript record holds.
+ *
+ */
+enum class Segment : uint8_t {
+  Open,    //!< A session started, the payload is its flags and the address of the client
+  Client,  //!< Bytes received from the client, as one read returned them
+  Server,  //!< Bytes sent to the client, as one write sent them
+  Close,   //!< The session ended
+};
+
+/**
+ * @brief One record of a transcript.
+ *
+ */
+struct TranscriptRecord {
+  Segment kind = Segment::Open;
+  uint64_t session = 0;            //!< Numbered from 1 in the order they opened
+  std::chrono::microseconds at{};  //!< Since the transcript was started
+  std::string_view payload{};      //!< Valid as long as the reader
+};
+
+/**
+ * @brief Records every session of a server, byte for byte, into one file.
+ *
+ * @details The file starts with the magic "MSTX" and a version byte, then
+ * holds one record after the other, in the order they happened:
+ *
+ *     kind (1 byte) | session (varint) | time since the previous record in us (varint)
+ *                   | payload length (varint) | payload
+ *
+ * The varints are LEB128, so a segment of a few dozen bytes costs five or six
+ * more. The records collect in memory and are written once `flushSize`
+ * bytes have collected and when the transcript is destroyed, so the event
+ * loop does not block on a write for every session that ends; a server
+ * killed loses up to `flushSize` bytes of records. Only the thread running
+ * the sessions uses a `Transcript`, which must outlive them.
+ * What the server received is recorded after TLS is removed, so a transcript
+ * holds the plain text of encrypted sessions.
+ */
+class Transcript {
+private:
+  FileDescriptor file;
+  std::string buffer{};  //!< Records not written yet
+  uint64_t sessions = 0;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::chrono::microseconds last{};  //!< When the previous record happened
+
+  void record(Segment kind, uint64_t session, std::string_view payload);
+
+public:
+  //! Flag of an Open record: the session offered STARTTLS
+  static constexpr uint8_t tlsOffered = 1;
+
+  //! Records collect up to this size before they are written
+  static constexpr size_t flushSize = 64 * 1024;
+
+  //! Start a transcript in `path`, replacing what was there
+  explicit Transcript(const std::string &path);
+
+  /**
+   * @brief Record the start of a session.
+   *
+   * @param[in] peer the address of the client, may be empty
+   * @param[in] flags `tlsOffered` or 0
+   * @return uint64_t the number of the session, for its other records
+   */
+  uint64_t open(std::string_view peer, uint8_t flags);
+
+  //! Record bytes received in `session`
+  void client(uint64_t session, std::string_view bytes) { record(Segment::Client, session, bytes); }
+
+  //! Record bytes sent in `session`
+  void server(uint64_t session, std::string_view bytes) { record(Segment::Server, session, bytes); }
+
+  //! Record the end of `session`
+  void close(uint64_t session);
+
+  //! Write the records collected so far
+  void flush();
+
+  //! Write the records left
+  ~Transcript();
+
+  Transcript(const Transcript &other) = delete;
+  Transcript &operator=(const Transcript &other) = delete;
+};
+
+/**
+ * @brief Reads the records of a transcript, in the order they were written.
+ *
+ * @details The whole file is read at once, the payloads point into it.
+ */
+class TranscriptReader {
+private:
+  std::string data{};
+  size_t offset = 0;
+  std::chrono::microseconds at{};
+
+  uint64_t varint();
+
+public:
+  //! Read the transcript in `path`, throws std::runtime_error if it is not one
+  explicit TranscriptReader(const std::string &path);
+
+  //! The next record, nothing at the end, throws std::runtime_error if the file is cut short
+  std::optional<TranscriptRecord> next();
+
+  //! Size of the file
+  size_t size() const { return data.size(); }
+};
@@ -0,0 +1,96 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+/**
+ * @brief The blocks released by the sessions of one thread.
+ *
+ */
+struct FreeList {
+  void *head = nullptr;
+  size_t count = 0;
+
+  ~FreeList() {
+    while (head != nullptr) {
+      void *next = *static_cast<void **>(head);
+      ::operator delete(head);
+      head = next;
+    }
+  }
+};
+
+static thread_local FreeList freeBlocks{};
+
+static constexpr size_t defaultAlignment = alignof(std::max_align_t);
+
+//! The header rounded up so the first allocation of a block is aligned
+static constexpr size_t headerSize = (2 * sizeof(void *) + defaultAlignment - 1) / defaultAlignment * defaultAlignment;
+
+static uintptr_t alignUp(uintptr_t address, size_t alignment) { return (address + alignment - 1) & ~(alignment - 1); }
+
+void *SessionArena::do_allocate(size_t bytes, size_t alignment) {
+  if (bytes > blockSize / 2 || alignment > defaultAlignment) {
+    return allocateLarge(bytes, alignment);
+  }
+
+  uintptr_t aligned = alignUp(reinterpret_cast<uintptr_t>(cursor), alignment);
+  if (cursor == nullptr || aligned + bytes > reinterpret_cast<uintptr_t>(limit)) {
+    Block *block = nullptr;
+    if (freeBlocks.head != nullptr) {
+      block = static_cast<Block *>(freeBlocks.head);
+      freeBlocks.head = block->next;
+      --freeBlocks.count;
+    } else {
+      block = static_cast<Block *>(::operator new(blockSize));
+    }
+    block->next = blocks;
+    block->alignment = defaultAlignment;
+    blocks = block;
+
+    cursor = reinterpret_cast<char *>(block) + headerSize;
+    limit = reinterpret_cast<char *>(block) + blockSize;
+    aligned = reinterpret_cast<uintptr_t>(cursor);
+  }
+
+  cursor = reinterpret_cast<char *>(aligned + bytes);
+  allocated += bytes;
+  return reinterpret_cast<void *>(aligned);
+}
+
+void *SessionArena::allocateLarge(size_t bytes, size_t alignment) {
+  // The header takes a whole alignment unit so the allocation after it stays aligned
+  alignment = std::max(alignment, defaultAlignment);
+  size_t offset = std::max(headerSize, alignment);
+  auto *block = static_cast<Block *>(::operator new(offset + bytes, std::align_val_t{alignment}));
+  block->next = large;
+  block->alignment = alignment;
+  large = block;
+  allocated += bytes;
+  return reinterpret_cast<char *>(block) + offset;
+}
+
+void SessionArena::reset() {
+  while (blocks != nullptr) {
+    Block *next = blocks->next;
+    if (freeBlocks.count < cachedBlocks) {
+      blocks->next = static_cast<Block *>(freeBlocks.head);
+      freeBlocks.head = blocks;
+      ++freeBlocks.count;
+    } else {
+      ::operator delete(blocks);
+    }
+    blocks = next;
+  }
+  while (large != nullptr) {
+    Block *next = large->next;
+    ::operator delete(large, std::align_val_t{large->alignment});
+    large = next;
+  }
+  cursor = nullptr;
+  limit = nullptr;
+  allocated = 0;
+}
+
+size_t SessionArena::cached() { return freeBlocks.count; }
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+/**
+ * @brief A bump allocator for the short-lived data of one SMTP session.
+ *
+ * @details Memory is carved out of fixed-size blocks and never freed one
+ * allocation at a time, `reset` gives back everything at once. Released
+ * blocks go to a free list of the calling thread, so a busy thread serves
+ * its sessions without touching the global allocator once it is warm.
+ * Requests larger than half a block get a block of their own, which is
+ * freed rather than cached.
+ *
+ * Nothing allocated from the arena may be used after `reset`.
+ */
+class SessionArena : public std::pmr::memory_resource {
+private:
+  struct Block {
+    Block *next;       //!< The previously filled block, or the next free one
+    size_t alignment;  //!< What the block was allocated with, see `allocateLarge`
+  };
+
+  Block *blocks = nullptr;  //!< Blocks of `blockSize`, the current one first
+  Block *large = nullptr;   //!< Blocks of one oversized allocation each
+  char *cursor = nullptr;   //!< Next free byte in the current block
+  char *limit = nullptr;    //!< End of the current block
+  size_t allocated = 0;     //!< Bytes handed out since the last reset
+
+  void *allocateLarge(size_t bytes, size_t alignment);
+
+protected:
+  void *do_allocate(size_t bytes, size_t alignment) override;
+  //! Nothing, memory only goes back on `reset`
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+public:
+  //! Size of a regular block, header included
+  static constexpr size_t blockSize = 4096;
+
+  //! Most blocks a thread keeps in its free list, the rest is freed
+  static constexpr size_t cachedBlocks = 256;
+
+  SessionArena() = default;
+
+  /**
+   * @brief Release everything allocated so far.
+   *
+   */
+  void reset();
+
+  //! Bytes handed out since the last reset
+  size_t used() const { return allocated; }
+
+  //! Number of blocks in the free list of the calling thread
+  static size_t cached();
+
+  ~SessionArena() override { reset(); }
+
+  SessionArena(const SessionArena &other) = delete;
+  SessionArena &operator=(const SessionArena &other) = delete;
+};
@@ -0,0 +1,91 @@
+#include "asyncSocket.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "socket.hpp"
+#include "task.hpp"
+#include "util.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A server with its own thread, the way `main` runs it.
+ *
+ */
+class Server {
+private:
+  std::thread thread{};
+  std::optional<FileDescriptor> stop{};
+
+  // Closes the listener once `stop` is closed, which ends the acceptor
+  static Task<> stopper(Scheduler &scheduler, FileDescriptor fd, AsyncSocket &listener) {
+    AsyncSocket control{scheduler, TCPSocket{std::move(fd)}};
+    co_await control.read_line();
+    listener.close();
+  }
+
+  static void serve(TCPSocket socket, FileDescriptor fd) {
+    Scheduler scheduler{};
+    AsyncSocket listener{scheduler, std::move(socket)};
+    scheduler.spawn(acceptor(scheduler, listener, nullptr));
+    scheduler.spawn(stopper(scheduler, std::move(fd), listener));
+    scheduler.run();
+  }
+
+public:
+  uint16_t port = 0;
+
+  Server() {
+    SocketOptions options{};
+    options.port = 0;
+    TCPSocket socket = listenOn(options);
+    port = socket.local_port();
+
+    int fds[2];
+    SystemCall("pipe2", ::pipe2(fds, O_CLOEXEC));
+    stop.emplace(fds[1]);
+    thread = std::thread{serve, std::move(socket), FileDescriptor{fds[0]}};
+  }
+
+  ~Server() {
+    stop->close();
+    thread.join();
+  }
+};
+
+// Open `count` connections at once, then wait for each greeting and quit,
+// the shortest session there is
+static void storm(uint16_t port, int64_t count) {
+  std::vector<TCPSocket> clients(count);
+  for (auto &client : clients) {
+    client.connect("127.0.0.1", port);
+  }
+  for (auto &client : clients) {
+    std::string reply = client.read(512);
+    client.write("QUIT\r\n");
+    while (reply.find("221") == std::string::npos && !client.eof()) {
+      reply += client.read(512);
+    }
+    // Reset instead of leaving the connection in TIME_WAIT, thousands of
+    // them make finding a free port in connect(2) the bottleneck
+    linger reset{1, 0};
+    SystemCall("setsockopt", ::setsockopt(client.fd_num(), SOL_SOCKET, SO_LINGER, &reset, sizeof(reset)));
+  }
+}
+
+static void BM_ConnectStorm(benchmark::State &state) {
+  Server server{};
+  for (auto _ : state) {
+    storm(server.port, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ConnectStorm)->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
@@ -0,0 +1,69 @@
+#include "context.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+
+// Every allocation of the process goes through here, so the benchmark can
+// report how many a message costs
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+    return pointer;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+
+// A message with three recipients and a 20 line body, then RSET and QUIT
+static std::string session() {
+  std::string lines = "EHLO 127.0.0.1\r\n"
+                      "MAIL FROM:<shejialuo@gmail.com>\r\n"
+                      "RCPT TO:<a@example.com>\r\n"
+                      "RCPT TO:<b@example.com>\r\n"
+                      "RCPT TO:<c@example.com>\r\n"
+                      "DATA\r\n";
+  for (int i = 0; i < 20; ++i) {
+    lines += "Line number " + std::to_string(i) + " of the message body\r\n";
+  }
+  lines += ".\r\nRSET\r\nQUIT\r\n";
+  return lines;
+}
+
+static void BM_Message(benchmark::State &state) {
+  const std::string buffer = session();
+  std::string reply{};
+  Context context{};
+
+  size_t before = allocations;
+  for (auto _ : state) {
+    // The same framing as the server loop
+    size_t start = 0;
+    for (size_t end = 0; (end = buffer.find("\r\n", start)) != std::string::npos; start = end + 2) {
+      std::string_view line{buffer.data() + start, end + 2 - start};
+      std::string_view result{};
+      if (context.receivingData()) {
+        result = context.data(line);
+        if (result.empty()) {
+          continue;
+        }
+      } else {
+        Parameters parameters = context.parse(line);
+        result = context.transitive(parameters);
+      }
+      reply.assign(result).append("\r\n");
+      benchmark::DoNotOptimize(reply.data());
+    }
+  }
+
+  state.counters["allocations"] =
+      benchmark::Counter(static_cast<double>(allocations - before), benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Message);
@@ -0,0 +1,181 @@
+#include "context.hpp"
+#include "framePool.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "util.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// A message with three recipients and a 20 line body, sent pipelined
+static std::string script() {
+  std::string lines = "EHLO 127.0.0.1\r\n"
+                      "MAIL FROM:<shejialuo@gmail.com>\r\n"
+                      "RCPT TO:<a@example.com>\r\n"
+                      "RCPT TO:<b@example.com>\r\n"
+                      "RCPT TO:<c@example.com>\r\n"
+                      "DATA\r\n";
+  for (int i = 0; i < 20; ++i) {
+    lines += "Line number " + std::to_string(i) + " of the message body\r\n";
+  }
+  lines += ".\r\nQUIT\r\n";
+  return lines;
+}
+
+/**
+ * @brief `count` connected socket pairs, the client side has already sent the script.
+ *
+ */
+struct Connections {
+  std::vector<TCPSocket> clients{};
+  std::vector<TCPSocket> servers{};
+
+  Connections(int count, const std::string &script) {
+    for (int i = 0; i < count; ++i) {
+      int fds[2];
+      SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+      clients.emplace_back(FileDescriptor{fds[0]});
+      servers.emplace_back(FileDescriptor{fds[1]});
+      clients.back().write(script);
+    }
+  }
+};
+
+/**
+ * @brief The same sessions as `session`, written as a hand-rolled reactor:
+ * one buffer and one `Context` per connection, driven by epoll callbacks.
+ *
+ */
+class Reactor {
+private:
+  struct Connection {
+    explicit Connection(TCPSocket &&s) : socket{std::move(s)} {}
+
+    TCPSocket socket;
+    std::string buffer{};
+    std::string reply{};
+    Context context{};
+  };
+
+  FileDescriptor epoll{SystemCall("epoll_create1", ::epoll_create1(EPOLL_CLOEXEC))};
+  std::vector<std::unique_ptr<Connection>> connections{};
+  size_t open = 0;
+
+  static void send(Connection &connection, std::string_view reply) {
+    connection.reply.assign(reply).append("\r\n");
+    SystemCall("send", ::send(connection.socket.fd_num(), connection.reply.data(), connection.reply.size(), 0));
+  }
+
+  // Handle every complete line, false once the session is over
+  bool readable(Connection &connection) {
+    char chunk[64 * 1024];
+    while (true) {
+      ssize_t bytes = SystemCall("read", ::read(connection.socket.fd_num(), chunk, sizeof(chunk)), EAGAIN);
+      if (bytes < 0) {
+        break;
+      }
+      if (bytes == 0) {
+        return false;
+      }
+      connection.buffer.append(chunk, bytes);
+    }
+
+    size_t start = 0;
+    for (size_t end = 0; (end = connection.buffer.find("\r\n", start)) != std::string::npos; start = end + 2) {
+      std::string_view line{connection.buffer.data() + start, end + 2 - start};
+      std::string_view result{};
+      if (connection.context.receivingData()) {
+        result = connection.context.data(line);
+        if (result.empty()) {
+          continue;
+        }
+      } else {
+        Parameters parameters = connection.context.parse(line);
+        result = connection.context.transitive(parameters);
+      }
+      send(connection, result);
+      if (result.substr(0, 3) == "221") {
+        return false;
+      }
+    }
+    connection.buffer.erase(0, start);
+    return true;
+  }
+
+public:
+  void add(TCPSocket &&socket) {
+    socket.set_blocking(false);
+    auto &connection = connections.emplace_back(std::make_unique<Connection>(std::move(socket)));
+    send(*connection, StateMachine::reply(Reply::ServiceReady));
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = connection.get();
+    SystemCall("epoll_ctl", ::epoll_ctl(epoll.fd_num(), EPOLL_CTL_ADD, connection->socket.fd_num(), &event));
+    ++open;
+  }
+
+  void run() {
+    epoll_event events[256];
+    while (open > 0) {
+      int count = SystemCall("epoll_wait", ::epoll_wait(epoll.fd_num(), events, 256, -1), EINTR);
+      for (int i = 0; i < count; ++i) {
+        auto *connection = static_cast<Connection *>(events[i].data.ptr);
+        if (!readable(*connection)) {
+          SystemCall("epoll_ctl", ::epoll_ctl(epoll.fd_num(), EPOLL_CTL_DEL, connection->socket.fd_num(), nullptr));
+          connection->socket.close();
+          --open;
+        }
+      }
+    }
+  }
+};
+
+static void BM_CoroutineSessions(benchmark::State &state) {
+  const std::string lines = script();
+  size_t misses = FramePool::misses();
+  for (auto _ : state) {
+    Connections connections{static_cast<int>(state.range(0)), lines};
+    Scheduler scheduler{};
+    for (auto &server : connections.servers) {
+      scheduler.spawn(session(scheduler, std::move(server), nullptr));
+    }
+    scheduler.run();
+  }
+  state.counters["frameMisses"] =
+      benchmark::Counter(static_cast<double>(FramePool::misses() - misses), benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CoroutineSessions)->Arg(1)->Arg(64)->Arg(512);
+
+static void BM_ReactorSessions(benchmark::State &state) {
+  const std::string lines = script();
+  for (auto _ : state) {
+    Connections connections{static_cast<int>(state.range(0)), lines};
+    Reactor reactor{};
+    for (auto &server : connections.servers) {
+      reactor.add(std::move(server));
+    }
+    reactor.run();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReactorSessions)->Arg(1)->Arg(64)->Arg(512);
+
+// What both of them pay for creating the socket pairs and sending the script
+static void BM_Setup(benchmark::State &state) {
+  const std::string lines = script();
+  for (auto _ : state) {
+    Connections connections{static_cast<int>(state.range(0)), lines};
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Setup)->Arg(1)->Arg(64)->Arg(512);
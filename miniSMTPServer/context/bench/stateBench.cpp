@@ -0,0 +1,62 @@
+#include "state.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// One message, as the server sees it line by line
+static const std::vector<Parameters> session{
+    {"EHLO", "127.0.0.1"},
+    {"MAIL", "FROM:<shejialuo@gmail.com>"},
+    {"RCPT", "TO:<shejialuo@gmail.com>"},
+    {"DATA"},
+    {"Subject:", "hi"},
+    {"body"},
+    {"."},
+    {"NOOP"},
+    {"RSET"},
+    {"QUIT"},
+};
+
+// Commands which need no address check, so only the dispatch is measured
+static const std::vector<Parameters> commands{
+    {"NOOP"},
+    {"RSET"},
+    {"HELP"},
+    {"DATA"},
+    {"."},
+    {"QUIT"},
+};
+
+static void BM_Lookup(benchmark::State &state) {
+  unsigned i = 0;
+  for (auto _ : state) {
+    auto from = static_cast<::State>(i % StateMachine::stateCount);
+    auto verb = static_cast<Verb>(i / StateMachine::stateCount % StateMachine::verbCount);
+    benchmark::DoNotOptimize(StateMachine::lookup(from, verb));
+    ++i;
+  }
+}
+BENCHMARK(BM_Lookup);
+
+static void BM_Commands(benchmark::State &state) {
+  for (auto _ : state) {
+    ::State current = ::State::Ehlo;
+    for (const auto &parameters : commands) {
+      benchmark::DoNotOptimize(StateMachine::transitive(parameters, current));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * commands.size());
+}
+BENCHMARK(BM_Commands);
+
+static void BM_Session(benchmark::State &state) {
+  for (auto _ : state) {
+    ::State current = ::State::Idle;
+    for (const auto &parameters : session) {
+      benchmark::DoNotOptimize(StateMachine::transitive(parameters, current));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * session.size());
+}
+BENCHMARK(BM_Session);
@@ -2,7 +2,161 @@
 
 #include "state.hpp"
 
-Context::Context() { current = &States::idleState; }
-std::string Context::transitive(std::vector<std::string> &parameters) {
-  return (*current)->transitive(parameters, current);
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <unistd.h>
+
+// Let clients send their envelope in one batch, see RFC 2920, and encrypt
+// the session first if they like, see RFC 3207
+static const std::string greeting =
+    "250-" + std::string{StateMachine::reply(Reply::Ok).substr(4)} + "\r\n250 PIPELINING";
+static const std::string greetingWithTls =
+    "250-" + std::string{StateMachine::reply(Reply::Ok).substr(4)} + "\r\n250-PIPELINING\r\n250 STARTTLS";
+
+// Whom the Received fields say received the message
+static const std::string &hostName() {
+  static const std::string name = [] {
+    char buffer[256] = {};
+    return ::gethostname(buffer, sizeof(buffer) - 1) == 0 ? std::string{buffer} : std::string{"localhost"};
+  }();
+  return name;
+}
+
+Context::Context(Spool *s, std::string p, const RecipientDirectory *r) : spool{s}, recipients{r}, peer{std::move(p)} {}
+
+std::string Context::received() const {
+  std::string field = "Received: from " + helo;
+  if (!peer.empty()) {
+    field += peer.find(':') == std::string::npos ? " ([" + peer + "])" : " ([IPv6:" + peer + "])";
+  }
+  field += "\r\n\tby " + hostName() + (tls == Tls::Active ? " with ESMTPS" : " with ESMTP");
+  field += " id " + message->queueId();
+  // Naming one of several recipients would tell it to the others
+  if (envelope.recipients.size() == 1) {
+    field += "\r\n\tfor <" + std::string{envelope.recipients.front()} + ">";
+  }
+
+  char date[64] = {};
+  std::time_t now = std::time(nullptr);
+  struct tm local {};
+  ::localtime_r(&now, &local);
+  std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S %z", &local);
+  return field + "; " + date + "\r\n";
+}
+
+void Context::release() {
+  // Not a move assignment, which would leave the strings with the buffers the reset frees
+  std::destroy_at(&envelope);
+  std::construct_at(&envelope, &arena);
+  arena.reset();
+}
+
+Parameters Context::parse(std::string_view line) {
+  if (current != State::Mail && current != State::Rcpt && current != State::DataStart) {
+    release();
+  }
+  // Commands within a transaction, e.g. a NOOP loop, would grow the envelope arena otherwise
+  scratch.reset();
+
+  line.remove_suffix(2);
+  size_t split = line.find(' ');
+
+  Parameters parameters{&scratch};
+  parameters.reserve(2);
+  parameters.emplace_back(line.substr(0, split));
+  if (split != std::string_view::npos) {
+    parameters.emplace_back(line.substr(split + 1));
+  }
+  return parameters;
+}
+
+std::string_view Context::transitive(const Parameters &parameters) {
+  State previous = current;
+  Step step = StateMachine::transitive(parameters, current, recipients);
+
+  switch (step.action) {
+    case Action::SetSender:
+      envelope.sender = StateMachine::address(parameters[1]);
+      envelope.recipients.clear();
+      break;
+    case Action::AddRecipient:
+      if (envelope.recipients.size() >= maxRecipients) {
+        current = previous;
+        return StateMachine::reply(Reply::TooManyRecipients);
+      }
+      envelope.recipients.emplace_back(StateMachine::address(parameters[1]));
+      break;
+    case Action::BeginData:
+      if (spool != nullptr) {
+        message = spool->create();
+        message->prepend(received());
+        message->setClient(peer);
+      }
+      break;
+    case Action::Greet:
+      helo = parameters[1];
+      return tls == Tls::Offered ? greetingWithTls : greeting;
+    case Action::StartTls:
+      // The table allows STARTTLS where RFC 3207 does, whether this session
+      // can start TLS is only known here
+      if (tls != Tls::Offered) {
+        current = previous;
+        return StateMachine::reply(tls == Tls::Active ? Reply::BadSequence : Reply::Unrecognized);
+      }
+      tls = Tls::Starting;
+      break;
+    default:
+      break;
+  }
+
+  return StateMachine::reply(step.reply);
+}
+
+std::shared_ptr<const FilterMessage> Context::filtered() {
+  if (!message) {
+    return nullptr;
+  }
+  auto filtered = std::make_shared<FilterMessage>();
+  filtered->id = message->queueId();
+  filtered->envelope = envelope.envelope();
+  filtered->headers = message->headers();
+  filtered->body = message->finish();
+  filtered->traceLength = message->traceLength();
+  filtered->compressed = message->compressed();
+  return filtered;
+}
+
+std::string_view Context::data(std::string_view line, Verdict verdict) {
+  if (line != ".\r\n") {
+    if (message) {
+      // Undo the dot-stuffing of lines starting with "."
+      message->append(line[0] == '.' ? line.substr(1) : line);
+    }
+    return {};
+  }
+
+  const Transition &end = StateMachine::lookup(current, Verb::End);
+  current = end.next;
+  std::string_view result = StateMachine::reply(end.reply);
+  if (verdict != Verdict::Accept) {
+    // The transaction is over, the body goes with its writer
+    message.reset();
+    current = State::Ehlo;
+    return StateMachine::reply(verdict == Verdict::Reject ? Reply::Rejected : Reply::LocalError);
+  }
+  if (message) {
+    try {
+      message->commit(envelope.envelope());
+    } catch (const std::exception &e) {
+      std::cerr << "Cannot spool the message: " << e.what() << std::endl;
+      result = StateMachine::reply(Reply::LocalError);
+      current = State::Ehlo;
+    }
+    message.reset();
+  }
+
+  return result;
 }
@@ -1,15 +1,130 @@
 #pragma once
 
+#include "arena.hpp"
+#include "filterPipeline.hpp"
+#include "spool.hpp"
 #include "state.hpp"
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief The envelope of the transaction in progress, allocated from the session arena.
+ *
+ */
+struct SessionEnvelope {
+  std::pmr::string sender;
+  std::pmr::vector<std::pmr::string> recipients;
+
+  explicit SessionEnvelope(std::pmr::memory_resource *resource) : sender{resource}, recipients{resource} {}
+
+  //! A copy which outlives the session, for the spool
+  Envelope envelope() const { return Envelope{std::string{sender}, {recipients.begin(), recipients.end()}}; }
+};
+
+/**
+ * @brief Where a session is with STARTTLS, see RFC 3207.
+ *
+ */
+enum class Tls : uint8_t {
+  Unavailable,  //!< No certificate, STARTTLS is not advertised
+  Offered,      //!< STARTTLS is advertised
+  Starting,     //!< STARTTLS has been accepted, the handshake is next
+  Active,       //!< The session is encrypted
+};
 
 class Context {
 private:
-  std::unique_ptr<State> *current;
+  State current = State::Idle;
+  Tls tls = Tls::Unavailable;
+
+  Spool *spool;                          //!< Where accepted messages go, nullptr to discard them
+  const RecipientDirectory *recipients;  //!< The local recipients, nullptr to accept every RCPT
+  std::string peer;                      //!< The address of the client, empty if unknown
+  std::string helo{};                    //!< The name the client gave with EHLO
+  SessionArena arena{};                  //!< Backs the envelope
+  SessionArena scratch{};                //!< Backs the parsed command, reset on every command
+  SessionEnvelope envelope{&arena};      //!< The sender and recipients of the current transaction
+  std::unique_ptr<SpoolWriter> message;  //!< The body being received in the DATA state
+
+  /**
+   * @brief forget the envelope and give the arena back
+   * @details Only called between commands, when no transaction is open, so
+   * nothing allocated from the arena is alive any more.
+   */
+  void release();
+
+  //! The Received field of the message about to be received, see RFC 5321 section 4.4
+  std::string received() const;
 
 public:
-  Context();
-  std::string transitive(std::vector<std::string> &parameters);
+  //! RCPTs accepted in one transaction, the least RFC 5321 section 4.5.3.1.8 allows
+  static constexpr size_t maxRecipients = 100;
+
+  explicit Context(Spool *spool = nullptr, std::string peer = {}, const RecipientDirectory *recipients = nullptr);
+
+  /**
+   * @brief split a command line into the command and its parameter
+   * @details The result lives in a scratch arena reset on every call, it
+   * must be dropped before the next one. A call made outside of a
+   * transaction, e.g. after RSET, the end of a message or QUIT, also resets
+   * the arena of the envelope.
+   *
+   * @param[in] line the command line with its CRLF
+   * @return Parameters the command and its parameters
+   */
+  Parameters parse(std::string_view line);
+
+  /**
+   * @brief handle a command and record its effect on the envelope
+   *
+   * @param[in] parameters the command and its parameters
+   * @return std::string_view the response to be sent back to the client
+   */
+  std::string_view transitive(const Parameters &parameters);
+
+  /**
+   * @brief whether the next line belongs to a message body
+   *
+   */
+  bool receivingData() const { return current == State::DataStart; }
+
+  /**
+   * @brief where the session is with STARTTLS
+   *
+   */
+  Tls tlsState() const { return tls; }
+
+  /**
+   * @brief offer STARTTLS, or tell that the handshake it asked for has completed
+   *
+   */
+  void setTls(Tls state) { tls = state; }
+
+  /**
+   * @brief handle a line of the message body
+   * @details The lines are written to the spool as they arrive, after a
+   * Received field. Nothing is sent back until the terminating ".", which
+   * commits the message, unless the content filters had it rejected (550)
+   * or deferred (451).
+   *
+   * @param[in] line a line of the body with its CRLF
+   * @param[in] verdict what the content filters said, for the terminating "."
+   * @return std::string_view the response, empty until the end of the body
+   */
+  std::string_view data(std::string_view line, Verdict verdict = Verdict::Accept);
+
+  /**
+   * @brief the message at the end of DATA, for the content filters
+   * @details The body is written out first, so the filters find it complete.
+   *
+   * @return std::shared_ptr<const FilterMessage> the message, nullptr when messages are discarded
+   */
+  std::shared_ptr<const FilterMessage> filtered();
+
   ~Context() = default;
 };
@@ -0,0 +1,183 @@
+#include "replay.hpp"
+
+#include "state.hpp"
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// The end of the reply starting at `from` in `replies`, past its CRLF: the
+// lines of a multiline reply have a "-" after the code, the last one a space
+static size_t replyEnd(std::string_view replies, size_t from) {
+  while (from < replies.size()) {
+    size_t end = replies.find("\r\n", from);
+    if (end == std::string_view::npos) {
+      return replies.size();
+    }
+    bool last = end - from < 4 || replies[from + 3] != '-';
+    from = end + 2;
+    if (last) {
+      break;
+    }
+  }
+  return from;
+}
+
+// Count a mismatch, and keep it if it is one of the first
+static void mismatch(ReplayResult &result,
+                     uint64_t session,
+                     size_t reply,
+                     std::string_view sent,
+                     std::string_view actual) {
+  ++result.mismatches;
+  if (result.first.size() < Replay::keptMismatches) {
+    if (sent.ends_with("\r\n")) {
+      sent.remove_suffix(2);
+    }
+    result.first.push_back(ReplayMismatch{session, reply, std::string{sent}, std::string{actual}});
+  }
+}
+
+Replay::Replay(const std::string &path, const RecipientDirectory *r) : reader{path}, recipients{r} {
+  std::optional<std::chrono::microseconds> first{};
+  while (std::optional<TranscriptRecord> record = reader.next()) {
+    if (!first.has_value()) {
+      first = record->at;
+    }
+    span = record->at - first.value();
+
+    if (record->kind == Segment::Open) {
+      if (record->session != recorded.size() + 1) {
+        throw std::runtime_error("transcript opens session " + std::to_string(record->session) + " out of order");
+      }
+      Recorded session{};
+      if (!record->payload.empty()) {
+        session.flags = static_cast<uint8_t>(record->payload[0]);
+        session.peer = record->payload.substr(1);
+      }
+      recorded.push_back(std::move(session));
+      events.push_back(Event{recorded.size() - 1, true, {}});
+      continue;
+    }
+    if (record->session == 0 || record->session > recorded.size()) {
+      throw std::runtime_error("transcript has a record of session " + std::to_string(record->session) +
+                               " before it opened");
+    }
+    size_t index = record->session - 1;
+    if (record->kind == Segment::Client) {
+      events.push_back(Event{index, false, record->payload});
+    } else if (record->kind == Segment::Server) {
+      recorded[index].replies.append(record->payload);
+    }
+  }
+}
+
+void Replay::compare(Player &player, size_t index, std::string_view reply, ReplayResult &result) {
+  std::string_view expected = recorded[index].replies;
+  const size_t number = player.replies++;
+  ++result.commands;
+
+  if (expected.compare(player.cursor, reply.size(), reply) == 0 &&
+      expected.compare(player.cursor + reply.size(), 2, "\r\n") == 0) {
+    player.cursor += reply.size() + 2;
+    return;
+  }
+
+  // Skip the recorded reply, the next ones may match again
+  size_t end = replyEnd(expected, player.cursor);
+  mismatch(result, index + 1, number, expected.substr(player.cursor, end - player.cursor), reply);
+  player.cursor = end;
+}
+
+void Replay::feed(Player &player, size_t index, std::string_view bytes, ReplayResult &result) {
+  result.bytes += bytes.size();
+  if (player.done) {
+    return;
+  }
+
+  // Lines are parsed where they are, only one cut by the end of the segment is copied
+  std::string_view input = bytes;
+  const bool buffered = !player.pending.empty();
+  if (buffered) {
+    player.pending.append(bytes);
+    input = player.pending;
+  }
+
+  Context &context = *player.context;
+  size_t start = 0;
+  for (size_t end = 0; (end = input.find("\r\n", start)) != std::string_view::npos;) {
+    std::string_view line = input.substr(start, end + 2 - start);
+    start = end + 2;
+
+    std::string_view reply{};
+    if (context.receivingData()) {
+      reply = context.data(line);
+      if (reply.empty()) {
+        continue;
+      }
+    } else {
+      Parameters parameters = context.parse(line);
+      reply = context.transitive(parameters);
+    }
+    compare(player, index, reply, result);
+
+    if (reply.substr(0, 3) == "221") {
+      player.done = true;
+      player.pending.clear();
+      return;
+    }
+    if (context.tlsState() == Tls::Starting) {
+      // What followed STARTTLS in the same segment is dropped, like `AsyncSocket::start_tls` does
+      context.setTls(Tls::Active);
+      start = input.size();
+      break;
+    }
+  }
+
+  if (buffered) {
+    player.pending.erase(0, start);
+  } else {
+    player.pending.assign(input.substr(start));
+  }
+}
+
+ReplayResult Replay::run(size_t segment) {
+  ReplayResult result{};
+  result.sessions = recorded.size();
+  result.recorded = span;
+  std::vector<Player> players(recorded.size());
+
+  const auto start = std::chrono::steady_clock::now();
+  for (const Event &event : events) {
+    Player &player = players[event.session];
+    if (event.open) {
+      player.context = std::make_unique<Context>(nullptr, std::string{recorded[event.session].peer}, recipients);
+      if (recorded[event.session].flags & Transcript::tlsOffered) {
+        player.context->setTls(Tls::Offered);
+      }
+      compare(player, event.session, StateMachine::reply(Reply::ServiceReady), result);
+      continue;
+    }
+    if (segment == 0) {
+      feed(player, event.session, event.bytes, result);
+      continue;
+    }
+    for (size_t offset = 0; offset < event.bytes.size(); offset += segment) {
+      feed(player, event.session, event.bytes.substr(offset, segment), result);
+    }
+  }
+  result.elapsed = std::chrono::steady_clock::now() - start;
+
+  // Replies the server sent and the replay did not produce
+  for (size_t i = 0; i < players.size(); ++i) {
+    std::string_view expected = recorded[i].replies;
+    while (players[i].cursor < expected.size()) {
+      size_t end = replyEnd(expected, players[i].cursor);
+      std::string_view sent = expected.substr(players[i].cursor, end - players[i].cursor);
+      mismatch(result, i + 1, players[i].replies++, sent, {});
+      players[i].cursor = end;
+    }
+  }
+  return result;
+}
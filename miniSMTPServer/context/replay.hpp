@@ -0,0 +1,107 @@
+#pragma once
+
+#include "context.hpp"
+#include "transcript.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A reply of the replay which is not the recorded one.
+ *
+ */
+struct ReplayMismatch {
+  uint64_t session = 0;    //!< The number of the session in the transcript
+  size_t reply = 0;        //!< Which of its replies, the greeting is 0
+  std::string expected{};  //!< What the server sent, empty if it sent nothing more
+  std::string actual{};    //!< What the replay produced, empty if it produced nothing more
+};
+
+/**
+ * @brief What a replay did, and how fast.
+ *
+ */
+struct ReplayResult {
+  uint64_t sessions = 0;
+  uint64_t commands = 0;                 //!< Replies produced, to commands and to message bodies
+  uint64_t bytes = 0;                    //!< Bytes from the clients fed to the sessions
+  uint64_t mismatches = 0;               //!< Replies differing from the recorded ones
+  std::vector<ReplayMismatch> first{};   //!< The first few of them
+  std::chrono::nanoseconds elapsed{};    //!< Spent replaying, without loading the transcript
+  std::chrono::microseconds recorded{};  //!< Between the first and the last record
+};
+
+/**
+ * @brief Feeds the sessions of a transcript to `Context`, without sockets.
+ *
+ * @details The bytes every client sent go through the parser and the state
+ * machine, cut where the reads of the server cut them, or in pieces of a
+ * given size to try other segmentations. The sessions are interleaved as
+ * they were recorded, and every reply is compared with the one recorded.
+ *
+ * Nothing is spooled and no content filter runs, so a reply the spool or a
+ * filter decided differs when it was not the usual one. RCPT is checked
+ * against the recipients given, if any.
+ */
+class Replay {
+private:
+  //! What the transcript holds of one session
+  struct Recorded {
+    std::string_view peer{};
+    uint8_t flags = 0;
+    std::string replies{};  //!< Every byte the server sent
+  };
+
+  //! A client segment, or the start of a session, in the order they were recorded
+  struct Event {
+    size_t session;  //!< Index into `recorded`
+    bool open;
+    std::string_view bytes;
+  };
+
+  //! A session being replayed
+  struct Player {
+    std::unique_ptr<Context> context{};
+    std::string pending{};  //!< The start of a line cut by the end of a segment
+    size_t cursor = 0;      //!< How much of the recorded replies has been matched
+    size_t replies = 0;
+    bool done = false;  //!< Past QUIT, the server read no further
+  };
+
+  TranscriptReader reader;
+  const RecipientDirectory *recipients;  //!< Checked by every RCPT, nullptr to accept every address
+  std::vector<Recorded> recorded{};
+  std::vector<Event> events{};
+  std::chrono::microseconds span{};
+
+  void feed(Player &player, size_t index, std::string_view bytes, ReplayResult &result);
+  void compare(Player &player, size_t index, std::string_view reply, ReplayResult &result);
+
+public:
+  //! How many mismatches `ReplayResult::first` keeps
+  static constexpr size_t keptMismatches = 10;
+
+  /**
+   * @brief Load the transcript in `path`, throws std::runtime_error if it cannot
+   *
+   * @param[in] path the transcript
+   * @param[in] recipients the local recipients RCPT is checked against, nullptr to accept every address
+   */
+  explicit Replay(const std::string &path, const RecipientDirectory *recipients = nullptr);
+
+  /**
+   * @brief Replay every session.
+   *
+   * @param[in] segment the most bytes fed at once, 0 to feed the segments as they were recorded
+   * @return ReplayResult the counts, the mismatches and the time it took
+   */
+  ReplayResult run(size_t segment = 0);
+
+  //! Number of sessions in the transcript
+  size_t sessions() const { return recorded.size(); }
+};
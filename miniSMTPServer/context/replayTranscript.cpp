@@ -0,0 +1,114 @@
+#include "recipientIndex.hpp"
+#include "replay.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+
+static void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options] <transcript>\n"
+            << "Replay the sessions recorded by miniSMTP --capture, without sockets, and compare the replies\n\n"
+            << "  -r, --recipients <index>  validate RCPT against <index>, as the server did\n"
+            << "  -s, --segment <bytes>     feed the clients' bytes <bytes> at a time instead of as recorded\n"
+            << "  -n, --repeat <n>          replay <n> times and report the fastest, 1 by default\n"
+            << "  -h, --help                show this message\n";
+}
+
+static unsigned long number(const char *program, const char *value) {
+  try {
+    size_t end = 0;
+    unsigned long result = std::stoul(value, &end);
+    if (value[end] == '\0') {
+      return result;
+    }
+  } catch (const std::exception &) {
+  }
+  std::cerr << program << ": invalid number " << value << "\n";
+  std::exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Replay a transcript through the parser and the state machine.
+ *
+ * @details Prints the commands and bytes replayed per second, and the first
+ * replies that differ from the recorded ones. Exits with 1 if any does, so
+ * a transcript of real traffic makes a regression test.
+ */
+int main(int argc, char *argv[]) {
+  static const option options[] = {
+      {"recipients", required_argument, nullptr, 'r'},
+      {"segment", required_argument, nullptr, 's'},
+      {"repeat", required_argument, nullptr, 'n'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  std::string recipients{};
+  size_t segment = 0;
+  unsigned long repeat = 1;
+  int option = 0;
+  while ((option = getopt_long(argc, argv, "r:s:n:h", options, nullptr)) != -1) {
+    switch (option) {
+      case 'r':
+        recipients = optarg;
+        break;
+      case 's':
+        segment = number(argv[0], optarg);
+        break;
+      case 'n':
+        repeat = std::max(number(argv[0], optarg), 1UL);
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    std::unique_ptr<RecipientDirectory> directory{};
+    if (!recipients.empty()) {
+      directory = std::make_unique<RecipientDirectory>(recipients);
+    }
+
+    Replay replay{argv[optind], directory.get()};
+    ReplayResult result = replay.run(segment);
+    for (unsigned long i = 1; i < repeat; ++i) {
+      ReplayResult again = replay.run(segment);
+      result.elapsed = std::min(result.elapsed, again.elapsed);
+    }
+
+    const double seconds = std::chrono::duration<double>(result.elapsed).count();
+    std::cout << "Replayed " << result.sessions << " sessions, " << result.commands << " commands and " << result.bytes
+              << " bytes in " << std::fixed << std::setprecision(3) << seconds * 1000 << " ms: "
+              << std::setprecision(0) << result.commands / seconds << " commands/s, " << std::setprecision(1)
+              << result.bytes / seconds / (1024 * 1024) << " MiB/s, recorded over "
+              << std::chrono::duration<double>(result.recorded).count() << " s\n";
+
+    for (const ReplayMismatch &mismatch : result.first) {
+      std::cout << "Session " << mismatch.session << ", reply " << mismatch.reply << ":\n"
+                << "  recorded: " << (mismatch.expected.empty() ? "(none)" : mismatch.expected) << "\n"
+                << "  replayed: " << (mismatch.actual.empty() ? "(none)" : mismatch.actual) << "\n";
+    }
+    if (result.mismatches > 0) {
+      std::cout << result.mismatches << " replies differ\n";
+      return 1;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
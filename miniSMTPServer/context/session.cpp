@@ -0,0 +1,140 @@
+#include "session.hpp"
+
+#include "asyncSocket.hpp"
+#include "context.hpp"
+#include "util.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+Task<> session(Scheduler &scheduler,
+               TCPSocket connection,
+               Spool *spool,
+               std::ostream *log,
+               TlsContext *tls,
+               FilterPipeline *filters,
+               Transcript *transcript,
+               const RecipientDirectory *recipients) {
+  // Only for the Received fields, a client gone already has no address
+  std::string peer{};
+  try {
+    peer = connection.peer_address();
+  } catch (const unix_error &) {
+  }
+
+  AsyncSocket socket{scheduler, std::move(connection)};
+  if (transcript != nullptr) {
+    socket.capture(*transcript, transcript->open(peer, tls != nullptr ? Transcript::tlsOffered : 0));
+  }
+  Context context{spool, std::move(peer), recipients};
+  if (tls != nullptr) {
+    context.setTls(Tls::Offered);
+  }
+
+  socket.write_later(StateMachine::reply(Reply::ServiceReady));
+  socket.write_later("\r\n");
+
+  while (true) {
+    std::string_view result{};
+    if (context.receivingData()) {
+      if (!co_await socket.read_body([&context](std::string_view line) { context.data(line); })) {
+        break;
+      }
+      // The session waits for the verdict off the event loop, the others go on
+      Verdict verdict = Verdict::Accept;
+      if (filters != nullptr) {
+        if (std::shared_ptr<const FilterMessage> message = context.filtered()) {
+          verdict = co_await filters->check(std::move(message));
+        }
+      }
+      result = context.data(".\r\n", verdict);
+    } else {
+      std::optional<std::string_view> line = co_await socket.read_line();
+      if (!line.has_value()) {
+        break;
+      }
+      if (log != nullptr) {
+        *log << "C: " << line.value();
+      }
+      Parameters parameters = context.parse(line.value());
+      result = context.transitive(parameters);
+    }
+
+    if (log != nullptr) {
+      *log << "S: " << result << std::endl;
+    }
+    // The replies to pipelined commands go out together, once the session
+    // would wait for more input
+    socket.write_later(result);
+    socket.write_later("\r\n");
+    if (result.substr(0, 3) == "221") {
+      co_await socket.flush();
+      socket.close();
+      co_return;
+    }
+    if (context.tlsState() == Tls::Starting) {
+      if (!co_await socket.start_tls(*tls)) {
+        if (log != nullptr) {
+          *log << "S: TLS handshake failed\n";
+        }
+        co_return;
+      }
+      context.setTls(Tls::Active);
+    }
+  }
+
+  if (socket.overran()) {
+    // Nothing past the line can be trusted to be where the client meant it
+    std::string_view result = StateMachine::reply(Reply::LineTooLong);
+    if (log != nullptr) {
+      *log << "S: " << result << std::endl;
+    }
+    socket.write_later(result);
+    socket.write_later("\r\n");
+    co_await socket.flush();
+    socket.close();
+    co_return;
+  }
+
+  if (log != nullptr) {
+    *log << "S: Connection lost\n";
+  }
+}
+
+Task<> acceptor(Scheduler &scheduler,
+                AsyncSocket &listener,
+                Spool *spool,
+                std::ostream *log,
+                TlsContext *tls,
+                FilterPipeline *filters,
+                Transcript *transcript,
+                const RecipientDirectory *recipients) {
+  while (true) {
+    std::optional<FileDescriptor> connection{};
+    bool failed = false;
+    try {
+      connection = co_await listener.accept();
+    } catch (const unix_error &e) {
+      // e.g. out of file descriptors, the sessions already running go on
+      std::cerr << e.what() << std::endl;
+      failed = true;
+    }
+    if (failed) {
+      // The pending connection is still queued and raises no new edge, so
+      // retry later rather than at once, a session may have ended by then
+      auto pause = scheduler.sleep(std::chrono::milliseconds{100});
+      co_await pause;
+      continue;
+    }
+    if (!connection.has_value()) {
+      co_return;
+    }
+    scheduler.spawn(session(
+        scheduler, TCPSocket{std::move(connection.value())}, spool, log, tls, filters, transcript, recipients));
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "asyncSocket.hpp"
+#include "filterPipeline.hpp"
+#include "scheduler.hpp"
+#include "socket.hpp"
+#include "spool.hpp"
+#include "task.hpp"
+#include "tlsContext.hpp"
+
+#include <ostream>
+
+class RecipientDirectory;
+
+/**
+ * @brief Serve one SMTP connection, from the greeting to QUIT.
+ *
+ * @param[in] scheduler the scheduler running the session
+ * @param[in] connection the accepted connection
+ * @param[in] spool where accepted messages go, nullptr to discard them
+ * @param[in] log where the commands and replies are traced, nullptr for none
+ * @param[in] tls offers STARTTLS with this certificate, nullptr for a session in the clear
+ * @param[in] filters checks every message before it is spooled, nullptr for none
+ * @param[in] transcript records the traffic of the session, nullptr to record nothing
+ * @param[in] recipients the local recipients RCPT is checked against, nullptr to accept every address
+ * @return Task<> the session, finished when the connection is closed
+ */
+Task<> session(Scheduler &scheduler,
+               TCPSocket connection,
+               Spool *spool,
+               std::ostream *log = nullptr,
+               TlsContext *tls = nullptr,
+               FilterPipeline *filters = nullptr,
+               Transcript *transcript = nullptr,
+               const RecipientDirectory *recipients = nullptr);
+
+/**
+ * @brief Accept connections on `listener` and spawn a `session` for each.
+ *
+ * @param[in] scheduler the scheduler running the sessions
+ * @param[in] listener a bound, listening socket
+ * @param[in] spool where accepted messages go, nullptr to discard them
+ * @param[in] log where the sessions are traced, nullptr for none
+ * @param[in] tls offers STARTTLS with this certificate, nullptr for sessions in the clear
+ * @param[in] filters checks every message before it is spooled, nullptr for none
+ * @param[in] transcript records the traffic of every session, nullptr to record nothing
+ * @param[in] recipients the local recipients RCPT is checked against, nullptr to accept every address
+ * @return Task<> the accept loop, finished once `listener` is closed
+ */
+Task<> acceptor(Scheduler &scheduler,
+                AsyncSocket &listener,
+                Spool *spool,
+                std::ostream *log = nullptr,
+                TlsContext *tls = nullptr,
+                FilterPipeline *filters = nullptr,
+                Transcript *transcript = nullptr,
+                const RecipientDirectory *recipients = nullptr);
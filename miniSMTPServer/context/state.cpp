@@ -1,180 +1,101 @@
 #include "state.hpp"
 
-#include <memory>
+#include "recipientIndex.hpp"
+
+#include <array>
 #include <optional>
 #include <regex>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
-
-std::unique_ptr<State> States::idleState = std::make_unique<IdleState>();
-std::unique_ptr<State> States::ehloState = std::make_unique<EhloState>();
-std::unique_ptr<State> States::mailState = std::make_unique<MailState>();
-std::unique_ptr<State> States::rcptState = std::make_unique<RcptState>();
-std::unique_ptr<State> States::dataStartState = std::make_unique<DataStartState>();
-std::unique_ptr<State> States::dataDoneState = std::make_unique<DataDoneState>();
-
-static std::unordered_set<std::string> commands{"EHLO", "MAIL", "RCPT", "RSET", "NOOP", "QUIT", "DATA", "."};
-
-static std::unordered_map<std::string, std::string> codeToMessages{
-    {"220", "Service ready"},
-    {"221", "Service closing transmission channel"},
-    {"250", "Requested mail action okay, completed"},
-    {"354", "Start mail input end <CRLF>.<CRLF>"},
-    {"500", "Syntax error, command unrecognized"},
-    {"501", "Syntax error in parameters or arguments"},
-    {"503", "Bad sequence of commands"},
-};
-
-State::State() {
-  allowed.insert("RSET");
-  allowed.insert("EHLO");
-  allowed.insert("QUIT");
-  allowed.insert("NOOP");
-}
-
-bool State::canTransitive(std::vector<std::string> &parameters) { return allowed.count(parameters[0]); }
-
-std::optional<std::string> State::checkCommand(std::vector<std::string> &parameters) {
-  if (!commands.count(parameters[0])) {
-    return "500 " + codeToMessages["500"];
-  }
-  if (!canTransitive(parameters)) {
-    return "503 " + codeToMessages["503"];
+#include <string_view>
+#include <utility>
+
+static constexpr std::array<std::pair<std::string_view, Verb>, 9> commands{{
+    {"EHLO", Verb::EHLO},
+    {"MAIL", Verb::MAIL},
+    {"RCPT", Verb::RCPT},
+    {"RSET", Verb::RSET},
+    {"NOOP", Verb::NOOP},
+    {"QUIT", Verb::QUIT},
+    {"DATA", Verb::DATA},
+    {"STARTTLS", Verb::STARTTLS},
+    {".", Verb::End},
+}};
+
+std::string_view StateMachine::address(std::string_view parameter) {
+  for (std::string_view prefix : {"FROM:", "TO:"}) {
+    if (parameter.size() > prefix.size() + 1 && parameter.compare(0, prefix.size(), prefix) == 0 &&
+        parameter[prefix.size()] == '<' && parameter.back() == '>') {
+      return parameter.substr(prefix.size() + 1, parameter.size() - prefix.size() - 2);
+    }
   }
-  return std::nullopt;
+  return parameter;
 }
 
-std::string State::transitiveFromQuit(std::unique_ptr<State> *&current) {
-  current = &States::idleState;
-  return "221 " + codeToMessages["221"];
+Verb StateMachine::verbOf(std::string_view command) {
+  for (const auto &[name, verb] : commands) {
+    if (name == command) {
+      return verb;
+    }
+  }
+  return Verb::Unknown;
 }
 
-std::string State::transitiveFromNoop() { return "250 " + codeToMessages["250"]; }
-
-std::optional<std::string> State::isCorrectParameters(std::vector<std::string> &parameters) {
-  const std::regex pattern{"(\\w+)(\\.|_)?(\\w*)@(\\w+)(\\.(\\w+))+"};
+std::optional<Reply> StateMachine::isCorrectParameters(const Parameters &parameters) {
+  // Compiled once, building a std::regex costs far more than matching it
+  static const std::regex pattern{"(\\w+)(\\.|_)?(\\w*)@(\\w+)(\\.(\\w+))+"};
 
-  std::string &command = parameters[0];
-  if (command == "NOOP" || command == "QUIT" || command == "RSET" || command == "DATA") {
+  const std::pmr::string &command = parameters[0];
+  if (command == "NOOP" || command == "QUIT" || command == "RSET" || command == "DATA" || command == "STARTTLS") {
     if (parameters.size() != 1) {
-      return "501 " + codeToMessages["501"];
+      return Reply::BadParameters;
     }
-  } else if (parameters[0] == "EHLO") {
+  } else if (command == "EHLO") {
     if (parameters.size() != 2 || parameters[1] != "127.0.0.1") {
-      return "501 " + codeToMessages["501"];
+      return Reply::BadParameters;
     }
-  } else if (parameters[0] == "MAIL" || parameters[0] == "RCPT") {
-    if (parameters.size() != 2 || !std::regex_match(parameters[1], pattern)) {
-      return "501 " + codeToMessages["501"];
+  } else if (command == "MAIL" || command == "RCPT") {
+    if (parameters.size() != 2) {
+      return Reply::BadParameters;
+    }
+    std::string_view mailbox = address(parameters[1]);
+    if (!std::regex_match(mailbox.begin(), mailbox.end(), pattern)) {
+      return Reply::BadParameters;
     }
   }
 
   return std::nullopt;
 }
 
-std::optional<std::string> State::transitiveHelper(std::vector<std::string> &parameters,
-                                                   std::unique_ptr<State> *&current) {
-  if (auto result = checkCommand(parameters); result.has_value()) {
-    return result.value();
-  }
-
-  if (auto result = isCorrectParameters(parameters); result.has_value()) {
-    return result.value();
-  }
-
-  if (parameters[0] == "QUIT") {
-    return transitiveFromQuit(current);
-  }
-
-  if (parameters[0] == "NOOP") {
-    return transitiveFromNoop();
+std::optional<Reply> StateMachine::isLocalRecipient(const Parameters &parameters,
+                                                    const RecipientDirectory *recipients) {
+  if (parameters[0] == "RCPT" && recipients != nullptr && !recipients->contains(address(parameters[1]))) {
+    return Reply::MailboxUnavailable;
   }
-
   return std::nullopt;
 }
 
-IdleState::IdleState() {}
-std::string IdleState::transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) {
-  if (auto result = transitiveHelper(parameters, current); result.has_value()) {
-    return result.value();
-  }
-
-  if (parameters[0] == "EHLO") {
-    current = &States::ehloState;
-  }
-
-  return "250 " + codeToMessages["250"];
-}
-
-EhloState::EhloState() { allowed.insert("MAIL"); }
-std::string EhloState::transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) {
-  if (auto result = transitiveHelper(parameters, current); result.has_value()) {
-    return result.value();
-  }
-
-  if (parameters[0] == "MAIL") {
-    current = &States::mailState;
-  }
-
-  return "250 " + codeToMessages["250"];
-}
-
-MailState::MailState() { allowed.insert("RCPT"); }
-std::string MailState::transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) {
-  if (auto result = transitiveHelper(parameters, current); result.has_value()) {
-    return result.value();
-  }
-
-  if (parameters[0] == "RCPT") {
-    current = &States::rcptState;
-  } else {
-    current = &States::ehloState;
-  }
-
-  return "250 " + codeToMessages["250"];
-}
-
-RcptState::RcptState() {
-  allowed.insert("RCPT");
-  allowed.insert("DATA");
-}
-std::string RcptState::transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) {
-  if (auto result = transitiveHelper(parameters, current); result.has_value()) {
-    return result.value();
-  }
-
-  if (parameters[0] == "DATA") {
-    current = &States::dataStartState;
-  } else if (parameters[0] == "RCPT") {
-    current = &States::rcptState;
+Step StateMachine::transitive(const Parameters &parameters, State &current, const RecipientDirectory *recipients) {
+  Verb verb{};
+  if (current == State::DataStart) {
+    verb = parameters.size() == 1 && parameters[0] == "." ? Verb::End : Verb::Text;
   } else {
-    current = &States::ehloState;
+    verb = verbOf(parameters[0]);
   }
 
-  return "250 " + codeToMessages["250"];
-}
+  const Transition &transition = lookup(current, verb);
 
-DataStartState::DataStartState() {}
-std::string DataStartState::transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) {
-  if (parameters[0] == "." && parameters.size() == 1) {
-    current = &States::dataDoneState;
-    return "250 " + codeToMessages["250"];
-  }
-  return "354 " + codeToMessages["354"];
-}
-
-DataDoneState::DataDoneState() { allowed.insert("MAIL"); }
-std::string DataDoneState::transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) {
-  if (auto result = transitiveHelper(parameters, current); result.has_value()) {
-    return result.value();
-  }
-
-  if (parameters[0] == "MAIL") {
-    current = &States::mailState;
-  } else {
-    current = &States::ehloState;
+  // Only a command the table accepts has its parameters checked, a failed
+  // check leaves the session where it was
+  if (current != State::DataStart && (transition.reply == Reply::Ok || transition.reply == Reply::Closing ||
+                                      transition.reply == Reply::ReadyToStartTls)) {
+    if (auto result = isCorrectParameters(parameters); result.has_value()) {
+      return {result.value(), Action::None};
+    }
+    if (auto result = isLocalRecipient(parameters, recipients); result.has_value()) {
+      return {result.value(), Action::None};
+    }
   }
 
-  return "250 " + codeToMessages["250"];
+  current = transition.next;
+  return {transition.reply, transition.action};
 }
@@ -1,136 +1,355 @@
 #pragma once
 
-#include <memory>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
 #include <optional>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <string_view>
 #include <vector>
 
-class State {
-protected:
+class RecipientDirectory;
+
+/**
+ * @brief A command and its parameters, allocated from the session arena.
+ *
+ */
+using Parameters = std::pmr::vector<std::pmr::string>;
+
+/**
+ * @brief The states of an SMTP session.
+ *
+ */
+enum class State : uint8_t {
+  Idle,       //!< Connected, waiting for EHLO
+  Ehlo,       //!< Greeted, waiting for MAIL
+  Mail,       //!< Got the sender, waiting for the first RCPT
+  Rcpt,       //!< Got at least one recipient, waiting for more or for DATA
+  DataStart,  //!< Receiving the message body
+  DataDone,   //!< The message has been accepted
+};
+
+/**
+ * @brief What the client sent, a command or a line of the message body.
+ *
+ */
+enum class Verb : uint8_t {
+  EHLO,
+  MAIL,
+  RCPT,
+  RSET,
+  NOOP,
+  QUIT,
+  DATA,
+  STARTTLS,
+  End,      //!< "." alone, the end of the message body
+  Text,     //!< Any other line of the message body
+  Unknown,  //!< A command we do not know
+};
+
+/**
+ * @brief The replies the server sends.
+ *
+ */
+enum class Reply : uint8_t {
+  ServiceReady,        //!< 220
+  ReadyToStartTls,     //!< 220
+  Closing,             //!< 221
+  Ok,                  //!< 250
+  StartInput,          //!< 354
+  LocalError,          //!< 451
+  TooManyRecipients,   //!< 452, see `Context::maxRecipients`
+  Unrecognized,        //!< 500
+  LineTooLong,         //!< 500, a line over the RFC 5321 limit, the connection is closed
+  BadParameters,       //!< 501
+  BadSequence,         //!< 503
+  MailboxUnavailable,  //!< 550
+  Rejected,            //!< 550, by a content filter
+};
+
+/**
+ * @brief What the session has to do on a transition, besides replying.
+ *
+ */
+enum class Action : uint8_t {
+  None,
+  Greet,         //!< Forget the current transaction and advertise the extensions
+  Reset,         //!< Forget the current transaction
+  Quit,          //!< Forget the current transaction and close the connection
+  SetSender,     //!< Start a transaction with the MAIL address
+  AddRecipient,  //!< Add the RCPT address to the transaction
+  BeginData,     //!< Start receiving the message body
+  AppendBody,    //!< Store a line of the message body
+  EndData,       //!< Commit the message
+  StartTls,      //!< Forget the session and start the TLS handshake
+};
+
+/**
+ * @brief One cell of the transition table.
+ *
+ * @details Each cell carries the (state, verb) pair it is the entry for, so
+ * the compiler can check that the table is complete and in order.
+ */
+struct Transition {
+  State from;
+  Verb verb;
+  State next;
+  Reply reply;
+  Action action = Action::None;
+};
+
+/**
+ * @brief The result of handling one command or body line.
+ *
+ */
+struct Step {
+  Reply reply;    //!< The response, see `StateMachine::reply`
+  Action action;  //!< What the session has to do
+};
+
+/**
+ * @brief How the transition table of `StateMachine` is built and checked.
+ *
+ * @details It is a class of its own because a constexpr member function can
+ * not be evaluated before its class is complete.
+ */
+class TransitionTable {
+public:
+  static constexpr size_t stateCount = static_cast<size_t>(State::DataDone) + 1;
+  static constexpr size_t verbCount = static_cast<size_t>(Verb::Unknown) + 1;
+
+  using Cells = std::array<Transition, stateCount * verbCount>;
+
+  static constexpr Cells build() {
+    using S = State;
+    using V = Verb;
+    using R = Reply;
+    using A = Action;
+
+    // clang-format off
+    return {{
+        // Idle: only the commands allowed in every state
+        {S::Idle, V::EHLO, S::Ehlo, R::Ok, A::Greet},
+        {S::Idle, V::MAIL, S::Idle, R::BadSequence},
+        {S::Idle, V::RCPT, S::Idle, R::BadSequence},
+        {S::Idle, V::RSET, S::Idle, R::Ok, A::Reset},
+        {S::Idle, V::NOOP, S::Idle, R::Ok},
+        {S::Idle, V::QUIT, S::Idle, R::Closing, A::Quit},
+        {S::Idle, V::DATA, S::Idle, R::BadSequence},
+        {S::Idle, V::STARTTLS, S::Idle, R::BadSequence},
+        {S::Idle, V::End, S::Idle, R::BadSequence},
+        {S::Idle, V::Text, S::Idle, R::Unrecognized},
+        {S::Idle, V::Unknown, S::Idle, R::Unrecognized},
+
+        // Ehlo: MAIL starts a transaction, STARTTLS starts the session over, encrypted
+        {S::Ehlo, V::EHLO, S::Ehlo, R::Ok, A::Greet},
+        {S::Ehlo, V::MAIL, S::Mail, R::Ok, A::SetSender},
+        {S::Ehlo, V::RCPT, S::Ehlo, R::BadSequence},
+        {S::Ehlo, V::RSET, S::Ehlo, R::Ok, A::Reset},
+        {S::Ehlo, V::NOOP, S::Ehlo, R::Ok},
+        {S::Ehlo, V::QUIT, S::Idle, R::Closing, A::Quit},
+        {S::Ehlo, V::DATA, S::Ehlo, R::BadSequence},
+        {S::Ehlo, V::STARTTLS, S::Idle, R::ReadyToStartTls, A::StartTls},
+        {S::Ehlo, V::End, S::Ehlo, R::BadSequence},
+        {S::Ehlo, V::Text, S::Ehlo, R::Unrecognized},
+        {S::Ehlo, V::Unknown, S::Ehlo, R::Unrecognized},
+
+        // Mail: waiting for the first RCPT
+        {S::Mail, V::EHLO, S::Ehlo, R::Ok, A::Greet},
+        {S::Mail, V::MAIL, S::Mail, R::BadSequence},
+        {S::Mail, V::RCPT, S::Rcpt, R::Ok, A::AddRecipient},
+        {S::Mail, V::RSET, S::Ehlo, R::Ok, A::Reset},
+        {S::Mail, V::NOOP, S::Mail, R::Ok},
+        {S::Mail, V::QUIT, S::Idle, R::Closing, A::Quit},
+        {S::Mail, V::DATA, S::Mail, R::BadSequence},
+        {S::Mail, V::STARTTLS, S::Mail, R::BadSequence},
+        {S::Mail, V::End, S::Mail, R::BadSequence},
+        {S::Mail, V::Text, S::Mail, R::Unrecognized},
+        {S::Mail, V::Unknown, S::Mail, R::Unrecognized},
+
+        // Rcpt: more RCPTs or DATA
+        {S::Rcpt, V::EHLO, S::Ehlo, R::Ok, A::Greet},
+        {S::Rcpt, V::MAIL, S::Rcpt, R::BadSequence},
+        {S::Rcpt, V::RCPT, S::Rcpt, R::Ok, A::AddRecipient},
+        {S::Rcpt, V::RSET, S::Ehlo, R::Ok, A::Reset},
+        {S::Rcpt, V::NOOP, S::Rcpt, R::Ok},
+        {S::Rcpt, V::QUIT, S::Idle, R::Closing, A::Quit},
+        {S::Rcpt, V::DATA, S::DataStart, R::Ok, A::BeginData},
+        {S::Rcpt, V::STARTTLS, S::Rcpt, R::BadSequence},
+        {S::Rcpt, V::End, S::Rcpt, R::BadSequence},
+        {S::Rcpt, V::Text, S::Rcpt, R::Unrecognized},
+        {S::Rcpt, V::Unknown, S::Rcpt, R::Unrecognized},
+
+        // DataStart: every line is body until "."
+        {S::DataStart, V::EHLO, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::MAIL, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::RCPT, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::RSET, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::NOOP, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::QUIT, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::DATA, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::STARTTLS, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::End, S::DataDone, R::Ok, A::EndData},
+        {S::DataStart, V::Text, S::DataStart, R::StartInput, A::AppendBody},
+        {S::DataStart, V::Unknown, S::DataStart, R::StartInput, A::AppendBody},
+
+        // DataDone: a new transaction may start
+        {S::DataDone, V::EHLO, S::Ehlo, R::Ok, A::Greet},
+        {S::DataDone, V::MAIL, S::Mail, R::Ok, A::SetSender},
+        {S::DataDone, V::RCPT, S::DataDone, R::BadSequence},
+        {S::DataDone, V::RSET, S::Ehlo, R::Ok, A::Reset},
+        {S::DataDone, V::NOOP, S::DataDone, R::Ok},
+        {S::DataDone, V::QUIT, S::Idle, R::Closing, A::Quit},
+        {S::DataDone, V::DATA, S::DataDone, R::BadSequence},
+        {S::DataDone, V::STARTTLS, S::Idle, R::ReadyToStartTls, A::StartTls},
+        {S::DataDone, V::End, S::DataDone, R::BadSequence},
+        {S::DataDone, V::Text, S::DataDone, R::Unrecognized},
+        {S::DataDone, V::Unknown, S::DataDone, R::Unrecognized},
+    }};
+    // clang-format on
+  }
+
+  static constexpr bool isComplete(const Cells &table) {
+    for (size_t i = 0; i < table.size(); ++i) {
+      if (static_cast<size_t>(table[i].from) != i / verbCount || static_cast<size_t>(table[i].verb) != i % verbCount) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static constexpr bool isAlwaysAllowed(const Cells &table) {
+    for (const Transition &transition : table) {
+      if (transition.from == State::DataStart) {
+        continue;
+      }
+      switch (transition.verb) {
+        case Verb::QUIT:
+          if (transition.next != State::Idle || transition.reply != Reply::Closing) {
+            return false;
+          }
+          break;
+        case Verb::EHLO:
+        case Verb::RSET:
+        case Verb::NOOP:
+          if (transition.reply != Reply::Ok) {
+            return false;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    return true;
+  }
+
+  static constexpr bool isBodyClosedByEnd(const Cells &table) {
+    for (const Transition &transition : table) {
+      bool staysInData = transition.next == State::DataStart;
+      if (transition.from == State::DataStart && staysInData == (transition.verb == Verb::End)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+class StateMachine {
+public:
+  static constexpr size_t stateCount = TransitionTable::stateCount;
+  static constexpr size_t verbCount = TransitionTable::verbCount;
+
   /**
-   * @brief allowed operations for each state, it should be used in
-   * derive class, so make it protected.
+   * @brief the response line of every `Reply`, indexed by the enum
    *
    */
-  std::unordered_set<std::string> allowed;
+  static constexpr std::array<std::string_view, static_cast<size_t>(Reply::Rejected) + 1> replies{
+      "220 Service ready",
+      "220 Ready to start TLS",
+      "221 Service closing transmission channel",
+      "250 Requested mail action okay, completed",
+      "354 Start mail input end <CRLF>.<CRLF>",
+      "451 Requested action aborted: local error in processing",
+      "452 Too many recipients",
+      "500 Syntax error, command unrecognized",
+      "500 Line too long",
+      "501 Syntax error in parameters or arguments",
+      "503 Bad sequence of commands",
+      "550 Requested action not taken: mailbox unavailable",
+      "550 Requested action not taken: message rejected by policy",
+  };
 
-public:
   /**
-   * @brief Construct a new State object. It will initialize the `allowed`
-   * for adding four commands.
+   * @brief the transition table, indexed by `state * verbCount + verb`
    *
    */
-  State();
+  static constexpr TransitionTable::Cells transitions = TransitionTable::build();
+
+  static_assert(TransitionTable::isComplete(transitions),
+                "every (state, verb) pair needs exactly one transition, in enum order");
+  static_assert(TransitionTable::isAlwaysAllowed(transitions),
+                "EHLO, RSET, NOOP and QUIT must be allowed outside of DATA");
+  static_assert(TransitionTable::isBodyClosedByEnd(transitions), "only \".\" may leave the DATA state");
 
   /**
-   * @brief can transitive to another state
-   * @details check whether parameters[0] is in the allowed
+   * @brief the transition for `verb` in `state`, a single table lookup
    *
-   * @param parameters the command and its parameters
-   * @return true the command is OK for transition
-   * @return false the command is not OK for transition
    */
-  bool canTransitive(std::vector<std::string> &parameters);
+  static constexpr const Transition &lookup(State state, Verb verb) {
+    return transitions[static_cast<size_t>(state) * verbCount + static_cast<size_t>(verb)];
+  }
 
   /**
-   * @brief check the command whether it is in the command
-   * and call `canTransitive`.
+   * @brief the response line of a reply, e.g. "250 Requested mail action okay, completed"
    *
-   * @param parameters
-   * @return std::optional<std::string>
    */
-  std::optional<std::string> checkCommand(std::vector<std::string> &parameters);
+  static constexpr std::string_view reply(Reply reply) { return replies[static_cast<size_t>(reply)]; }
 
   /**
-   * @brief is the parameters are correct
+   * @brief the address in a MAIL or RCPT parameter
+   * @details Both the bare form "shejialuo@gmail.com" and the RFC 5321 forms
+   * "FROM:<shejialuo@gmail.com>" and "TO:<shejialuo@gmail.com>" are accepted.
    *
-   * @param[in] parameters the command and its parameters
-   * @return std::optional<std::string>
+   * @param[in] parameter the parameter of MAIL or RCPT
+   * @return std::string_view the address, a view into `parameter`
    */
-  std::optional<std::string> isCorrectParameters(std::vector<std::string> &parameters);
+  static std::string_view address(std::string_view parameter);
 
   /**
-   * @brief QUIT command handle
+   * @brief the verb of a command, `Verb::Unknown` when it is not a command we know
    *
-   * @param[in] current the current state
-   * @return std::string the response code
+   * @param[in] command the first word of the request
    */
-  std::string transitiveFromQuit(std::unique_ptr<State> *&current);
+  static Verb verbOf(std::string_view command);
 
   /**
-   * @brief NOOP command handle
+   * @brief is the parameters are correct
    *
-   * @return std::string the response code
+   * @param[in] parameters the command and its parameters
+   * @return std::optional<Reply> `Reply::BadParameters` for wrong parameters
    */
-  std::string transitiveFromNoop();
+  static std::optional<Reply> isCorrectParameters(const Parameters &parameters);
 
   /**
-   * @brief The operations all the states need to do
+   * @brief is the RCPT address a local recipient
    *
+   * @param[in] parameters the command and its parameters
+   * @param[in] recipients the local recipients, nullptr to accept every address
+   * @return std::optional<Reply> `Reply::MailboxUnavailable` for an unknown recipient
    */
-  std::optional<std::string> transitiveHelper(std::vector<std::string> &parameters, std::unique_ptr<State> *&current);
+  static std::optional<Reply> isLocalRecipient(const Parameters &parameters, const RecipientDirectory *recipients);
 
   /**
-   * @brief transitive to another state and return the response string.
+   * @brief transitive to another state and return the response.
+   * @details Unknown commands (500) and commands not allowed in the current
+   * state (503) are answered by the table itself, the parameters of the other
+   * commands are checked (501, 550) before the transition is taken.
    *
    * @param[in] parameters the command and its parameters
-   * @param[out] current the current state
-   * @return std::string the results should be sent back to the client
+   * @param[in,out] current the current state
+   * @param[in] recipients the local recipients RCPT is checked against, nullptr to accept every well-formed address
+   * @return Step the response and the action the session has to take
    */
-  virtual std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) = 0;
-
-  virtual ~State() = default;
-};
-
-class IdleState : public State {
-public:
-  IdleState();
-  std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) override;
-  ~IdleState() override = default;
-};
-
-class EhloState : public State {
-public:
-  EhloState();
-  std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) override;
-  ~EhloState() override = default;
-};
-
-class MailState : public State {
-public:
-  MailState();
-  std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) override;
-  ~MailState() override = default;
-};
-
-class RcptState : public State {
-public:
-  RcptState();
-  std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) override;
-  ~RcptState() override = default;
-};
-
-class DataStartState : public State {
-public:
-  DataStartState();
-  std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) override;
-  ~DataStartState() override = default;
-};
-
-class DataDoneState : public State {
-public:
-  DataDoneState();
-  std::string transitive(std::vector<std::string> &parameters, std::unique_ptr<State> *&current) override;
-  ~DataDoneState() override = default;
-};
-
-struct States {
-  static std::unique_ptr<State> idleState;
-  static std::unique_ptr<State> ehloState;
-  static std::unique_ptr<State> mailState;
-  static std::unique_ptr<State> rcptState;
-  static std::unique_ptr<State> dataStartState;
-  static std::unique_ptr<State> dataDoneState;
+  static Step transitive(const Parameters &parameters, State &current, const RecipientDirectory *recipients = nullptr);
 };
@@ -0,0 +1,109 @@
+#include "arena.hpp"
+#include "context.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+TEST(SessionArena, blocksAreRecycled) {
+  SessionArena arena{};
+  void *first = arena.allocate(64);
+  void *second = arena.allocate(64);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(arena.used(), 128);
+
+  size_t cached = SessionArena::cached();
+  arena.reset();
+  EXPECT_EQ(arena.used(), 0);
+  EXPECT_EQ(SessionArena::cached(), cached + 1);
+
+  // The block comes back from the free list of this thread
+  EXPECT_EQ(arena.allocate(64), first);
+  EXPECT_EQ(SessionArena::cached(), cached);
+}
+
+TEST(SessionArena, alignmentAndLargeAllocations) {
+  SessionArena arena{};
+  EXPECT_NE(arena.allocate(1, 1), nullptr);
+  void *aligned = arena.allocate(8, 8);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 8, 0);
+
+  void *large = arena.allocate(SessionArena::blockSize * 4, 64);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % 64, 0);
+  EXPECT_EQ(arena.used(), 9 + SessionArena::blockSize * 4);
+
+  // Many small allocations span several blocks
+  for (int i = 0; i < 1000; ++i) {
+    std::memset(arena.allocate(100), i, 100);
+  }
+  arena.reset();
+  EXPECT_EQ(arena.used(), 0);
+}
+
+TEST(SessionArena, contextReleasesAfterTransaction) {
+  Context context{};
+  std::vector<std::string_view> session{
+      "EHLO 127.0.0.1\r\n", "MAIL FROM:<shejialuo@gmail.com>\r\n", "RCPT TO:<a@example.com>\r\n", "DATA\r\n",
+  };
+  for (auto line : session) {
+    Parameters parameters = context.parse(line);
+    EXPECT_EQ(context.transitive(parameters)[0], '2');
+  }
+  EXPECT_TRUE(context.receivingData());
+  EXPECT_TRUE(context.data("body\r\n").empty());
+  EXPECT_EQ(context.data(".\r\n"), StateMachine::reply(Reply::Ok));
+
+  size_t cached = SessionArena::cached();
+  {
+    // The transaction is over, so the arena is given back before parsing
+    Parameters parameters = context.parse("MAIL FROM:<shejialuo@gmail.com>\r\n");
+    EXPECT_EQ(parameters, (Parameters{"MAIL", "FROM:<shejialuo@gmail.com>"}));
+    EXPECT_EQ(context.transitive(parameters), StateMachine::reply(Reply::Ok));
+  }
+  EXPECT_EQ(SessionArena::cached(), cached);
+
+  Parameters parameters = context.parse("NOOP\r\n");
+  EXPECT_EQ(parameters, (Parameters{"NOOP"}));
+}
+
+TEST(SessionArena, commandsWithinATransactionDoNotGrowTheArena) {
+  Context context{};
+  std::vector<std::string_view> session{
+      "EHLO 127.0.0.1\r\n",
+      "MAIL FROM:<shejialuo@gmail.com>\r\n",
+      "RCPT TO:<a@example.com>\r\n",
+  };
+  for (auto line : session) {
+    Parameters parameters = context.parse(line);
+    EXPECT_EQ(context.transitive(parameters)[0], '2');
+  }
+
+  size_t cached = SessionArena::cached();
+  for (int i = 0; i < 10000; ++i) {
+    Parameters parameters = context.parse("NOOP\r\n");
+    EXPECT_EQ(context.transitive(parameters), StateMachine::reply(Reply::Ok));
+  }
+  EXPECT_EQ(SessionArena::cached(), cached);
+}
+
+TEST(SessionArena, recipientsAreCapped) {
+  Context context{};
+  for (auto line : {"EHLO 127.0.0.1\r\n", "MAIL FROM:<shejialuo@gmail.com>\r\n"}) {
+    Parameters parameters = context.parse(line);
+    EXPECT_EQ(context.transitive(parameters)[0], '2');
+  }
+  for (size_t i = 0; i < Context::maxRecipients; ++i) {
+    Parameters parameters = context.parse("RCPT TO:<user" + std::to_string(i) + "@example.com>\r\n");
+    EXPECT_EQ(context.transitive(parameters), StateMachine::reply(Reply::Ok));
+  }
+  Parameters parameters = context.parse("RCPT TO:<last@example.com>\r\n");
+  EXPECT_EQ(context.transitive(parameters), StateMachine::reply(Reply::TooManyRecipients));
+
+  // The transaction goes on with the recipients accepted
+  parameters = context.parse("DATA\r\n");
+  EXPECT_EQ(context.transitive(parameters), StateMachine::reply(Reply::Ok));
+  EXPECT_TRUE(context.receivingData());
+}
@@ -0,0 +1,83 @@
+#include "recipientIndex.hpp"
+#include "replay.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "state.hpp"
+#include "transcript.hpp"
+#include "util.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// Serve two clients with a transcript, each sending its script in two writes
+static void capture(const std::string &path) {
+  const std::string script = "EHLO 127.0.0.1\r\nMAIL FROM:<a@example.com>\r\nRCPT TO:<b@example.com>\r\nDATA\r\n"
+                             "Subject: hi\r\n\r\n..dot\r\nbody\r\n.\r\nNOOP\r\nHELO\r\nRSET\r\nQUIT\r\n";
+  Transcript transcript{path};
+  Scheduler scheduler{};
+  std::vector<TCPSocket> clients{};
+  for (int i = 0; i < 2; ++i) {
+    int fds[2];
+    SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+    clients.emplace_back(FileDescriptor{fds[0]});
+    scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, nullptr, nullptr, nullptr, nullptr,
+                            &transcript));
+  }
+  // Cut in the middle of a line, so the replay has to join it again
+  for (auto &client : clients) {
+    client.write(script.substr(0, 40));
+  }
+  scheduler.stopAt(std::chrono::steady_clock::now() + std::chrono::milliseconds{20});
+  scheduler.run();
+  for (auto &client : clients) {
+    client.write(script.substr(40));
+  }
+  scheduler.stopAt(std::chrono::steady_clock::now() + std::chrono::seconds{5});
+  scheduler.run();
+}
+
+TEST(Replay, repliesMatchTheRecordedOnes) {
+  const std::string path = "/tmp/replayTest-" + std::to_string(::getpid()) + ".transcript";
+  capture(path);
+
+  Replay replay{path};
+  EXPECT_EQ(replay.sessions(), 2);
+  // Greeting, EHLO, MAIL, RCPT, DATA, the body, NOOP, HELO, RSET and QUIT
+  for (size_t segment : {0, 1, 7}) {
+    ReplayResult result = replay.run(segment);
+    EXPECT_EQ(result.sessions, 2);
+    EXPECT_EQ(result.commands, 20) << "segment " << segment;
+    EXPECT_EQ(result.mismatches, 0) << "segment " << segment;
+    EXPECT_TRUE(result.first.empty());
+    EXPECT_GE(result.recorded, std::chrono::milliseconds{20});
+  }
+  std::remove(path.c_str());
+}
+
+TEST(Replay, reportsTheRepliesThatChanged) {
+  const std::string path = "/tmp/replayTest-" + std::to_string(::getpid()) + ".transcript";
+  capture(path);
+
+  // b@example.com was accepted when the sessions were recorded
+  const std::string index = "/tmp/replayTest-" + std::to_string(::getpid()) + ".idx";
+  RecipientIndex::build({"c@example.com"}, index);
+  RecipientDirectory directory{index};
+  ReplayResult result = Replay{path, &directory}.run();
+
+  // Per session RCPT is refused, DATA then is out of sequence and the body
+  // lines are commands
+  EXPECT_GT(result.mismatches, 4);
+  ASSERT_EQ(result.first.size(), Replay::keptMismatches);
+  EXPECT_EQ(result.first[0].session, 1);
+  EXPECT_EQ(result.first[0].reply, 3);
+  EXPECT_EQ(result.first[0].expected, StateMachine::reply(Reply::Ok));
+  EXPECT_EQ(result.first[0].actual, StateMachine::reply(Reply::MailboxUnavailable));
+
+  std::remove(index.c_str());
+  std::remove(path.c_str());
+}
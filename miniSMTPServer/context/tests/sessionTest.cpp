@@ -0,0 +1,245 @@
+#include "asyncSocket.hpp"
+#include "filterPipeline.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "state.hpp"
+#include "tlsContext.hpp"
+#include "util.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <openssl/ssl.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static std::string readAll(TCPSocket &socket) {
+  std::string all{};
+  while (true) {
+    std::string chunk = socket.read();
+    if (chunk.empty()) {
+      return all;
+    }
+    all += chunk;
+  }
+}
+
+TEST(Session, concurrentPipelinedSessions) {
+  const std::string script = "EHLO 127.0.0.1\r\n"
+                             "MAIL FROM:<shejialuo@gmail.com>\r\n"
+                             "RCPT TO:<a@example.com>\r\n"
+                             "DATA\r\n"
+                             "Subject: hi\r\n"
+                             "..hidden\r\n"
+                             ".\r\n"
+                             "QUIT\r\n";
+
+  std::string ok{StateMachine::reply(Reply::Ok)};
+  std::string expected = std::string{StateMachine::reply(Reply::ServiceReady)} + "\r\n" + "250-" + ok.substr(4) +
+                         "\r\n250 PIPELINING\r\n" + ok + "\r\n" + ok + "\r\n" + ok + "\r\n" + ok + "\r\n" +
+                         std::string{StateMachine::reply(Reply::Closing)} + "\r\n";
+
+  Scheduler scheduler{};
+  std::vector<TCPSocket> clients{};
+  for (int i = 0; i < 64; ++i) {
+    int fds[2];
+    SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+    clients.emplace_back(FileDescriptor{fds[0]});
+    clients.back().write(script);
+    scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, nullptr));
+  }
+  scheduler.run();
+
+  // Every session ran to QUIT and closed its end
+  EXPECT_EQ(scheduler.running(), 0);
+  for (auto &client : clients) {
+    EXPECT_EQ(readAll(client), expected);
+  }
+}
+
+TEST(Session, connectionLostInTheMiddleOfData) {
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  TCPSocket client{FileDescriptor{fds[0]}};
+  client.write("EHLO 127.0.0.1\r\nMAIL FROM:<a@example.com>\r\nRCPT TO:<b@example.com>\r\nDATA\r\nhalf a bo");
+  client.close();
+
+  Scheduler scheduler{};
+  scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, nullptr));
+  scheduler.run();
+  EXPECT_EQ(scheduler.running(), 0);
+}
+
+TEST(Session, commandLineOverTheLimitClosesTheSession) {
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  TCPSocket client{FileDescriptor{fds[0]}};
+  client.write("EHLO 127.0.0.1\r\nNOOP " + std::string(AsyncSocket::commandLineLimit, 'x') + "\r\nQUIT\r\n");
+
+  Scheduler scheduler{};
+  scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, nullptr));
+  scheduler.run();
+  EXPECT_EQ(scheduler.running(), 0);
+
+  std::string replies = readAll(client);
+  EXPECT_NE(replies.find("250 PIPELINING\r\n"), std::string::npos);
+  EXPECT_TRUE(replies.ends_with(std::string{StateMachine::reply(Reply::LineTooLong)} + "\r\n"));
+}
+
+TEST(Session, receivedFieldBeforeTheMessage) {
+  const std::string directory = "/tmp/sessionTest.spool." + std::to_string(::getpid());
+  Spool spool{directory};
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  TCPSocket client{FileDescriptor{fds[0]}};
+  client.write("EHLO 127.0.0.1\r\nMAIL FROM:<a@example.com>\r\nRCPT TO:<b@example.com>\r\nDATA\r\n"
+               "Subject: hi\r\n\r\n..body\r\n.\r\nQUIT\r\n");
+
+  Scheduler scheduler{};
+  scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, &spool));
+  scheduler.run();
+
+  auto records = spool.records();
+  ASSERT_EQ(records.size(), 1);
+  std::ifstream file{spool.bodyPath(records[0].id)};
+  std::string body{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  ASSERT_EQ(body.size(), records[0].traceLength + 22);
+  EXPECT_EQ(body.rfind("Received: from 127.0.0.1\r\n\tby ", 0), 0);
+  EXPECT_NE(body.find(" with ESMTP id " + records[0].id + "\r\n\tfor <b@example.com>; "), std::string::npos);
+  EXPECT_EQ(body.substr(records[0].traceLength), "Subject: hi\r\n\r\n.body\r\n");
+
+  std::filesystem::remove_all(directory);
+}
+
+TEST(Session, filterVerdictsBecomeReplies) {
+  const std::string directory = "/tmp/sessionTest.filters." + std::to_string(::getpid());
+  Spool spool{directory};
+  std::vector<FilterStage> stages{};
+  stages.push_back(FilterStage{"subject", [](const FilterMessage &message) {
+                                 std::string_view subject = message.headers.find(Header::Subject).value_or("");
+                                 if (subject == "slow") {
+                                   std::this_thread::sleep_for(std::chrono::milliseconds{200});
+                                 }
+                                 return subject == "spam" ? Verdict::Reject : Verdict::Accept;
+                               }});
+
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  TCPSocket client{FileDescriptor{fds[0]}};
+  std::string envelope = "MAIL FROM:<a@example.com>\r\nRCPT TO:<b@example.com>\r\nDATA\r\n";
+  client.write("EHLO 127.0.0.1\r\n" + envelope + "Subject: spam\r\n\r\nbuy\r\n.\r\n" + envelope +
+               "Subject: slow\r\n\r\nwait\r\n.\r\n" + envelope + "Subject: hi\r\n\r\nhello\r\n.\r\nQUIT\r\n");
+
+  Scheduler scheduler{};
+  {
+    FilterPipeline filters{scheduler, std::move(stages), 2, std::chrono::milliseconds{50}};
+    scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, &spool, nullptr, nullptr, &filters));
+    scheduler.run();
+  }
+
+  std::string replies = readAll(client);
+  const std::string ok{StateMachine::reply(Reply::Ok)};
+  size_t rejected = replies.find(StateMachine::reply(Reply::Rejected));
+  size_t deferred = replies.find(StateMachine::reply(Reply::LocalError));
+  ASSERT_NE(rejected, std::string::npos);
+  ASSERT_NE(deferred, std::string::npos);
+  EXPECT_LT(rejected, deferred);
+  EXPECT_NE(replies.find(ok, deferred), std::string::npos);
+
+  // Only the last one was spooled, the others left nothing behind
+  EXPECT_EQ(spool.records().size(), 1);
+  EXPECT_TRUE(std::filesystem::is_empty(directory + "/tmp"));
+  std::filesystem::remove_all(directory);
+}
+
+// Read from `socket` until what was read ends with `end`
+static std::string readUntil(TCPSocket &socket, const std::string &end) {
+  std::string all{};
+  while (all.size() < end.size() || all.compare(all.size() - end.size(), end.size(), end) != 0) {
+    std::string chunk = socket.read(1);
+    if (chunk.empty()) {
+      break;
+    }
+    all += chunk;
+  }
+  return all;
+}
+
+TEST(Session, startTlsThenStartOver) {
+  // The handshake writes with write(2), not send(2)
+  std::signal(SIGPIPE, SIG_IGN);
+  const std::string certificate = "/tmp/sessionTest." + std::to_string(::getpid()) + ".crt";
+  const std::string key = "/tmp/sessionTest." + std::to_string(::getpid()) + ".key";
+  writeSelfSigned(certificate, key);
+  TlsContext tls{certificate, key};
+
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  TCPSocket client{FileDescriptor{fds[0]}};
+  // The NOOP came before the handshake, it must not be taken as sent over TLS
+  client.write("EHLO 127.0.0.1\r\nSTARTTLS\r\nNOOP\r\n");
+
+  std::string clear{};
+  std::string encrypted{};
+  std::thread peer{[&] {
+    clear = readUntil(client, std::string{StateMachine::reply(Reply::ReadyToStartTls)} + "\r\n");
+
+    std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> context{SSL_CTX_new(TLS_client_method()), SSL_CTX_free};
+    TlsSession connection{SSL_new(context.get())};
+    SSL_set_fd(connection.get(), client.fd_num());
+    if (SSL_connect(connection.get()) != 1) {
+      return;
+    }
+    const std::string script = "EHLO 127.0.0.1\r\nSTARTTLS\r\nQUIT\r\n";
+    SSL_write(connection.get(), script.data(), static_cast<int>(script.size()));
+    char chunk[512];
+    int bytes = 0;
+    while ((bytes = SSL_read(connection.get(), chunk, sizeof(chunk))) > 0) {
+      encrypted.append(chunk, bytes);
+    }
+  }};
+
+  Scheduler scheduler{};
+  scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, nullptr, nullptr, &tls));
+  scheduler.run();
+  peer.join();
+
+  std::string ok{StateMachine::reply(Reply::Ok)};
+  EXPECT_EQ(clear,
+            std::string{StateMachine::reply(Reply::ServiceReady)} + "\r\n250-" + ok.substr(4) +
+                "\r\n250-PIPELINING\r\n250 STARTTLS\r\n" +
+                std::string{StateMachine::reply(Reply::ReadyToStartTls)} + "\r\n");
+  // No second greeting, and no second STARTTLS
+  EXPECT_EQ(encrypted,
+            "250-" + ok.substr(4) + "\r\n250 PIPELINING\r\n" +
+                std::string{StateMachine::reply(Reply::BadSequence)} + "\r\n" +
+                std::string{StateMachine::reply(Reply::Closing)} + "\r\n");
+
+  std::remove(certificate.c_str());
+  std::remove(key.c_str());
+}
+
+TEST(Session, startTlsOnlyWhenOffered) {
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  TCPSocket client{FileDescriptor{fds[0]}};
+  client.write("STARTTLS\r\nEHLO 127.0.0.1\r\nSTARTTLS\r\nQUIT\r\n");
+
+  Scheduler scheduler{};
+  scheduler.spawn(session(scheduler, TCPSocket{FileDescriptor{fds[1]}}, nullptr));
+  scheduler.run();
+
+  std::string ok{StateMachine::reply(Reply::Ok)};
+  EXPECT_EQ(readAll(client),
+            std::string{StateMachine::reply(Reply::ServiceReady)} + "\r\n" +
+                std::string{StateMachine::reply(Reply::BadSequence)} + "\r\n250-" + ok.substr(4) +
+                "\r\n250 PIPELINING\r\n" + std::string{StateMachine::reply(Reply::Unrecognized)} + "\r\n" +
+                std::string{StateMachine::reply(Reply::Closing)} + "\r\n");
+}
@@ -1,7 +1,11 @@
 #include "state.hpp"
 
+#include "recipientIndex.hpp"
+
+#include <cstdio>
 #include <gtest/gtest.h>
-#include <memory>
+#include <string>
+#include <unistd.h>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -14,31 +18,30 @@ static std::unordered_map<std::string, std::string> codeToMessages{
     {"500", "Syntax error, command unrecognized"},
     {"501", "Syntax error in parameters or arguments"},
     {"503", "Bad sequence of commands"},
+    {"550", "Requested action not taken: mailbox unavailable"},
 };
 
 TEST(State, isCorrectParametersNOOP) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"NOOP", "param1"},
       {"NOOP", "param1", "param2"},
       {"NOOP", "12"},
       {"NOOP", "3"},
   };
 
-  auto state = std::make_unique<IdleState>();
-
   for (auto &&test : tests) {
-    auto result = state->isCorrectParameters(test);
+    auto result = StateMachine::isCorrectParameters(test);
     ASSERT_TRUE(result.has_value());
-    ASSERT_EQ(result.value(), "501 " + codeToMessages["501"]);
+    ASSERT_EQ(StateMachine::reply(result.value()), "501 " + codeToMessages["501"]);
   }
 
-  std::vector<std::string> successful{"NOOP"};
+  Parameters successful{"NOOP"};
 
-  ASSERT_FALSE(state->isCorrectParameters(successful).has_value());
+  ASSERT_FALSE(StateMachine::isCorrectParameters(successful).has_value());
 }
 
 TEST(State, isCorrectParametersQUIT) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"QUIT", "NOOP"},
       {"QUIT", "NOOP", "EHLO"},
       {"QUIT", "12", "13", "14", "15"},
@@ -46,21 +49,19 @@ TEST(State, isCorrectParametersQUIT) {
       {"QUIT", "MAIL", "RCPT", "11111", "22"},
   };
 
-  auto state = std::make_unique<IdleState>();
-
   for (auto &&test : tests) {
-    auto result = state->isCorrectParameters(test);
+    auto result = StateMachine::isCorrectParameters(test);
     ASSERT_TRUE(result.has_value());
-    ASSERT_EQ(result.value(), "501 " + codeToMessages["501"]);
+    ASSERT_EQ(StateMachine::reply(result.value()), "501 " + codeToMessages["501"]);
   }
 
-  std::vector<std::string> successful{"QUIT"};
+  Parameters successful{"QUIT"};
 
-  ASSERT_FALSE(state->isCorrectParameters(successful).has_value());
+  ASSERT_FALSE(StateMachine::isCorrectParameters(successful).has_value());
 }
 
 TEST(State, isCorrectParametersRSET) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"RSET", "NOOP"},
       {"RSET", "NOOP", "EHLO"},
       {"RSET", "12", "13", "14", "15"},
@@ -68,21 +69,19 @@ TEST(State, isCorrectParametersRSET) {
       {"RSET", "MAIL", "RCPT", "11111", "22"},
   };
 
-  auto state = std::make_unique<IdleState>();
-
   for (auto &&test : tests) {
-    auto result = state->isCorrectParameters(test);
+    auto result = StateMachine::isCorrectParameters(test);
     ASSERT_TRUE(result.has_value());
-    ASSERT_EQ(result.value(), "501 " + codeToMessages["501"]);
+    ASSERT_EQ(StateMachine::reply(result.value()), "501 " + codeToMessages["501"]);
   }
 
-  std::vector<std::string> successful{"RSET"};
+  Parameters successful{"RSET"};
 
-  ASSERT_FALSE(state->isCorrectParameters(successful).has_value());
+  ASSERT_FALSE(StateMachine::isCorrectParameters(successful).has_value());
 }
 
 TEST(State, isCorrectParametersEHLO) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"EHLO"},
       {"EHLO", "127.0.0.2"},
       {"EHLO", "127.0.1.1"},
@@ -92,21 +91,19 @@ TEST(State, isCorrectParametersEHLO) {
       {"EHLO", "MAIL", "RCPT", "11111", "22"},
   };
 
-  auto state = std::make_unique<IdleState>();
-
   for (auto &&test : tests) {
-    auto result = state->isCorrectParameters(test);
+    auto result = StateMachine::isCorrectParameters(test);
     ASSERT_TRUE(result.has_value());
-    ASSERT_EQ(result.value(), "501 " + codeToMessages["501"]);
+    ASSERT_EQ(StateMachine::reply(result.value()), "501 " + codeToMessages["501"]);
   }
 
-  std::vector<std::string> successful{"EHLO", "127.0.0.1"};
+  Parameters successful{"EHLO", "127.0.0.1"};
 
-  ASSERT_FALSE(state->isCorrectParameters(successful).has_value());
+  ASSERT_FALSE(StateMachine::isCorrectParameters(successful).has_value());
 }
 
 TEST(State, isCorrectParametersMAIL) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"MAIL"},
       {"MAIL", "MAIL"},
       {"MAIL", "NOOP", "MAIL"},
@@ -116,21 +113,19 @@ TEST(State, isCorrectParametersMAIL) {
       {"EHLO", "shejialuo@123.1.cn"},
   };
 
-  auto state = std::make_unique<IdleState>();
-
   for (auto &&test : tests) {
-    auto result = state->isCorrectParameters(test);
+    auto result = StateMachine::isCorrectParameters(test);
     ASSERT_TRUE(result.has_value());
-    ASSERT_EQ(result.value(), "501 " + codeToMessages["501"]);
+    ASSERT_EQ(StateMachine::reply(result.value()), "501 " + codeToMessages["501"]);
   }
 
-  std::vector<std::string> successful{"MAIL", "shejialuo@gmail.com"};
+  Parameters successful{"MAIL", "shejialuo@gmail.com"};
 
-  ASSERT_FALSE(state->isCorrectParameters(successful).has_value());
+  ASSERT_FALSE(StateMachine::isCorrectParameters(successful).has_value());
 }
 
 TEST(State, IdleStateTransitive) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"RSET"},
       {"NOOP"},
       {"QUIT"},
@@ -142,33 +137,34 @@ TEST(State, IdleStateTransitive) {
       {"QUIT", "QUIT"},
       {"EHLO", "127.0.1.1"},
       {"DATA"},
+      {"STARTTLS"},
   };
 
-  std::vector<std::pair<std::string, std::unique_ptr<State> *>> expects{
-      {"250 " + codeToMessages["250"], &States::idleState},
-      {"250 " + codeToMessages["250"], &States::idleState},
-      {"221 " + codeToMessages["221"], &States::idleState},
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"500 " + codeToMessages["500"], &States::idleState},
-      {"500 " + codeToMessages["500"], &States::idleState},
-      {"501 " + codeToMessages["501"], &States::idleState},
-      {"501 " + codeToMessages["501"], &States::idleState},
-      {"501 " + codeToMessages["501"], &States::idleState},
-      {"501 " + codeToMessages["501"], &States::idleState},
-      {"503 " + codeToMessages["503"], &States::idleState},
+  std::vector<std::pair<std::string, State>> expects{
+      {"250 " + codeToMessages["250"], State::Idle},
+      {"250 " + codeToMessages["250"], State::Idle},
+      {"221 " + codeToMessages["221"], State::Idle},
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"500 " + codeToMessages["500"], State::Idle},
+      {"500 " + codeToMessages["500"], State::Idle},
+      {"501 " + codeToMessages["501"], State::Idle},
+      {"501 " + codeToMessages["501"], State::Idle},
+      {"501 " + codeToMessages["501"], State::Idle},
+      {"501 " + codeToMessages["501"], State::Idle},
+      {"503 " + codeToMessages["503"], State::Idle},
+      {"503 " + codeToMessages["503"], State::Idle},
   };
 
   for (int i = 0; i < tests.size(); ++i) {
-    auto state = std::make_unique<IdleState>();
-    std::unique_ptr<State> *current = &States::idleState;
-    std::string result = state->transitive(tests[i], current);
-    EXPECT_EQ(result, expects[i].first);
+    State current = State::Idle;
+    Step step = StateMachine::transitive(tests[i], current);
+    EXPECT_EQ(StateMachine::reply(step.reply), expects[i].first);
     EXPECT_EQ(current, expects[i].second);
   }
 }
 
 TEST(State, EhloStateTransitive) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"RSET"},
       {"NOOP"},
       {"QUIT"},
@@ -178,31 +174,34 @@ TEST(State, EhloStateTransitive) {
       {"DATA"},
       {"."},
       {"RCPT"},
+      {"STARTTLS"},
+      {"STARTTLS", "now"},
   };
 
-  std::vector<std::pair<std::string, std::unique_ptr<State> *>> expects{
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"221 " + codeToMessages["221"], &States::idleState},
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"250 " + codeToMessages["250"], &States::mailState},
-      {"500 " + codeToMessages["500"], &States::ehloState},
-      {"503 " + codeToMessages["503"], &States::ehloState},
-      {"503 " + codeToMessages["503"], &States::ehloState},
-      {"503 " + codeToMessages["503"], &States::ehloState},
+  std::vector<std::pair<std::string, State>> expects{
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"221 " + codeToMessages["221"], State::Idle},
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"250 " + codeToMessages["250"], State::Mail},
+      {"500 " + codeToMessages["500"], State::Ehlo},
+      {"503 " + codeToMessages["503"], State::Ehlo},
+      {"503 " + codeToMessages["503"], State::Ehlo},
+      {"503 " + codeToMessages["503"], State::Ehlo},
+      {"220 Ready to start TLS", State::Idle},
+      {"501 " + codeToMessages["501"], State::Ehlo},
   };
 
   for (int i = 0; i < tests.size(); ++i) {
-    auto state = std::make_unique<EhloState>();
-    std::unique_ptr<State> *current = &States::ehloState;
-    std::string result = state->transitive(tests[i], current);
-    EXPECT_EQ(result, expects[i].first);
+    State current = State::Ehlo;
+    Step step = StateMachine::transitive(tests[i], current);
+    EXPECT_EQ(StateMachine::reply(step.reply), expects[i].first);
     EXPECT_EQ(current, expects[i].second);
   }
 }
 
 TEST(State, MailStateTransitive) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"RSET"},
       {"NOOP"},
       {"QUIT"},
@@ -213,28 +212,27 @@ TEST(State, MailStateTransitive) {
       {"."},
   };
 
-  std::vector<std::pair<std::string, std::unique_ptr<State> *>> expects{
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"250 " + codeToMessages["250"], &States::mailState},
-      {"221 " + codeToMessages["221"], &States::idleState},
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"250 " + codeToMessages["250"], &States::rcptState},
-      {"503 " + codeToMessages["503"], &States::mailState},
-      {"503 " + codeToMessages["503"], &States::mailState},
-      {"503 " + codeToMessages["503"], &States::mailState},
+  std::vector<std::pair<std::string, State>> expects{
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"250 " + codeToMessages["250"], State::Mail},
+      {"221 " + codeToMessages["221"], State::Idle},
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"250 " + codeToMessages["250"], State::Rcpt},
+      {"503 " + codeToMessages["503"], State::Mail},
+      {"503 " + codeToMessages["503"], State::Mail},
+      {"503 " + codeToMessages["503"], State::Mail},
   };
 
   for (int i = 0; i < tests.size(); ++i) {
-    auto state = std::make_unique<MailState>();
-    std::unique_ptr<State> *current = &States::mailState;
-    std::string result = state->transitive(tests[i], current);
-    EXPECT_EQ(result, expects[i].first);
+    State current = State::Mail;
+    Step step = StateMachine::transitive(tests[i], current);
+    EXPECT_EQ(StateMachine::reply(step.reply), expects[i].first);
     EXPECT_EQ(current, expects[i].second);
   }
 }
 
 TEST(State, RCPTStateTransitive) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"RSET"},
       {"NOOP"},
       {"QUIT"},
@@ -245,28 +243,27 @@ TEST(State, RCPTStateTransitive) {
       {"."},
   };
 
-  std::vector<std::pair<std::string, std::unique_ptr<State> *>> expects{
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"250 " + codeToMessages["250"], &States::rcptState},
-      {"221 " + codeToMessages["221"], &States::idleState},
-      {"250 " + codeToMessages["250"], &States::ehloState},
-      {"250 " + codeToMessages["250"], &States::rcptState},
-      {"503 " + codeToMessages["503"], &States::rcptState},
-      {"250 " + codeToMessages["250"], &States::dataStartState},
-      {"503 " + codeToMessages["503"], &States::rcptState},
+  std::vector<std::pair<std::string, State>> expects{
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"250 " + codeToMessages["250"], State::Rcpt},
+      {"221 " + codeToMessages["221"], State::Idle},
+      {"250 " + codeToMessages["250"], State::Ehlo},
+      {"250 " + codeToMessages["250"], State::Rcpt},
+      {"503 " + codeToMessages["503"], State::Rcpt},
+      {"250 " + codeToMessages["250"], State::DataStart},
+      {"503 " + codeToMessages["503"], State::Rcpt},
   };
 
   for (int i = 0; i < tests.size(); ++i) {
-    auto state = std::make_unique<RcptState>();
-    std::unique_ptr<State> *current = &States::rcptState;
-    std::string result = state->transitive(tests[i], current);
-    EXPECT_EQ(result, expects[i].first);
+    State current = State::Rcpt;
+    Step step = StateMachine::transitive(tests[i], current);
+    EXPECT_EQ(StateMachine::reply(step.reply), expects[i].first);
     EXPECT_EQ(current, expects[i].second);
   }
 }
 
 TEST(State, DataStartStateTransitive) {
-  std::vector<std::vector<std::string>> tests{
+  std::vector<Parameters> tests{
       {"RSET"},
       {"RSET", "1"},
       {"NOOP"},
@@ -281,26 +278,52 @@ TEST(State, DataStartStateTransitive) {
       {"."},
   };
 
-  std::vector<std::pair<std::string, std::unique_ptr<State> *>> expects{
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"354 " + codeToMessages["354"], &States::dataStartState},
-      {"250 " + codeToMessages["250"], &States::dataDoneState},
+  std::vector<std::pair<std::string, State>> expects{
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"354 " + codeToMessages["354"], State::DataStart},
+      {"250 " + codeToMessages["250"], State::DataDone},
   };
 
   for (int i = 0; i < tests.size(); ++i) {
-    auto state = std::make_unique<DataStartState>();
-    std::unique_ptr<State> *current = &States::dataStartState;
-    std::string result = state->transitive(tests[i], current);
-    EXPECT_EQ(result, expects[i].first);
+    State current = State::DataStart;
+    Step step = StateMachine::transitive(tests[i], current);
+    EXPECT_EQ(StateMachine::reply(step.reply), expects[i].first);
+    EXPECT_EQ(current, expects[i].second);
+  }
+}
+
+TEST(State, RCPTLocalRecipients) {
+  std::string path = "/tmp/stateTest.recipients." + std::to_string(::getpid()) + ".idx";
+  RecipientIndex::build({"shejialuo@gmail.com"}, path);
+  RecipientDirectory directory{path};
+  // The mapping outlives the file, which is gone whatever the test does next
+  std::remove(path.c_str());
+
+  std::vector<Parameters> tests{
+      {"RCPT", "shejialuo@gmail.com"},
+      {"RCPT", "nobody@gmail.com"},
+      {"RCPT", "nobody@gmail"},
+  };
+
+  std::vector<std::pair<std::string, State>> expects{
+      {"250 " + codeToMessages["250"], State::Rcpt},
+      {"550 " + codeToMessages["550"], State::Mail},
+      {"501 " + codeToMessages["501"], State::Mail},
+  };
+
+  for (size_t i = 0; i < tests.size(); ++i) {
+    State current = State::Mail;
+    Step step = StateMachine::transitive(tests[i], current, &directory);
+    EXPECT_EQ(StateMachine::reply(step.reply), expects[i].first);
     EXPECT_EQ(current, expects[i].second);
   }
 }
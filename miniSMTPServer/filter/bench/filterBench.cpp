@@ -0,0 +1,128 @@
+#include "filterPipeline.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "socket.hpp"
+#include "spool.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// What a scanner costs, spent on the CPU rather than asleep
+static constexpr std::chrono::microseconds scanTime{20000};
+
+static FilterStage scanner() {
+  return FilterStage{"scanner", [](const FilterMessage &) {
+                       auto start = std::chrono::steady_clock::now();
+                       while (std::chrono::steady_clock::now() - start < scanTime) {
+                       }
+                       return Verdict::Reject;
+                     }};
+}
+
+static std::pair<TCPSocket, TCPSocket> pair() {
+  int fds[2];
+  SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+  return {TCPSocket{FileDescriptor{fds[0]}}, TCPSocket{FileDescriptor{fds[1]}}};
+}
+
+// Read from `socket` until a reply starting with `code` came
+static void await(TCPSocket &socket, const std::string &code) {
+  std::string replies = "\n";
+  while (replies.find("\n" + code) == std::string::npos && !socket.eof()) {
+    replies += socket.read(512);
+  }
+}
+
+/**
+ * @brief A server with its own thread, serving a client which keeps sending
+ * messages the scanner rejects, and a probe.
+ *
+ */
+class Server {
+private:
+  std::string directory = "/tmp/filterBench." + std::to_string(::getpid());
+  std::atomic<bool> stopping{false};
+  std::thread server{};
+  std::thread sender{};
+
+  static void serve(const std::string &directory, size_t threads, TCPSocket busy, TCPSocket probe) {
+    Spool spool{directory};
+    Scheduler scheduler{};
+    std::vector<FilterStage> stages{};
+    stages.push_back(scanner());
+    FilterPipeline filters{scheduler, std::move(stages), threads, 10s};
+    scheduler.spawn(session(scheduler, std::move(busy), &spool, nullptr, nullptr, &filters));
+    scheduler.spawn(session(scheduler, std::move(probe), &spool, nullptr, nullptr, &filters));
+    scheduler.run();
+  }
+
+  static void send(TCPSocket client, std::atomic<bool> &stopping) {
+    client.write("EHLO 127.0.0.1\r\n");
+    while (!stopping.load()) {
+      client.write("MAIL FROM:<a@example.com>\r\nRCPT TO:<b@example.com>\r\nDATA\r\n"
+                   "From: a@example.com\r\nSubject: offer\r\n\r\nbuy now\r\n.\r\n");
+      await(client, "550");
+      // A client sending its next message at once would be read before the
+      // session ever suspends, and keep the loop from the probe altogether
+      std::this_thread::sleep_for(1ms);
+    }
+    client.write("QUIT\r\n");
+    await(client, "221");
+  }
+
+public:
+  TCPSocket probe{};
+
+  explicit Server(size_t threads) {
+    auto [busyClient, busyServer] = pair();
+    auto [probeClient, probeServer] = pair();
+    probe = std::move(probeClient);
+    server = std::thread{serve, directory, threads, std::move(busyServer), std::move(probeServer)};
+    sender = std::thread{send, std::move(busyClient), std::ref(stopping)};
+
+    probe.write("EHLO 127.0.0.1\r\n");
+    await(probe, "250 ");
+  }
+
+  ~Server() {
+    stopping = true;
+    probe.write("QUIT\r\n");
+    await(probe, "221");
+    sender.join();
+    server.join();
+    std::filesystem::remove_all(directory);
+  }
+};
+
+// How long a NOOP waits for its reply while another session's messages are
+// being scanned, with the scanner inline (0) or on workers
+static void BM_NoopWhileScanning(benchmark::State &state) {
+  Server server{static_cast<size_t>(state.range(0))};
+  std::vector<double> latencies{};
+  for (auto _ : state) {
+    auto start = std::chrono::steady_clock::now();
+    server.probe.write("NOOP\r\n");
+    await(server.probe, "250");
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    state.SetIterationTime(elapsed.count());
+    latencies.push_back(elapsed.count());
+    // Let the scans go on between the probes
+    std::this_thread::sleep_for(1ms);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  state.counters["p99_ms"] = latencies[latencies.size() * 99 / 100] * 1000;
+  state.counters["max_ms"] = latencies.back() * 1000;
+}
+BENCHMARK(BM_NoopWhileScanning)->Arg(0)->Arg(2)->UseManualTime()->Iterations(300)->Unit(benchmark::kMicrosecond);
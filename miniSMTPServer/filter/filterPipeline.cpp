@@ -0,0 +1,169 @@
+#include "filterPipeline.hpp"
+
+#include <bit>
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <utility>
+
+void FilterStats::record(std::chrono::microseconds latency) {
+  const uint64_t micros = static_cast<uint64_t>(latency.count());
+  calls.fetch_add(1, std::memory_order_relaxed);
+  totalMicros.fetch_add(micros, std::memory_order_relaxed);
+  uint64_t max = maxMicros.load(std::memory_order_relaxed);
+  while (micros > max && !maxMicros.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {
+  }
+  buckets[std::min<size_t>(std::bit_width(micros), bucketCount - 1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::chrono::microseconds FilterStats::percentile(double fraction) const {
+  uint64_t total = 0;
+  for (const auto &bucket : buckets) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen > 0 && static_cast<double>(seen) >= fraction * static_cast<double>(total)) {
+      return std::chrono::microseconds{uint64_t{1} << i};
+    }
+  }
+  return std::chrono::microseconds{0};
+}
+
+/**
+ * @brief Where a verdict meets the session waiting for it.
+ *
+ * @details Only touched on the event loop: the worker posts its verdict
+ * there, and the deadline fires there, so whichever comes first wins
+ * without a lock.
+ */
+struct FilterPipeline::Pending {
+  Scheduler *scheduler;
+  std::optional<Verdict> verdict{};
+  std::coroutine_handle<> waiter{};
+
+  //! Settle on `result` unless a verdict is in already, false then
+  bool settle(Verdict result) {
+    if (verdict.has_value()) {
+      return false;
+    }
+    verdict = result;
+    if (waiter) {
+      scheduler->resume(std::exchange(waiter, nullptr));
+    }
+    return true;
+  }
+};
+
+//! Suspends the session until its `Pending` is settled
+struct FilterPipeline::Settled {
+  std::shared_ptr<Pending> pending;
+
+  bool await_ready() const noexcept { return pending->verdict.has_value(); }
+  void await_suspend(std::coroutine_handle<> handle) noexcept { pending->waiter = handle; }
+  Verdict await_resume() const noexcept { return pending->verdict.value(); }
+
+  // A session destroyed while it waits, e.g. at the end of a drain, must not be resumed
+  ~Settled() { pending->waiter = nullptr; }
+};
+
+FilterPipeline::FilterPipeline(Scheduler &s,
+                               std::vector<FilterStage> f,
+                               size_t threads,
+                               std::chrono::milliseconds d,
+                               size_t capacity)
+    : scheduler{s}
+    , stages{std::move(f)}
+    , deadline{d}
+    , pool{threads, capacity} {
+  for (size_t i = 0; i < stages.size(); ++i) {
+    stats.push_back(std::make_unique<FilterStats>());
+  }
+}
+
+Verdict FilterPipeline::run(const FilterMessage &message) {
+  for (size_t i = 0; i < stages.size(); ++i) {
+    FilterStats &stage = *stats[i];
+    const auto start = std::chrono::steady_clock::now();
+    Verdict verdict = Verdict::Defer;
+    try {
+      verdict = stages[i].check(message);
+    } catch (const std::exception &e) {
+      stage.failed.fetch_add(1, std::memory_order_relaxed);
+      std::cerr << "Filter " << stages[i].name << " failed on " << message.id << ": " << e.what() << std::endl;
+    }
+    stage.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+
+    if (verdict == Verdict::Reject) {
+      stage.rejected.fetch_add(1, std::memory_order_relaxed);
+      return verdict;
+    }
+    if (verdict == Verdict::Defer) {
+      stage.deferred.fetch_add(1, std::memory_order_relaxed);
+      return verdict;
+    }
+  }
+  return Verdict::Accept;
+}
+
+Task<Verdict> FilterPipeline::check(std::shared_ptr<const FilterMessage> message) {
+  if (stages.empty()) {
+    co_return Verdict::Accept;
+  }
+  if (pool.size() == 0) {
+    co_return run(*message);
+  }
+
+  std::shared_ptr<Pending> pending = dispatch(std::move(message));
+  if (pending == nullptr) {
+    co_return Verdict::Defer;
+  }
+  // A named awaiter, GCC 12 destroys a temporary one in `co_await` twice
+  Settled settled{std::move(pending)};
+  co_return co_await settled;
+}
+
+std::shared_ptr<FilterPipeline::Pending> FilterPipeline::dispatch(std::shared_ptr<const FilterMessage> message) {
+  auto pending = std::make_shared<Pending>(Pending{&scheduler});
+  bool queued = pool.submit([this, message, pending] {
+    Verdict verdict = run(*message);
+    scheduler.post([pending, verdict] { pending->settle(verdict); });
+  });
+  if (!queued) {
+    overloaded.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  scheduler.after(deadline, [this, pending] {
+    if (pending->settle(Verdict::Defer)) {
+      late.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+  return pending;
+}
+
+std::string FilterPipeline::report() const {
+  std::ostringstream out{};
+  for (size_t i = 0; i < stages.size(); ++i) {
+    const FilterStats &stage = *stats[i];
+    const uint64_t calls = stage.calls.load();
+    out << "Filter " << stages[i].name << ": " << calls << " calls, " << stage.rejected.load() << " rejected, "
+        << stage.deferred.load() << " deferred, " << stage.failed.load() << " failed, mean "
+        << (calls == 0 ? 0 : stage.totalMicros.load() / calls) << " us, p50 < " << stage.percentile(0.5).count()
+        << " us, p99 < " << stage.percentile(0.99).count() << " us, max " << stage.maxMicros.load() << " us\n";
+  }
+  out << "Filters: " << late.load() << " messages deferred at the deadline, " << overloaded.load()
+      << " with every worker busy\n";
+  return out.str();
+}
+
+FilterStage requiredHeaders() {
+  return FilterStage{"required-headers", [](const FilterMessage &message) {
+                       const bool complete = message.headers.find(Header::Date).has_value() &&
+                                             message.headers.find(Header::From).has_value();
+                       return complete ? Verdict::Accept : Verdict::Reject;
+                     }};
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "headerIndex.hpp"
+#include "scheduler.hpp"
+#include "spool.hpp"
+#include "task.hpp"
+#include "workerPool.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief What a content filter decides about a message.
+ *
+ */
+enum class Verdict : uint8_t {
+  Accept,  //!< 250, on to the next filter, or into the spool after the last one
+  Reject,  //!< 550, the client should not send it again
+  Defer,   //!< 451, the client may try again later
+};
+
+/**
+ * @brief A message at the end of DATA, as the filters see it.
+ *
+ * @details It owns everything a filter reads, so a filter still running
+ * when the deadline has passed reads nothing the session has freed. The body
+ * is complete in `body`, which may be gone by then.
+ */
+struct FilterMessage {
+  std::string id{};         //!< The id the message will be queued under
+  Envelope envelope{};      //!< The sender and the recipients
+  HeaderIndex headers{};    //!< The header fields of the message
+  std::string body{};       //!< The path of the body, which starts with `traceLength` bytes of trace fields
+  size_t traceLength = 0;   //!< Bytes of the Received field the server put before the message
+  bool compressed = false;  //!< Whether the spool compresses `body`, then read it with `Spool::open`
+};
+
+/**
+ * @brief One stage of the pipeline, e.g. a signature check, a scanner or a policy script.
+ *
+ * @details `check` runs on a worker thread, for several messages at once,
+ * so it must be thread-safe. An exception it throws defers the message.
+ */
+struct FilterStage {
+  std::string name{};  //!< For the metrics and the logs
+  std::function<Verdict(const FilterMessage &)> check{};
+};
+
+/**
+ * @brief The latencies and verdicts of one stage, updated by the workers.
+ *
+ */
+struct FilterStats {
+  //! Latencies are counted in buckets of powers of two microseconds
+  static constexpr size_t bucketCount = 32;
+
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> rejected{0};
+  std::atomic<uint64_t> deferred{0};
+  std::atomic<uint64_t> failed{0};  //!< Calls which threw
+  std::atomic<uint64_t> totalMicros{0};
+  std::atomic<uint64_t> maxMicros{0};
+  std::array<std::atomic<uint64_t>, bucketCount> buckets{};  //!< Bucket i counts latencies below 2^i us
+
+  void record(std::chrono::microseconds latency);
+
+  //! The latency `fraction` of the calls stayed below, as a bucket bound
+  std::chrono::microseconds percentile(double fraction) const;
+};
+
+/**
+ * @brief Runs the content filters at the end of DATA, off the event loop.
+ *
+ * @details The stages run in order on a `WorkerPool`, for one message on
+ * one worker, and stop at the first verdict that is not `Verdict::Accept`.
+ * The session awaiting `check` is suspended meanwhile, the scheduler serves
+ * the other sessions, and the worker posts the verdict back to it.
+ *
+ * A message whose verdict is not in by `deadline` is deferred, and so is one
+ * arriving while the pool has `capacity` messages waiting already. The
+ * stages left running finish on their worker and their verdict is dropped.
+ *
+ * The pipeline must outlive the `Scheduler::run` its sessions are served by.
+ */
+class FilterPipeline {
+private:
+  struct Pending;
+  struct Settled;
+
+  Scheduler &scheduler;
+  std::vector<FilterStage> stages;
+  std::chrono::milliseconds deadline;
+  std::vector<std::unique_ptr<FilterStats>> stats{};  //!< One per stage
+  std::atomic<uint64_t> late{0};                      //!< Messages deferred at the deadline
+  std::atomic<uint64_t> overloaded{0};                //!< Messages deferred with the pool full
+  WorkerPool pool;                                    //!< Last, so its workers stop first
+
+  //! Run the stages on `message`, on the calling thread
+  Verdict run(const FilterMessage &message);
+
+  //! Queue `message` on the pool and arm its deadline, nullptr if the pool is full
+  std::shared_ptr<Pending> dispatch(std::shared_ptr<const FilterMessage> message);
+
+public:
+  /**
+   * @brief Run `stages` on `threads` workers.
+   *
+   * @param[in] scheduler the scheduler of the sessions awaiting the verdicts
+   * @param[in] stages the filters, in the order they run in
+   * @param[in] threads the workers, 0 runs the filters on the event loop, which stalls it
+   * @param[in] deadline how long a message may wait for its verdict
+   * @param[in] capacity how many messages may wait for a worker
+   */
+  FilterPipeline(Scheduler &scheduler,
+                 std::vector<FilterStage> stages,
+                 size_t threads,
+                 std::chrono::milliseconds deadline,
+                 size_t capacity = 1024);
+
+  /**
+   * @brief The verdict on `message`.
+   *
+   * @param[in] message the message at the end of DATA
+   * @return Task<Verdict> the first verdict that is not `Verdict::Accept`, or
+   * `Verdict::Defer` when it is not in by the deadline
+   */
+  Task<Verdict> check(std::shared_ptr<const FilterMessage> message);
+
+  //! The metrics of stage `index`
+  const FilterStats &statistics(size_t index) const { return *stats[index]; }
+
+  //! Number of messages deferred because their verdict missed the deadline
+  uint64_t missedDeadlines() const { return late.load(); }
+
+  //! One line per stage with its calls, verdicts and latencies, then the deferrals
+  std::string report() const;
+};
+
+/**
+ * @brief A stage rejecting messages without the Date or From field, which RFC 5322 requires.
+ *
+ */
+FilterStage requiredHeaders();
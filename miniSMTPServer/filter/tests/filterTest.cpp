@@ -0,0 +1,145 @@
+#include "filterPipeline.hpp"
+#include "scheduler.hpp"
+#include "task.hpp"
+#include "workerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+TEST(WorkerPool, idleWorkersStealFromABusyOne) {
+  std::promise<void> release{};
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<int> done{0};
+  {
+    WorkerPool pool{2, 64};
+    // Blocks the first worker, half of the jobs after it are dealt to its queue
+    ASSERT_TRUE(pool.submit([released] { released.wait(); }));
+    for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(pool.submit([&done] { ++done; }));
+    }
+
+    auto waited = std::chrono::steady_clock::now();
+    while (done.load() < 10 && std::chrono::steady_clock::now() - waited < 5s) {
+      std::this_thread::sleep_for(1ms);
+    }
+    EXPECT_EQ(done.load(), 10);
+    release.set_value();
+  }
+}
+
+TEST(WorkerPool, refusesJobsBeyondItsCapacity) {
+  std::promise<void> release{};
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<bool> started{false};
+  std::atomic<int> done{0};
+  {
+    WorkerPool pool{1, 2};
+    ASSERT_TRUE(pool.submit([&started, released] {
+      started = true;
+      released.wait();
+    }));
+    while (!started.load()) {
+      std::this_thread::yield();
+    }
+    EXPECT_TRUE(pool.submit([&done] { ++done; }));
+    EXPECT_TRUE(pool.submit([&done] { ++done; }));
+    EXPECT_FALSE(pool.submit([&done] { ++done; }));
+    release.set_value();
+  }
+  // The waiting jobs ran before the pool went away
+  EXPECT_EQ(done.load(), 2);
+}
+
+static std::shared_ptr<const FilterMessage> message(const std::string &subject) {
+  auto result = std::make_shared<FilterMessage>();
+  result->id = subject;
+  result->headers.append("Subject: " + subject + "\r\n\r\n");
+  return result;
+}
+
+static Task<> collect(FilterPipeline &filters,
+                      std::shared_ptr<const FilterMessage> message,
+                      std::vector<std::pair<std::string, Verdict>> &verdicts) {
+  Verdict verdict = co_await filters.check(message);
+  verdicts.emplace_back(message->id, verdict);
+}
+
+TEST(FilterPipeline, verdictsComeBackToTheLoop) {
+  std::vector<FilterStage> stages{};
+  stages.push_back(FilterStage{"subject", [](const FilterMessage &message) {
+                                 return message.headers.find(Header::Subject) == "spam" ? Verdict::Reject
+                                                                                         : Verdict::Accept;
+                               }});
+  stages.push_back(FilterStage{"slow", [](const FilterMessage &message) {
+                                 if (message.id == "slow") {
+                                   std::this_thread::sleep_for(300ms);
+                                 }
+                                 if (message.id == "broken") {
+                                   throw std::runtime_error("cannot scan");
+                                 }
+                                 return Verdict::Accept;
+                               }});
+
+  Scheduler scheduler{};
+  FilterPipeline filters{scheduler, std::move(stages), 2, 100ms};
+  std::vector<std::pair<std::string, Verdict>> verdicts{};
+  for (const char *subject : {"slow", "spam", "ham", "broken"}) {
+    scheduler.spawn(collect(filters, message(subject), verdicts));
+  }
+  scheduler.run();
+
+  // The slow one did not hold the others up, and missed the deadline
+  ASSERT_EQ(verdicts.size(), 4);
+  EXPECT_EQ(verdicts.back(), std::make_pair(std::string{"slow"}, Verdict::Defer));
+  std::sort(verdicts.begin(), verdicts.end() - 1);
+  EXPECT_EQ(verdicts[0], std::make_pair(std::string{"broken"}, Verdict::Defer));
+  EXPECT_EQ(verdicts[1], std::make_pair(std::string{"ham"}, Verdict::Accept));
+  EXPECT_EQ(verdicts[2], std::make_pair(std::string{"spam"}, Verdict::Reject));
+  EXPECT_EQ(filters.missedDeadlines(), 1);
+
+  EXPECT_EQ(filters.statistics(0).calls.load(), 4);
+  EXPECT_EQ(filters.statistics(0).rejected.load(), 1);
+  // The slow call is still running
+  EXPECT_GE(filters.statistics(1).calls.load(), 2);
+  EXPECT_EQ(filters.statistics(1).failed.load(), 1);
+  EXPECT_EQ(filters.statistics(1).deferred.load(), 1);
+}
+
+TEST(FilterPipeline, latencyPercentiles) {
+  FilterStats stats{};
+  for (int i = 0; i < 98; ++i) {
+    stats.record(3us);
+  }
+  stats.record(1000us);
+  stats.record(70000us);
+
+  EXPECT_EQ(stats.percentile(0.5), 4us);
+  EXPECT_EQ(stats.percentile(0.99), 1024us);
+  EXPECT_EQ(stats.maxMicros.load(), 70000);
+  EXPECT_EQ(stats.totalMicros.load(), 98 * 3 + 1000 + 70000);
+}
+
+TEST(FilterPipeline, requiredHeaders) {
+  FilterStage stage = requiredHeaders();
+  FilterMessage message{};
+  message.headers.append("From: a@example.com\r\n");
+  message.headers.append("\r\n");
+  EXPECT_EQ(stage.check(message), Verdict::Reject);
+
+  FilterMessage dated{};
+  dated.headers.append("From: a@example.com\r\n");
+  dated.headers.append("Date: Mon, 19 Oct 2026 06:06:00 +0000\r\n");
+  dated.headers.append("\r\n");
+  EXPECT_EQ(stage.check(dated), Verdict::Accept);
+}
@@ -0,0 +1,78 @@
+#include "workerPool.hpp"
+
+#include <utility>
+
+WorkerPool::WorkerPool(size_t count, size_t c) : capacity{c} {
+  for (size_t i = 0; i < count; ++i) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (size_t i = 0; i < count; ++i) {
+    threads.emplace_back([this, i] { work(i); });
+  }
+}
+
+bool WorkerPool::take(size_t self, Job &job) {
+  for (size_t i = 0; i < queues.size(); ++i) {
+    Queue &queue = *queues[(self + i) % queues.size()];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.jobs.empty()) {
+      continue;
+    }
+    // The oldest of our own jobs, the newest of someone else's
+    if (i == 0) {
+      job = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+    } else {
+      job = std::move(queue.jobs.back());
+      queue.jobs.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void WorkerPool::work(size_t self) {
+  while (true) {
+    Job job{};
+    if (take(self, job)) {
+      waiting.fetch_sub(1);
+      job();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock{sleeping};
+    // A job counted but not queued yet keeps us spinning for that short while
+    wakeup.wait(lock, [this] { return stopping || waiting.load() > 0; });
+    if (stopping && waiting.load() == 0) {
+      return;
+    }
+  }
+}
+
+bool WorkerPool::submit(Job job) {
+  if (waiting.fetch_add(1) >= capacity) {
+    waiting.fetch_sub(1);
+    return false;
+  }
+
+  Queue &queue = *queues[next.fetch_add(1) % queues.size()];
+  {
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    queue.jobs.push_back(std::move(job));
+  }
+  // A worker about to wait either sees the job counted or gets the signal
+  { std::lock_guard<std::mutex> lock{sleeping}; }
+  wakeup.notify_one();
+  return true;
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock{sleeping};
+    stopping = true;
+  }
+  wakeup.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed set of threads running jobs, with a bound on the jobs waiting.
+ *
+ * @details Every worker has its own queue, and jobs are dealt to the queues
+ * in turn. A worker takes the oldest job of its own queue, and when that is
+ * empty steals the newest one of another queue, so a job never waits behind
+ * a slow one while a worker is idle. Workers only contend on a queue when
+ * one of them is stealing.
+ *
+ * At most `capacity` jobs wait at once, `submit` refuses the others so the
+ * caller can shed load instead of queueing without bound.
+ */
+class WorkerPool {
+public:
+  using Job = std::function<void()>;
+
+private:
+  struct Queue {
+    std::mutex mutex{};
+    std::deque<Job> jobs{};
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues{};  //!< One per worker
+  size_t capacity;
+  std::atomic<size_t> waiting{0};  //!< Jobs submitted and not taken yet
+  std::atomic<size_t> next{0};     //!< The queue the next job is dealt to
+
+  std::mutex sleeping{};             //!< Guards `stopping`, and the waits for new jobs
+  std::condition_variable wakeup{};  //!< Signalled when a job is submitted or the pool stops
+  bool stopping = false;
+  std::vector<std::thread> threads{};
+
+  bool take(size_t self, Job &job);
+  void work(size_t self);
+
+public:
+  /**
+   * @brief Start `threads` workers.
+   *
+   * @param[in] threads how many jobs run at once
+   * @param[in] capacity how many jobs may wait
+   */
+  WorkerPool(size_t threads, size_t capacity);
+
+  /**
+   * @brief Run `job` on a worker.
+   *
+   * @param[in] job what to run, it must not throw
+   * @return bool false if `capacity` jobs are waiting already, `job` is not run then
+   */
+  bool submit(Job job);
+
+  //! Number of workers
+  size_t size() const { return threads.size(); }
+
+  //! Run the jobs still waiting, then stop the workers
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &other) = delete;
+  WorkerPool &operator=(const WorkerPool &other) = delete;
+};
@@ -1,65 +1,182 @@
+#include "config.hpp"
+#include "asyncSocket.hpp"
 #include "context.hpp"
+#include "filterPipeline.hpp"
+#include "handover.hpp"
+#include "mailboxes.hpp"
+#include "recipientIndex.hpp"
+#include "relayEngine.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
 #include "socket.hpp"
+#include "spool.hpp"
+#include "tlsContext.hpp"
+#include "transcript.hpp"
 
+#include <chrono>
+#include <csignal>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
-std::vector<std::string> getParameters(std::string &request) {
-  request.pop_back();
-  request.pop_back();
-  int split = 0;
-  for (; split < request.size(); split++) {
-    if (request[split] == ' ') {
-      break;
+/**
+ * @brief Hand the listening socket over to the next process, then drain.
+ *
+ */
+static Task<> restart(Scheduler &scheduler,
+                      const Config &config,
+                      AsyncSocket &listener,
+                      std::unique_ptr<RelayEngine> &relay,
+                      std::optional<UnixSocket> &successor) {
+  // The new process relays from now on, including what we accept while
+  // draining. Stopping waits for the deliveries in progress, off the loop
+  std::function<void()> release = [&relay] {
+    if (relay) {
+      relay->stop();
     }
-  }
+  };
+  successor = co_await handover(scheduler, config.handover, std::vector<int>(1, listener.fd_num()), release);
 
-  std::string command = request.substr(0, split);
-  if (split != request.size()) {
-    std::string parameter = request.substr(split + 1, request.size() - split - 1);
-    return {command, parameter};
-  }
+  listener.close();
+  scheduler.stopAt(std::chrono::steady_clock::now() + std::chrono::seconds{config.drain});
+  std::cout << "Handed over to the new process, draining " << scheduler.running() - 1 << " sessions\n";
+}
 
-  return {command};
+/**
+ * @brief Wait for the process we took over from to exit, then relay what it left in the spool.
+ *
+ */
+static Task<> adopt(Scheduler &scheduler, UnixSocket control, std::unique_ptr<RelayEngine> &relay) {
+  AsyncSocket previous{scheduler, std::move(control)};
+  while ((co_await previous.read_line()).has_value()) {
+  }
+  if (relay) {
+    std::cout << "The previous process has exited, " << relay->rescan() << " more messages queued\n";
+  }
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  Config config = parseConfig(argc, argv);
+
+  // A client going away while we write to it must not kill the server
+  std::signal(SIGPIPE, SIG_IGN);
+
   std::cout << "Hello, This is a simple SMTP server\n";
 
-  TCPSocket socket{};
-  socket.set_reuseaddr();
-  socket.bind();
-  socket.listen();
-
-  std::string request{};
-  Context context{};
-
-  while (true) {
-    auto s = socket.accept();
-
-    bool isDone = false;
-    while (!isDone) {
-      s.read(request);
-      if (request.empty()) {
-        std::cout << "S: Connection lost\n";
-        s.close();
-        break;
-      }
-      std::cout << "C: " << request;
-      std::string parameter{};
-      std::vector<std::string> parameters = getParameters(request);
-
-      std::string result = context.transitive(parameters);
-
-      s.write(result + "\r\n");
-      std::cout << "S: " << result << std::endl;
-      if (result.substr(0, 3) == "221") {
-        s.close();
-        isDone = true;
-      }
+  std::unique_ptr<RecipientDirectory> recipients{};
+  if (!config.recipients.empty()) {
+    recipients = std::make_unique<RecipientDirectory>(config.recipients);
+    std::cout << "Accepting mail for " << recipients->snapshot()->size() << " local recipients\n";
+  }
+
+  std::unique_ptr<TlsContext> tls{};
+  if (!config.tlsCertificate.empty()) {
+    tls = std::make_unique<TlsContext>(
+        config.tlsCertificate, config.tlsKey, std::chrono::seconds{config.ticketRotation});
+    std::cout << "Offering STARTTLS with " << config.tlsCertificate << "\n";
+  }
+
+  // The previous process gives up its relay before handing over, so the
+  // relay starts after the takeover
+  std::optional<Takeover> previous{};
+  if (!config.handover.empty()) {
+    previous = takeover(config.handover);
+  }
+
+  // The previous process is still writing to the spool while it drains
+  std::unique_ptr<Spool> spool{};
+  if (!config.spool.empty()) {
+    spool = std::make_unique<Spool>(config.spool, !previous.has_value());
+    if (config.dedupWindow > 0) {
+      spool->deduplicate(std::chrono::seconds{config.dedupWindow});
+    }
+    if (config.compression > 0) {
+      spool->compress(static_cast<int>(config.compression), config.dictionary);
+      std::cout << "Compressing spooled bodies at level " << config.compression
+                << (config.dictionary.empty() ? "" : " with " + config.dictionary) << "\n";
+    }
+    if (config.catalog) {
+      spool->catalog();
+      std::cout << "Cataloging accepted messages in " << config.spool << "/catalog\n";
     }
   }
 
+  // Local delivery goes through the relay engine, with its retries
+  std::unique_ptr<Mailboxes> mailboxes{};
+  std::unique_ptr<RelayEngine> relay{};
+  if (!config.mailboxes.empty()) {
+    mailboxes = std::make_unique<Mailboxes>(config.mailboxes);
+    RelayOptions options{};
+    options.mailboxes = mailboxes.get();
+    relay = std::make_unique<RelayEngine>(*spool, options);
+    spool->committed = [&relay](const QueueRecord &record) { relay->enqueue(record); };
+    std::cout << "Delivering to the mailboxes in " << config.mailboxes << ", " << relay->queued()
+              << " messages queued\n";
+  } else if (!config.relay.empty()) {
+    RelayOptions options{};
+    options.nextHop.host = config.relay;
+    options.nextHop.port = config.relayPort;
+    options.helo = config.helo;
+    options.connections = config.relayConnections;
+    options.retry = std::chrono::seconds{config.relayRetry};
+    relay = std::make_unique<RelayEngine>(*spool, options);
+    spool->committed = [&relay](const QueueRecord &record) { relay->enqueue(record); };
+    std::cout << "Relaying to " << options.nextHop.name() << ", " << relay->queued() << " messages queued\n";
+  }
+
+  std::unique_ptr<Transcript> transcript{};
+  if (!config.capture.empty()) {
+    transcript = std::make_unique<Transcript>(config.capture);
+    std::cout << "Recording the sessions into " << config.capture << "\n";
+  }
+
+  // Every session is a coroutine on this thread, see `session`. What the
+  // sessions point to is declared above, it outlives the scheduler, which
+  // destroys the sessions still open when a drain ends
+  Scheduler scheduler{};
+  TCPSocket socket = previous.has_value() ? std::move(previous->listeners.front()) : listenOn(config.listen);
+  AsyncSocket listener{scheduler, std::move(socket)};
+
+  // The content filters run off the event loop, see `FilterPipeline`
+  std::vector<FilterStage> stages{};
+  if (config.requireHeaders) {
+    stages.push_back(requiredHeaders());
+  }
+  std::unique_ptr<FilterPipeline> filters{};
+  if (!stages.empty()) {
+    filters = std::make_unique<FilterPipeline>(
+        scheduler, std::move(stages), config.filterThreads, std::chrono::milliseconds{config.filterDeadline});
+    std::cout << "Filtering messages on " << config.filterThreads << " threads\n";
+  }
+
+  scheduler.spawn(acceptor(scheduler,
+                           listener,
+                           spool.get(),
+                           &std::cout,
+                           tls.get(),
+                           filters.get(),
+                           transcript.get(),
+                           recipients.get()));
+
+  if (previous.has_value()) {
+    std::cout << "Took the listening socket over from the previous process\n";
+    scheduler.spawn(adopt(scheduler, std::move(previous->control), relay));
+  }
+
+  // Closed on exit, which tells the next process we are gone
+  std::optional<UnixSocket> successor{};
+  if (!config.handover.empty()) {
+    scheduler.spawn(restart(scheduler, config, listener, relay, successor));
+  }
+
+  scheduler.run();
+
+  if (filters) {
+    std::cout << filters->report();
+  }
   return 0;
 }
@@ -0,0 +1,54 @@
+#include "recipientIndex.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static constexpr int recipients = 4'000'000;
+
+static std::shared_ptr<const RecipientIndex> recipientIndex() {
+  static std::shared_ptr<const RecipientIndex> index = [] {
+    std::string path = "/tmp/recipientIndexBench." + std::to_string(::getpid()) + ".idx";
+    std::vector<std::string> addresses{};
+    addresses.reserve(recipients);
+    for (int i = 0; i < recipients; ++i) {
+      addresses.push_back("user" + std::to_string(i) + "@example.com");
+    }
+    RecipientIndex::build(std::move(addresses), path);
+    auto mapped = RecipientIndex::open(path);
+    std::remove(path.c_str());
+    return mapped;
+  }();
+  return index;
+}
+
+static std::vector<std::string> probes(int first) {
+  std::vector<std::string> result{};
+  for (int i = 0; i < 4096; ++i) {
+    // Spread the probes over the whole index so they miss the cache like real traffic
+    result.push_back("user" + std::to_string(first + (i * 7919) % recipients) + "@example.com");
+  }
+  return result;
+}
+
+static void BM_LookupHit(benchmark::State &state) {
+  auto index = recipientIndex();
+  auto addresses = probes(0);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index->contains(addresses[i++ & 4095]));
+  }
+}
+BENCHMARK(BM_LookupHit);
+
+static void BM_LookupMiss(benchmark::State &state) {
+  auto index = recipientIndex();
+  auto addresses = probes(recipients);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index->contains(addresses[i++ & 4095]));
+  }
+}
+BENCHMARK(BM_LookupMiss);
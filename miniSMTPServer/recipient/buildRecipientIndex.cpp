@@ -0,0 +1,53 @@
+#include "recipientIndex.hpp"
+
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Build a recipient index from a plain text list of addresses.
+ *
+ * @details The list holds one address per line. Surrounding whitespace, empty
+ * lines and lines starting with '#' are ignored. The index replaces the output
+ * file atomically, so it can be rebuilt while miniSMTP is running.
+ */
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <addresses.txt> <recipients.idx>\n";
+    return 1;
+  }
+
+  std::ifstream input{argv[1]};
+  if (!input) {
+    std::cerr << "Cannot open " << argv[1] << "\n";
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::string> addresses{};
+  std::string line{};
+  while (std::getline(input, line)) {
+    const auto begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos || line[begin] == '#') {
+      continue;
+    }
+    const auto end = line.find_last_not_of(" \t\r");
+    addresses.emplace_back(line, begin, end - begin + 1);
+  }
+
+  try {
+    RecipientIndex::build(std::move(addresses), argv[2]);
+    auto index = RecipientIndex::open(argv[2]);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "Indexed " << index->size() << " recipients into " << argv[2] << " in " << elapsed.count() << " ms\n";
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
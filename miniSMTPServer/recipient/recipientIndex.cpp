@@ -0,0 +1,287 @@
+#include "recipientIndex.hpp"
+
+#include "socket.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char magic[8] = {'M', 'S', 'M', 'T', 'P', 'R', 'C', 'P'};
+
+static constexpr uint32_t bloomHashes = 7;
+static constexpr uint64_t bloomBitsPerAddress = 10;
+
+static inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; }
+
+static inline uint64_t align8(uint64_t offset) { return (offset + 7) & ~uint64_t{7}; }
+
+static inline uint64_t bucketOf(uint64_t hash, uint64_t bucketBits) { return hash >> (64 - bucketBits); }
+
+static inline bool bloomContains(const uint64_t *bloom, uint64_t bloomBits, uint64_t hash) {
+  // Kirsch-Mitzenmacher: derive all the probes from two halves of one hash
+  const uint64_t h2 = (hash >> 32) | 1;
+  for (uint32_t i = 0; i < bloomHashes; ++i) {
+    uint64_t bit = (hash + i * h2) & (bloomBits - 1);
+    if (!(bloom[bit >> 6] & (uint64_t{1} << (bit & 63)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline void bloomInsert(uint64_t *bloom, uint64_t bloomBits, uint64_t hash) {
+  const uint64_t h2 = (hash >> 32) | 1;
+  for (uint32_t i = 0; i < bloomHashes; ++i) {
+    uint64_t bit = (hash + i * h2) & (bloomBits - 1);
+    bloom[bit >> 6] |= uint64_t{1} << (bit & 63);
+  }
+}
+
+uint64_t RecipientIndex::hash(std::string_view address) noexcept { return hashIgnoringCase(address); }
+
+RecipientIndex::RecipientIndex(const unsigned char *base, size_t length) : base{base}, length{length} {}
+
+RecipientIndex::~RecipientIndex() {
+  if (base != nullptr) {
+    ::munmap(const_cast<unsigned char *>(base), length);
+  }
+}
+
+std::shared_ptr<const RecipientIndex> RecipientIndex::open(const std::string &path) {
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_RDONLY | O_CLOEXEC))};
+
+  struct stat status;
+  SystemCall("fstat " + path, ::fstat(file.fd_num(), &status));
+  const auto size = static_cast<size_t>(status.st_size);
+  if (size < sizeof(RecipientIndexHeader)) {
+    throw std::runtime_error(path + ": too small to be a recipient index");
+  }
+
+  // Fault in the whole file now, so the first lookups do not pay for it
+  void *address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED | MAP_POPULATE, file.fd_num(), 0);
+  if (address == MAP_FAILED) {
+    throw unix_error("mmap " + path);
+  }
+
+  std::shared_ptr<RecipientIndex> index{new RecipientIndex(static_cast<const unsigned char *>(address), size)};
+
+  const auto *header = reinterpret_cast<const RecipientIndexHeader *>(index->base);
+  if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+    throw std::runtime_error(path + ": not a recipient index or an unsupported version");
+  }
+
+  if (header->bucketBits == 0 || header->bucketBits > 32 || header->bloomBits / 8 > size ||
+      header->count > size / sizeof(RecipientIndexEntry)) {
+    throw std::runtime_error(path + ": corrupted recipient index header");
+  }
+  const uint64_t directorySize = ((uint64_t{1} << header->bucketBits) + 1) * sizeof(uint32_t);
+  if (header->fileSize != size || header->bloomHashes != bloomHashes || header->bloomBits < 64 ||
+      (header->bloomBits & (header->bloomBits - 1)) != 0 ||
+      header->bloomOffset != align8(sizeof(RecipientIndexHeader)) ||
+      header->directoryOffset != header->bloomOffset + header->bloomBits / 8 ||
+      header->entriesOffset != align8(header->directoryOffset + directorySize) ||
+      header->stringsOffset != header->entriesOffset + header->count * sizeof(RecipientIndexEntry) ||
+      header->stringsOffset > size) {
+    throw std::runtime_error(path + ": corrupted recipient index header");
+  }
+
+  index->header = header;
+  index->bloom = reinterpret_cast<const uint64_t *>(index->base + header->bloomOffset);
+  index->directory = reinterpret_cast<const uint32_t *>(index->base + header->directoryOffset);
+  index->entries = reinterpret_cast<const RecipientIndexEntry *>(index->base + header->entriesOffset);
+  index->strings = reinterpret_cast<const char *>(index->base + header->stringsOffset);
+
+  // Check everything a lookup dereferences once here, so `contains` can trust the file
+  const uint64_t stringsSize = size - header->stringsOffset;
+  if (index->directory[uint64_t{1} << header->bucketBits] != header->count) {
+    throw std::runtime_error(path + ": corrupted recipient index directory");
+  }
+  for (uint64_t bucket = 0; bucket < (uint64_t{1} << header->bucketBits); ++bucket) {
+    if (index->directory[bucket] > index->directory[bucket + 1]) {
+      throw std::runtime_error(path + ": corrupted recipient index directory");
+    }
+  }
+  for (uint64_t i = 0; i < header->count; ++i) {
+    const RecipientIndexEntry &entry = index->entries[i];
+    if (uint64_t{entry.offset} + entry.length > stringsSize) {
+      throw std::runtime_error(path + ": corrupted recipient index entry");
+    }
+  }
+
+  return index;
+}
+
+void RecipientIndex::build(std::vector<std::string> addresses, const std::string &path) {
+  for (auto &address : addresses) {
+    std::transform(address.begin(), address.end(), address.begin(), lower);
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+  std::vector<std::pair<uint64_t, const std::string *>> hashed;
+  hashed.reserve(addresses.size());
+  for (const auto &address : addresses) {
+    hashed.emplace_back(hash(address), &address);
+  }
+  std::sort(hashed.begin(), hashed.end(), [](const auto &lhs, const auto &rhs) {
+    return lhs.first != rhs.first ? lhs.first < rhs.first : *lhs.second < *rhs.second;
+  });
+
+  RecipientIndexHeader header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.bloomHashes = bloomHashes;
+  header.count = hashed.size();
+  header.bloomBits = 64;
+  while (header.bloomBits < header.count * bloomBitsPerAddress) {
+    header.bloomBits <<= 1;
+  }
+  header.bucketBits = 1;
+  while (header.bucketBits < 32 && (uint64_t{1} << header.bucketBits) < header.count) {
+    ++header.bucketBits;
+  }
+
+  const uint64_t buckets = uint64_t{1} << header.bucketBits;
+  header.bloomOffset = align8(sizeof(RecipientIndexHeader));
+  header.directoryOffset = header.bloomOffset + header.bloomBits / 8;
+  header.entriesOffset = align8(header.directoryOffset + (buckets + 1) * sizeof(uint32_t));
+  header.stringsOffset = header.entriesOffset + header.count * sizeof(RecipientIndexEntry);
+
+  uint64_t stringsSize = 0;
+  for (const auto &address : addresses) {
+    stringsSize += address.size();
+  }
+  if (stringsSize > UINT32_MAX) {
+    throw std::runtime_error("too many addresses for a recipient index");
+  }
+  header.fileSize = header.stringsOffset + stringsSize;
+
+  std::vector<unsigned char> file(header.fileSize, 0);
+  std::memcpy(file.data(), &header, sizeof(header));
+  auto *bloom = reinterpret_cast<uint64_t *>(file.data() + header.bloomOffset);
+  auto *directory = reinterpret_cast<uint32_t *>(file.data() + header.directoryOffset);
+  auto *entries = reinterpret_cast<RecipientIndexEntry *>(file.data() + header.entriesOffset);
+  auto *strings = reinterpret_cast<char *>(file.data() + header.stringsOffset);
+
+  uint32_t offset = 0;
+  uint64_t bucket = 0;
+  for (uint64_t i = 0; i < hashed.size(); ++i) {
+    const auto &[h, address] = hashed[i];
+    bloomInsert(bloom, header.bloomBits, h);
+    for (; bucket <= bucketOf(h, header.bucketBits); ++bucket) {
+      directory[bucket] = static_cast<uint32_t>(i);
+    }
+    entries[i] = {h, offset, static_cast<uint32_t>(address->size())};
+    std::memcpy(strings + offset, address->data(), address->size());
+    offset += static_cast<uint32_t>(address->size());
+  }
+  for (; bucket <= buckets; ++bucket) {
+    directory[bucket] = static_cast<uint32_t>(hashed.size());
+  }
+
+  const std::string temporary = path + ".tmp";
+  {
+    FileDescriptor output{
+        SystemCall("open " + temporary, ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))};
+    for (size_t written = 0; written < file.size();) {
+      const size_t chunk = std::min<size_t>(file.size() - written, 1 << 30);
+      written += SystemCall("write " + temporary, ::write(output.fd_num(), file.data() + written, chunk));
+    }
+    SystemCall("fsync " + temporary, ::fsync(output.fd_num()));
+  }
+  SystemCall("rename " + temporary, ::rename(temporary.c_str(), path.c_str()));
+}
+
+bool RecipientIndex::contains(std::string_view address) const noexcept {
+  if (header->count == 0) {
+    return false;
+  }
+
+  const uint64_t h = hash(address);
+  if (!bloomContains(bloom, header->bloomBits, h)) {
+    return false;
+  }
+
+  const uint64_t bucket = bucketOf(h, header->bucketBits);
+  for (uint32_t i = directory[bucket]; i < directory[bucket + 1] && entries[i].hash <= h; ++i) {
+    const RecipientIndexEntry &entry = entries[i];
+    if (entry.hash != h || entry.length != address.size()) {
+      continue;
+    }
+    const char *candidate = strings + entry.offset;
+    size_t j = 0;
+    while (j < address.size() && candidate[j] == lower(address[j])) {
+      ++j;
+    }
+    if (j == address.size()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+RecipientDirectory::RecipientDirectory(std::string p, std::chrono::milliseconds i) : path{std::move(p)}, interval{i} {
+  struct stat status;
+  SystemCall("stat " + path, ::stat(path.c_str(), &status));
+  current = RecipientIndex::open(path);
+  inode = status.st_ino;
+  modified = status.st_mtim;
+
+  watcher = std::thread{&RecipientDirectory::watch, this};
+}
+
+RecipientDirectory::~RecipientDirectory() {
+  {
+    std::lock_guard<std::mutex> lock{watcherMutex};
+    stopped = true;
+  }
+  watcherCondition.notify_all();
+  watcher.join();
+}
+
+void RecipientDirectory::watch() {
+  std::unique_lock<std::mutex> lock{watcherMutex};
+  while (!watcherCondition.wait_for(lock, interval, [this] { return stopped; })) {
+    lock.unlock();
+    reload();
+    lock.lock();
+  }
+}
+
+bool RecipientDirectory::reload() {
+  std::lock_guard<std::mutex> lock{watcherMutex};
+
+  struct stat status;
+  if (::stat(path.c_str(), &status) < 0) {
+    // The builder renames the new file over the old one, so the path never
+    // disappears unless somebody removed it. Keep serving the last index.
+    return false;
+  }
+  if (status.st_ino == inode && status.st_mtim.tv_sec == modified.tv_sec &&
+      status.st_mtim.tv_nsec == modified.tv_nsec) {
+    return false;
+  }
+  inode = status.st_ino;
+  modified = status.st_mtim;
+
+  try {
+    // The previous index is unmapped by the store, unless a lookup still holds it
+    current.store(RecipientIndex::open(path));
+  } catch (const std::exception &e) {
+    std::cerr << "Keeping the previous recipient index: " << e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<const RecipientIndex> RecipientDirectory::snapshot() const { return current.load(); }
+
+bool RecipientDirectory::contains(std::string_view address) const { return snapshot()->contains(address); }
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief On-disk header of a recipient index file.
+ *
+ * @details The file is laid out as
+ *
+ *   header | bloom filter bits | bucket directory | entries | address strings
+ *
+ * Entries are sorted by the hash of the address, and the bucket directory maps
+ * the top `bucketBits` bits of a hash to the first entry carrying them, so a
+ * lookup touches one bucket, usually one entry and one string.
+ */
+struct RecipientIndexHeader {
+  char magic[8];             //!< Always "MSMTPRCP"
+  uint32_t version;          //!< Format version, see `RecipientIndex::version`
+  uint32_t bloomHashes;      //!< Number of probes in the bloom filter
+  uint64_t bloomBits;        //!< Size of the bloom filter in bits, a power of two
+  uint64_t bucketBits;       //!< log2 of the number of buckets in the directory
+  uint64_t count;            //!< Number of addresses
+  uint64_t bloomOffset;      //!< File offset of the bloom filter words
+  uint64_t directoryOffset;  //!< File offset of the bucket directory
+  uint64_t entriesOffset;    //!< File offset of the entries
+  uint64_t stringsOffset;    //!< File offset of the address strings
+  uint64_t fileSize;         //!< Total size of the file
+};
+
+/**
+ * @brief One address in the recipient index.
+ *
+ */
+struct RecipientIndexEntry {
+  uint64_t hash;    //!< Hash of the lower-cased address
+  uint32_t offset;  //!< Offset of the address relative to the strings section
+  uint32_t length;  //!< Length of the address
+};
+
+/**
+ * @brief A read-only, memory-mapped set of local recipient addresses.
+ *
+ * @details Addresses are compared case-insensitively. `contains` neither
+ * allocates nor copies, it hashes the address once and reuses the hash for
+ * the bloom filter and the bucket directory.
+ */
+class RecipientIndex {
+private:
+  const unsigned char *base = nullptr;
+  size_t length = 0;
+  const RecipientIndexHeader *header = nullptr;
+  const uint64_t *bloom = nullptr;
+  const uint32_t *directory = nullptr;
+  const RecipientIndexEntry *entries = nullptr;
+  const char *strings = nullptr;
+
+  RecipientIndex(const unsigned char *base, size_t length);
+
+public:
+  static constexpr uint32_t version = 1;
+
+  /**
+   * @brief Map the index file at `path`.
+   *
+   * @param[in] path the index file built by `RecipientIndex::build`
+   * @return std::shared_ptr<const RecipientIndex> the mapped index
+   * @throw std::runtime_error the file is not a valid recipient index
+   */
+  static std::shared_ptr<const RecipientIndex> open(const std::string &path);
+
+  /**
+   * @brief Write an index of `addresses` to `path`.
+   *
+   * @details The index is written to a temporary file next to `path` and
+   * renamed over it, so a running `RecipientDirectory` never maps a partially
+   * written file.
+   *
+   * @param[in] addresses the addresses, duplicates and case are ignored
+   * @param[in] path where the index should be written
+   */
+  static void build(std::vector<std::string> addresses, const std::string &path);
+
+  /**
+   * @brief Hash an address the way the index does
+   *
+   * @details FNV-1a over the lower-cased bytes, followed by the murmur3
+   * finalizer so that the top bits used by the bucket directory are well mixed.
+   */
+  static uint64_t hash(std::string_view address) noexcept;
+
+  /**
+   * @brief whether the address is a local recipient
+   *
+   * @param[in] address the address, e.g. "shejialuo@gmail.com"
+   * @return true the address is in the index
+   * @return false the address is not in the index
+   */
+  bool contains(std::string_view address) const noexcept;
+
+  //! Number of addresses in the index
+  size_t size() const noexcept { return header->count; }
+
+  ~RecipientIndex();
+
+  RecipientIndex(const RecipientIndex &other) = delete;
+  RecipientIndex &operator=(const RecipientIndex &other) = delete;
+};
+
+/**
+ * @brief The recipient index currently in use.
+ *
+ * @details It maps the index file at startup and watches it. Whenever the
+ * file is replaced on disk, the new one is mapped and swapped in atomically.
+ * Lookups in flight keep the old mapping alive until they finish.
+ */
+class RecipientDirectory {
+private:
+  std::string path;
+  std::chrono::milliseconds interval;
+
+  std::atomic<std::shared_ptr<const RecipientIndex>> current;  //!< Swapped by `reload`, read without a lock
+
+  ino_t inode = 0;
+  struct timespec modified {};
+
+  std::mutex watcherMutex;
+  std::condition_variable watcherCondition;
+  bool stopped = false;
+  std::thread watcher;
+
+  void watch();
+
+public:
+  /**
+   * @brief Map the index file at `path` and start watching it.
+   *
+   * @param[in] path the index file
+   * @param[in] interval how often the file is checked for replacement
+   */
+  explicit RecipientDirectory(std::string path, std::chrono::milliseconds interval = std::chrono::seconds{1});
+
+  /**
+   * @brief Map the index again if the file has been replaced.
+   *
+   * @return true a new index has been swapped in
+   * @return false the file has not changed
+   */
+  bool reload();
+
+  //! whether the address is a local recipient
+  bool contains(std::string_view address) const;
+
+  //! The index currently in use
+  std::shared_ptr<const RecipientIndex> snapshot() const;
+
+  ~RecipientDirectory();
+
+  RecipientDirectory(const RecipientDirectory &other) = delete;
+  RecipientDirectory &operator=(const RecipientDirectory &other) = delete;
+};
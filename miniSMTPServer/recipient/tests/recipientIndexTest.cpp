@@ -0,0 +1,99 @@
+#include "recipientIndex.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static std::string temporaryPath(const std::string &name) {
+  return "/tmp/" + name + "." + std::to_string(::getpid()) + ".idx";
+}
+
+TEST(RecipientIndex, contains) {
+  std::string path = temporaryPath("contains");
+  RecipientIndex::build({"shejialuo@gmail.com", "postmaster@example.com", "Admin@Example.com"}, path);
+
+  auto index = RecipientIndex::open(path);
+  ASSERT_EQ(index->size(), 3);
+
+  EXPECT_TRUE(index->contains("shejialuo@gmail.com"));
+  EXPECT_TRUE(index->contains("postmaster@example.com"));
+  EXPECT_TRUE(index->contains("admin@example.com"));
+  EXPECT_TRUE(index->contains("SheJiaLuo@GMAIL.com"));
+
+  EXPECT_FALSE(index->contains("shejialuo@gmail.co"));
+  EXPECT_FALSE(index->contains("nobody@example.com"));
+  EXPECT_FALSE(index->contains(""));
+
+  std::remove(path.c_str());
+}
+
+TEST(RecipientIndex, duplicatesAndEmpty) {
+  std::string path = temporaryPath("duplicates");
+  RecipientIndex::build({"a@b.com", "A@B.COM", "a@b.com"}, path);
+  EXPECT_EQ(RecipientIndex::open(path)->size(), 1);
+
+  RecipientIndex::build({}, path);
+  auto empty = RecipientIndex::open(path);
+  EXPECT_EQ(empty->size(), 0);
+  EXPECT_FALSE(empty->contains("a@b.com"));
+
+  std::remove(path.c_str());
+}
+
+TEST(RecipientIndex, manyAddresses) {
+  std::string path = temporaryPath("many");
+  std::vector<std::string> addresses{};
+  for (int i = 0; i < 100000; ++i) {
+    addresses.push_back("user" + std::to_string(i) + "@example.com");
+  }
+  RecipientIndex::build(addresses, path);
+
+  auto index = RecipientIndex::open(path);
+  ASSERT_EQ(index->size(), addresses.size());
+  for (const auto &address : addresses) {
+    ASSERT_TRUE(index->contains(address));
+  }
+  for (int i = 100000; i < 110000; ++i) {
+    ASSERT_FALSE(index->contains("user" + std::to_string(i) + "@example.com"));
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST(RecipientIndex, rejectsInvalidFile) {
+  std::string path = temporaryPath("invalid");
+  FILE *file = std::fopen(path.c_str(), "w");
+  std::fputs("shejialuo@gmail.com\npostmaster@example.com\nthis is not an index at all, just a text file\n", file);
+  std::fclose(file);
+
+  EXPECT_THROW(RecipientIndex::open(path), std::runtime_error);
+  EXPECT_THROW(RecipientIndex::open(path + ".missing"), std::runtime_error);
+
+  std::remove(path.c_str());
+}
+
+TEST(RecipientDirectory, reload) {
+  std::string path = temporaryPath("reload");
+  RecipientIndex::build({"old@example.com"}, path);
+
+  // Reload by hand rather than waiting for the watcher
+  RecipientDirectory directory{path, std::chrono::hours{1}};
+  EXPECT_TRUE(directory.contains("old@example.com"));
+  EXPECT_FALSE(directory.reload());
+
+  auto pinned = directory.snapshot();
+  RecipientIndex::build({"new@example.com"}, path);
+  EXPECT_TRUE(directory.reload());
+
+  EXPECT_FALSE(directory.contains("old@example.com"));
+  EXPECT_TRUE(directory.contains("new@example.com"));
+
+  // A lookup holding the previous index still sees the previous file
+  EXPECT_TRUE(pinned->contains("old@example.com"));
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,94 @@
+#include "connectionPool.hpp"
+
+ConnectionPool::ConnectionPool(std::string h, size_t l, std::chrono::milliseconds t, std::chrono::seconds i)
+    : helo{std::move(h)}, limit{l}, timeout{t}, idleTimeout{i} {
+  reaper = std::thread{&ConnectionPool::reap, this};
+}
+
+void ConnectionPool::reap() {
+  std::unique_lock<std::mutex> lock{mutex};
+  while (!stopped) {
+    std::vector<std::unique_ptr<SMTPClient>> expired{};
+    for (auto &[name, destination] : destinations) {
+      auto &idle = destination.idle;
+      for (auto it = idle.begin(); it != idle.end();) {
+        if ((*it)->idleFor(idleTimeout)) {
+          expired.push_back(std::move(*it));
+          it = idle.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+
+    lock.unlock();
+    for (auto &client : expired) {
+      client->quit();
+    }
+    lock.lock();
+
+    released.wait_for(lock, std::chrono::milliseconds{idleTimeout} / 2, [this] { return stopped; });
+  }
+}
+
+std::unique_ptr<SMTPClient> ConnectionPool::acquire(const NextHop &hop) {
+  {
+    std::unique_lock<std::mutex> lock{mutex};
+    Destination &destination = destinations[hop.name()];
+    released.wait(lock, [&] { return stopped || destination.active < limit; });
+    if (stopped) {
+      return nullptr;
+    }
+    ++destination.active;
+
+    // The most recently used session is the most likely to still be open
+    if (!destination.idle.empty()) {
+      std::unique_ptr<SMTPClient> client = std::move(destination.idle.back());
+      destination.idle.pop_back();
+      return client;
+    }
+  }
+
+  try {
+    return std::make_unique<SMTPClient>(hop, helo, timeout);
+  } catch (...) {
+    release(hop, nullptr);
+    throw;
+  }
+}
+
+void ConnectionPool::release(const NextHop &hop, std::unique_ptr<SMTPClient> client) {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    Destination &destination = destinations[hop.name()];
+    --destination.active;
+    if (client && client->reusable() && !stopped) {
+      destination.idle.push_back(std::move(client));
+    }
+  }
+  released.notify_all();
+}
+
+void ConnectionPool::stop() {
+  std::vector<std::unique_ptr<SMTPClient>> idle{};
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopped = true;
+    for (auto &[name, destination] : destinations) {
+      for (auto &client : destination.idle) {
+        idle.push_back(std::move(client));
+      }
+      destination.idle.clear();
+    }
+  }
+  released.notify_all();
+
+  for (auto &client : idle) {
+    client->quit();
+  }
+  if (reaper.joinable()) {
+    reaper.join();
+  }
+}
+
+ConnectionPool::~ConnectionPool() { stop(); }
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "smtpClient.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Persistent outbound sessions, shared by the relay workers.
+ *
+ * @details At most `limit` sessions to the same destination are in use at
+ * once, `acquire` blocks until one is released. Released sessions stay open
+ * and are handed to the next message for the same destination. A reaper
+ * thread closes the sessions idle for longer than `idleTimeout`, so they do
+ * not hold on to the next hop's resources.
+ */
+class ConnectionPool {
+private:
+  struct Destination {
+    size_t active = 0;
+    std::vector<std::unique_ptr<SMTPClient>> idle{};
+  };
+
+  std::string helo;
+  size_t limit;
+  std::chrono::milliseconds timeout;
+  std::chrono::seconds idleTimeout;
+
+  std::mutex mutex;
+  std::condition_variable released;
+  std::unordered_map<std::string, Destination> destinations{};
+  bool stopped = false;
+  std::thread reaper{};
+
+  void reap();
+
+public:
+  /**
+   * @brief Construct a new Connection Pool object
+   *
+   * @param[in] helo the name sent with EHLO
+   * @param[in] limit the maximum number of concurrent sessions per destination
+   * @param[in] timeout how long a read or a write may block
+   * @param[in] idleTimeout how long an unused session is kept open
+   */
+  ConnectionPool(std::string helo,
+                 size_t limit,
+                 std::chrono::milliseconds timeout,
+                 std::chrono::seconds idleTimeout = std::chrono::seconds{5});
+
+  /**
+   * @brief Get a session to `hop`, reusing an idle one when possible.
+   *
+   * @param[in] hop the destination
+   * @return std::unique_ptr<SMTPClient> the session, nullptr when the pool is stopped
+   * @throw std::exception a new session could not be opened
+   */
+  std::unique_ptr<SMTPClient> acquire(const NextHop &hop);
+
+  /**
+   * @brief Give a session back to the pool.
+   *
+   * @param[in] hop the destination the session was acquired for
+   * @param[in] client the session, or nullptr when it has been dropped
+   */
+  void release(const NextHop &hop, std::unique_ptr<SMTPClient> client);
+
+  //! Close every idle session, wake up the waiting workers and stop the reaper
+  void stop();
+
+  ~ConnectionPool();
+};
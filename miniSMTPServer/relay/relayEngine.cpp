@@ -0,0 +1,135 @@
+#include "relayEngine.hpp"
+
+#include <algorithm>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <unistd.h>
+
+RelayEngine::RelayEngine(Spool &s, RelayOptions o)
+    : options{std::move(o)}, spool{s}, queue{spool}, pool{options.helo, options.connections, options.timeout} {
+  for (size_t i = 0; i < options.connections; ++i) {
+    workers.emplace_back(&RelayEngine::work, this);
+  }
+}
+
+void RelayEngine::stop() {
+  queue.stop();
+  pool.stop();
+  for (auto &worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+RelayEngine::~RelayEngine() { stop(); }
+
+void RelayEngine::enqueue(const QueueRecord &record) { queue.push(record); }
+
+std::chrono::seconds RelayEngine::backoff(unsigned attempts) const {
+  auto delay = options.retry;
+  for (unsigned i = 0; i < attempts && delay < options.maxRetry; ++i) {
+    delay *= 2;
+  }
+  return std::min(delay, options.maxRetry);
+}
+
+void RelayEngine::work() {
+  while (auto record = queue.pop()) {
+    deliver(std::move(record.value()));
+  }
+}
+
+std::optional<DeliveryResult> RelayEngine::relay(const QueueRecord &record) {
+  DeliveryResult result{};
+
+  // A pooled session may have been closed by the next hop while it was idle,
+  // so a failure on a reused session is retried once on a fresh one.
+  for (bool retry = true; retry;) {
+    std::unique_ptr<SMTPClient> client{};
+    retry = false;
+    try {
+      client = pool.acquire(options.nextHop);
+      if (!client) {
+        // Shutting down, the record is still in the spool
+        return std::nullopt;
+      }
+      retry = !client->fresh();
+      BodyReader body = spool.open(record);
+      result = client->send(record, body);
+      pool.release(options.nextHop, std::move(client));
+      break;
+    } catch (const std::exception &e) {
+      if (client) {
+        pool.release(options.nextHop, nullptr);
+      }
+      result = DeliveryResult{};
+      result.deferred = record.envelope.recipients;
+      result.reply = e.what();
+    }
+  }
+  return result;
+}
+
+DeliveryResult RelayEngine::store(const QueueRecord &record) {
+  DeliveryResult result{};
+  // The mailboxes link a plain body, a compressed one is inflated for them first
+  std::string copy{};
+  try {
+    if (record.compressed) {
+      copy = spool.inflate(record);
+    }
+    MailboxDelivery delivery = options.mailboxes->deliver(
+        record.id, record.envelope.recipients, copy.empty() ? spool.bodyPath(record.id) : copy);
+    result.delivered = std::move(delivery.delivered);
+    result.failed = std::move(delivery.failed);
+    result.reply = "no such mailbox";
+  } catch (const std::exception &e) {
+    // e.g. out of space, every mailbox is tried again, those that have the message keep it
+    result.deferred = record.envelope.recipients;
+    result.reply = e.what();
+  }
+  if (!copy.empty()) {
+    // The mailboxes hold their own links to it
+    ::unlink(copy.c_str());
+  }
+  return result;
+}
+
+void RelayEngine::deliver(QueueRecord record) {
+  if (!spool.intact(record)) {
+    // Out of the queue until the next start, the spool keeps it for whoever looks into it
+    std::cerr << "Relay: " << record.id << " has a corrupt body, left in the spool\n";
+    return;
+  }
+
+  std::optional<DeliveryResult> attempt = options.mailboxes != nullptr ? store(record) : relay(record);
+  if (!attempt.has_value()) {
+    return;
+  }
+  DeliveryResult &result = attempt.value();
+
+  for (const auto &recipient : result.failed) {
+    std::cerr << "Relay: " << record.id << " to " << recipient << " failed permanently: " << result.reply << "\n";
+  }
+
+  if (result.deferred.empty()) {
+    std::cout << "Relay: " << record.id << " delivered to " << result.delivered.size() << " recipients\n";
+    queue.complete(record);
+    return;
+  }
+
+  if (std::time(nullptr) - record.created > options.maxAge.count()) {
+    std::cerr << "Relay: giving up on " << record.id << " after " << record.attempts + 1
+              << " attempts: " << result.reply << "\n";
+    queue.complete(record);
+    return;
+  }
+
+  std::cerr << "Relay: " << record.id << " deferred for " << result.deferred.size()
+            << " recipients: " << result.reply << "\n";
+  const auto delay = backoff(record.attempts);
+  record.envelope.recipients = std::move(result.deferred);
+  queue.retry(std::move(record), delay);
+}
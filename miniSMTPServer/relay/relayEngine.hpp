@@ -0,0 +1,87 @@
+#pragma once
+
+#include "connectionPool.hpp"
+#include "mailboxes.hpp"
+#include "retryQueue.hpp"
+#include "smtpClient.hpp"
+#include "spool.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Options of the relay engine.
+ *
+ */
+struct RelayOptions {
+  NextHop nextHop{};                           //!< Where every message is relayed to
+  std::string helo = "127.0.0.1";              //!< The name sent with EHLO
+  size_t connections = 4;                      //!< Concurrent sessions per destination
+  std::chrono::seconds retry{60};              //!< Delay before the first retry, doubled on every attempt
+  std::chrono::seconds maxRetry{3600};         //!< Upper bound of the retry delay
+  std::chrono::seconds maxAge{5 * 24 * 3600};  //!< Give up on a message this long after it was accepted
+  std::chrono::milliseconds timeout{300000};   //!< How long a read or a write to the next hop may block
+  Mailboxes *mailboxes = nullptr;              //!< Deliver to these local mailboxes instead of the next hop
+};
+
+/**
+ * @brief Relays the messages accepted into the spool to the next hop, or
+ * delivers them to the local mailboxes.
+ *
+ * @details Worker threads take the due messages from the `RetryQueue` and
+ * send them over sessions from the `ConnectionPool`, or link them into
+ * `RelayOptions::mailboxes`. A message leaves the
+ * spool once every recipient has been accepted or permanently rejected by
+ * the next hop, the recipients rejected temporarily are retried with an
+ * exponential backoff.
+ *
+ * The queue record is removed right after the next hop accepts the message,
+ * a crash in between is the only way a message is relayed twice.
+ */
+class RelayEngine {
+private:
+  RelayOptions options;
+  Spool &spool;
+  RetryQueue queue;
+  ConnectionPool pool;
+  std::vector<std::thread> workers{};
+
+  void work();
+  void deliver(QueueRecord record);
+  std::optional<DeliveryResult> relay(const QueueRecord &record);
+  DeliveryResult store(const QueueRecord &record);
+  std::chrono::seconds backoff(unsigned attempts) const;
+
+public:
+  /**
+   * @brief Load the queued messages of `spool` and start relaying them.
+   *
+   * @param[in] spool the spool holding the accepted messages
+   * @param[in] options where and how to relay
+   */
+  RelayEngine(Spool &spool, RelayOptions options);
+
+  //! Queue a message which has just been committed to the spool
+  void enqueue(const QueueRecord &record);
+
+  //! Number of messages waiting for their next attempt
+  size_t queued() { return queue.size(); }
+
+  //! Queue the messages another process left in the spool, see `RetryQueue::rescan`
+  size_t rescan() { return queue.rescan(); }
+
+  /**
+   * @brief Finish the deliveries in progress and stop the workers.
+   * @details May be called from any thread, while `enqueue` is called on
+   * another. The messages enqueued from then on stay in the spool.
+   *
+   */
+  void stop();
+
+  //! Stop, unless `stop` was called already
+  ~RelayEngine();
+};
@@ -0,0 +1,98 @@
+#include "retryQueue.hpp"
+
+#include <ctime>
+
+RetryQueue::RetryQueue(Spool &s) : spool{s} { rescan(); }
+
+void RetryQueue::push(QueueRecord record) {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (!known.insert(record.id).second) {
+      // Already found by `rescan`
+      return;
+    }
+    heap.push(std::move(record));
+  }
+  changed.notify_one();
+}
+
+std::optional<QueueRecord> RetryQueue::pop() {
+  std::unique_lock<std::mutex> lock{mutex};
+  while (!stopped) {
+    if (heap.empty()) {
+      changed.wait(lock);
+      continue;
+    }
+
+    auto due = std::chrono::system_clock::from_time_t(heap.top().next);
+    if (due <= std::chrono::system_clock::now()) {
+      QueueRecord record = heap.top();
+      heap.pop();
+      return record;
+    }
+    // Woken up early when a sooner record is pushed
+    changed.wait_until(lock, due);
+  }
+  return std::nullopt;
+}
+
+void RetryQueue::retry(QueueRecord record, std::chrono::seconds delay) {
+  ++record.attempts;
+  record.next = std::time(nullptr) + delay.count();
+  spool.save(record);
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    heap.push(std::move(record));
+  }
+  changed.notify_one();
+}
+
+void RetryQueue::complete(const QueueRecord &record) {
+  // Outside the lock, `push` waits on it from the event loop. The id stays
+  // known meanwhile, so `rescan` does not queue the record again
+  spool.remove(record.id);
+  std::lock_guard<std::mutex> lock{mutex};
+  known.erase(record.id);
+  if (scanning > 0) {
+    // A listing taken before the removal may still hold it
+    removed.insert(record.id);
+  }
+}
+
+size_t RetryQueue::rescan() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    ++scanning;
+  }
+  std::vector<QueueRecord> records = spool.records();
+
+  size_t added = 0;
+  std::unique_lock<std::mutex> lock{mutex};
+  for (auto &record : records) {
+    if (!removed.contains(record.id) && known.insert(record.id).second) {
+      heap.push(std::move(record));
+      ++added;
+    }
+  }
+  if (--scanning == 0) {
+    removed.clear();
+  }
+  lock.unlock();
+  if (added > 0) {
+    changed.notify_all();
+  }
+  return added;
+}
+
+void RetryQueue::stop() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopped = true;
+  }
+  changed.notify_all();
+}
+
+size_t RetryQueue::size() {
+  std::lock_guard<std::mutex> lock{mutex};
+  return heap.size();
+}
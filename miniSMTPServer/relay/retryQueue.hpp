@@ -0,0 +1,83 @@
+#pragma once
+
+#include "spool.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief The messages waiting for relay, ordered by their next attempt.
+ *
+ * @details The queue is a min-heap keyed by `QueueRecord::next` in front of
+ * the queue records in the spool, which are the durable copy: the heap is
+ * rebuilt from them on startup, and every change to a record is written to
+ * the spool before the heap is updated. A record being delivered is not in
+ * the heap, so a message is never handed to two workers.
+ */
+class RetryQueue {
+private:
+  struct Later {
+    bool operator()(const QueueRecord &lhs, const QueueRecord &rhs) const { return lhs.next > rhs.next; }
+  };
+
+  Spool &spool;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::priority_queue<QueueRecord, std::vector<QueueRecord>, Later> heap{};
+  std::unordered_set<std::string> known{};    //!< Ids of the records in the heap, being delivered or removed
+  std::unordered_set<std::string> removed{};  //!< Ids removed while a `rescan` was listing the spool
+  size_t scanning = 0;                        //!< Number of `rescan` calls listing the spool
+  bool stopped = false;
+
+public:
+  /**
+   * @brief Load the queue records already in the spool.
+   *
+   * @param[in] spool the spool holding the records
+   */
+  explicit RetryQueue(Spool &spool);
+
+  //! Add a record which is already in the spool
+  void push(QueueRecord record);
+
+  /**
+   * @brief Wait for the earliest record to be due and take it out of the queue
+   *
+   * @return std::optional<QueueRecord> the record, std::nullopt once the queue is stopped
+   */
+  std::optional<QueueRecord> pop();
+
+  /**
+   * @brief Persist a record to be attempted again after `delay` and queue it
+   *
+   * @param[in] record the record, with the recipients left to deliver
+   * @param[in] delay how long to wait before the next attempt
+   */
+  void retry(QueueRecord record, std::chrono::seconds delay);
+
+  //! Remove a record and its body from the spool, after its last attempt
+  void complete(const QueueRecord &record);
+
+  /**
+   * @brief Queue the records which entered the spool behind our back
+   * @details e.g. committed by the previous process while it drained its
+   * sessions after a hot restart. The spool is listed without the lock,
+   * which `push` takes on the event loop.
+   *
+   * @return size_t the number of records added
+   */
+  size_t rescan();
+
+  //! Wake up every `pop` and make them return std::nullopt
+  void stop();
+
+  //! Number of records waiting in the queue
+  size_t size();
+};
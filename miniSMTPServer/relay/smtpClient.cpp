@@ -0,0 +1,196 @@
+#include "smtpClient.hpp"
+
+#include "util.hpp"
+
+#include <cctype>
+#include <exception>
+#include <stdexcept>
+
+static bool positive(int code) { return code >= 200 && code < 300; }
+static bool transient(int code) { return code >= 400 && code < 500; }
+
+SMTPClient::SMTPClient(const NextHop &hop, const std::string &helo, std::chrono::milliseconds timeout) {
+  socket.set_timeout(timeout);
+  socket.connect(hop.host, hop.port);
+
+  Reply greeting = readReply();
+  if (greeting.code != 220) {
+    throw std::runtime_error("unexpected greeting from " + hop.name() + ": " + greeting.text);
+  }
+
+  socket.write("EHLO " + helo + "\r\n");
+  Reply hello = readReply();
+  if (!positive(hello.code)) {
+    throw std::runtime_error("EHLO rejected by " + hop.name() + ": " + hello.text);
+  }
+  pipelining = hello.text.find("PIPELINING") != std::string::npos;
+  lastUsed = std::chrono::steady_clock::now();
+}
+
+SMTPClient::Reply SMTPClient::readReply() {
+  Reply reply{};
+  while (true) {
+    size_t end = 0;
+    while ((end = buffer.find("\r\n")) == std::string::npos) {
+      std::string chunk = socket.read();
+      if (chunk.empty()) {
+        healthy = false;
+        throw std::runtime_error("connection closed by the next hop");
+      }
+      buffer += chunk;
+    }
+
+    std::string line = buffer.substr(0, end);
+    buffer.erase(0, end + 2);
+    if (line.size() < 3 || !std::isdigit(line[0]) || !std::isdigit(line[1]) || !std::isdigit(line[2])) {
+      healthy = false;
+      throw std::runtime_error("malformed reply from the next hop: " + line);
+    }
+
+    reply.code = std::stoi(line.substr(0, 3));
+    reply.text += reply.text.empty() ? line : "\n" + line;
+    if (line.size() == 3 || line[3] != '-') {
+      return reply;
+    }
+  }
+}
+
+void SMTPClient::sendBody(BodyReader &body) {
+  std::string chunk{};
+  std::string stuffed{};
+  bool lineStart = true;
+  while (true) {
+    body.read(chunk);
+    if (chunk.empty()) {
+      break;
+    }
+    stuffed.clear();
+    for (char c : chunk) {
+      if (lineStart && c == '.') {
+        stuffed += '.';
+      }
+      stuffed += c;
+      lineStart = c == '\n';
+    }
+    socket.write(stuffed);
+  }
+
+  socket.write(lineStart ? ".\r\n" : "\r\n.\r\n");
+}
+
+void SMTPClient::transaction(const QueueRecord &record, BodyReader &body, DeliveryResult &result) {
+  const bool reused = transactions > 0;
+  std::vector<std::string> commands{};
+  if (reused) {
+    commands.push_back("RSET\r\n");
+  }
+  commands.push_back("MAIL FROM:<" + record.envelope.sender + ">\r\n");
+  for (const auto &recipient : record.envelope.recipients) {
+    commands.push_back("RCPT TO:<" + recipient + ">\r\n");
+  }
+  commands.push_back("DATA\r\n");
+
+  if (pipelining) {
+    std::string batch{};
+    for (const auto &command : commands) {
+      batch += command;
+    }
+    socket.write(batch);
+  }
+
+  // Read the replies in order. Without pipelining each command is sent
+  // right before its reply is read, and nothing is sent after a failed MAIL.
+  size_t next = 0;
+  auto reply = [&]() {
+    if (!pipelining) {
+      socket.write(commands[next]);
+    }
+    ++next;
+    return readReply();
+  };
+  auto reject = [&result](int code, const std::vector<std::string> &recipients) {
+    auto &rejected = transient(code) ? result.deferred : result.failed;
+    rejected.insert(rejected.end(), recipients.begin(), recipients.end());
+  };
+
+  if (reused) {
+    if (Reply reset = reply(); !positive(reset.code)) {
+      throw std::runtime_error("RSET rejected: " + reset.text);
+    }
+  }
+
+  Reply mail = reply();
+  if (!positive(mail.code)) {
+    reject(mail.code, record.envelope.recipients);
+    result.reply = mail.text;
+    while (pipelining && next < commands.size()) {
+      reply();
+    }
+    return;
+  }
+
+  std::vector<std::string> accepted{};
+  for (const auto &recipient : record.envelope.recipients) {
+    Reply rcpt = reply();
+    if (positive(rcpt.code)) {
+      accepted.push_back(recipient);
+    } else {
+      reject(rcpt.code, {recipient});
+      result.reply = rcpt.text;
+    }
+  }
+
+  if (!pipelining && accepted.empty()) {
+    return;
+  }
+
+  // RFC 5321 answers DATA with 354, miniSMTP with 250
+  Reply data = reply();
+  if (data.code != 354 && !positive(data.code)) {
+    reject(data.code, accepted);
+    result.reply = data.text;
+    return;
+  }
+
+  if (accepted.empty()) {
+    // Pipelined DATA went through without any recipient, end it empty
+    socket.write(".\r\n");
+    readReply();
+    return;
+  }
+
+  sendBody(body);
+  Reply done = readReply();
+  result.reply = done.text;
+  if (positive(done.code)) {
+    result.delivered = std::move(accepted);
+  } else {
+    reject(done.code, accepted);
+  }
+}
+
+DeliveryResult SMTPClient::send(const QueueRecord &record, BodyReader &body) {
+  DeliveryResult result{};
+  try {
+    transaction(record, body, result);
+  } catch (...) {
+    healthy = false;
+    throw;
+  }
+  ++transactions;
+  lastUsed = std::chrono::steady_clock::now();
+  return result;
+}
+
+void SMTPClient::quit() {
+  try {
+    socket.write("QUIT\r\n");
+    readReply();
+  } catch (const std::exception &) {
+    // The session is going away either way
+  }
+  healthy = false;
+  if (!socket.closed()) {
+    socket.close();
+  }
+}
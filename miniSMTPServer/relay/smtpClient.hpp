@@ -0,0 +1,97 @@
+#pragma once
+
+#include "socket.hpp"
+#include "spool.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The SMTP server messages are relayed to.
+ *
+ */
+struct NextHop {
+  std::string host{};
+  uint16_t port = 25;
+
+  //! "host:port", the key of the destination in the connection pool
+  std::string name() const { return host + ":" + std::to_string(port); }
+};
+
+/**
+ * @brief What happened to each recipient of a relayed message.
+ *
+ */
+struct DeliveryResult {
+  std::vector<std::string> delivered{};  //!< Accepted by the next hop
+  std::vector<std::string> deferred{};   //!< Temporarily rejected, should be retried
+  std::vector<std::string> failed{};     //!< Permanently rejected
+  std::string reply{};                   //!< The last reply, for logging
+};
+
+/**
+ * @brief One outbound SMTP session.
+ *
+ * @details The session is opened with EHLO and can carry any number of
+ * messages, each transaction is preceded by RSET so a session left in an
+ * unknown state by a previous failure can be reused. When the server
+ * advertises PIPELINING, RSET, MAIL, the RCPTs and DATA are sent in one write.
+ *
+ * Network errors and timeouts throw, the session is then unusable.
+ */
+class SMTPClient {
+private:
+  TCPSocket socket{};
+  std::string buffer{};
+  bool pipelining = false;
+  bool healthy = true;
+  unsigned transactions = 0;
+  std::chrono::steady_clock::time_point lastUsed{};
+
+  struct Reply {
+    int code = 0;
+    std::string text{};
+  };
+
+  Reply readReply();
+  void sendBody(BodyReader &body);
+  void transaction(const QueueRecord &record, BodyReader &body, DeliveryResult &result);
+
+public:
+  /**
+   * @brief Connect to the next hop and say EHLO.
+   *
+   * @param[in] hop the server to connect to
+   * @param[in] helo the name sent with EHLO
+   * @param[in] timeout how long a read or a write may block
+   */
+  SMTPClient(const NextHop &hop, const std::string &helo, std::chrono::milliseconds timeout);
+
+  /**
+   * @brief Relay one message in this session.
+   *
+   * @param[in] record the envelope of the message
+   * @param[in] body the spooled body, dot-unstuffed with CRLF line endings, read from where it is
+   * @return DeliveryResult the outcome for each recipient
+   */
+  DeliveryResult send(const QueueRecord &record, BodyReader &body);
+
+  //! Say QUIT and close the connection
+  void quit();
+
+  //! Whether the session can carry another message
+  bool reusable() const { return healthy; }
+
+  //! Whether the session has been idle for longer than `idle`
+  bool idleFor(std::chrono::steady_clock::duration idle) const {
+    return std::chrono::steady_clock::now() - lastUsed > idle;
+  }
+
+  //! Whether the session has not carried any message yet
+  bool fresh() const { return transactions == 0; }
+
+  //! Whether the server advertised PIPELINING
+  bool pipelined() const { return pipelining; }
+};
@@ -0,0 +1,371 @@
+#include "connectionPool.hpp"
+#include "relayEngine.hpp"
+#include "retryQueue.hpp"
+#include "smtpClient.hpp"
+#include "socket.hpp"
+#include "spool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static std::string temporarySpool(const std::string &name) {
+  auto path = fs::temp_directory_path() / ("relayTest." + name + "." + std::to_string(::getpid()));
+  fs::remove_all(path);
+  return path.string();
+}
+
+static QueueRecord spoolMessage(Spool &spool, const std::vector<std::string> &recipients, const std::string &body) {
+  auto writer = spool.create();
+  writer->append(body);
+  return writer->commit(Envelope{"shejialuo@gmail.com", recipients}).value();
+}
+
+/**
+ * @brief A next hop speaking just enough SMTP to be relayed to.
+ *
+ * @details It rejects RCPT for "bad@example.com" with 550 and for
+ * "later@example.com" with 450, and accepts everything else.
+ */
+class FakeNextHop {
+private:
+  TCPSocket listener{};
+  std::thread thread{};
+  std::vector<std::thread> clients{};
+  std::atomic<bool> stopped{false};
+  std::mutex mutex{};
+  std::vector<std::string> lines{};
+  std::atomic<int> sessions{0};
+
+  void serve(TCPSocket client) {
+    ++sessions;
+    client.write("220 fake ready\r\n");
+    std::string buffer{};
+    bool data = false;
+    while (true) {
+      std::string chunk = client.read();
+      if (chunk.empty()) {
+        return;
+      }
+      buffer += chunk;
+      size_t end = 0;
+      while ((end = buffer.find("\r\n")) != std::string::npos) {
+        std::string line = buffer.substr(0, end);
+        buffer.erase(0, end + 2);
+        {
+          std::lock_guard<std::mutex> lock{mutex};
+          lines.push_back(line);
+        }
+        if (data) {
+          if (line == ".") {
+            data = false;
+            client.write("250 queued\r\n");
+          }
+        } else if (line.rfind("EHLO", 0) == 0) {
+          client.write("250-fake\r\n250 PIPELINING\r\n");
+        } else if (line == "RCPT TO:<bad@example.com>") {
+          client.write("550 no such user\r\n");
+        } else if (line == "RCPT TO:<later@example.com>") {
+          client.write("450 try again later\r\n");
+        } else if (line == "DATA") {
+          data = true;
+          client.write("354 go ahead\r\n");
+        } else if (line == "QUIT") {
+          client.write("221 bye\r\n");
+          return;
+        } else {
+          client.write("250 ok\r\n");
+        }
+      }
+    }
+  }
+
+public:
+  FakeNextHop() {
+    listener.set_reuseaddr();
+    listener.bind(0);
+    listener.listen();
+    thread = std::thread{[this] {
+      while (true) {
+        auto client = listener.accept();
+        if (stopped) {
+          return;
+        }
+        clients.emplace_back(&FakeNextHop::serve, this, std::move(client));
+      }
+    }};
+  }
+
+  NextHop hop() { return NextHop{"127.0.0.1", listener.local_port()}; }
+
+  std::vector<std::string> received() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return lines;
+  }
+
+  int sessionCount() const { return sessions; }
+
+  ~FakeNextHop() {
+    stopped = true;
+    // Wake up the accept loop
+    TCPSocket waker{};
+    waker.connect("127.0.0.1", listener.local_port());
+    thread.join();
+    for (auto &client : clients) {
+      client.join();
+    }
+  }
+};
+
+TEST(Spool, commitAndRecover) {
+  std::string directory = temporarySpool("commit");
+  {
+    Spool spool{directory};
+    QueueRecord record = spoolMessage(spool, {"a@example.com", "b@example.com"}, "Subject: hi\r\n\r\nbody\r\n");
+    EXPECT_TRUE(fs::exists(spool.bodyPath(record.id)));
+
+    auto unfinished = spool.create();
+    unfinished->append("never committed\r\n");
+  }
+
+  Spool spool{directory};
+  auto records = spool.records();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].envelope.sender, "shejialuo@gmail.com");
+  EXPECT_EQ(records[0].envelope.recipients, (std::vector<std::string>{"a@example.com", "b@example.com"}));
+  EXPECT_TRUE(fs::is_empty(fs::path{directory} / "tmp"));
+
+  spool.remove(records[0].id);
+  EXPECT_TRUE(spool.records().empty());
+  EXPECT_TRUE(fs::is_empty(fs::path{directory} / "msg"));
+
+  fs::remove_all(directory);
+}
+
+TEST(RetryQueue, survivesRestart) {
+  std::string directory = temporarySpool("retry");
+  {
+    Spool spool{directory};
+    spoolMessage(spool, {"a@example.com"}, "first\r\n");
+    spoolMessage(spool, {"b@example.com"}, "second\r\n");
+
+    RetryQueue queue{spool};
+    ASSERT_EQ(queue.size(), 2);
+    auto record = queue.pop();
+    ASSERT_TRUE(record.has_value());
+    queue.retry(record.value(), std::chrono::seconds{3600});
+  }
+
+  Spool spool{directory};
+  RetryQueue queue{spool};
+  ASSERT_EQ(queue.size(), 2);
+
+  // The record which is not deferred comes out first
+  auto due = queue.pop();
+  ASSERT_TRUE(due.has_value());
+  EXPECT_EQ(due->attempts, 0);
+  queue.complete(due.value());
+
+  auto records = spool.records();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].attempts, 1);
+  EXPECT_GT(records[0].next, std::time(nullptr) + 3000);
+
+  queue.stop();
+  EXPECT_FALSE(queue.pop().has_value());
+
+  fs::remove_all(directory);
+}
+
+TEST(RetryQueue, rescanDoesNotQueueWhatIsBeingCompleted) {
+  std::string directory = temporarySpool("rescan");
+  Spool spool{directory};
+  RetryQueue queue{spool};
+  for (int i = 0; i < 200; ++i) {
+    spoolMessage(spool, {"a@example.com"}, "body\r\n");
+  }
+  ASSERT_EQ(queue.rescan(), 200);
+
+  // Workers completing records while the event loop rescans
+  std::thread worker{[&queue] {
+    for (int i = 0; i < 200; ++i) {
+      queue.complete(queue.pop().value());
+    }
+  }};
+  size_t added = 0;
+  for (int i = 0; i < 50; ++i) {
+    added += queue.rescan();
+  }
+  worker.join();
+
+  EXPECT_EQ(added, 0);
+  EXPECT_EQ(queue.size(), 0);
+  EXPECT_TRUE(spool.records().empty());
+
+  queue.stop();
+  fs::remove_all(directory);
+}
+
+TEST(SMTPClient, pipelinedSessionIsReused) {
+  std::string directory = temporarySpool("client");
+  Spool spool{directory};
+  FakeNextHop server{};
+
+  QueueRecord first = spoolMessage(spool, {"a@example.com", "bad@example.com", "later@example.com"}, ".hidden\r\n");
+  QueueRecord second = spoolMessage(spool, {"b@example.com"}, "plain\r\n");
+
+  SMTPClient client{server.hop(), "127.0.0.1", std::chrono::seconds{5}};
+  EXPECT_TRUE(client.pipelined());
+
+  BodyReader body = spool.open(first);
+  DeliveryResult result = client.send(first, body);
+  EXPECT_EQ(result.delivered, std::vector<std::string>{"a@example.com"});
+  EXPECT_EQ(result.failed, std::vector<std::string>{"bad@example.com"});
+  EXPECT_EQ(result.deferred, std::vector<std::string>{"later@example.com"});
+
+  BodyReader secondBody = spool.open(second);
+  result = client.send(second, secondBody);
+  EXPECT_EQ(result.delivered, std::vector<std::string>{"b@example.com"});
+  client.quit();
+
+  std::vector<std::string> expected{
+      "EHLO 127.0.0.1",
+      "MAIL FROM:<shejialuo@gmail.com>",
+      "RCPT TO:<a@example.com>",
+      "RCPT TO:<bad@example.com>",
+      "RCPT TO:<later@example.com>",
+      "DATA",
+      "..hidden",
+      ".",
+      "RSET",
+      "MAIL FROM:<shejialuo@gmail.com>",
+      "RCPT TO:<b@example.com>",
+      "DATA",
+      "plain",
+      ".",
+      "QUIT",
+  };
+  EXPECT_EQ(server.received(), expected);
+  EXPECT_EQ(server.sessionCount(), 1);
+
+  fs::remove_all(directory);
+}
+
+TEST(RelayEngine, relaysQueuedMessages) {
+  std::string directory = temporarySpool("engine");
+  Spool spool{directory};
+  FakeNextHop server{};
+
+  // Accepted before the engine starts, as if left over from a previous run
+  spoolMessage(spool, {"a@example.com"}, "one\r\n");
+
+  RelayOptions options{};
+  options.nextHop = server.hop();
+  options.connections = 2;
+  options.retry = std::chrono::seconds{3600};
+  {
+    RelayEngine relay{spool, options};
+    spool.committed = [&relay](const QueueRecord &record) { relay.enqueue(record); };
+    for (int i = 0; i < 20; ++i) {
+      spoolMessage(spool, {"b@example.com", "later@example.com"}, "two\r\n");
+    }
+
+    // Wait until every message has been attempted once
+    for (int i = 0; i < 500; ++i) {
+      auto records = spool.records();
+      bool attempted = records.size() == 20;
+      for (const auto &record : records) {
+        attempted = attempted && record.attempts == 1;
+      }
+      if (attempted) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    spool.committed = nullptr;
+  }
+
+  // Only the deferred recipient stays in the queue
+  auto records = spool.records();
+  ASSERT_EQ(records.size(), 20);
+  for (const auto &record : records) {
+    EXPECT_EQ(record.envelope.recipients, std::vector<std::string>{"later@example.com"});
+    EXPECT_EQ(record.attempts, 1);
+  }
+  EXPECT_LE(server.sessionCount(), 2);
+
+  fs::remove_all(directory);
+}
+
+TEST(RelayEngine, deliversToLocalMailboxes) {
+  std::string directory = temporarySpool("mailboxes");
+  Spool spool{directory + "/spool"};
+  Mailboxes mailboxes{directory + "/mailboxes"};
+
+  RelayOptions options{};
+  options.mailboxes = &mailboxes;
+  std::vector<std::string> recipients{"a@example.com", "b@example.com", "bad/name@example.com"};
+  QueueRecord record{};
+  {
+    RelayEngine relay{spool, options};
+    spool.committed = [&relay](const QueueRecord &record) { relay.enqueue(record); };
+    record = spoolMessage(spool, recipients, "one\r\n");
+    for (int i = 0; i < 500 && !spool.records().empty(); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    spool.committed = nullptr;
+  }
+
+  // Delivered, or failed for the recipient without a valid mailbox
+  EXPECT_TRUE(spool.records().empty());
+  EXPECT_FALSE(fs::exists(spool.bodyPath(record.id)));
+  for (const auto &recipient : {"a@example.com", "b@example.com"}) {
+    EXPECT_EQ(mailboxes.messages(recipient), std::vector<std::string>{record.id});
+    EXPECT_EQ(fs::hard_link_count(mailboxes.path(recipient, record.id)), 2);
+  }
+
+  fs::remove_all(directory);
+}
+
+TEST(RelayEngine, inflatesCompressedBodiesForTheMailboxes) {
+  std::string directory = temporarySpool("compressed");
+  Spool spool{directory + "/spool"};
+  spool.compress(1);
+  Mailboxes mailboxes{directory + "/mailboxes"};
+
+  RelayOptions options{};
+  options.mailboxes = &mailboxes;
+  QueueRecord record{};
+  {
+    RelayEngine relay{spool, options};
+    spool.committed = [&relay](const QueueRecord &record) { relay.enqueue(record); };
+    record = spoolMessage(spool, {"a@example.com", "b@example.com"}, "Subject: hi\r\n\r\none\r\n");
+    for (int i = 0; i < 500 && !spool.records().empty(); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    spool.committed = nullptr;
+  }
+
+  // Both mailboxes share the plain copy, which is gone from tmp/
+  EXPECT_TRUE(record.compressed);
+  EXPECT_TRUE(spool.records().empty());
+  EXPECT_TRUE(fs::is_empty(directory + "/spool/tmp"));
+  for (const auto &recipient : {"a@example.com", "b@example.com"}) {
+    std::ifstream file{mailboxes.path(recipient, record.id)};
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}),
+              "Subject: hi\r\n\r\none\r\n");
+    EXPECT_EQ(fs::hard_link_count(mailboxes.path(recipient, record.id)), 2);
+  }
+
+  fs::remove_all(directory);
+}
@@ -0,0 +1,158 @@
+#include "messageCatalog.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static constexpr std::time_t start = 1790000000;
+static constexpr size_t senders = 100003;
+static constexpr size_t logLines = 16384;
+
+// Message `i` of a catalog, one every 3 seconds from `start`
+static CatalogEntry entryOf(size_t i) {
+  char messageId[64];
+  std::snprintf(messageId,
+                sizeof(messageId),
+                "%016llx.%zu@example.net",
+                static_cast<unsigned long long>(i * 0x9e3779b97f4a7c15ULL),
+                i);
+  CatalogEntry entry{};
+  entry.accepted = start + static_cast<std::time_t>(i * 3);
+  entry.client = "198.51.100." + std::to_string(i % 250);
+  entry.sender = "sender" + std::to_string(i % senders) + "@example.net";
+  entry.recipients = {"user" + std::to_string(i % 5000) + "@example.com", "team@example.com"};
+  entry.messageId = messageId;
+  entry.size = 1024 + i % 100000;
+  entry.id = std::to_string(i);
+  entry.location = "/var/spool/miniSMTP/msg/" + entry.id;
+  return entry;
+}
+
+/**
+ * @brief A catalog of `count` messages, as compaction leaves it.
+ *
+ * @details `MessageCatalog::maxSegments` segments, then a full log not
+ * compacted yet, which every query scans.
+ */
+static const std::string &catalogOf(size_t count) {
+  struct Catalog {
+    std::string directory{};
+    ~Catalog() { fs::remove_all(directory); }
+  };
+  static std::map<size_t, Catalog> catalogs{};
+  auto found = catalogs.find(count);
+  if (found != catalogs.end()) {
+    return found->second.directory;
+  }
+
+  Catalog &catalog = catalogs[count];
+  catalog.directory =
+      (fs::temp_directory_path() / ("catalogBench." + std::to_string(::getpid()) + "." + std::to_string(count)))
+          .string();
+  fs::create_directories(catalog.directory);
+  const size_t indexed = count - logLines;
+  const size_t perSegment = indexed / MessageCatalog::maxSegments + 1;
+  for (size_t first = 0; first < indexed; first += perSegment) {
+    std::string text{};
+    for (size_t i = first; i < std::min(first + perSegment, indexed); ++i) {
+      text += entryOf(i).line();
+    }
+    std::vector<std::string_view> lines{};
+    for (size_t end = text.find('\n'), at = 0; end != std::string::npos; at = end + 1, end = text.find('\n', at)) {
+      lines.push_back(std::string_view{text}.substr(at, end - at));
+    }
+    const std::string name = "bench" + std::to_string(first);
+    CatalogSegment::build(std::move(lines), {name}, catalog.directory + "/segment." + name);
+  }
+  std::ofstream log{catalog.directory + "/log.bench", std::ios::binary};
+  for (size_t i = indexed; i < count; ++i) {
+    log << entryOf(i).line();
+  }
+  return catalog.directory;
+}
+
+// What the DATA path adds to a commit
+static void BM_Append(benchmark::State &state) {
+  const std::string directory = (fs::temp_directory_path() / ("catalogBench." + std::to_string(::getpid()))).string();
+  {
+    MessageCatalog catalog{directory};
+    const CatalogEntry entry = entryOf(42);
+    for (auto _ : state) {
+      catalog.append(entry);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  }
+  fs::remove_all(directory);
+}
+BENCHMARK(BM_Append);
+
+// Compacting a full log
+static void BM_BuildSegment(benchmark::State &state) {
+  std::string text{};
+  for (size_t i = 0; i < logLines; ++i) {
+    text += entryOf(i).line();
+  }
+  std::vector<std::string_view> lines{};
+  for (size_t end = text.find('\n'), at = 0; end != std::string::npos; at = end + 1, end = text.find('\n', at)) {
+    lines.push_back(std::string_view{text}.substr(at, end - at));
+  }
+  const std::string path = (fs::temp_directory_path() / ("catalogBench." + std::to_string(::getpid()))).string();
+  for (auto _ : state) {
+    CatalogSegment::build(lines, {"bench"}, path);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * logLines));
+  fs::remove(path);
+}
+BENCHMARK(BM_BuildSegment)->Unit(benchmark::kMillisecond);
+
+// Args: messages in the catalog, then 0 for a Message-ID, 1 for a sender and 2 for an hour
+static CatalogQuery queryOf(const benchmark::State &state, size_t i) {
+  CatalogQuery query{};
+  const auto count = static_cast<size_t>(state.range(0));
+  const CatalogEntry entry = entryOf(i % count);
+  switch (state.range(1)) {
+    case 0:
+      query.messageId = entry.messageId;
+      break;
+    case 1:
+      query.sender = entry.sender;
+      break;
+    default:
+      query.from = entry.accepted;
+      query.to = entry.accepted + 3600;
+      break;
+  }
+  return query;
+}
+
+// A lookup in a view already taken
+static void BM_Search(benchmark::State &state) {
+  CatalogReader reader{catalogOf(static_cast<size_t>(state.range(0)))};
+  std::mt19937_64 random{7};
+  size_t found = 0;
+  for (auto _ : state) {
+    found += reader.search(queryOf(state, random())).size();
+  }
+  state.counters["found"] = static_cast<double>(found) / static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_Search)->ArgsProduct({{1 << 20, 10 << 20}, {0, 1, 2}})->Unit(benchmark::kMicrosecond);
+
+// What queryCatalog pays: taking the view, reading the log, then the lookup
+static void BM_Query(benchmark::State &state) {
+  const std::string &directory = catalogOf(static_cast<size_t>(state.range(0)));
+  std::mt19937_64 random{7};
+  for (auto _ : state) {
+    CatalogReader reader{directory};
+    benchmark::DoNotOptimize(reader.search(queryOf(state, random())));
+  }
+}
+BENCHMARK(BM_Query)->ArgsProduct({{1 << 20, 10 << 20}, {0}})->Unit(benchmark::kMillisecond);
@@ -0,0 +1,86 @@
+#include "checksum.hpp"
+#include "spool.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// A 1 MB body in lines of 78 characters, the limit RFC 5322 recommends
+static const std::vector<std::string> &lines() {
+  static const std::vector<std::string> result = [] {
+    std::vector<std::string> body{};
+    for (size_t size = 0; size < 1024 * 1024; size += 80) {
+      body.push_back(std::string(78, static_cast<char>('a' + body.size() % 26)) + "\r\n");
+    }
+    return body;
+  }();
+  return result;
+}
+
+static void BM_Crc32cLines(benchmark::State &state) {
+  size_t bytes = 0;
+  for (auto _ : state) {
+    uint32_t crc = 0;
+    for (const auto &line : lines()) {
+      crc = crc32c(crc, line);
+      bytes += line.size();
+    }
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK(BM_Crc32cLines);
+
+static void BM_Crc32cPortableLines(benchmark::State &state) {
+  size_t bytes = 0;
+  for (auto _ : state) {
+    uint32_t crc = 0;
+    for (const auto &line : lines()) {
+      crc = crc32cPortable(crc, line);
+      bytes += line.size();
+    }
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK(BM_Crc32cPortableLines);
+
+// How the spool checksums the body, one write buffer at a time
+static void BM_Crc32cBuffers(benchmark::State &state) {
+  std::string body{};
+  for (const auto &line : lines()) {
+    body += line;
+  }
+  for (auto _ : state) {
+    uint32_t crc = 0;
+    for (size_t start = 0; start < body.size(); start += 64 * 1024) {
+      crc = crc32c(crc, std::string_view{body}.substr(start, 64 * 1024));
+    }
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * body.size()));
+}
+BENCHMARK(BM_Crc32cBuffers);
+
+// What DATA costs the spool, the checksum included: buffering and writing
+// the lines to tmp/, without the fsyncs of the commit
+static void BM_IngestLines(benchmark::State &state) {
+  const std::string directory = (fs::temp_directory_path() / ("checksumBench." + std::to_string(::getpid()))).string();
+  Spool spool{directory};
+  size_t bytes = 0;
+  for (auto _ : state) {
+    auto writer = spool.create();
+    for (const auto &line : lines()) {
+      writer->append(line);
+      bytes += line.size();
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  fs::remove_all(directory);
+}
+BENCHMARK(BM_IngestLines);
@@ -0,0 +1,247 @@
+#include "compression.hpp"
+#include "socket.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static constexpr size_t blockSize = 64 * 1024;
+
+static const std::vector<std::string> words{
+    "the",      "of",       "and",     "to",       "in",        "for",      "is",       "on",       "that",
+    "by",       "this",     "with",    "you",      "it",        "not",      "or",       "be",       "are",
+    "from",     "at",       "as",      "your",     "all",       "have",     "new",      "more",     "an",
+    "was",      "we",       "will",    "can",      "us",        "about",    "if",       "my",       "has",
+    "please",   "order",    "account", "invoice",  "meeting",   "report",   "project",  "update",   "team",
+    "attached", "review",   "change",  "release",  "customer",  "service",  "payment",  "schedule", "thanks",
+    "question", "details",  "week",    "today",    "tomorrow",  "monday",   "friday",   "office",   "budget",
+    "draft",    "contract", "support", "ticket",   "deadline",  "version",  "server",   "database", "deploy",
+    "issue",    "feedback", "summary", "agenda",   "quarter",   "numbers",  "forecast", "regards",  "hello",
+    "confirm",  "shipping", "address", "delivery", "available", "required", "following", "received", "sent",
+};
+
+static const std::vector<std::string> footers{
+    "This message and its attachments are confidential and intended solely for the addressee.\r\n"
+    "If you received it in error, please notify the sender and delete it.\r\n",
+    "Sent from my phone\r\n",
+    "--\r\nExample Corp | 1 Example Street | example.com\r\n"
+    "To unsubscribe from these notifications, change your settings in your account.\r\n",
+    "Please consider the environment before printing this email.\r\n",
+};
+
+static std::string sentence(std::mt19937 &random) {
+  std::uniform_real_distribution<double> uniform{0, 1};
+  std::string line{};
+  size_t count = 4 + random() % 12;
+  for (size_t i = 0; i < count; ++i) {
+    // Skewed towards the first words, like English
+    double u = uniform(random);
+    line += words[static_cast<size_t>(u * u * u * static_cast<double>(words.size()))];
+    line += i + 1 < count ? " " : ".\r\n";
+  }
+  return line;
+}
+
+static std::string base64(std::string_view data) {
+  static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string result{};
+  size_t column = 0;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    const size_t count = std::min<size_t>(3, data.size() - i);
+    uint32_t bits = 0;
+    for (size_t j = 0; j < 3; ++j) {
+      bits = bits << 8 | (j < count ? static_cast<uint8_t>(data[i + j]) : 0);
+    }
+    for (size_t j = 0; j < 4; ++j) {
+      result += j <= count ? alphabet[(bits >> (18 - 6 * j)) & 63] : '=';
+    }
+    if ((column += 4) == 76) {
+      result += "\r\n";
+      column = 0;
+    }
+  }
+  return result + "\r\n";
+}
+
+/**
+ * @brief A synthetic corpus, the training half then the half measured.
+ *
+ * @details Headers from a few senders and relays, English-like text with a
+ * footer, and in one message in five a base64 attachment: half of them a
+ * CSV export, half random bytes, like a PDF or a JPEG, which deflate cannot
+ * shrink.
+ */
+static const std::vector<std::string> &corpus() {
+  static const std::vector<std::string> result = [] {
+    std::mt19937 random{2026};
+    std::vector<std::string> messages{};
+    for (int n = 0; n < 2000; ++n) {
+      const unsigned sender = random() % 40;
+      std::string message{};
+      message += "Received: from mail" + std::to_string(sender % 8) + ".example.net (mail" +
+                 std::to_string(sender % 8) + ".example.net [198.51.100." + std::to_string(sender % 8) + "])\r\n";
+      message += "\tby mx.example.com with ESMTPS id " + std::to_string(random()) + "\r\n";
+      message += "From: Sender " + std::to_string(sender) + " <sender" + std::to_string(sender) + "@example.net>\r\n";
+      message += "To: user" + std::to_string(random() % 500) + "@example.com\r\n";
+      message += "Subject: " + sentence(random);
+      message += "Date: Mon, 19 Oct 2026 0" + std::to_string(random() % 10) + ":" + std::to_string(10 + random() % 50) +
+                 ":00 +0000\r\n";
+      message += "Message-ID: <" + std::to_string(random()) + "." + std::to_string(random()) + "@example.net>\r\n";
+      message += "MIME-Version: 1.0\r\n";
+
+      std::string text{};
+      for (size_t lines = 3 + random() % 40; lines > 0; --lines) {
+        text += sentence(random);
+      }
+      text += "\r\n" + footers[sender % footers.size()];
+
+      if (random() % 5 != 0) {
+        message += "Content-Type: text/plain; charset=utf-8\r\n\r\n" + text;
+      } else {
+        const std::string boundary = "----=_Part_" + std::to_string(random());
+        message += "Content-Type: multipart/mixed; boundary=\"" + boundary + "\"\r\n\r\n";
+        message += "--" + boundary + "\r\nContent-Type: text/plain; charset=utf-8\r\n\r\n" + text;
+        std::string attachment{};
+        const size_t size = 2048 + random() % (60 * 1024);
+        const bool csv = random() % 2 == 0;
+        while (attachment.size() < size) {
+          if (csv) {
+            attachment += std::to_string(random() % 100000) + "," + words[random() % words.size()] + "," +
+                          std::to_string(random() % 1000) + ".00\n";
+          } else {
+            attachment += static_cast<char>(random());
+          }
+        }
+        message += "--" + boundary + "\r\nContent-Type: application/octet-stream\r\n";
+        message += "Content-Transfer-Encoding: base64\r\n\r\n" + base64(attachment);
+        message += "--" + boundary + "--\r\n";
+      }
+      messages.push_back(std::move(message));
+    }
+    return messages;
+  }();
+  return result;
+}
+
+static std::vector<std::string_view> measured(bool attachments) {
+  std::vector<std::string_view> result{};
+  for (size_t i = corpus().size() / 2; i < corpus().size(); ++i) {
+    if (attachments || corpus()[i].find("multipart/mixed") == std::string::npos) {
+      result.push_back(corpus()[i]);
+    }
+  }
+  return result;
+}
+
+static std::shared_ptr<const Dictionary> trained() {
+  static const auto result = [] {
+    std::vector<std::string> samples(corpus().begin(), corpus().begin() + static_cast<ptrdiff_t>(corpus().size() / 2));
+    return std::make_shared<const Dictionary>(Dictionary::train(samples));
+  }();
+  return result;
+}
+
+// Write `message` as the spool does, a block per buffer
+static uint64_t compress(FileDescriptor &file, std::string_view message, BlockCompressor &compressor) {
+  CompressedWriter writer{file, compressor};
+  for (size_t offset = 0; offset < message.size(); offset += blockSize) {
+    std::string_view block = message.substr(offset, blockSize);
+    writer.write(block, {}, offset + blockSize >= message.size());
+  }
+  return writer.written();
+}
+
+// Args: the corpus, 0 for text only and 1 with the attachments, the zlib level, and 1 with the dictionary
+static void BM_Compress(benchmark::State &state) {
+  const auto messages = measured(state.range(0) != 0);
+  BlockCompressor compressor{static_cast<int>(state.range(1)), state.range(2) != 0 ? trained() : nullptr};
+  FileDescriptor null{SystemCall("open /dev/null", ::open("/dev/null", O_WRONLY | O_CLOEXEC))};
+
+  uint64_t raw = 0;
+  uint64_t written = 0;
+  for (auto _ : state) {
+    raw = written = 0;
+    for (std::string_view message : messages) {
+      raw += message.size();
+      written += compress(null, message, compressor);
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw));
+  state.counters["ratio"] = static_cast<double>(raw) / static_cast<double>(written);
+  state.counters["messages"] = static_cast<double>(messages.size());
+}
+BENCHMARK(BM_Compress)->ArgsProduct({{0, 1}, {1, 6, 9}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// Stream every measured message back, as the relay does
+static void BM_Inflate(benchmark::State &state) {
+  const auto messages = measured(true);
+  BlockCompressor compressor{static_cast<int>(state.range(0)), state.range(1) != 0 ? trained() : nullptr};
+  const fs::path directory = fs::temp_directory_path() / ("compressionBench." + std::to_string(::getpid()));
+  fs::create_directories(directory);
+  uint64_t raw = 0;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const std::string path = (directory / std::to_string(i)).string();
+    FileDescriptor file{
+        SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+    compress(file, messages[i], compressor);
+    raw += messages[i].size();
+  }
+
+  auto lookup = [](uint32_t) { return trained(); };
+  std::string chunk{};
+  for (auto _ : state) {
+    for (size_t i = 0; i < messages.size(); ++i) {
+      const std::string path = (directory / std::to_string(i)).string();
+      CompressedReader reader{FileDescriptor{SystemCall("open", ::open(path.c_str(), O_RDONLY | O_CLOEXEC))}, lookup};
+      for (reader.read(chunk); !chunk.empty(); reader.read(chunk)) {
+        benchmark::DoNotOptimize(chunk.data());
+      }
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw));
+  fs::remove_all(directory);
+}
+BENCHMARK(BM_Inflate)->ArgsProduct({{1, 6}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// The last 4 KB of a 4 MB message: arg 1 seeks to them, 0 inflates the whole message to get there
+static void BM_ReadTheEnd(benchmark::State &state) {
+  std::string message{};
+  std::mt19937 random{1};
+  while (message.size() < 4 * 1024 * 1024) {
+    message += sentence(random);
+  }
+  const std::string path =
+      (fs::temp_directory_path() / ("compressionBench." + std::to_string(::getpid()) + ".seek")).string();
+  {
+    FileDescriptor file{
+        SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+    BlockCompressor compressor{1};
+    compress(file, message, compressor);
+  }
+
+  const bool seek = state.range(0) != 0;
+  std::string chunk{};
+  for (auto _ : state) {
+    CompressedReader reader{FileDescriptor{SystemCall("open", ::open(path.c_str(), O_RDONLY | O_CLOEXEC))}, nullptr};
+    std::string end{};
+    if (seek) {
+      reader.seek(reader.size() - 4096);
+    }
+    for (reader.read(chunk); !chunk.empty(); reader.read(chunk)) {
+      end = chunk;
+    }
+    benchmark::DoNotOptimize(end.data());
+  }
+  ::unlink(path.c_str());
+}
+BENCHMARK(BM_ReadTheEnd)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
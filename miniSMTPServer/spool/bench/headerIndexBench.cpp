@@ -0,0 +1,101 @@
+#include "headerIndex.hpp"
+#include "socket.hpp"
+#include "spool.hpp"
+#include "util.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <strings.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// The header section of a message relayed a few times, then a 1 MB body
+static const std::vector<std::string> &lines() {
+  static const std::vector<std::string> result = [] {
+    std::vector<std::string> message{};
+    for (int hop = 0; hop < 6; ++hop) {
+      message.push_back("Received: from relay" + std::to_string(hop) + ".example.com ([192.0.2.1])\r\n");
+      message.push_back("\tby mx.example.com with ESMTPS id 00065e2b51010119.1384.0\r\n");
+      message.push_back("\tfor <user@example.com>; Mon, 19 Oct 2026 06:06:00 +0000\r\n");
+    }
+    message.push_back("DKIM-Signature: v=1; a=rsa-sha256; d=example.com; s=s1; h=from:to:subject:date;\r\n");
+    message.push_back("\tbh=47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=\r\n");
+    message.push_back("From: Someone <someone@example.com>\r\n");
+    message.push_back("To: user@example.com\r\n");
+    message.push_back("Subject: The report\r\n");
+    message.push_back("Date: Mon, 19 Oct 2026 06:05:59 +0000\r\n");
+    message.push_back("Message-ID: <00065e2b51010119@example.com>\r\n");
+    message.push_back("MIME-Version: 1.0\r\n");
+    message.push_back("Content-Type: text/plain; charset=utf-8\r\n");
+    message.push_back("\r\n");
+    for (size_t size = 0; size < 1024 * 1024; size += 80) {
+      message.push_back(std::string(78, 'x') + "\r\n");
+    }
+    return message;
+  }();
+  return result;
+}
+
+// Index while the message streams in, then look the fields up
+static void BM_IndexWhileReceiving(benchmark::State &state) {
+  for (auto _ : state) {
+    HeaderIndex index{};
+    for (const auto &line : lines()) {
+      if (!index.complete()) {
+        index.append(line);
+      }
+    }
+    benchmark::DoNotOptimize(index.find(Header::MessageId));
+    benchmark::DoNotOptimize(index.find(Header::From));
+    benchmark::DoNotOptimize(index.find(Header::Date));
+  }
+}
+BENCHMARK(BM_IndexWhileReceiving);
+
+// What the index saves: read the spooled message back and look for the fields
+static void BM_ReparseFromSpool(benchmark::State &state) {
+  const std::string directory =
+      (fs::temp_directory_path() / ("headerIndexBench." + std::to_string(::getpid()))).string();
+  Spool spool{directory};
+  auto writer = spool.create();
+  for (const auto &line : lines()) {
+    writer->append(line);
+  }
+  const std::string path = spool.bodyPath(writer->commit(Envelope{"a@example.com", {"b@example.com"}})->id);
+
+  std::string head{};
+  for (auto _ : state) {
+    FileDescriptor file{SystemCall("open", ::open(path.c_str(), O_RDONLY | O_CLOEXEC))};
+    file.read(head, 64 * 1024);
+    std::string_view rest{head};
+    rest = rest.substr(0, rest.find("\r\n\r\n"));
+    for (const char *name : {"\nMessage-ID:", "\nFrom:", "\nDate:"}) {
+      size_t at = std::string::npos;
+      for (size_t i = 0; i < rest.size() && at == std::string::npos; ++i) {
+        if (::strncasecmp(rest.data() + i, name, std::strlen(name)) == 0) {
+          at = i;
+        }
+      }
+      benchmark::DoNotOptimize(at);
+    }
+  }
+  fs::remove_all(directory);
+}
+BENCHMARK(BM_ReparseFromSpool);
+
+// A lookup once the index is built
+static void BM_Lookup(benchmark::State &state) {
+  HeaderIndex index{};
+  for (const auto &line : lines()) {
+    index.append(line);
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.find(Header::MessageId));
+  }
+}
+BENCHMARK(BM_Lookup);
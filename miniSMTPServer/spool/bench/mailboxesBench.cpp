@@ -0,0 +1,123 @@
+#include "mailboxes.hpp"
+#include "socket.hpp"
+#include "spool.hpp"
+#include "util.hpp"
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// A 1 MB body, large enough for the copies to show
+static constexpr size_t bodySize = 1024 * 1024;
+
+static std::vector<std::string> recipients(int count) {
+  std::vector<std::string> result{};
+  for (int i = 0; i < count; ++i) {
+    result.push_back("user" + std::to_string(i) + "@example.com");
+  }
+  return result;
+}
+
+/**
+ * @brief A spool holding one message of `bodySize` bytes to `count` recipients.
+ *
+ */
+struct Fixture {
+  std::string directory = (fs::temp_directory_path() / ("mailboxesBench." + std::to_string(::getpid()))).string();
+  Spool spool{directory + "/spool"};
+  QueueRecord record{};
+
+  explicit Fixture(int count) {
+    auto writer = spool.create();
+    const std::string line(1022, 'x');
+    for (size_t written = 0; written < bodySize; written += line.size() + 2) {
+      writer->append(line + "\r\n");
+    }
+    record = writer->commit(Envelope{"shejialuo@gmail.com", recipients(count)}).value();
+  }
+
+  ~Fixture() { fs::remove_all(directory); }
+};
+
+/**
+ * @brief What a naive local delivery does: one durable copy of the body per mailbox.
+ *
+ */
+static size_t copyToEveryMailbox(const std::string &root, const QueueRecord &record, const std::string &body) {
+  std::string content{};
+  FileDescriptor{SystemCall("open", ::open(body.c_str(), O_RDONLY | O_CLOEXEC))}.read(content, bodySize);
+
+  size_t written = 0;
+  for (const auto &recipient : record.envelope.recipients) {
+    const std::string mailbox = root + "/" + recipient;
+    fs::create_directories(mailbox + "/tmp");
+    fs::create_directories(mailbox + "/new");
+    const std::string partial = mailbox + "/tmp/" + record.id;
+    FileDescriptor file{SystemCall("open", ::open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+    written += file.write(content);
+    SystemCall("fsync", ::fsync(file.fd_num()));
+    SystemCall("rename", ::rename(partial.c_str(), (mailbox + "/new/" + record.id).c_str()));
+    FileDescriptor fresh{SystemCall("open", ::open((mailbox + "/new").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))};
+    SystemCall("fsync", ::fsync(fresh.fd_num()));
+  }
+  return written;
+}
+
+// Mailboxes are made once, on the first delivery, so only the message goes
+static void clear(const std::string &root, const QueueRecord &record) {
+  for (const auto &recipient : record.envelope.recipients) {
+    fs::remove(fs::path{root} / recipient / "new" / record.id);
+  }
+}
+
+// Bytes written for the message, the spooled body included, per byte of body
+static void report(benchmark::State &state, size_t written) {
+  state.counters["writeAmplification"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * bodySize + written) / static_cast<double>(bodySize),
+      benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_SharedDelivery(benchmark::State &state) {
+  Fixture fixture{static_cast<int>(state.range(0))};
+  const std::string root = fixture.directory + "/mailboxes";
+  const std::string body = fixture.spool.bodyPath(fixture.record.id);
+  Mailboxes mailboxes{root};
+  mailboxes.deliver(fixture.record.id, fixture.record.envelope.recipients, body);
+  clear(root, fixture.record);
+
+  size_t written = 0;
+  for (auto _ : state) {
+    written += mailboxes.deliver(fixture.record.id, fixture.record.envelope.recipients, body).bytesWritten;
+
+    state.PauseTiming();
+    clear(root, fixture.record);
+    state.ResumeTiming();
+  }
+  report(state, written);
+}
+BENCHMARK(BM_SharedDelivery)->Arg(1)->Arg(10)->Arg(100)->Arg(500)->UseRealTime();
+
+static void BM_CopiedDelivery(benchmark::State &state) {
+  Fixture fixture{static_cast<int>(state.range(0))};
+  const std::string root = fixture.directory + "/mailboxes";
+  const std::string body = fixture.spool.bodyPath(fixture.record.id);
+  copyToEveryMailbox(root, fixture.record, body);
+  clear(root, fixture.record);
+
+  size_t written = 0;
+  for (auto _ : state) {
+    written += copyToEveryMailbox(root, fixture.record, body);
+
+    state.PauseTiming();
+    clear(root, fixture.record);
+    state.ResumeTiming();
+  }
+  report(state, written);
+}
+BENCHMARK(BM_CopiedDelivery)->Arg(1)->Arg(10)->Arg(100)->Arg(500)->UseRealTime();
@@ -0,0 +1,147 @@
+#include "checksum.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// The reflected Castagnoli polynomial
+static constexpr uint32_t polynomial = 0x82f63b78;
+
+static constexpr std::array<uint32_t, 256> table = [] {
+  std::array<uint32_t, 256> result{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (crc & 1 ? polynomial : 0);
+    }
+    result[i] = crc;
+  }
+  return result;
+}();
+
+uint32_t crc32cPortable(uint32_t crc, std::string_view data) {
+  crc = ~crc;
+  for (unsigned char byte : data) {
+    crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+// The crc32 instruction takes 3 cycles and a new one can start every cycle,
+// so long buffers are cut in three lanes checksummed at once, then combined
+static constexpr size_t longLane = 8192;
+static constexpr size_t shortLane = 256;
+
+// Multiply a 32x32 matrix over GF(2) by a vector
+static constexpr uint32_t times(const std::array<uint32_t, 32> &matrix, uint32_t vector) {
+  uint32_t sum = 0;
+  for (size_t i = 0; vector != 0; vector >>= 1, ++i) {
+    sum ^= vector & 1 ? matrix[i] : 0;
+  }
+  return sum;
+}
+
+static constexpr std::array<uint32_t, 32> square(const std::array<uint32_t, 32> &matrix) {
+  std::array<uint32_t, 32> result{};
+  for (size_t i = 0; i < 32; ++i) {
+    result[i] = times(matrix, matrix[i]);
+  }
+  return result;
+}
+
+// Tables moving a CRC past `length` zero bytes, so a lane checksummed from 0
+// can be appended to the one before it, see zlib's crc32_combine
+static constexpr std::array<std::array<uint32_t, 256>, 4> zeros(size_t length) {
+  std::array<uint32_t, 32> odd{};  // One zero bit
+  odd[0] = polynomial;
+  for (size_t i = 1; i < 32; ++i) {
+    odd[i] = 1u << (i - 1);
+  }
+  std::array<uint32_t, 32> even = square(odd);  // Two zero bits
+  odd = square(even);                           // Four zero bits
+  std::array<uint32_t, 32> *result = &odd;
+  // Every square doubles the zero bits, the first one below makes it a byte
+  while (length != 0) {
+    even = square(odd);
+    length >>= 1;
+    result = &even;
+    if (length == 0) {
+      break;
+    }
+    odd = square(even);
+    length >>= 1;
+    result = &odd;
+  }
+
+  std::array<std::array<uint32_t, 256>, 4> tables{};
+  for (uint32_t n = 0; n < 256; ++n) {
+    for (size_t byte = 0; byte < 4; ++byte) {
+      tables[byte][n] = times(*result, n << (8 * byte));
+    }
+  }
+  return tables;
+}
+
+static constexpr auto longZeros = zeros(longLane);
+static constexpr auto shortZeros = zeros(shortLane);
+
+static uint32_t shift(const std::array<std::array<uint32_t, 256>, 4> &tables, uint32_t crc) {
+  return tables[0][crc & 0xff] ^ tables[1][(crc >> 8) & 0xff] ^ tables[2][(crc >> 16) & 0xff] ^ tables[3][crc >> 24];
+}
+
+static inline uint64_t load(const char *data) {
+  uint64_t word = 0;
+  std::memcpy(&word, data, 8);
+  return word;
+}
+
+// Built for SSE4.2 whatever the rest of the program is built for, only
+// called once the CPU is known to have it
+__attribute__((target("sse4.2"))) static uint32_t crc32cHardware(uint32_t crc, std::string_view data) {
+  const char *next = data.data();
+  size_t left = data.size();
+  uint64_t crc0 = ~crc;
+
+  for (size_t lane : {longLane, shortLane}) {
+    const auto &tables = lane == longLane ? longZeros : shortZeros;
+    for (; left >= 3 * lane; next += 3 * lane, left -= 3 * lane) {
+      uint64_t crc1 = 0;
+      uint64_t crc2 = 0;
+      for (size_t i = 0; i < lane; i += 8) {
+        crc0 = _mm_crc32_u64(crc0, load(next + i));
+        crc1 = _mm_crc32_u64(crc1, load(next + lane + i));
+        crc2 = _mm_crc32_u64(crc2, load(next + 2 * lane + i));
+      }
+      crc0 = shift(tables, static_cast<uint32_t>(crc0)) ^ crc1;
+      crc0 = shift(tables, static_cast<uint32_t>(crc0)) ^ crc2;
+    }
+  }
+
+  for (; left >= 8; next += 8, left -= 8) {
+    crc0 = _mm_crc32_u64(crc0, load(next));
+  }
+  auto narrow = static_cast<uint32_t>(crc0);
+  for (; left > 0; ++next, --left) {
+    narrow = _mm_crc32_u8(narrow, static_cast<unsigned char>(*next));
+  }
+  return ~narrow;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, std::string_view data) {
+  // Chosen on the first call, which may come from a static initializer
+  static const auto implementation = [] {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+      return crc32cHardware;
+    }
+#endif
+    return crc32cPortable;
+  }();
+  return implementation(crc, data);
+}
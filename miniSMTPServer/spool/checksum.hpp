@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @brief Extend a CRC32C (Castagnoli) checksum with `data`.
+ *
+ * @details Start with 0 and feed the data in any number of pieces, the
+ * result is the same as for one piece. Uses the SSE4.2 crc32 instruction
+ * when the CPU has it, a table otherwise. The instruction is fastest on
+ * pieces of a few KB and more.
+ *
+ * @param[in] crc the checksum of what came before
+ * @param[in] data what comes next
+ * @return uint32_t the checksum of both
+ */
+uint32_t crc32c(uint32_t crc, std::string_view data);
+
+//! `crc32c` without the SSE4.2 instruction, for CPUs without it and to compare against
+uint32_t crc32cPortable(uint32_t crc, std::string_view data);
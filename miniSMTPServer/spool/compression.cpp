@@ -0,0 +1,331 @@
+#include "compression.hpp"
+
+#include "checksum.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <zlib.h>
+
+static_assert(std::endian::native == std::endian::little, "the block headers are written as they are in memory");
+
+static constexpr std::string_view magic{"MSZ\x01", 4};
+static constexpr std::string_view endMagic{"MSZE", 4};
+static constexpr size_t headerSize = 8;
+static constexpr size_t blockHeaderSize = 8;
+static constexpr size_t indexEntrySize = 16;
+static constexpr size_t footerSize = 16;
+
+// Raw deflate, without the zlib header and checksum, the spool has its own
+static constexpr int windowBits = -15;
+
+template <typename T>
+static void put(std::string &out, T value) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &value, sizeof(T));
+  out.append(bytes, sizeof(T));
+}
+
+template <typename T>
+static T get(std::string_view in, size_t at) {
+  T value{};
+  std::memcpy(&value, in.data() + at, sizeof(T));
+  return value;
+}
+
+static std::string hex(uint32_t id) {
+  char name[16];
+  std::snprintf(name, sizeof(name), "%08x", id);
+  return name;
+}
+
+Dictionary::Dictionary(std::string d) : id{crc32c(0, d)}, data{std::move(d)} {}
+
+Dictionary Dictionary::load(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error("cannot open dictionary " + path);
+  }
+  std::string data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  if (data.empty() || data.size() > maxSize) {
+    throw std::runtime_error(path + " is not a dictionary of at most " + std::to_string(maxSize) + " bytes");
+  }
+  return Dictionary{std::move(data)};
+}
+
+Dictionary Dictionary::train(const std::vector<std::string> &samples, size_t size) {
+  static constexpr size_t shortest = 4;
+
+  // In how many samples every line and every word is
+  std::unordered_map<std::string_view, size_t> seen{};
+  std::unordered_set<std::string_view> strings{};
+  for (const std::string &sample : samples) {
+    strings.clear();
+    std::string_view rest{sample};
+    while (!rest.empty()) {
+      size_t end = rest.find('\n');
+      std::string_view line = rest.substr(0, end == std::string_view::npos ? rest.size() : end + 1);
+      rest.remove_prefix(line.size());
+      if (line.size() >= shortest) {
+        strings.insert(line);
+      }
+      // A word with the space after it, a field name with its colon
+      for (size_t start = 0; start < line.size();) {
+        size_t space = line.find(' ', start);
+        size_t stop = space == std::string_view::npos ? line.size() : space + 1;
+        if (stop - start >= shortest && stop - start < line.size()) {
+          strings.insert(line.substr(start, stop - start));
+        }
+        start = stop;
+      }
+    }
+    for (std::string_view string : strings) {
+      ++seen[string];
+    }
+  }
+
+  // Every sample after the first that has it saves its length
+  std::vector<std::pair<size_t, std::string_view>> candidates{};
+  for (const auto &[string, count] : seen) {
+    if (count > 1) {
+      candidates.emplace_back((count - 1) * string.size(), string);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+
+  std::vector<std::string_view> chosen{};
+  std::string taken{};
+  for (const auto &[score, string] : candidates) {
+    if (taken.size() + string.size() > size) {
+      continue;
+    }
+    // A word of a line already in is found there
+    if (taken.find(string) != std::string::npos) {
+      continue;
+    }
+    taken.append(string);
+    chosen.push_back(string);
+  }
+
+  // Deflate refers to the end of the dictionary with the shortest distances
+  std::string data{};
+  data.reserve(taken.size());
+  for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+    data.append(*it);
+  }
+  return Dictionary{std::move(data)};
+}
+
+BlockCompressor::BlockCompressor(int level, std::shared_ptr<const Dictionary> d)
+    : stream{std::make_unique<z_stream_s>()}, dictionary{std::move(d)} {
+  if (deflateInit2(stream.get(), level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("cannot compress at level " + std::to_string(level));
+  }
+}
+
+void BlockCompressor::deflate(std::string_view data, int flush) {
+  stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream->avail_in = static_cast<uInt>(data.size());
+  // Out of space only for data deflate cannot shrink, which is then stored
+  ::deflate(stream.get(), flush);
+}
+
+void BlockCompressor::compress(std::string &out, std::string_view first, std::string_view second) {
+  const size_t length = first.size() + second.size();
+  const size_t header = out.size();
+  put<uint32_t>(out, static_cast<uint32_t>(length));
+  put<uint32_t>(out, 0);
+  const size_t start = out.size();
+
+  deflateReset(stream.get());
+  if (dictionary) {
+    deflateSetDictionary(stream.get(),
+                         reinterpret_cast<const Bytef *>(dictionary->data.data()),
+                         static_cast<uInt>(dictionary->data.size()));
+  }
+  // Never longer than stored, the output stops there
+  out.resize(start + length);
+  stream->next_out = reinterpret_cast<Bytef *>(out.data() + start);
+  stream->avail_out = static_cast<uInt>(length);
+  deflate(first, Z_NO_FLUSH);
+  deflate(second, Z_FINISH);
+
+  size_t stored = stream->total_out;
+  if (stream->avail_out == 0 || stored >= length) {
+    out.resize(start);
+    out.append(first);
+    out.append(second);
+    stored = length;
+  } else {
+    out.resize(start + stored);
+  }
+  const auto storedLength = static_cast<uint32_t>(stored);
+  std::memcpy(out.data() + header + 4, &storedLength, sizeof(storedLength));
+}
+
+BlockCompressor::~BlockCompressor() { deflateEnd(stream.get()); }
+
+CompressedWriter::CompressedWriter(FileDescriptor &f, BlockCompressor &c) : file{f}, compressor{c} {}
+
+void CompressedWriter::write(std::string_view first, std::string_view second, bool last) {
+  const size_t length = first.size() + second.size();
+  if (sealed) {
+    if (length == 0) {
+      return;
+    }
+    throw std::logic_error("a block after the last one");
+  }
+
+  if (offset == 0) {
+    out.append(magic);
+    put<uint32_t>(out, compressor.dictionaryId());
+  }
+
+  if (length > 0) {
+    blocks.emplace_back(raw, offset + out.size());
+    compressor.compress(out, first, second);
+    raw += length;
+  }
+
+  if (last) {
+    for (const auto &[rawOffset, fileOffset] : blocks) {
+      put<uint64_t>(out, rawOffset);
+      put<uint64_t>(out, fileOffset);
+    }
+    put<uint64_t>(out, raw);
+    put<uint32_t>(out, static_cast<uint32_t>(blocks.size()));
+    out.append(endMagic);
+    sealed = true;
+  }
+
+  if (!out.empty()) {
+    file.write(std::string_view{out});
+    offset += out.size();
+    out.clear();
+  }
+}
+
+CompressedReader::CompressedReader(FileDescriptor &&f, const Dictionaries &dictionaries)
+    : file{std::move(f)}, stream{std::make_unique<z_stream_s>()} {
+  struct stat status {};
+  SystemCall("fstat", ::fstat(file.fd_num(), &status));
+  const auto length = static_cast<uint64_t>(status.st_size);
+  if (length < headerSize + footerSize) {
+    throw std::runtime_error("compressed body cut short");
+  }
+
+  std::string data{};
+  pread(data, footerSize, length - footerSize);
+  total = get<uint64_t>(data, 0);
+  const auto count = get<uint32_t>(data, 8);
+  if (data.compare(12, endMagic.size(), endMagic) != 0 ||
+      count > (length - headerSize - footerSize) / (indexEntrySize + blockHeaderSize)) {
+    throw std::runtime_error("compressed body has no index");
+  }
+
+  const uint64_t index = length - footerSize - count * indexEntrySize;
+  pread(data, count * indexEntrySize, index);
+  for (size_t i = 0; i < count; ++i) {
+    blocks.emplace_back(get<uint64_t>(data, i * indexEntrySize), get<uint64_t>(data, i * indexEntrySize + 8));
+  }
+  blocks.emplace_back(total, index);
+  // Both offsets grow from the first block on, so no block reads past the next
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const auto [rawOffset, fileOffset] = blocks[i];
+    bool ordered = i == 0 ? rawOffset == 0 && fileOffset == headerSize
+                          : rawOffset > blocks[i - 1].first && fileOffset >= blocks[i - 1].second + blockHeaderSize;
+    if (!ordered) {
+      throw std::runtime_error("compressed body has a garbled index");
+    }
+  }
+
+  pread(data, headerSize, 0);
+  if (data.compare(0, magic.size(), magic) != 0) {
+    throw std::runtime_error("body is not compressed");
+  }
+  const auto id = get<uint32_t>(data, 4);
+  if (id != 0) {
+    dictionary = dictionaries ? dictionaries(id) : nullptr;
+    if (!dictionary) {
+      throw std::runtime_error("body is compressed with the unknown dictionary " + hex(id));
+    }
+  }
+
+  if (inflateInit2(stream.get(), windowBits) != Z_OK) {
+    throw std::runtime_error("cannot inflate");
+  }
+}
+
+void CompressedReader::pread(std::string &data, size_t length, uint64_t at) {
+  data.resize(length);
+  size_t done = 0;
+  while (done < length) {
+    ssize_t bytes =
+        SystemCall("pread", ::pread(file.fd_num(), data.data() + done, length - done, static_cast<off_t>(at + done)));
+    if (bytes == 0) {
+      throw std::runtime_error("compressed body cut short");
+    }
+    done += static_cast<size_t>(bytes);
+  }
+}
+
+void CompressedReader::read(std::string &chunk) {
+  chunk.clear();
+  if (position >= total) {
+    return;
+  }
+
+  // The last block starting at or before the position, the end is not one
+  auto next = std::upper_bound(
+      blocks.begin(), blocks.end() - 1, position, [](uint64_t at, const auto &block) { return at < block.first; });
+  const auto [rawOffset, fileOffset] = *(next - 1);
+  const uint64_t rawLength = next->first - rawOffset;
+
+  pread(stored, next->second - fileOffset, fileOffset);
+  const auto storedLength = get<uint32_t>(stored, 4);
+  if (get<uint32_t>(stored, 0) != rawLength || storedLength != stored.size() - blockHeaderSize ||
+      storedLength > rawLength) {
+    throw std::runtime_error("compressed body has a garbled block");
+  }
+
+  if (storedLength == rawLength) {
+    chunk.assign(stored, blockHeaderSize);
+  } else {
+    inflateReset(stream.get());
+    if (dictionary) {
+      inflateSetDictionary(stream.get(),
+                           reinterpret_cast<const Bytef *>(dictionary->data.data()),
+                           static_cast<uInt>(dictionary->data.size()));
+    }
+    chunk.resize(rawLength);
+    stream->next_in = reinterpret_cast<Bytef *>(stored.data() + blockHeaderSize);
+    stream->avail_in = storedLength;
+    stream->next_out = reinterpret_cast<Bytef *>(chunk.data());
+    stream->avail_out = static_cast<uInt>(rawLength);
+    if (inflate(stream.get(), Z_FINISH) != Z_STREAM_END || stream->avail_out != 0) {
+      throw std::runtime_error("compressed body has a corrupt block");
+    }
+  }
+
+  chunk.erase(0, position - rawOffset);
+  position = next->first;
+}
+
+CompressedReader::~CompressedReader() {
+  if (stream) {
+    inflateEnd(stream.get());
+  }
+}
+
+CompressedReader::CompressedReader(CompressedReader &&other) noexcept = default;
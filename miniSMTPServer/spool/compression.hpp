@@ -0,0 +1,199 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct z_stream_s;
+
+/**
+ * @brief A preset dictionary, the strings messages commonly start with.
+ *
+ * @details Deflate finds matches up to 32 KB back, a message's first block
+ * finds them in the dictionary too. Header fields, MIME boundaries and
+ * footers repeat across messages but seldom within a small one, so the
+ * dictionary is what makes small messages compress.
+ */
+struct Dictionary {
+  //! Deflate does not look further back
+  static constexpr size_t maxSize = 32 * 1024;
+
+  uint32_t id = 0;     //!< CRC32C of `data`, which compressed files name it by
+  std::string data{};  //!< The most useful strings last, they are the cheapest to refer to
+
+  //! A dictionary holding `data`
+  explicit Dictionary(std::string data);
+
+  //! Load the dictionary in `path`, throws std::runtime_error if it cannot
+  static Dictionary load(const std::string &path);
+
+  /**
+   * @brief Build a dictionary from sample messages.
+   *
+   * @details Lines, and words in them, are scored by how many samples have
+   * them times their length, those in a single sample are left out: a
+   * base64 line is worth nothing, a disclaimer in every message a lot.
+   *
+   * @param[in] samples complete messages
+   * @param[in] size the most bytes the dictionary holds
+   * @return Dictionary the best strings that fit
+   */
+  static Dictionary train(const std::vector<std::string> &samples, size_t size = maxSize);
+};
+
+/**
+ * @brief Deflates blocks, each on its own, with one preset dictionary.
+ *
+ * @details A deflate stream costs a few hundred KB to set up, more than
+ * compressing a small message, so one stream is reset for every block of
+ * every message. Setting the dictionary hashes it again for every block,
+ * which zlib has no way around. Not thread-safe.
+ */
+class BlockCompressor {
+private:
+  std::unique_ptr<z_stream_s> stream;
+  std::shared_ptr<const Dictionary> dictionary;
+
+  void deflate(std::string_view data, int flush);
+
+public:
+  /**
+   * @brief A compressor at `level`, with `dictionary` if there is one.
+   *
+   * @param[in] level the zlib level, 1 for speed to 9 for ratio
+   * @param[in] dictionary the preset dictionary, nullptr for none
+   */
+  explicit BlockCompressor(int level, std::shared_ptr<const Dictionary> dictionary = nullptr);
+
+  /**
+   * @brief Append a block holding `first` then `second` to `out`.
+   *
+   * @details The block is its raw length (u32), its stored length (u32)
+   * and the stored bytes, a raw deflate stream, or the data as it is when
+   * deflate does not make it shorter, e.g. an already compressed attachment.
+   *
+   * @param[in,out] out where the block goes
+   * @param[in] first the start of the block
+   * @param[in] second the rest of it
+   */
+  void compress(std::string &out, std::string_view first, std::string_view second);
+
+  //! The id of the dictionary, 0 without one
+  uint32_t dictionaryId() const { return dictionary ? dictionary->id : 0; }
+
+  ~BlockCompressor();
+
+  BlockCompressor(const BlockCompressor &other) = delete;
+  BlockCompressor &operator=(const BlockCompressor &other) = delete;
+};
+
+/**
+ * @brief Writes a file of independently compressed blocks.
+ *
+ * @details Every block is a raw deflate stream of its own, with the same
+ * preset dictionary, so any block can be inflated without those before it.
+ * Blocks are written as they come, nothing but the block at hand is held in
+ * memory. The file is:
+ *
+ *   "MSZ\x01"  dictionary id (u32, 0 for none)
+ *   the blocks, see `BlockCompressor::compress`
+ *   per block: raw offset (u64), file offset (u64)
+ *   raw size (u64), number of blocks (u32), "MSZE"
+ *
+ * Integers are little-endian.
+ */
+class CompressedWriter {
+private:
+  FileDescriptor &file;
+  BlockCompressor &compressor;
+  std::vector<std::pair<uint64_t, uint64_t>> blocks{};  //!< Raw and file offsets of every block
+  std::string out{};                                    //!< What the next write(2) writes
+  uint64_t raw = 0;                                     //!< Bytes compressed so far
+  uint64_t offset = 0;                                  //!< Bytes written so far
+  bool sealed = false;
+
+public:
+  /**
+   * @brief Start a compressed file in `file`.
+   *
+   * @param[in] file where the file is written, from its current offset
+   * @param[in] compressor compresses the blocks, it may be shared with other writers
+   */
+  CompressedWriter(FileDescriptor &file, BlockCompressor &compressor);
+
+  /**
+   * @brief Compress `first` then `second` into one block and write it.
+   *
+   * @details With `last`, the index follows in the same write, and the file
+   * is complete. Empty blocks are not written, writing nothing after the
+   * last block is allowed.
+   *
+   * @param[in] first the start of the block
+   * @param[in] second the rest of it
+   * @param[in] last whether this is the last block
+   */
+  void write(std::string_view first, std::string_view second = {}, bool last = false);
+
+  //! Bytes written to the file so far
+  uint64_t written() const { return offset; }
+};
+
+/**
+ * @brief Reads a file written by `CompressedWriter`, from any offset.
+ *
+ * @details The index at the end of the file maps raw offsets to blocks, so
+ * seeking inflates only the block the offset is in. Reads return one block,
+ * or the rest of it, at a time. A file which is cut short or garbled throws
+ * std::runtime_error.
+ */
+class CompressedReader {
+public:
+  //! The dictionary named by an id, nullptr if there is none
+  using Dictionaries = std::function<std::shared_ptr<const Dictionary>(uint32_t)>;
+
+private:
+  FileDescriptor file;
+  std::unique_ptr<z_stream_s> stream;
+  std::shared_ptr<const Dictionary> dictionary{};
+  std::vector<std::pair<uint64_t, uint64_t>> blocks{};  //!< As written, with the end of the file last
+  uint64_t total = 0;                                   //!< Raw bytes in the file
+  uint64_t position = 0;                                //!< Raw offset of the next read
+  std::string stored{};
+
+  void pread(std::string &data, size_t length, uint64_t at);
+
+public:
+  /**
+   * @brief Open the compressed file in `file`.
+   *
+   * @param[in] file the file, read with pread(2)
+   * @param[in] dictionaries where to find the dictionary the file was compressed with
+   */
+  CompressedReader(FileDescriptor &&file, const Dictionaries &dictionaries);
+
+  /**
+   * @brief Inflate what follows the current offset, to the end of its block.
+   *
+   * @param[out] chunk the bytes, empty at the end of the file
+   */
+  void read(std::string &chunk);
+
+  //! Read from raw offset `to` next, past the end reads nothing
+  void seek(uint64_t to) { position = to; }
+
+  //! Raw bytes in the file
+  uint64_t size() const { return total; }
+
+  ~CompressedReader();
+
+  CompressedReader(CompressedReader &&other) noexcept;
+  CompressedReader(const CompressedReader &other) = delete;
+  CompressedReader &operator=(const CompressedReader &other) = delete;
+};
@@ -0,0 +1,87 @@
+#include "dedupIndex.hpp"
+
+#include "util.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+DedupIndex::DedupIndex(std::string p, std::chrono::seconds w) : path{std::move(p)}, window{w} {
+  std::ifstream file{path};
+  std::time_t when = 0;
+  std::string key{};
+  // "<time> <key>", the key has spaces
+  while (file >> when && file.get() == ' ' && std::getline(file, key)) {
+    if (accepted.emplace(key, when).second) {
+      order.emplace_back(when, std::move(key));
+    }
+  }
+  expire(std::time(nullptr));
+  compact();
+}
+
+std::string DedupIndex::key(std::string_view messageId, uint32_t checksum, std::string_view envelope) {
+  // RFC 5322 limits lines to 998 characters, a Message-ID has no spaces
+  if (messageId.empty() || messageId.size() > 998) {
+    return {};
+  }
+  for (unsigned char c : messageId) {
+    if (!std::isgraph(c)) {
+      return {};
+    }
+  }
+
+  // FNV-1a, stable from one build and one process to the next
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : envelope) {
+    hash = (hash ^ c) * 0x100000001b3;
+  }
+  char digests[32];
+  std::snprintf(digests, sizeof(digests), " %08x %016llx", checksum, static_cast<unsigned long long>(hash));
+  return std::string{messageId} + digests;
+}
+
+void DedupIndex::expire(std::time_t now) {
+  while (!order.empty() && order.front().first + window.count() <= now) {
+    accepted.erase(order.front().second);
+    order.pop_front();
+  }
+}
+
+void DedupIndex::compact() {
+  const std::string rewritten = path + ".tmp";
+  {
+    FileDescriptor file{SystemCall("open " + rewritten,
+                                   ::open(rewritten.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+    std::string content{};
+    for (const auto &[when, key] : order) {
+      content += std::to_string(when) + " " + key + "\n";
+    }
+    file.write(content);
+  }
+  SystemCall("rename " + rewritten, ::rename(rewritten.c_str(), path.c_str()));
+  journal.emplace(SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC)));
+  journaled = order.size();
+}
+
+bool DedupIndex::contains(const std::string &key, std::time_t now) {
+  expire(now);
+  return accepted.contains(key);
+}
+
+void DedupIndex::insert(const std::string &key, std::time_t now) {
+  expire(now);
+  if (!accepted.emplace(key, now).second) {
+    return;
+  }
+  order.emplace_back(now, key);
+
+  // Not synced: a crash forgets the last few keys, at worst a duplicate is
+  // accepted again
+  journal->write(std::to_string(now) + " " + key + "\n");
+  if (++journaled > 2 * order.size() + 1024) {
+    compact();
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief The messages accepted lately, to recognize the ones sent again.
+ *
+ * @details A client which times out waiting for the reply to the final "."
+ * sends the whole message again, though we may have accepted it. A message
+ * is the same when its Message-ID, the checksum of its body and its envelope
+ * are, the envelope matters because a message to many recipients is often
+ * split over several transactions.
+ *
+ * The keys live in memory for `window`, and are appended to a journal so a
+ * restart keeps them. The journal is rewritten without the expired keys when
+ * it is opened and whenever they make up most of it.
+ */
+class DedupIndex {
+private:
+  std::string path;
+  std::chrono::seconds window;
+  std::unordered_map<std::string, std::time_t> accepted{};  //!< When each key was accepted
+  std::deque<std::pair<std::time_t, std::string>> order{};  //!< The same keys, the oldest first
+  std::optional<FileDescriptor> journal{};                  //!< Opened for appending
+  size_t journaled = 0;                                     //!< Lines in the journal, expired or not
+
+  void expire(std::time_t now);
+  void compact();
+
+public:
+  /**
+   * @brief Load the keys still in the window from the journal at `path`.
+   *
+   * @param[in] path the journal, created if needed
+   * @param[in] window how long a message is remembered
+   */
+  DedupIndex(std::string path, std::chrono::seconds window);
+
+  /**
+   * @brief The key of a message.
+   *
+   * @param[in] messageId its Message-ID, without the angle brackets
+   * @param[in] checksum the CRC32C of its body
+   * @param[in] envelope its sender and recipients, in any stable form
+   * @return std::string the key, empty when the Message-ID cannot be one
+   */
+  static std::string key(std::string_view messageId, uint32_t checksum, std::string_view envelope);
+
+  //! Whether a message with `key` was accepted within the window
+  bool contains(const std::string &key, std::time_t now = std::time(nullptr));
+
+  //! Remember that a message with `key` has been accepted
+  void insert(const std::string &key, std::time_t now = std::time(nullptr));
+
+  //! Number of keys in the window
+  size_t size() const { return accepted.size(); }
+};
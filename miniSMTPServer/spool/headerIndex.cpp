@@ -0,0 +1,87 @@
+#include "headerIndex.hpp"
+
+#include <strings.h>
+
+// Lower case, in the order of `Header`
+static constexpr std::array<std::string_view, headerCount> knownNames = {
+    "date", "from", "to", "cc", "subject", "message-id",
+};
+
+static bool sameName(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && ::strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+HeaderIndex::HeaderIndex() { known.fill(-1); }
+
+void HeaderIndex::index(size_t end) {
+  std::string_view line = std::string_view{section}.substr(start, end - start);
+  size_t eol = line.size() >= 2 && line[line.size() - 2] == '\r' ? 2 : 1;
+
+  if (line.size() == eol) {
+    done = true;
+  } else if (line[0] == ' ' || line[0] == '\t') {
+    // A folded line goes on with the field before it
+    if (!list.empty()) {
+      list.back().length = static_cast<uint32_t>(end - eol - list.back().offset);
+    }
+  } else {
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      // Not a field, so the body started without the empty line
+      section.resize(start);
+      done = true;
+      return;
+    }
+    list.push_back(HeaderField{static_cast<uint32_t>(start),
+                               static_cast<uint32_t>(line.size() - eol),
+                               static_cast<uint16_t>(colon)});
+    for (size_t i = 0; i < knownNames.size(); ++i) {
+      if (known[i] < 0 && sameName(line.substr(0, colon), knownNames[i])) {
+        known[i] = static_cast<int32_t>(list.size() - 1);
+      }
+    }
+  }
+  start = end;
+}
+
+void HeaderIndex::append(std::string_view data) {
+  while (!done && !data.empty() && section.size() < maxSection) {
+    size_t newline = data.find('\n');
+    size_t length = newline == std::string_view::npos ? data.size() : newline + 1;
+    section.append(data.substr(0, length));
+    data.remove_prefix(length);
+    if (newline != std::string_view::npos) {
+      index(section.size());
+    }
+  }
+}
+
+std::string_view HeaderIndex::name(const HeaderField &field) const {
+  return std::string_view{section}.substr(field.offset, field.nameLength);
+}
+
+std::string_view HeaderIndex::value(const HeaderField &field) const {
+  std::string_view value =
+      std::string_view{section}.substr(field.offset + field.nameLength + 1, field.length - field.nameLength - 1);
+  while (!value.empty() && (value[0] == ' ' || value[0] == '\t')) {
+    value.remove_prefix(1);
+  }
+  return value;
+}
+
+std::optional<std::string_view> HeaderIndex::find(Header header) const {
+  int32_t field = known[static_cast<size_t>(header)];
+  if (field < 0) {
+    return std::nullopt;
+  }
+  return value(list[static_cast<size_t>(field)]);
+}
+
+std::optional<std::string_view> HeaderIndex::find(std::string_view wanted) const {
+  for (const HeaderField &field : list) {
+    if (sameName(name(field), wanted)) {
+      return value(field);
+    }
+  }
+  return std::nullopt;
+}
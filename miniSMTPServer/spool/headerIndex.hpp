@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief The header fields the server itself looks at, for logging and routing.
+ *
+ */
+enum class Header : uint8_t {
+  Date,
+  From,
+  To,
+  Cc,
+  Subject,
+  MessageId,
+};
+
+//! Number of `Header` values
+static constexpr size_t headerCount = 6;
+
+/**
+ * @brief Where a header field is in the message.
+ *
+ */
+struct HeaderField {
+  uint32_t offset = 0;      //!< Of its name, from the start of the message
+  uint32_t length = 0;      //!< Of the whole field, folded lines included, without its final CRLF
+  uint16_t nameLength = 0;  //!< Of its name, without the colon
+};
+
+/**
+ * @brief An index of the header section, built while the message streams in.
+ *
+ * @details Every field gets its offset and length as its lines are appended,
+ * and indexing stops at the empty line ending the header section, so the
+ * body is not looked at. The fields named by `Header` are found in O(1),
+ * any other by a scan of the few fields.
+ *
+ * The header section is kept, it is small, so that values can be read once
+ * the message has left memory. A header section longer than `maxSection` is
+ * only indexed that far.
+ */
+class HeaderIndex {
+private:
+  std::string section{};                     //!< The header section as appended so far
+  std::vector<HeaderField> list{};           //!< Every field, in order
+  std::array<int32_t, headerCount> known{};  //!< The first field of each `Header`, -1 if there is none
+  size_t start = 0;                          //!< Where the line not indexed yet starts in `section`
+  bool done = false;                         //!< The empty line has been seen
+
+  void index(size_t end);
+
+public:
+  //! Header sections longer than this are not indexed any further
+  static constexpr size_t maxSection = 64 * 1024;
+
+  HeaderIndex();
+
+  /**
+   * @brief Index the next piece of the message.
+   *
+   * @details Pieces need not be whole lines. Once the header section is
+   * complete, this returns right away.
+   *
+   * @param[in] data the next bytes of the message
+   */
+  void append(std::string_view data);
+
+  //! Whether the whole header section has been seen
+  bool complete() const { return done; }
+
+  //! Every field, in the order of the message
+  const std::vector<HeaderField> &fields() const { return list; }
+
+  //! The name of `field`, as the message spells it
+  std::string_view name(const HeaderField &field) const;
+
+  //! The value of `field` after the colon and the spaces following it, folding included
+  std::string_view value(const HeaderField &field) const;
+
+  //! The value of the first `header` field, in O(1)
+  std::optional<std::string_view> find(Header header) const;
+
+  //! The value of the first field called `name`, ignoring case
+  std::optional<std::string_view> find(std::string_view name) const;
+};
@@ -0,0 +1,96 @@
+#include "mailboxes.hpp"
+
+#include "files.hpp"
+#include "socket.hpp"
+#include "util.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The recipient names a directory, it must stay below the mailboxes
+static bool validMailbox(const std::string &recipient) {
+  return !recipient.empty() && recipient[0] != '.' && recipient.find('/') == std::string::npos;
+}
+
+Mailboxes::Mailboxes(std::string d) : directory{std::move(d)} { std::filesystem::create_directories(directory); }
+
+std::string Mailboxes::open(const std::string &recipient) {
+  const std::string mailbox = directory + "/" + recipient;
+  for (const std::string &name : {mailbox, mailbox + "/tmp", mailbox + "/new", mailbox + "/cur"}) {
+    // Another worker, or a delivery cut short by a crash, may have made some of them
+    if (::mkdir(name.c_str(), 0700) != 0 && errno != EEXIST) {
+      throw unix_error("mkdir " + name);
+    }
+  }
+  syncDirectory(mailbox);
+  syncDirectory(directory);
+  return mailbox;
+}
+
+MailboxDelivery Mailboxes::deliver(const std::string &id,
+                                   const std::vector<std::string> &recipients,
+                                   const std::string &body) {
+  MailboxDelivery result{};
+  // What the next mailbox links to, the spooled body unless it had to be copied
+  std::string source = body;
+
+  for (const auto &recipient : recipients) {
+    if (!validMailbox(recipient)) {
+      result.failed.push_back(recipient);
+      continue;
+    }
+
+    const std::string target = path(recipient, id);
+    int linked = ::link(source.c_str(), target.c_str());
+    if (linked != 0 && errno == ENOENT) {
+      // A mailbox is made on its first delivery, one link(2) is all the later ones cost
+      open(recipient);
+      linked = ::link(source.c_str(), target.c_str());
+    }
+
+    if (linked == 0) {
+      ++result.linked;
+    } else if (errno == EXDEV) {
+      // The Maildir way: write into tmp/, then move into new/ once complete
+      const std::string partial = directory + "/" + recipient + "/tmp/" + id;
+      std::filesystem::copy_file(source, partial, std::filesystem::copy_options::overwrite_existing);
+      FileDescriptor file{SystemCall("open " + partial, ::open(partial.c_str(), O_RDONLY | O_CLOEXEC))};
+      SystemCall("fsync " + partial, ::fsync(file.fd_num()));
+      SystemCall("rename " + partial, ::rename(partial.c_str(), target.c_str()));
+      result.bytesWritten += std::filesystem::file_size(target);
+      source = target;
+    } else if (errno != EEXIST) {
+      throw unix_error("link " + target);
+    }
+
+    // Also when it was there already, the attempt that linked it may not have synced it
+    syncDirectory(directory + "/" + recipient + "/new");
+    result.delivered.push_back(recipient);
+  }
+  return result;
+}
+
+std::vector<std::string> Mailboxes::messages(const std::string &recipient) const {
+  namespace fs = std::filesystem;
+  std::vector<std::string> ids{};
+  const fs::path fresh = fs::path{directory} / recipient / "new";
+  if (!validMailbox(recipient) || !fs::exists(fresh)) {
+    return ids;
+  }
+  for (const auto &entry : fs::directory_iterator{fresh}) {
+    ids.push_back(entry.path().filename().string());
+  }
+  return ids;
+}
+
+std::string Mailboxes::path(const std::string &recipient, const std::string &id) const {
+  return directory + "/" + recipient + "/new/" + id;
+}
+
+void Mailboxes::remove(const std::string &recipient, const std::string &id) {
+  const std::string message = path(recipient, id);
+  SystemCall("unlink " + message, ::unlink(message.c_str()));
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @brief What delivering one message to the local mailboxes did.
+ *
+ */
+struct MailboxDelivery {
+  std::vector<std::string> delivered{};  //!< Recipients whose mailbox holds the message
+  std::vector<std::string> failed{};     //!< Recipients without a valid mailbox name
+  size_t linked = 0;                     //!< Mailboxes sharing a body already on disk
+  size_t bytesWritten = 0;               //!< Body bytes written, 0 unless the body had to be copied
+};
+
+/**
+ * @brief Local mailboxes, one Maildir per recipient.
+ *
+ * @details A message is stored once however many recipients it has: every
+ * mailbox gets a hard link to the body in the spool, so a message to 500
+ * recipients costs 500 directory entries rather than 500 copies. The link
+ * count of the body is its reference count, the spool drops its own link
+ * once the message is delivered and the file system frees the body when the
+ * last mailbox removes it.
+ *
+ * A hard link cannot cross file systems. When the mailboxes live on another
+ * one than the spool, the body is copied into the first mailbox and the
+ * others link to that copy, so it is still written once.
+ *
+ *   <directory>/<recipient>/{tmp,new,cur}/<message id>
+ */
+class Mailboxes {
+private:
+  std::string directory;
+
+  //! The Maildir of `recipient`, created if needed
+  std::string open(const std::string &recipient);
+
+public:
+  /**
+   * @brief Use the mailboxes under `directory`, creating it if needed.
+   *
+   * @param[in] directory where the mailboxes are
+   */
+  explicit Mailboxes(std::string directory);
+
+  /**
+   * @brief Deliver a spooled message to the mailbox of every recipient.
+   *
+   * @details When this returns, the message has reached every mailbox it
+   * was delivered to durably. Delivering the same message again is harmless,
+   * the mailboxes that have it already are left alone.
+   *
+   * @param[in] id the id of the message, which names it in every mailbox
+   * @param[in] recipients the local recipients
+   * @param[in] body the path of the spooled body
+   * @return MailboxDelivery who got the message and what it cost
+   */
+  MailboxDelivery deliver(const std::string &id, const std::vector<std::string> &recipients, const std::string &body);
+
+  //! The ids of the new messages in the mailbox of `recipient`
+  std::vector<std::string> messages(const std::string &recipient) const;
+
+  //! The path of message `id` in the mailbox of `recipient`
+  std::string path(const std::string &recipient, const std::string &id) const;
+
+  //! Remove message `id` from the mailbox of `recipient`, its body goes with the last mailbox holding it
+  void remove(const std::string &recipient, const std::string &id);
+};
@@ -0,0 +1,654 @@
+#include "messageCatalog.hpp"
+
+#include "files.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+
+static constexpr char magic[8] = {'M', 'S', 'M', 'T', 'P', 'C', 'A', 'T'};
+
+static constexpr size_t writeSize = 1024 * 1024;
+
+// The fields of a log line, the recipients are all those from the last on
+enum Field : size_t { Accepted, Client, Sender, MessageId, Size, Id, Location, Recipients };
+
+static inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; }
+
+static bool equalsIgnoringCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return lower(x) == lower(y);
+         });
+}
+
+// The field `which` of a log line, empty if the line is shorter
+static std::string_view field(std::string_view line, Field which) {
+  size_t start = 0;
+  for (size_t n = which; n > 0; --n) {
+    size_t tab = line.find('\t', start);
+    if (tab == std::string_view::npos) {
+      return {};
+    }
+    start = tab + 1;
+  }
+  size_t end = line.find('\t', start);
+  return line.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+}
+
+// The time a log line starts with, std::nullopt if it does not start with one
+static std::optional<std::time_t> acceptedOf(std::string_view line) {
+  std::time_t when = 0;
+  auto [end, error] = std::from_chars(line.data(), line.data() + line.size(), when);
+  if (error != std::errc{} || end == line.data() + line.size() || *end != '\t') {
+    return std::nullopt;
+  }
+  return when;
+}
+
+// Whether a log line matches `query`, but for the time
+static bool matches(std::string_view line, const CatalogQuery &query) {
+  return (query.messageId.empty() || field(line, MessageId) == query.messageId) &&
+         (query.sender.empty() || equalsIgnoringCase(field(line, Sender), query.sender));
+}
+
+// The complete lines of a log, the last one is cut short if its writer crashed writing it
+static std::vector<std::string_view> linesOf(std::string_view log) {
+  std::vector<std::string_view> lines{};
+  for (size_t end = log.find('\n'); end != std::string_view::npos; end = log.find('\n')) {
+    lines.push_back(log.substr(0, end));
+    log.remove_prefix(end + 1);
+  }
+  return lines;
+}
+
+// The complete lines of a log with `text` in them, memmem(3) skips the others far faster than splitting them
+static std::vector<std::string_view> linesWith(std::string_view log, std::string_view text) {
+  std::vector<std::string_view> lines{};
+  size_t at = 0;
+  while (const void *found = ::memmem(log.data() + at, log.size() - at, text.data(), text.size())) {
+    const auto offset = static_cast<size_t>(static_cast<const char *>(found) - log.data());
+    const size_t previous = log.rfind('\n', offset);
+    const size_t begin = previous == std::string_view::npos ? 0 : previous + 1;
+    const size_t end = log.find('\n', offset);
+    if (end == std::string_view::npos) {
+      break;
+    }
+    lines.push_back(log.substr(begin, end - begin));
+    at = end + 1;
+  }
+  return lines;
+}
+
+static std::string readFile(const std::string &path) {
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_RDONLY | O_CLOEXEC))};
+  struct stat status;
+  SystemCall("fstat " + path, ::fstat(file.fd_num(), &status));
+  // A writer may append meanwhile, what follows the size is read next time
+  std::string content(static_cast<size_t>(status.st_size), '\0');
+  size_t done = 0;
+  while (done < content.size()) {
+    ssize_t bytes = SystemCall("read " + path, ::read(file.fd_num(), content.data() + done, content.size() - done));
+    if (bytes == 0) {
+      break;
+    }
+    done += static_cast<size_t>(bytes);
+  }
+  content.resize(done);
+  return content;
+}
+
+// The ids of the files named `prefix`.<id> in `directory`, without the temporary ones
+static std::vector<std::string> list(const std::string &directory, std::string_view prefix) {
+  std::vector<std::string> ids{};
+  for (const auto &entry : std::filesystem::directory_iterator{directory}) {
+    const std::string name = entry.path().filename().string();
+    if (name.size() > prefix.size() + 1 && name.starts_with(prefix) && name[prefix.size()] == '.' &&
+        !name.ends_with(".new") && !name.ends_with(".tmp")) {
+      ids.push_back(name.substr(prefix.size() + 1));
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+using Segments = std::vector<std::pair<std::string, std::shared_ptr<const CatalogSegment>>>;
+
+// The segments in `directory` by id, std::nullopt if one went away while they were opened
+static std::optional<Segments> openSegments(const std::string &directory) {
+  Segments segments{};
+  for (const std::string &id : list(directory, "segment")) {
+    try {
+      segments.emplace_back(id, CatalogSegment::open(directory + "/segment." + id));
+    } catch (const unix_error &e) {
+      if (e.code().value() == ENOENT) {
+        return std::nullopt;
+      }
+      throw;
+    }
+  }
+  return segments;
+}
+
+// Whether another segment holds every log `segment` holds: a merge renames
+// its segment into place before it removes those it merged
+static bool superseded(const CatalogSegment &segment, const Segments &segments) {
+  return std::any_of(segments.begin(), segments.end(), [&segment](const auto &other) {
+    const auto &sources = other.second->sources();
+    return other.second.get() != &segment && sources.size() > segment.sources().size() &&
+           std::includes(sources.begin(), sources.end(), segment.sources().begin(), segment.sources().end());
+  });
+}
+
+std::string CatalogEntry::line() const {
+  std::string result = std::to_string(accepted);
+  auto add = [&result](std::string_view value) {
+    result += '\t';
+    for (char c : value) {
+      result += (c == '\t' || c == '\r' || c == '\n') ? ' ' : c;
+    }
+  };
+  add(client);
+  add(sender);
+  add(messageId);
+  add(std::to_string(size));
+  add(id);
+  add(location);
+  for (const auto &recipient : recipients) {
+    add(recipient);
+  }
+  result += '\n';
+  return result;
+}
+
+std::optional<CatalogEntry> CatalogEntry::parse(std::string_view line) {
+  if (!line.empty() && line.back() == '\n') {
+    line.remove_suffix(1);
+  }
+  auto when = acceptedOf(line);
+  if (!when.has_value()) {
+    return std::nullopt;
+  }
+
+  std::vector<std::string_view> fields{};
+  for (size_t start = 0;;) {
+    size_t tab = line.find('\t', start);
+    fields.push_back(line.substr(start, tab == std::string_view::npos ? std::string_view::npos : tab - start));
+    if (tab == std::string_view::npos) {
+      break;
+    }
+    start = tab + 1;
+  }
+  if (fields.size() < Recipients) {
+    return std::nullopt;
+  }
+
+  CatalogEntry entry{};
+  entry.accepted = when.value();
+  entry.client = fields[Client];
+  entry.sender = fields[Sender];
+  entry.messageId = fields[MessageId];
+  auto [end, error] = std::from_chars(fields[Size].data(), fields[Size].data() + fields[Size].size(), entry.size);
+  if (error != std::errc{} || end != fields[Size].data() + fields[Size].size()) {
+    return std::nullopt;
+  }
+  entry.id = fields[Id];
+  entry.location = fields[Location];
+  entry.recipients.assign(fields.begin() + Recipients, fields.end());
+  return entry;
+}
+
+CatalogSegment::CatalogSegment(const unsigned char *b, size_t l) : base{b}, length{l} {}
+
+CatalogSegment::~CatalogSegment() {
+  if (base != nullptr) {
+    ::munmap(const_cast<unsigned char *>(base), length);
+  }
+}
+
+std::shared_ptr<const CatalogSegment> CatalogSegment::open(const std::string &path) {
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_RDONLY | O_CLOEXEC))};
+
+  struct stat status;
+  SystemCall("fstat " + path, ::fstat(file.fd_num(), &status));
+  const auto size = static_cast<size_t>(status.st_size);
+  if (size < sizeof(CatalogSegmentHeader)) {
+    throw std::runtime_error(path + ": too small to be a catalog segment");
+  }
+
+  // Not populated: a query touches a few pages of a segment of gigabytes
+  void *address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, file.fd_num(), 0);
+  if (address == MAP_FAILED) {
+    throw unix_error("mmap " + path);
+  }
+
+  std::shared_ptr<CatalogSegment> segment{new CatalogSegment(static_cast<const unsigned char *>(address), size)};
+
+  const auto *header = reinterpret_cast<const CatalogSegmentHeader *>(segment->base);
+  if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+    throw std::runtime_error(path + ": not a catalog segment or an unsupported version");
+  }
+  if (header->count > size / sizeof(CatalogSegmentEntry) || header->messageIds > header->count ||
+      header->senders > header->count || header->fileSize != size ||
+      header->entriesOffset != sizeof(CatalogSegmentHeader) ||
+      header->messageIdsOffset != header->entriesOffset + header->count * sizeof(CatalogSegmentEntry) ||
+      header->sendersOffset != header->messageIdsOffset + header->messageIds * sizeof(CatalogKey) ||
+      header->sourcesOffset != header->sendersOffset + header->senders * sizeof(CatalogKey) ||
+      header->linesOffset < header->sourcesOffset || header->linesOffset > size) {
+    throw std::runtime_error(path + ": corrupted catalog segment header");
+  }
+
+  segment->header = header;
+  segment->entries = reinterpret_cast<const CatalogSegmentEntry *>(segment->base + header->entriesOffset);
+  segment->messageIds = reinterpret_cast<const CatalogKey *>(segment->base + header->messageIdsOffset);
+  segment->senders = reinterpret_cast<const CatalogKey *>(segment->base + header->sendersOffset);
+  segment->lines = {reinterpret_cast<const char *>(segment->base + header->linesOffset), size - header->linesOffset};
+
+  std::string_view sources{reinterpret_cast<const char *>(segment->base + header->sourcesOffset),
+                           header->linesOffset - header->sourcesOffset};
+  for (std::string_view source : linesOf(sources)) {
+    segment->covered.emplace_back(source);
+  }
+  return segment;
+}
+
+void CatalogSegment::build(std::vector<std::string_view> lines,
+                           const std::vector<std::string> &sources,
+                           const std::string &path) {
+  std::vector<std::pair<std::time_t, std::string_view>> sorted{};
+  sorted.reserve(lines.size());
+  for (std::string_view line : lines) {
+    if (auto when = acceptedOf(line); when.has_value() && line.size() <= UINT32_MAX) {
+      sorted.emplace_back(when.value(), line);
+    }
+  }
+  std::stable_sort(
+      sorted.begin(), sorted.end(), [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+
+  std::vector<CatalogSegmentEntry> entries{};
+  std::vector<CatalogKey> messageIds{};
+  std::vector<CatalogKey> senders{};
+  entries.reserve(sorted.size());
+  messageIds.reserve(sorted.size());
+  senders.reserve(sorted.size());
+  uint64_t offset = 0;
+  for (uint64_t i = 0; i < sorted.size(); ++i) {
+    const auto &[when, line] = sorted[i];
+    entries.push_back({when, offset, static_cast<uint32_t>(line.size()), 0});
+    offset += line.size() + 1;
+    if (std::string_view id = field(line, MessageId); !id.empty()) {
+      messageIds.push_back({hashIgnoringCase(id), i});
+    }
+    if (std::string_view sender = field(line, Sender); !sender.empty()) {
+      senders.push_back({hashIgnoringCase(sender), i});
+    }
+  }
+  auto byKey = [](const CatalogKey &lhs, const CatalogKey &rhs) {
+    return lhs.hash != rhs.hash ? lhs.hash < rhs.hash : lhs.entry < rhs.entry;
+  };
+  std::sort(messageIds.begin(), messageIds.end(), byKey);
+  std::sort(senders.begin(), senders.end(), byKey);
+
+  // Sorted, to tell whether a segment holds every log another one does
+  std::set<std::string> names{sources.begin(), sources.end()};
+  std::string sourceLines{};
+  for (const auto &name : names) {
+    sourceLines += name + "\n";
+  }
+
+  CatalogSegmentHeader header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.count = entries.size();
+  header.messageIds = messageIds.size();
+  header.senders = senders.size();
+  header.entriesOffset = sizeof(CatalogSegmentHeader);
+  header.messageIdsOffset = header.entriesOffset + entries.size() * sizeof(CatalogSegmentEntry);
+  header.sendersOffset = header.messageIdsOffset + messageIds.size() * sizeof(CatalogKey);
+  header.sourcesOffset = header.sendersOffset + senders.size() * sizeof(CatalogKey);
+  header.linesOffset = header.sourcesOffset + sourceLines.size();
+  header.fileSize = header.linesOffset + offset;
+
+  auto bytes = [](const auto &items) {
+    return std::string_view{reinterpret_cast<const char *>(items.data()), items.size() * sizeof(items[0])};
+  };
+  const std::string temporary = path + ".tmp";
+  {
+    FileDescriptor output{
+        SystemCall("open " + temporary, ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))};
+    output.write(std::string_view{reinterpret_cast<const char *>(&header), sizeof(header)});
+    output.write(bytes(entries));
+    output.write(bytes(messageIds));
+    output.write(bytes(senders));
+    output.write(std::string_view{sourceLines});
+    std::string buffer{};
+    buffer.reserve(writeSize);
+    for (const auto &[when, line] : sorted) {
+      buffer.append(line);
+      buffer += '\n';
+      if (buffer.size() >= writeSize) {
+        output.write(std::string_view{buffer});
+        buffer.clear();
+      }
+    }
+    output.write(std::string_view{buffer});
+    SystemCall("fsync " + temporary, ::fsync(output.fd_num()));
+  }
+  SystemCall("rename " + temporary, ::rename(temporary.c_str(), path.c_str()));
+}
+
+std::string_view CatalogSegment::line(uint64_t entry) const {
+  const CatalogSegmentEntry &at = entries[entry];
+  if (at.offset > lines.size() || at.length > lines.size() - at.offset) {
+    throw std::runtime_error("catalog segment has a garbled entry");
+  }
+  return lines.substr(at.offset, at.length);
+}
+
+void CatalogSegment::search(const CatalogQuery &query, std::vector<CatalogEntry> &out) const {
+  size_t found = 0;
+  auto take = [&](uint64_t entry) {
+    if (entry >= header->count || entries[entry].accepted < query.from || entries[entry].accepted > query.to) {
+      return;
+    }
+    std::string_view text = line(entry);
+    if (!matches(text, query)) {
+      return;
+    }
+    if (auto parsed = CatalogEntry::parse(text); parsed.has_value()) {
+      out.push_back(std::move(parsed.value()));
+      ++found;
+    }
+  };
+
+  const CatalogKey *keys = nullptr;
+  uint64_t count = 0;
+  std::string_view value{};
+  if (!query.messageId.empty()) {
+    keys = messageIds;
+    count = header->messageIds;
+    value = query.messageId;
+  } else if (!query.sender.empty()) {
+    keys = senders;
+    count = header->senders;
+    value = query.sender;
+  }
+
+  if (keys != nullptr) {
+    const uint64_t h = hashIgnoringCase(value);
+    const CatalogKey *first =
+        std::lower_bound(keys, keys + count, h, [](const CatalogKey &key, uint64_t at) { return key.hash < at; });
+    const CatalogKey *last =
+        std::upper_bound(first, keys + count, h, [](uint64_t at, const CatalogKey &key) { return at < key.hash; });
+    // The matches of a key are the oldest first
+    while (last != first && found < query.limit) {
+      take((--last)->entry);
+    }
+    return;
+  }
+
+  const CatalogSegmentEntry *begin = std::lower_bound(
+      entries, entries + header->count, query.from, [](const CatalogSegmentEntry &entry, std::time_t at) {
+        return entry.accepted < at;
+      });
+  const CatalogSegmentEntry *end = std::upper_bound(
+      begin, entries + header->count, query.to, [](std::time_t at, const CatalogSegmentEntry &entry) {
+        return at < entry.accepted;
+      });
+  while (end != begin && found < query.limit) {
+    --end;
+    take(static_cast<uint64_t>(end - entries));
+  }
+}
+
+void CatalogSegment::append(std::vector<std::string_view> &out) const {
+  out.reserve(out.size() + header->count);
+  for (uint64_t i = 0; i < header->count; ++i) {
+    out.push_back(line(i));
+  }
+}
+
+CatalogReader::CatalogReader(const std::string &directory) {
+  // The logs first: one compacted after it was read is in a segment listed
+  // after, and left out below. A segment merged away between the listing
+  // and the opening is in one listed again.
+  std::vector<std::pair<std::string, std::string>> read{};
+  std::optional<Segments> opened{};
+  for (int attempt = 0; !opened.has_value(); ++attempt) {
+    if (attempt == 10) {
+      throw std::runtime_error("the catalog in " + directory + " is compacted faster than it is read");
+    }
+    read.clear();
+    for (const std::string &id : list(directory, "log")) {
+      try {
+        read.emplace_back(id, readFile(directory + "/log." + id));
+      } catch (const unix_error &) {
+        // Compacted and removed
+      }
+    }
+    opened = openSegments(directory);
+  }
+
+  std::unordered_set<std::string> covered{};
+  for (const auto &[id, segment] : opened.value()) {
+    covered.insert(segment->sources().begin(), segment->sources().end());
+    if (!superseded(*segment, opened.value())) {
+      segments.push_back(segment);
+    }
+  }
+  for (auto &[id, content] : read) {
+    if (!covered.contains(id)) {
+      logs.push_back(std::move(content));
+    }
+  }
+}
+
+std::vector<CatalogEntry> CatalogReader::search(const CatalogQuery &query) const {
+  std::vector<CatalogEntry> result{};
+  for (const auto &segment : segments) {
+    segment->search(query, result);
+  }
+
+  // Only the newest lines of the logs are parsed
+  std::vector<std::pair<std::time_t, std::string_view>> candidates{};
+  for (const std::string &log : logs) {
+    for (std::string_view line : query.messageId.empty() ? linesOf(log) : linesWith(log, query.messageId)) {
+      auto when = acceptedOf(line);
+      if (when.has_value() && when.value() >= query.from && when.value() <= query.to && matches(line, query)) {
+        candidates.emplace_back(when.value(), line);
+      }
+    }
+  }
+  // Lines are appended in order, the last of those accepted the same second is the newest
+  std::reverse(candidates.begin(), candidates.end());
+  std::stable_sort(candidates.begin(), candidates.end(), [](const auto &lhs, const auto &rhs) {
+    return lhs.first > rhs.first;
+  });
+  for (size_t i = 0; i < candidates.size() && i < query.limit; ++i) {
+    if (auto parsed = CatalogEntry::parse(candidates[i].second); parsed.has_value()) {
+      result.push_back(std::move(parsed.value()));
+    }
+  }
+
+  // Queue ids start with the time, in microseconds
+  std::sort(result.begin(), result.end(), [](const CatalogEntry &lhs, const CatalogEntry &rhs) {
+    return lhs.accepted != rhs.accepted ? lhs.accepted > rhs.accepted : lhs.id > rhs.id;
+  });
+  if (result.size() > query.limit) {
+    result.resize(query.limit);
+  }
+  return result;
+}
+
+uint64_t CatalogReader::size() const {
+  uint64_t count = 0;
+  for (const auto &segment : segments) {
+    count += segment->size();
+  }
+  for (const std::string &log : logs) {
+    count += static_cast<uint64_t>(std::count(log.begin(), log.end(), '\n'));
+  }
+  return count;
+}
+
+MessageCatalog::MessageCatalog(std::string d, size_t r, std::chrono::milliseconds i)
+    : directory{std::move(d)}
+    , rotateLines{r}
+    , interval{i} {
+  std::filesystem::create_directories(directory);
+  rotate();
+  compactor = std::thread{&MessageCatalog::run, this};
+}
+
+MessageCatalog::~MessageCatalog() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopped = true;
+  }
+  condition.notify_all();
+  compactor.join();
+}
+
+void MessageCatalog::rotate() {
+  // Locked before it is named like a log, so a compaction never takes it for
+  // one left behind
+  const std::string path = directory + "/log." + uniqueId();
+  const std::string partial = path + ".new";
+  FileDescriptor file{SystemCall(
+      "open " + partial, ::open(partial.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644))};
+  SystemCall("flock " + partial, ::flock(file.fd_num(), LOCK_EX | LOCK_NB));
+  SystemCall("rename " + partial, ::rename(partial.c_str(), path.c_str()));
+  // Closing the previous log hands it to the compaction
+  log.emplace(std::move(file));
+  lines = 0;
+}
+
+void MessageCatalog::append(const CatalogEntry &entry) {
+  // A reader sees whole lines, but for the last one while it is written
+  log->write(entry.line());
+  if (++lines >= rotateLines) {
+    rotate();
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      sealed = true;
+    }
+    condition.notify_one();
+  }
+}
+
+void MessageCatalog::run() {
+  std::unique_lock<std::mutex> lock{mutex};
+  while (!stopped) {
+    sealed = false;
+    lock.unlock();
+    try {
+      compact();
+    } catch (const std::exception &e) {
+      std::cerr << "Cannot compact the message catalog: " << e.what() << std::endl;
+    }
+    lock.lock();
+    condition.wait_for(lock, interval, [this] { return stopped || sealed; });
+  }
+}
+
+void MessageCatalog::compact() {
+  namespace fs = std::filesystem;
+  const std::string lockPath = directory + "/lock";
+  FileDescriptor lock{SystemCall("open " + lockPath, ::open(lockPath.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644))};
+  if (::flock(lock.fd_num(), LOCK_EX | LOCK_NB) < 0) {
+    if (errno == EWOULDBLOCK) {
+      return;
+    }
+    throw unix_error("flock " + lockPath);
+  }
+
+  // Segments only the holder of the lock writes, and logs whose writer
+  // crashed before naming them
+  for (const auto &entry : fs::directory_iterator{directory}) {
+    const std::string name = entry.path().filename().string();
+    const bool stale = name.ends_with(".new") &&
+                       fs::last_write_time(entry.path()) < fs::file_time_type::clock::now() - std::chrono::minutes{1};
+    if ((name.starts_with("segment.") && name.ends_with(".tmp")) || (name.starts_with("log.") && stale)) {
+      fs::remove(entry.path());
+    }
+  }
+
+  // Nothing else compacts, so nothing goes away while they are opened
+  Segments segments = openSegments(directory).value();
+  std::unordered_set<std::string> covered{};
+  for (const auto &[id, segment] : segments) {
+    covered.insert(segment->sources().begin(), segment->sources().end());
+  }
+
+  // Every log no process appends to any more, into a segment of its own
+  bool built = false;
+  for (const std::string &id : list(directory, "log")) {
+    const std::string path = directory + "/log." + id;
+    FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_RDONLY | O_CLOEXEC))};
+    if (::flock(file.fd_num(), LOCK_EX | LOCK_NB) < 0) {
+      continue;
+    }
+    if (!covered.contains(id)) {
+      const std::string content = readFile(path);
+      CatalogSegment::build(linesOf(content), {id}, directory + "/segment." + id);
+      built = true;
+    }
+  }
+  if (built) {
+    syncDirectory(directory);
+    segments = openSegments(directory).value();
+  }
+  for (const auto &[id, segment] : segments) {
+    for (const std::string &source : segment->sources()) {
+      if (::unlink((directory + "/log." + source).c_str()) < 0 && errno != ENOENT) {
+        throw unix_error("unlink " + directory + "/log." + source);
+      }
+    }
+  }
+
+  Segments live{};
+  for (const auto &[id, segment] : segments) {
+    if (superseded(*segment, segments)) {
+      SystemCall("unlink segment." + id, ::unlink((directory + "/segment." + id).c_str()));
+    } else {
+      live.emplace_back(id, segment);
+    }
+  }
+
+  // Size-tiered: the smallest are merged, so an entry is rewritten about
+  // once per `mergeWidth` times the segment it is in grows
+  while (live.size() > maxSegments) {
+    std::sort(live.begin(), live.end(), [](const auto &lhs, const auto &rhs) {
+      return lhs.second->size() < rhs.second->size();
+    });
+    std::vector<std::string_view> lines{};
+    std::vector<std::string> sources{};
+    for (size_t i = 0; i < mergeWidth; ++i) {
+      live[i].second->append(lines);
+      sources.insert(sources.end(), live[i].second->sources().begin(), live[i].second->sources().end());
+    }
+    const std::string id = uniqueId();
+    const std::string path = directory + "/segment." + id;
+    CatalogSegment::build(std::move(lines), sources, path);
+    syncDirectory(directory);
+    for (size_t i = 0; i < mergeWidth; ++i) {
+      SystemCall("unlink segment." + live[i].first, ::unlink((directory + "/segment." + live[i].first).c_str()));
+    }
+    live.erase(live.begin(), live.begin() + mergeWidth);
+    live.emplace_back(id, CatalogSegment::open(path));
+  }
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief What the catalog knows of an accepted message.
+ *
+ * @details In a log, an entry is one line of tab-separated fields: the
+ * time, the client, the sender, the Message-ID, the size, the queue id,
+ * the location, then the recipients. Tabs and line breaks in a field are
+ * written as spaces.
+ */
+struct CatalogEntry {
+  std::time_t accepted = 0;               //!< When the message was committed
+  std::string client{};                   //!< Address of the client which sent it, empty if unknown
+  std::string sender{};                   //!< MAIL FROM, empty for a bounce
+  std::vector<std::string> recipients{};  //!< Every RCPT of the transaction
+  std::string messageId{};                //!< Without the angle brackets, empty if the message has none
+  uint64_t size = 0;                      //!< Bytes of the message as the client sent it
+  std::string id{};                       //!< The queue id, see `QueueRecord::id`
+  std::string location{};                 //!< Path of the body when it was spooled
+
+  //! The entry as a log line, with its line feed
+  std::string line() const;
+
+  //! The entry in a log line, std::nullopt if the line is garbled
+  static std::optional<CatalogEntry> parse(std::string_view line);
+};
+
+/**
+ * @brief Which messages to look up.
+ *
+ * @details Every condition given must hold. The Message-ID is compared
+ * exactly, the sender case-insensitively.
+ */
+struct CatalogQuery {
+  std::string messageId{};                                   //!< Without the angle brackets, empty for any
+  std::string sender{};                                      //!< MAIL FROM address, empty for any
+  std::time_t from = 0;                                      //!< Accepted at or after
+  std::time_t to = std::numeric_limits<std::time_t>::max();  //!< Accepted at or before
+  size_t limit = 100;                                        //!< At most this many, the newest
+};
+
+/**
+ * @brief On-disk header of a catalog segment.
+ *
+ * @details The file is laid out as
+ *
+ *   header | entries | Message-ID keys | sender keys | sources | lines
+ *
+ * Entries are sorted by the time the message was accepted, the keys by
+ * hash then entry, so a lookup is a binary search and the matches of a key
+ * come oldest first. The lines are those of the logs the segment was built
+ * from, the sources name those logs.
+ */
+struct CatalogSegmentHeader {
+  char magic[8];              //!< Always "MSMTPCAT"
+  uint32_t version;           //!< Format version, see `CatalogSegment::version`
+  uint32_t reserved;          //!< Zero
+  uint64_t count;             //!< Number of entries
+  uint64_t messageIds;        //!< Number of Message-ID keys, messages without one have none
+  uint64_t senders;           //!< Number of sender keys, bounces have none
+  uint64_t entriesOffset;     //!< File offset of the entries
+  uint64_t messageIdsOffset;  //!< File offset of the Message-ID keys
+  uint64_t sendersOffset;     //!< File offset of the sender keys
+  uint64_t sourcesOffset;     //!< File offset of the source names, one per line
+  uint64_t linesOffset;       //!< File offset of the log lines
+  uint64_t fileSize;          //!< Total size of the file
+};
+
+/**
+ * @brief One message in a catalog segment.
+ *
+ */
+struct CatalogSegmentEntry {
+  int64_t accepted;   //!< When the message was committed
+  uint64_t offset;    //!< Offset of its log line relative to the lines section
+  uint32_t length;    //!< Length of the log line, without its line feed
+  uint32_t reserved;  //!< Zero
+};
+
+/**
+ * @brief A hashed Message-ID or sender in a catalog segment.
+ *
+ */
+struct CatalogKey {
+  uint64_t hash;   //!< Hash of the lower-cased value
+  uint64_t entry;  //!< Index of the entry it was taken from
+};
+
+/**
+ * @brief An immutable, memory-mapped, sorted run of catalog entries.
+ *
+ * @details Pages are faulted in as lookups touch them, a lookup by key
+ * reads a few pages of keys and one line per match, whatever the size of
+ * the segment. Lines are checked against the section they are in when they
+ * are read, not when the file is opened, which would read all of it.
+ */
+class CatalogSegment {
+private:
+  const unsigned char *base = nullptr;
+  size_t length = 0;
+  const CatalogSegmentHeader *header = nullptr;
+  const CatalogSegmentEntry *entries = nullptr;
+  const CatalogKey *messageIds = nullptr;
+  const CatalogKey *senders = nullptr;
+  std::string_view lines{};
+  std::vector<std::string> covered{};
+
+  CatalogSegment(const unsigned char *base, size_t length);
+
+  std::string_view line(uint64_t entry) const;
+
+public:
+  static constexpr uint32_t version = 1;
+
+  /**
+   * @brief Map the segment file at `path`.
+   *
+   * @param[in] path the segment built by `CatalogSegment::build`
+   * @return std::shared_ptr<const CatalogSegment> the mapped segment
+   * @throw std::runtime_error the file is not a valid catalog segment
+   */
+  static std::shared_ptr<const CatalogSegment> open(const std::string &path);
+
+  /**
+   * @brief Write a segment of `lines` to `path`, atomically.
+   *
+   * @details Garbled lines are left out. The file is written to a temporary
+   * name, fsync'ed and renamed, the caller syncs the directory.
+   *
+   * @param[in] lines log lines without their line feed, in any order
+   * @param[in] sources the names of the logs the lines come from
+   * @param[in] path where the segment goes
+   */
+  static void build(std::vector<std::string_view> lines,
+                    const std::vector<std::string> &sources,
+                    const std::string &path);
+
+  /**
+   * @brief Append the entries matching `query` to `out`, the newest first.
+   *
+   * @param[in] query what to look up, at most `query.limit` entries are appended
+   * @param[in,out] out where the entries go
+   */
+  void search(const CatalogQuery &query, std::vector<CatalogEntry> &out) const;
+
+  //! Append every log line of the segment to `out`, e.g. to merge it
+  void append(std::vector<std::string_view> &out) const;
+
+  //! The names of the logs the segment holds
+  const std::vector<std::string> &sources() const { return covered; }
+
+  //! Number of entries
+  uint64_t size() const { return header->count; }
+
+  ~CatalogSegment();
+
+  CatalogSegment(const CatalogSegment &other) = delete;
+  CatalogSegment &operator=(const CatalogSegment &other) = delete;
+};
+
+/**
+ * @brief A consistent view of a catalog directory, to query it.
+ *
+ * @details The segments are mapped and the logs not compacted yet are read
+ * when the view is taken, a compaction running meanwhile changes neither.
+ */
+class CatalogReader {
+private:
+  std::vector<std::shared_ptr<const CatalogSegment>> segments{};
+  std::vector<std::string> logs{};
+
+public:
+  /**
+   * @brief Take a view of the catalog in `directory`.
+   *
+   * @param[in] directory the catalog, see `MessageCatalog`
+   * @throw std::runtime_error a segment is garbled
+   */
+  explicit CatalogReader(const std::string &directory);
+
+  //! The entries matching `query`, the newest first
+  std::vector<CatalogEntry> search(const CatalogQuery &query) const;
+
+  //! Number of segments in the view
+  size_t segmentCount() const { return segments.size(); }
+
+  //! Number of entries in the view
+  uint64_t size() const;
+};
+
+/**
+ * @brief The metadata of every message the spool accepted, to look them up.
+ *
+ * @details A directory of logs and segments:
+ *
+ *   log.<id>      lines appended as messages are committed, see `CatalogEntry`
+ *   segment.<id>  the lines of compacted logs, indexed, see `CatalogSegment`
+ *
+ * Every process appends to a log of its own, holding an exclusive flock(2)
+ * on it, so a server taking over from another never shares one. Once a log
+ * has `rotateLines` lines the process starts the next one, and a background
+ * thread builds a segment from every log no process holds any more, then
+ * removes the log. When there are more than `maxSegments` segments, the
+ * smallest are merged into one.
+ *
+ * A segment is renamed into place before what it replaces is removed, and
+ * names the logs it holds: a crash in between leaves entries twice on disk,
+ * which readers and the next compaction ignore.
+ *
+ * Lines are written without fsync(2), after the message is durable. They
+ * survive the server crashing, not the machine.
+ */
+class MessageCatalog {
+private:
+  std::string directory;
+  size_t rotateLines;
+  std::chrono::milliseconds interval;
+  std::optional<FileDescriptor> log{};  //!< The log appended to, flock'ed
+  size_t lines = 0;                     //!< Lines in it so far
+
+  std::mutex mutex{};
+  std::condition_variable condition{};
+  bool stopped = false;
+  bool sealed = false;  //!< Whether a log was rotated since the last compaction
+  std::thread compactor{};
+
+  void rotate();
+  void run();
+
+public:
+  //! Segments kept before the smallest are merged
+  static constexpr size_t maxSegments = 8;
+
+  //! Segments merged at a time
+  static constexpr size_t mergeWidth = 4;
+
+  /**
+   * @brief Open the catalog in `directory`, creating it if needed.
+   *
+   * @param[in] directory the catalog
+   * @param[in] rotateLines lines in a log before the next one is started
+   * @param[in] interval how often logs left by other processes are compacted
+   */
+  explicit MessageCatalog(std::string directory,
+                          size_t rotateLines = 16384,
+                          std::chrono::milliseconds interval = std::chrono::seconds{10});
+
+  //! Append `entry` to the log, one write(2)
+  void append(const CatalogEntry &entry);
+
+  /**
+   * @brief Build segments from the logs no process holds, then merge segments.
+   *
+   * @details Runs on the background thread. Does nothing while another
+   * process, or another thread, compacts the same directory.
+   */
+  void compact();
+
+  ~MessageCatalog();
+
+  MessageCatalog(const MessageCatalog &other) = delete;
+  MessageCatalog &operator=(const MessageCatalog &other) = delete;
+};
@@ -0,0 +1,132 @@
+#include "messageCatalog.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+static void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options] <spool>\n"
+            << "  -i, --message-id <id>    the message with the Message-ID <id>, without the angle brackets\n"
+            << "  -f, --sender <address>   the messages with MAIL FROM:<address>\n"
+            << "      --since <time>       the messages accepted at or after <time>\n"
+            << "      --until <time>       the messages accepted at or before <time>\n"
+            << "  -n, --limit <n>          at most the <n> newest messages, 100 by default\n"
+            << "  -h, --help               show this message\n"
+            << "A <time> is seconds since the epoch, or YYYY-MM-DD[THH:MM:SS] in UTC.\n";
+}
+
+static std::time_t timeOf(const std::string &value) {
+  std::tm parts{};
+  for (const char *format : {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d"}) {
+    const char *end = ::strptime(value.c_str(), format, &parts);
+    if (end != nullptr && *end == '\0') {
+      return ::timegm(&parts);
+    }
+    parts = std::tm{};
+  }
+  size_t end = 0;
+  std::time_t seconds = std::stoll(value, &end);
+  if (end != value.size()) {
+    throw std::invalid_argument(value);
+  }
+  return seconds;
+}
+
+static std::string formatTime(std::time_t when) {
+  std::tm parts{};
+  ::gmtime_r(&when, &parts);
+  char text[32];
+  std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &parts);
+  return text;
+}
+
+/**
+ * @brief Look up accepted messages in the catalog of a spool, see `miniSMTP --catalog`.
+ *
+ * @details One line per message, the newest first: when it was accepted,
+ * the client, the envelope, the Message-ID, the size and where its body
+ * was spooled. How many were found and how long it took go to stderr.
+ */
+int main(int argc, char *argv[]) {
+  enum {
+    since = 256,
+    until,
+  };
+
+  static const struct option options[] = {
+      {"message-id", required_argument, nullptr, 'i'},
+      {"sender", required_argument, nullptr, 'f'},
+      {"since", required_argument, nullptr, since},
+      {"until", required_argument, nullptr, until},
+      {"limit", required_argument, nullptr, 'n'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  CatalogQuery query{};
+  try {
+    int option = 0;
+    while ((option = getopt_long(argc, argv, "i:f:n:h", options, nullptr)) != -1) {
+      switch (option) {
+        case 'i':
+          query.messageId = optarg;
+          break;
+        case 'f':
+          query.sender = optarg;
+          break;
+        case since:
+          query.from = timeOf(optarg);
+          break;
+        case until:
+          query.to = timeOf(optarg);
+          break;
+        case 'n':
+          query.limit = std::stoul(optarg);
+          break;
+        case 'h':
+          usage(argv[0]);
+          return 0;
+        default:
+          usage(argv[0]);
+          return 1;
+      }
+    }
+  } catch (const std::exception &) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  try {
+    CatalogReader reader{std::string{argv[optind]} + "/catalog"};
+    const auto found = reader.search(query);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    for (const CatalogEntry &entry : found) {
+      std::cout << formatTime(entry.accepted) << " " << (entry.client.empty() ? "-" : entry.client) << " <"
+                << entry.sender << "> ->";
+      for (const auto &recipient : entry.recipients) {
+        std::cout << " <" << recipient << ">";
+      }
+      std::cout << " " << (entry.messageId.empty() ? "-" : "<" + entry.messageId + ">") << " " << entry.size
+                << " bytes " << entry.location << "\n";
+    }
+    std::cerr << found.size() << " messages of " << reader.size() << " in " << reader.segmentCount()
+              << " segments, in " << static_cast<double>(elapsed.count()) / 1000 << " ms\n";
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,430 @@
+#include "spool.hpp"
+
+#include "checksum.hpp"
+#include "files.hpp"
+#include "util.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+static constexpr size_t bufferSize = 64 * 1024;
+
+static void writeRecord(const std::string &path, const QueueRecord &record) {
+  std::ostringstream content{};
+  content << "sender " << record.envelope.sender << "\n";
+  for (const auto &recipient : record.envelope.recipients) {
+    content << "recipient " << recipient << "\n";
+  }
+  content << "attempts " << record.attempts << "\n";
+  content << "created " << record.created << "\n";
+  content << "next " << record.next << "\n";
+  if (record.checksum.has_value()) {
+    char checksum[16];
+    std::snprintf(checksum, sizeof(checksum), "%08x", record.checksum.value());
+    content << "checksum " << checksum << "\n";
+  }
+  if (!record.messageId.empty()) {
+    content << "message-id " << record.messageId << "\n";
+  }
+  if (record.traceLength > 0) {
+    content << "trace-length " << record.traceLength << "\n";
+  }
+  if (record.compressed) {
+    content << "compressed 1\n";
+  }
+  if (!record.client.empty()) {
+    content << "client " << record.client << "\n";
+  }
+  content << "size " << record.size << "\n";
+
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+  file.write(content.str());
+  SystemCall("fsync " + path, ::fsync(file.fd_num()));
+}
+
+static QueueRecord readRecord(const std::string &path, const std::string &id) {
+  std::ifstream file{path};
+  if (!file) {
+    throw std::runtime_error("cannot open queue record " + path);
+  }
+
+  QueueRecord record{};
+  record.id = id;
+  std::string key{};
+  while (file >> key) {
+    if (key == "sender") {
+      file >> record.envelope.sender;
+    } else if (key == "recipient") {
+      record.envelope.recipients.emplace_back();
+      file >> record.envelope.recipients.back();
+    } else if (key == "attempts") {
+      file >> record.attempts;
+    } else if (key == "created") {
+      file >> record.created;
+    } else if (key == "next") {
+      file >> record.next;
+    } else if (key == "checksum") {
+      uint32_t checksum = 0;
+      file >> std::hex >> checksum >> std::dec;
+      record.checksum = checksum;
+    } else if (key == "message-id") {
+      file >> record.messageId;
+    } else if (key == "trace-length") {
+      file >> record.traceLength;
+    } else if (key == "compressed") {
+      file >> record.compressed;
+    } else if (key == "client") {
+      file >> record.client;
+    } else if (key == "size") {
+      file >> record.size;
+    } else {
+      throw std::runtime_error("unknown key " + key + " in queue record " + path);
+    }
+  }
+  return record;
+}
+
+SpoolWriter::SpoolWriter(Spool &s, std::string i, std::string p, FileDescriptor &&f)
+    : spool{s}
+    , id{std::move(i)}
+    , path{std::move(p)}
+    , file{std::move(f)} {
+  buffer.reserve(bufferSize);
+  if (spool.compressor) {
+    compressor = std::make_unique<CompressedWriter>(file, *spool.compressor);
+  }
+}
+
+void SpoolWriter::flush(bool last) {
+  // Whole buffers checksum faster than lines, and are still in the cache
+  checksum = crc32c(checksum, buffer);
+  if (compressor) {
+    // A block per buffer, the trace fields start the first one
+    compressor->write(flushed ? std::string_view{} : std::string_view{trace}, buffer, last);
+  } else if (!flushed && !trace.empty()) {
+    file.write({trace, buffer});
+  } else {
+    file.write(buffer);
+  }
+  flushed = true;
+  buffer.clear();
+}
+
+// The msg-id between the angle brackets of a Message-ID header, empty if it
+// has none or has spaces in it
+static std::string messageIdOf(std::string_view value) {
+  size_t open = value.find('<');
+  size_t close = value.find('>', open);
+  if (open == std::string_view::npos || close == std::string_view::npos) {
+    return {};
+  }
+  std::string_view id = value.substr(open + 1, close - open - 1);
+  for (unsigned char c : id) {
+    if (!std::isgraph(c)) {
+      return {};
+    }
+  }
+  return std::string{id};
+}
+
+void SpoolWriter::append(std::string_view data) {
+  received += data.size();
+  if (!index.complete()) {
+    index.append(data);
+  }
+
+  if (buffer.size() + data.size() > bufferSize) {
+    flush();
+  }
+  buffer.append(data);
+}
+
+const std::string &SpoolWriter::finish() {
+  flush(true);
+  return path;
+}
+
+void SpoolWriter::prepend(std::string fields) {
+  if (flushed) {
+    throw std::runtime_error("trace fields for " + id + " come after its body was written");
+  }
+  trace = std::move(fields) + trace;
+}
+
+std::optional<QueueRecord> SpoolWriter::commit(const Envelope &envelope) {
+  // The checksum is complete once the last buffer is out
+  flush(true);
+
+  QueueRecord record{};
+  record.id = id;
+  record.envelope = envelope;
+  record.created = record.next = std::time(nullptr);
+  record.checksum = checksum;
+  record.messageId = messageIdOf(index.find(Header::MessageId).value_or(""));
+  record.traceLength = trace.size();
+  record.compressed = compressed();
+  record.client = client;
+  record.size = received;
+
+  std::string key{};
+  if (spool.dedup) {
+    std::string sender = envelope.sender;
+    for (const auto &recipient : envelope.recipients) {
+      sender += "\n" + recipient;
+    }
+    key = DedupIndex::key(record.messageId, checksum, sender);
+    if (!key.empty() && spool.dedup->contains(key)) {
+      // Never synced, the destructor removes it
+      return std::nullopt;
+    }
+  }
+
+  SystemCall("fsync " + path, ::fsync(file.fd_num()));
+
+  const std::string recordPath = spool.directory + "/tmp/" + id + ".queue";
+  writeRecord(recordPath, record);
+
+  // The body goes first: a body without a record is removed on startup, a
+  // record without a body would be a message we can never deliver.
+  SystemCall("rename " + path, ::rename(path.c_str(), spool.bodyPath(id).c_str()));
+  committed = true;
+  const std::string queuePath = spool.directory + "/queue/" + id;
+  SystemCall("rename " + recordPath, ::rename(recordPath.c_str(), queuePath.c_str()));
+  syncDirectory(spool.directory + "/msg");
+  syncDirectory(spool.directory + "/queue");
+
+  if (!key.empty()) {
+    spool.dedup->insert(key);
+  }
+  if (spool.messages) {
+    // The message is queued whatever happens to its line
+    try {
+      CatalogEntry entry{};
+      entry.accepted = record.created;
+      entry.client = record.client;
+      entry.sender = envelope.sender;
+      entry.recipients = envelope.recipients;
+      entry.messageId = record.messageId;
+      entry.size = record.size;
+      entry.id = id;
+      entry.location = spool.bodyPath(id);
+      spool.messages->append(entry);
+    } catch (const std::exception &e) {
+      std::cerr << "Cannot catalog message " << id << ": " << e.what() << std::endl;
+    }
+  }
+  if (spool.committed) {
+    spool.committed(record);
+  }
+  return record;
+}
+
+SpoolWriter::~SpoolWriter() {
+  if (!committed) {
+    ::unlink(path.c_str());
+  }
+}
+
+Spool::Spool(std::string d, bool recovering) : directory{std::move(d)} {
+  namespace fs = std::filesystem;
+  for (const char *name : {"tmp", "msg", "queue"}) {
+    fs::create_directories(fs::path{directory} / name);
+  }
+
+  if (recovering) {
+    recover();
+  }
+  loadDictionaries();
+}
+
+void Spool::loadDictionaries() {
+  namespace fs = std::filesystem;
+  if (!fs::exists(fs::path{directory} / "dict")) {
+    return;
+  }
+  for (const auto &entry : fs::directory_iterator{fs::path{directory} / "dict"}) {
+    auto loaded = std::make_shared<const Dictionary>(Dictionary::load(entry.path().string()));
+    dictionaries.emplace(loaded->id, std::move(loaded));
+  }
+}
+
+void Spool::recover() {
+  namespace fs = std::filesystem;
+  for (const auto &entry : fs::directory_iterator{fs::path{directory} / "tmp"}) {
+    fs::remove(entry.path());
+  }
+  for (const auto &entry : fs::directory_iterator{fs::path{directory} / "msg"}) {
+    if (!fs::exists(fs::path{directory} / "queue" / entry.path().filename())) {
+      fs::remove(entry.path());
+    }
+  }
+  for (const auto &entry : fs::directory_iterator{fs::path{directory} / "queue"}) {
+    if (!fs::exists(fs::path{directory} / "msg" / entry.path().filename())) {
+      std::cerr << "Dropping queue record " << entry.path() << " without a body\n";
+      fs::remove(entry.path());
+    }
+  }
+}
+
+std::unique_ptr<SpoolWriter> Spool::create() {
+  std::string id = uniqueId();
+  std::string path = directory + "/tmp/" + id;
+  FileDescriptor file{
+      SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600))};
+  return std::make_unique<SpoolWriter>(*this, std::move(id), std::move(path), std::move(file));
+}
+
+void Spool::deduplicate(std::chrono::seconds window) {
+  dedup = std::make_unique<DedupIndex>(directory + "/dedup", window);
+}
+
+void Spool::catalog() { messages = std::make_unique<MessageCatalog>(directory + "/catalog"); }
+
+void Spool::compress(int l, const std::string &path) {
+  if (l < 1 || l > 9) {
+    throw std::runtime_error("compression level " + std::to_string(l) + " is not 1 to 9");
+  }
+  if (path.empty()) {
+    compressor = std::make_unique<BlockCompressor>(l);
+    return;
+  }
+
+  auto loaded = std::make_shared<const Dictionary>(Dictionary::load(path));
+  char name[16];
+  std::snprintf(name, sizeof(name), "%08x", loaded->id);
+  const std::string kept = directory + "/dict/" + name;
+  if (!std::filesystem::exists(kept)) {
+    // Durable before the first body that needs it is
+    std::filesystem::create_directories(directory + "/dict");
+    const std::string partial = kept + ".tmp";
+    {
+      FileDescriptor file{
+          SystemCall("open " + partial, ::open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+      file.write(std::string_view{loaded->data});
+      SystemCall("fsync " + partial, ::fsync(file.fd_num()));
+    }
+    SystemCall("rename " + partial, ::rename(partial.c_str(), kept.c_str()));
+    syncDirectory(directory + "/dict");
+  }
+  dictionaries[loaded->id] = loaded;
+  compressor = std::make_unique<BlockCompressor>(l, std::move(loaded));
+}
+
+BodyReader Spool::open(const QueueRecord &record) const { return open(bodyPath(record.id), record.compressed); }
+
+BodyReader Spool::open(const std::string &path, bool compressed) const {
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_RDONLY | O_CLOEXEC))};
+  if (!compressed) {
+    return BodyReader{std::move(file)};
+  }
+  auto lookup = [this](uint32_t id) -> std::shared_ptr<const Dictionary> {
+    auto found = dictionaries.find(id);
+    return found != dictionaries.end() ? found->second : nullptr;
+  };
+  return BodyReader{CompressedReader{std::move(file), lookup}};
+}
+
+std::string Spool::inflate(const QueueRecord &record) const {
+  BodyReader body = open(record);
+  const std::string path = directory + "/tmp/" + record.id + ".plain";
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600))};
+  try {
+    std::string chunk{};
+    for (body.read(chunk); !chunk.empty(); body.read(chunk)) {
+      file.write(std::string_view{chunk});
+    }
+    SystemCall("fsync " + path, ::fsync(file.fd_num()));
+  } catch (...) {
+    ::unlink(path.c_str());
+    throw;
+  }
+  return path;
+}
+
+bool Spool::intact(const QueueRecord &record) const {
+  if (!record.checksum.has_value()) {
+    return true;
+  }
+
+  try {
+    BodyReader body = open(record);
+    // The checksum is the one of the message, without our trace fields
+    body.seek(record.traceLength);
+    uint32_t checksum = 0;
+    std::string chunk{};
+    while (true) {
+      body.read(chunk);
+      if (chunk.empty()) {
+        return checksum == record.checksum.value();
+      }
+      checksum = crc32c(checksum, chunk);
+    }
+  } catch (const std::exception &) {
+    // Gone, or a compressed body too garbled to inflate
+    return false;
+  }
+}
+
+void Spool::save(const QueueRecord &record) {
+  const std::string recordPath = directory + "/tmp/" + record.id + ".queue";
+  const std::string queuePath = directory + "/queue/" + record.id;
+  writeRecord(recordPath, record);
+  SystemCall("rename " + recordPath, ::rename(recordPath.c_str(), queuePath.c_str()));
+  syncDirectory(directory + "/queue");
+}
+
+void Spool::remove(const std::string &id) {
+  // Drop the record first, a crash in between leaves an orphan body which is
+  // cleaned up on startup rather than a record that would be delivered again.
+  const std::string queuePath = directory + "/queue/" + id;
+  SystemCall("unlink " + queuePath, ::unlink(queuePath.c_str()));
+  syncDirectory(directory + "/queue");
+  const std::string body = bodyPath(id);
+  SystemCall("unlink " + body, ::unlink(body.c_str()));
+}
+
+std::vector<QueueRecord> Spool::records() {
+  namespace fs = std::filesystem;
+  std::vector<QueueRecord> result{};
+  for (const auto &entry : fs::directory_iterator{fs::path{directory} / "queue"}) {
+    try {
+      result.push_back(readRecord(entry.path().string(), entry.path().filename().string()));
+    } catch (const std::runtime_error &) {
+      // Removed since it was listed, e.g. delivered meanwhile
+      if (fs::exists(entry.path())) {
+        throw;
+      }
+    }
+  }
+  return result;
+}
+
+BodyReader::BodyReader(FileDescriptor &&file) : plain{std::move(file)} {}
+
+BodyReader::BodyReader(CompressedReader &&reader) : blocks{std::move(reader)} {}
+
+void BodyReader::read(std::string &chunk) {
+  if (blocks.has_value()) {
+    blocks->read(chunk);
+  } else {
+    plain->read(chunk, bufferSize);
+  }
+}
+
+void BodyReader::seek(uint64_t offset) {
+  if (blocks.has_value()) {
+    blocks->seek(offset);
+  } else {
+    SystemCall("lseek", ::lseek(plain->fd_num(), static_cast<off_t>(offset), SEEK_SET));
+  }
+}
+
+std::string Spool::bodyPath(const std::string &id) const { return directory + "/msg/" + id; }
@@ -0,0 +1,282 @@
+#pragma once
+
+#include "compression.hpp"
+#include "dedupIndex.hpp"
+#include "headerIndex.hpp"
+#include "messageCatalog.hpp"
+#include "socket.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief The sender and the recipients of a message.
+ *
+ */
+struct Envelope {
+  std::string sender{};
+  std::vector<std::string> recipients{};
+};
+
+/**
+ * @brief A message waiting in the spool queue.
+ *
+ */
+struct QueueRecord {
+  std::string id{};                    //!< Names both the body and the record in the spool
+  Envelope envelope{};                 //!< The recipients still waiting for delivery
+  unsigned attempts = 0;               //!< Number of delivery attempts so far
+  std::time_t created = 0;             //!< When the message was accepted
+  std::time_t next = 0;                //!< When the next delivery attempt is due
+  std::optional<uint32_t> checksum{};  //!< CRC32C of the body, missing in records spooled before it was kept
+  std::string messageId{};             //!< The Message-ID of the message, if it has one
+  size_t traceLength = 0;              //!< Bytes of trace fields, e.g. Received, the body starts with
+  bool compressed = false;             //!< Whether the body is stored by `CompressedWriter`
+  std::string client{};                //!< Address of the client which sent the message, empty if unknown
+  uint64_t size = 0;                   //!< Bytes of the message as the client sent it, without the trace fields
+};
+
+class Spool;
+
+/**
+ * @brief Reads a spooled body, compressed or not.
+ *
+ * @details Reads return what follows, a buffer or a compressed block at a
+ * time, the body as it was appended either way.
+ */
+class BodyReader {
+private:
+  std::optional<FileDescriptor> plain{};
+  std::optional<CompressedReader> blocks{};
+
+public:
+  //! Read the plain body in `file`
+  explicit BodyReader(FileDescriptor &&file);
+
+  //! Read a compressed body
+  explicit BodyReader(CompressedReader &&reader);
+
+  //! The next bytes of the body, empty at its end
+  void read(std::string &chunk);
+
+  //! Read from `offset` next, a compressed body inflates only the block it is in
+  void seek(uint64_t offset);
+};
+
+/**
+ * @brief A message body being received in the DATA state.
+ *
+ * @details The body is written to `tmp/` and only becomes part of the spool
+ * when it is committed. Destroying an uncommitted writer removes the file.
+ */
+class SpoolWriter {
+private:
+  Spool &spool;
+  std::string id;
+  std::string path;
+  FileDescriptor file;
+  std::string buffer{};
+  bool committed = false;
+
+  uint32_t checksum = 0;                           //!< CRC32C of what was flushed so far
+  HeaderIndex index{};                             //!< The header fields of the message
+  std::string trace{};                             //!< Trace fields to write before the message
+  bool flushed = false;                            //!< Whether anything has been written yet
+  std::unique_ptr<CompressedWriter> compressor{};  //!< Compresses every buffer into a block, if the spool compresses
+  std::string client{};                            //!< Address of the client sending the message
+  uint64_t received = 0;                           //!< Bytes of the message appended so far
+
+  void flush(bool last = false);
+
+public:
+  SpoolWriter(Spool &spool, std::string id, std::string path, FileDescriptor &&file);
+
+  /**
+   * @brief Append one line of the body, with its CRLF.
+   *
+   * @details The header fields are indexed on the way, and the checksum of
+   * the body taken from the buffer about to be written, the body is never
+   * read again.
+   *
+   * @param[in] line the line, already dot-unstuffed
+   */
+  void append(std::string_view line);
+
+  /**
+   * @brief Put trace fields, e.g. Received, before the message.
+   *
+   * @details They go to the file ahead of the first buffer, in the same
+   * writev(2) or the same compressed block, so the message is neither
+   * copied nor rewritten. They are left out of the checksum and of the
+   * header index, which stay those of the message as the client sent it.
+   * Only allowed before the first buffer is written, i.e. before 64 KB of
+   * the message have been appended.
+   *
+   * @param[in] fields complete header fields, each with its CRLF
+   */
+  void prepend(std::string fields);
+
+  /**
+   * @brief Write out what is still buffered, to read the body before it is committed.
+   *
+   * @details Nothing may be appended afterwards. A compressed body is read
+   * with `Spool::open`.
+   *
+   * @return const std::string& the path of the complete body, until the writer commits or goes away
+   */
+  const std::string &finish();
+
+  //! Record that the message comes from the client at `address`
+  void setClient(std::string address) { client = std::move(address); }
+
+  //! Whether the body is written compressed
+  bool compressed() const { return compressor != nullptr; }
+
+  //! The header fields of the message, as far as they have been appended
+  const HeaderIndex &headers() const { return index; }
+
+  //! The id the message will be queued under
+  const std::string &queueId() const { return id; }
+
+  //! Bytes of trace fields before the message
+  size_t traceLength() const { return trace.size(); }
+
+  /**
+   * @brief Make the message durable and queue it.
+   *
+   * @details When this returns, the body and its queue record have been
+   * fsync'ed and renamed into the spool, so the message may be acknowledged.
+   * A message the spool accepted lately, see `Spool::deduplicate`, is
+   * dropped instead, and may be acknowledged too.
+   *
+   * @param[in] envelope the sender and the recipients
+   * @return std::optional<QueueRecord> the record of the queued message, std::nullopt for a duplicate
+   */
+  std::optional<QueueRecord> commit(const Envelope &envelope);
+
+  ~SpoolWriter();
+
+  SpoolWriter(const SpoolWriter &other) = delete;
+  SpoolWriter &operator=(const SpoolWriter &other) = delete;
+};
+
+/**
+ * @brief The on-disk store of accepted messages.
+ *
+ * @details The spool directory holds three directories:
+ *
+ *   tmp/    bodies being received and records being rewritten
+ *   msg/    the body of every queued message
+ *   queue/  one record per queued message, see `QueueRecord`
+ *
+ * Files only enter `msg/` and `queue/` through rename(2), so a crash never
+ * leaves a partial file there.
+ *
+ * A spool which compresses, see `compress`, also keeps the dictionaries its
+ * bodies were compressed with in `dict/`, named by their id. A spool which
+ * catalogs, see `catalog`, keeps the metadata of every message it accepted
+ * in `catalog/`, long after the message was delivered.
+ */
+class Spool {
+private:
+  std::string directory;
+  std::unique_ptr<DedupIndex> dedup{};
+  std::unique_ptr<MessageCatalog> messages{};     //!< Where every committed message is appended, if the spool catalogs
+  std::unique_ptr<BlockCompressor> compressor{};  //!< Compresses the bodies of every writer, if the spool compresses
+  //! Those in `dict/`, by id
+  std::unordered_map<uint32_t, std::shared_ptr<const Dictionary>> dictionaries{};
+
+  void loadDictionaries();
+
+  friend class SpoolWriter;
+
+  void recover();
+
+public:
+  /**
+   * @brief Called after a message has been committed, e.g. to hand it to the relay
+   *
+   */
+  std::function<void(const QueueRecord &)> committed{};
+
+  /**
+   * @brief Open the spool, creating it if needed.
+   * @details Partially received bodies and bodies without a queue record,
+   * left behind by a crash, are removed. A process taking the spool over
+   * from a running one must not recover, those files may still be written.
+   *
+   * @param[in] directory the spool directory
+   * @param[in] recovering whether to remove what a crash left behind
+   */
+  explicit Spool(std::string directory, bool recovering = true);
+
+  //! Start receiving a new message body
+  std::unique_ptr<SpoolWriter> create();
+
+  /**
+   * @brief Drop the messages sent again within `window`, see `DedupIndex`.
+   *
+   * @param[in] window how long an accepted message is remembered
+   */
+  void deduplicate(std::chrono::seconds window);
+
+  /**
+   * @brief Compress the bodies received from now on, see `CompressedWriter`.
+   *
+   * @details The dictionary is copied into the spool, the bodies compressed
+   * with it can be read as long as the spool is there. Call before the
+   * relay starts reading bodies.
+   *
+   * @param[in] level the zlib level, 1 for speed to 9 for ratio
+   * @param[in] dictionary a file made by trainDictionary, empty for none
+   */
+  void compress(int level, const std::string &dictionary = {});
+
+  /**
+   * @brief Record every message committed from now on in `catalog/`.
+   *
+   * @details A line per message is appended once it is durable, query them
+   * with `CatalogReader` or queryCatalog. See `MessageCatalog`.
+   */
+  void catalog();
+
+  //! Read the body of `record`, throws if it is not there
+  BodyReader open(const QueueRecord &record) const;
+
+  //! Read the body in `path`, e.g. the one `SpoolWriter::finish` returns
+  BodyReader open(const std::string &path, bool compressed) const;
+
+  /**
+   * @brief Copy the body of a compressed message into a plain file.
+   *
+   * @details For whoever needs the body as a file, e.g. the mailboxes which
+   * link it. The copy is in tmp/, fsync'ed, and the caller removes it.
+   *
+   * @param[in] record the message
+   * @return std::string the path of the copy
+   */
+  std::string inflate(const QueueRecord &record) const;
+
+  //! Whether the body of `record` is there and still has the checksum it was spooled with
+  bool intact(const QueueRecord &record) const;
+
+  //! Atomically replace the queue record of `record.id`
+  void save(const QueueRecord &record);
+
+  //! Remove a message and its queue record from the spool
+  void remove(const std::string &id);
+
+  //! All the queue records in the spool, less those removed while they are listed
+  std::vector<QueueRecord> records();
+
+  //! The path of the body of message `id`
+  std::string bodyPath(const std::string &id) const;
+};
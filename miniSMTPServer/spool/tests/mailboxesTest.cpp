@@ -0,0 +1,114 @@
+#include "mailboxes.hpp"
+#include "spool.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static std::string temporaryDirectory(const fs::path &parent, const std::string &name) {
+  auto path = parent / ("mailboxesTest." + name + "." + std::to_string(::getpid()));
+  fs::remove_all(path);
+  return path.string();
+}
+
+static QueueRecord spoolMessage(Spool &spool, const std::vector<std::string> &recipients, const std::string &body) {
+  auto writer = spool.create();
+  writer->append(body);
+  return writer->commit(Envelope{"shejialuo@gmail.com", recipients}).value();
+}
+
+static struct stat status(const std::string &path) {
+  struct stat result {};
+  EXPECT_EQ(::stat(path.c_str(), &result), 0) << path;
+  return result;
+}
+
+static std::string content(const std::string &path) {
+  std::ifstream file{path};
+  std::stringstream all{};
+  all << file.rdbuf();
+  return all.str();
+}
+
+TEST(Mailboxes, everyRecipientSharesTheSpooledBody) {
+  std::string directory = temporaryDirectory(fs::temp_directory_path(), "shared");
+  Spool spool{directory + "/spool"};
+  Mailboxes mailboxes{directory + "/mailboxes"};
+  const std::vector<std::string> recipients{"a@example.com", "b@example.com", "c@example.com"};
+  QueueRecord record = spoolMessage(spool, recipients, "Subject: hi\r\n\r\nbody\r\n");
+
+  std::vector<std::string> all = recipients;
+  all.push_back("../escape@example.com");
+  MailboxDelivery delivery = mailboxes.deliver(record.id, all, spool.bodyPath(record.id));
+  EXPECT_EQ(delivery.delivered, recipients);
+  EXPECT_EQ(delivery.failed, std::vector<std::string>{"../escape@example.com"});
+  EXPECT_EQ(delivery.linked, 3);
+  EXPECT_EQ(delivery.bytesWritten, 0);
+
+  // One body, referenced by the spool and the three mailboxes
+  struct stat body = status(spool.bodyPath(record.id));
+  EXPECT_EQ(body.st_nlink, 4);
+  for (const auto &recipient : recipients) {
+    EXPECT_EQ(mailboxes.messages(recipient), std::vector<std::string>{record.id});
+    EXPECT_EQ(status(mailboxes.path(recipient, record.id)).st_ino, body.st_ino);
+  }
+
+  // The body outlives the spool, and goes with the last mailbox
+  spool.remove(record.id);
+  EXPECT_EQ(status(mailboxes.path("c@example.com", record.id)).st_nlink, 3);
+  mailboxes.remove("a@example.com", record.id);
+  mailboxes.remove("b@example.com", record.id);
+  EXPECT_EQ(content(mailboxes.path("c@example.com", record.id)), "Subject: hi\r\n\r\nbody\r\n");
+  EXPECT_EQ(status(mailboxes.path("c@example.com", record.id)).st_nlink, 1);
+  mailboxes.remove("c@example.com", record.id);
+  EXPECT_TRUE(mailboxes.messages("c@example.com").empty());
+
+  fs::remove_all(directory);
+}
+
+TEST(Mailboxes, deliveringAgainIsHarmless) {
+  std::string directory = temporaryDirectory(fs::temp_directory_path(), "again");
+  Spool spool{directory + "/spool"};
+  Mailboxes mailboxes{directory + "/mailboxes"};
+  QueueRecord record = spoolMessage(spool, {"a@example.com", "b@example.com"}, "body\r\n");
+
+  mailboxes.deliver(record.id, {"a@example.com"}, spool.bodyPath(record.id));
+  MailboxDelivery delivery = mailboxes.deliver(record.id, record.envelope.recipients, spool.bodyPath(record.id));
+  EXPECT_EQ(delivery.delivered, record.envelope.recipients);
+  EXPECT_EQ(delivery.linked, 1);
+  EXPECT_EQ(status(spool.bodyPath(record.id)).st_nlink, 3);
+
+  fs::remove_all(directory);
+}
+
+TEST(Mailboxes, anotherFileSystemGetsOneCopy) {
+  // /dev/shm is a tmpfs, usually not where the temporary directory is
+  if (!fs::is_directory("/dev/shm") ||
+      status("/dev/shm").st_dev == status(fs::temp_directory_path().string()).st_dev) {
+    GTEST_SKIP() << "no second file system";
+  }
+  std::string directory = temporaryDirectory(fs::temp_directory_path(), "copy");
+  std::string elsewhere = temporaryDirectory("/dev/shm", "copy");
+  Spool spool{directory};
+  Mailboxes mailboxes{elsewhere};
+  const std::string body = "Subject: hi\r\n\r\nbody\r\n";
+  QueueRecord record = spoolMessage(spool, {"a@example.com", "b@example.com", "c@example.com"}, body);
+
+  MailboxDelivery delivery = mailboxes.deliver(record.id, record.envelope.recipients, spool.bodyPath(record.id));
+  EXPECT_EQ(delivery.delivered, record.envelope.recipients);
+  EXPECT_EQ(delivery.linked, 2);
+  EXPECT_EQ(delivery.bytesWritten, body.size());
+  EXPECT_EQ(status(mailboxes.path("c@example.com", record.id)).st_nlink, 3);
+  EXPECT_EQ(content(mailboxes.path("a@example.com", record.id)), body);
+  EXPECT_TRUE(fs::is_empty(fs::path{elsewhere} / "a@example.com" / "tmp"));
+
+  fs::remove_all(directory);
+  fs::remove_all(elsewhere);
+}
@@ -0,0 +1,474 @@
+#include "checksum.hpp"
+#include "dedupIndex.hpp"
+#include "headerIndex.hpp"
+#include "messageCatalog.hpp"
+#include "spool.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static std::string temporarySpool(const std::string &name) {
+  auto path = fs::temp_directory_path() / ("spoolTest." + name + "." + std::to_string(::getpid()));
+  fs::remove_all(path);
+  return path.string();
+}
+
+static std::optional<QueueRecord> spoolMessage(Spool &spool,
+                                               const std::vector<std::string> &recipients,
+                                               const std::vector<std::string> &lines) {
+  auto writer = spool.create();
+  for (const auto &line : lines) {
+    writer->append(line);
+  }
+  return writer->commit(Envelope{"shejialuo@gmail.com", recipients});
+}
+
+TEST(Checksum, crc32cKnownValues) {
+  EXPECT_EQ(crc32c(0, ""), 0);
+  EXPECT_EQ(crc32c(0, "123456789"), 0xe3069283);
+  EXPECT_EQ(crc32cPortable(0, "123456789"), 0xe3069283);
+  EXPECT_EQ(crc32c(0, std::string(32, '\0')), 0x8a9136aa);
+}
+
+TEST(Checksum, piecesGiveTheSameChecksum) {
+  std::mt19937 random{42};
+  // Long enough for the three lanes of the SSE4.2 version
+  std::string data(100003, '\0');
+  for (auto &c : data) {
+    c = static_cast<char>(random());
+  }
+
+  uint32_t whole = crc32cPortable(0, data);
+  EXPECT_EQ(crc32c(0, data), whole);
+  for (size_t split : {1, 7, 8, 9, 767, 768, 24576, 100002}) {
+    std::string_view view{data};
+    EXPECT_EQ(crc32c(crc32c(0, view.substr(0, split)), view.substr(split)), whole) << split;
+  }
+}
+
+TEST(Spool, keepsTheChecksumAndTheMessageId) {
+  std::string directory = temporarySpool("checksum");
+  Spool spool{directory};
+  // The header comes in pieces and is folded
+  std::vector<std::string> lines{"Subject: hi\r\n", "message-ID:\r\n", " <abc.123@example.com", ">\r\n", "\r\n",
+                                 "Message-ID: <not@a.header>\r\n"};
+  std::optional<QueueRecord> record = spoolMessage(spool, {"a@example.com"}, lines);
+  ASSERT_TRUE(record.has_value());
+
+  std::string body{};
+  for (const auto &line : lines) {
+    body += line;
+  }
+  auto records = spool.records();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].messageId, "abc.123@example.com");
+  EXPECT_EQ(records[0].checksum, crc32c(0, body));
+  EXPECT_TRUE(spool.intact(records[0]));
+
+  // A flipped byte, and a record from before checksums were kept
+  std::fstream file{spool.bodyPath(record->id), std::ios::in | std::ios::out};
+  file.seekp(3);
+  file.put('J');
+  file.close();
+  EXPECT_FALSE(spool.intact(records[0]));
+  records[0].checksum.reset();
+  EXPECT_TRUE(spool.intact(records[0]));
+
+  fs::remove_all(directory);
+}
+
+TEST(Spool, dropsAMessageSentAgain) {
+  std::string directory = temporarySpool("dedup");
+  Spool spool{directory};
+  spool.deduplicate(std::chrono::seconds{3600});
+  const std::vector<std::string> message{"Message-ID: <1@example.com>\r\n", "\r\n", "body\r\n"};
+
+  ASSERT_TRUE(spoolMessage(spool, {"a@example.com"}, message).has_value());
+  EXPECT_FALSE(spoolMessage(spool, {"a@example.com"}, message).has_value());
+  EXPECT_TRUE(fs::is_empty(fs::path{directory} / "tmp"));
+
+  // The rest of a message split over transactions, another body, no Message-ID
+  EXPECT_TRUE(spoolMessage(spool, {"b@example.com"}, message).has_value());
+  EXPECT_TRUE(spoolMessage(spool, {"a@example.com"}, {message[0], message[1], "other\r\n"}).has_value());
+  EXPECT_TRUE(spoolMessage(spool, {"a@example.com"}, {"\r\n", "body\r\n"}).has_value());
+  EXPECT_TRUE(spoolMessage(spool, {"a@example.com"}, {"\r\n", "body\r\n"}).has_value());
+  EXPECT_EQ(spool.records().size(), 5);
+
+  // Still known after a restart
+  Spool restarted{directory};
+  restarted.deduplicate(std::chrono::seconds{3600});
+  EXPECT_FALSE(spoolMessage(restarted, {"a@example.com"}, message).has_value());
+
+  fs::remove_all(directory);
+}
+
+TEST(Spool, writesTraceFieldsBeforeTheMessage) {
+  std::string directory = temporarySpool("trace");
+  Spool spool{directory};
+  spool.deduplicate(std::chrono::seconds{3600});
+  const std::string message = "Message-ID: <1@example.com>\r\n\r\nbody\r\n";
+
+  auto writer = spool.create();
+  writer->prepend("Received: from a\r\n");
+  writer->append(message);
+  writer->prepend("Received: from b\r\n");
+  EXPECT_EQ(writer->headers().find(Header::MessageId), "<1@example.com>");
+  QueueRecord record = writer->commit(Envelope{"shejialuo@gmail.com", {"a@example.com"}}).value();
+
+  std::ifstream file{spool.bodyPath(record.id)};
+  std::string body{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  EXPECT_EQ(body, "Received: from b\r\nReceived: from a\r\n" + message);
+  auto records = spool.records();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].traceLength, 36);
+  EXPECT_EQ(records[0].checksum, crc32c(0, message));
+  EXPECT_TRUE(spool.intact(records[0]));
+
+  // Every copy has its own Received field, the message is still the same
+  writer = spool.create();
+  writer->prepend("Received: from c\r\n");
+  writer->append(message);
+  EXPECT_FALSE(writer->commit(Envelope{"shejialuo@gmail.com", {"a@example.com"}}).has_value());
+
+  // Too late once the first buffer is out
+  writer = spool.create();
+  writer->append(std::string(128 * 1024, 'x'));
+  EXPECT_THROW(writer->prepend("Received: from d\r\n"), std::runtime_error);
+
+  fs::remove_all(directory);
+}
+
+static std::string readBody(BodyReader &body) {
+  std::string all{};
+  std::string chunk{};
+  for (body.read(chunk); !chunk.empty(); body.read(chunk)) {
+    all += chunk;
+  }
+  return all;
+}
+
+TEST(Spool, compressesBodiesInBlocks) {
+  std::string directory = temporarySpool("compressed");
+  Spool spool{directory};
+  spool.compress(1);
+
+  // Text over a few blocks, then an attachment deflate cannot shrink
+  std::vector<std::string> lines{"Subject: report\r\n", "\r\n"};
+  for (int i = 0; i < 4000; ++i) {
+    lines.push_back("Line " + std::to_string(i) + " of the quarterly report, nothing new to say.\r\n");
+  }
+  std::mt19937 random{7};
+  for (int i = 0; i < 1000; ++i) {
+    std::string line(76, '\0');
+    for (auto &c : line) {
+      c = static_cast<char>(random());
+    }
+    lines.push_back(line + "\r\n");
+  }
+  std::string message{};
+  for (const auto &line : lines) {
+    message += line;
+  }
+
+  auto writer = spool.create();
+  writer->prepend("Received: from a\r\n");
+  for (const auto &line : lines) {
+    writer->append(line);
+  }
+  QueueRecord record = writer->commit(Envelope{"shejialuo@gmail.com", {"a@example.com"}}).value();
+  EXPECT_TRUE(record.compressed);
+  EXPECT_LT(fs::file_size(spool.bodyPath(record.id)), message.size() / 2);
+  EXPECT_EQ(record.checksum, crc32c(0, message));
+  ASSERT_EQ(spool.records().size(), 1);
+  EXPECT_TRUE(spool.records()[0].compressed);
+  EXPECT_TRUE(spool.intact(record));
+
+  BodyReader body = spool.open(record);
+  EXPECT_EQ(readBody(body), "Received: from a\r\n" + message);
+  // Into the middle of a block, and past the end
+  body.seek(record.traceLength + 150000);
+  EXPECT_EQ(readBody(body), message.substr(150000));
+  body.seek(record.traceLength + message.size() + 1);
+  EXPECT_EQ(readBody(body), "");
+
+  // A plain copy for the mailboxes
+  std::string copy = spool.inflate(record);
+  std::ifstream file{copy, std::ios::binary};
+  EXPECT_EQ(std::string(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}),
+            "Received: from a\r\n" + message);
+  fs::remove(copy);
+
+  // A garbled block fails to inflate or to match the checksum
+  {
+    std::fstream garble{spool.bodyPath(record.id), std::ios::in | std::ios::out | std::ios::binary};
+    garble.seekp(40);
+    garble.put('\xff');
+  }
+  EXPECT_FALSE(spool.intact(record));
+
+  fs::remove_all(directory);
+}
+
+TEST(Spool, compressesWithATrainedDictionary) {
+  std::string directory = temporarySpool("dictionary");
+  // Alike but for a few fields, each too small to compress much on its own
+  auto message = [](int i) {
+    return "From: Billing <billing@example.com>\r\nTo: customer" + std::to_string(i) +
+           "@example.org\r\nSubject: Your invoice " + std::to_string(i) +
+           " is ready\r\nMIME-Version: 1.0\r\nContent-Type: text/plain; charset=utf-8\r\n\r\nDear customer,\r\n\r\n"
+           "your invoice for this month is ready, you can find it in your account.\r\n"
+           "This is an automated message, please do not reply to it.\r\n";
+  };
+  std::vector<std::string> samples{};
+  for (int i = 0; i < 20; ++i) {
+    samples.push_back(message(i));
+  }
+  Dictionary dictionary = Dictionary::train(samples);
+  EXPECT_NE(dictionary.data.find("This is an automated message, please do not reply to it.\r\n"), std::string::npos);
+  EXPECT_EQ(dictionary.data.find("customer3@"), std::string::npos);
+
+  fs::create_directories(directory);
+  const std::string path = directory + "/invoices.dict";
+  std::ofstream{path, std::ios::binary} << dictionary.data;
+
+  std::vector<std::string> lines{message(100)};
+  Spool without{directory + "/without"};
+  without.compress(6);
+  QueueRecord plain = spoolMessage(without, {"a@example.com"}, lines).value();
+  QueueRecord record{};
+  {
+    Spool spool{directory + "/spool"};
+    spool.compress(6, path);
+    record = spoolMessage(spool, {"a@example.com"}, lines).value();
+  }
+  EXPECT_LT(fs::file_size(directory + "/spool/msg/" + record.id) * 2, fs::file_size(without.bodyPath(plain.id)));
+
+  // The spool kept the dictionary, whoever opens it next reads the body
+  fs::remove(path);
+  Spool spool{directory + "/spool"};
+  EXPECT_TRUE(spool.intact(record));
+  BodyReader body = spool.open(record);
+  EXPECT_EQ(readBody(body), message(100));
+
+  fs::remove_all(directory + "/spool/dict");
+  EXPECT_FALSE(Spool{directory + "/spool"}.intact(record));
+
+  fs::remove_all(directory);
+}
+
+TEST(Spool, catalogsCommittedMessages) {
+  std::string directory = temporarySpool("catalog");
+  Spool spool{directory};
+  spool.catalog();
+  for (const char *id : {"1@example.com", "2@example.com", ""}) {
+    auto writer = spool.create();
+    writer->prepend("Received: from 127.0.0.1\r\n");
+    writer->setClient("192.0.2.1");
+    writer->append(*id != '\0' ? "Message-ID: <" + std::string{id} + ">\r\n" : "Subject: hi\r\n");
+    writer->append("\r\nbody\r\n");
+    ASSERT_TRUE(writer->commit(Envelope{"Sender@example.com", {"a@example.com", "b@example.com"}}).has_value());
+  }
+
+  std::vector<QueueRecord> records = spool.records();
+  ASSERT_EQ(records.size(), 3);
+  EXPECT_EQ(records[0].client, "192.0.2.1");
+  EXPECT_EQ(records[0].size, records[0].messageId.empty() ? 21 : 37);
+
+  CatalogReader reader{directory + "/catalog"};
+  EXPECT_EQ(reader.size(), 3);
+  CatalogQuery query{};
+  query.messageId = "2@example.com";
+  auto found = reader.search(query);
+  ASSERT_EQ(found.size(), 1);
+  EXPECT_EQ(found[0].client, "192.0.2.1");
+  EXPECT_EQ(found[0].sender, "Sender@example.com");
+  EXPECT_EQ(found[0].recipients, (std::vector<std::string>{"a@example.com", "b@example.com"}));
+  EXPECT_EQ(found[0].size, 37);
+  EXPECT_EQ(found[0].location, spool.bodyPath(found[0].id));
+  EXPECT_GE(found[0].accepted, std::time(nullptr) - 60);
+
+  // The newest first, the sender in any case
+  query = CatalogQuery{};
+  query.sender = "sender@EXAMPLE.com";
+  query.limit = 2;
+  found = reader.search(query);
+  ASSERT_EQ(found.size(), 2);
+  EXPECT_TRUE(found[0].messageId.empty());
+  EXPECT_EQ(found[1].messageId, "2@example.com");
+
+  query = CatalogQuery{};
+  query.from = std::time(nullptr) + 3600;
+  EXPECT_TRUE(reader.search(query).empty());
+
+  fs::remove_all(directory);
+}
+
+static CatalogEntry catalogEntry(int i) {
+  CatalogEntry entry{};
+  entry.accepted = 1000 + i;
+  entry.client = "192.0.2." + std::to_string(i % 250);
+  entry.sender = i % 2 == 0 ? "even@example.com" : "odd@example.com";
+  entry.recipients = {"a@example.com"};
+  entry.messageId = std::to_string(i) + "@example.com";
+  entry.size = 100 + i;
+  entry.id = std::to_string(i);
+  entry.location = "msg/" + std::to_string(i);
+  return entry;
+}
+
+// Compact until no log but the one appended to is left and the segments are merged
+static void compactAll(MessageCatalog &catalog, const std::string &directory) {
+  auto compacted = [&directory] {
+    size_t logs = 0;
+    for (const auto &entry : fs::directory_iterator{directory}) {
+      logs += entry.path().filename().string().starts_with("log.") ? 1 : 0;
+    }
+    return logs == 1 && CatalogReader{directory}.segmentCount() <= MessageCatalog::maxSegments;
+  };
+  // The background thread compacts too, one of them at a time
+  for (int i = 0; i < 500 && !compacted(); ++i) {
+    catalog.compact();
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+}
+
+TEST(MessageCatalog, compactsLogsIntoSegments) {
+  std::string directory = temporarySpool("segments");
+  // Another process, which exited and left its log
+  {
+    MessageCatalog other{directory, 1000, std::chrono::hours{1}};
+    for (int i = 1000; i < 1005; ++i) {
+      other.append(catalogEntry(i));
+    }
+  }
+
+  {
+    MessageCatalog catalog{directory, 10, std::chrono::hours{1}};
+    for (int i = 0; i < 200; ++i) {
+      catalog.append(catalogEntry(i));
+    }
+    compactAll(catalog, directory);
+  }
+
+  // The last log is left for the next process to compact
+  CatalogReader reader{directory};
+  EXPECT_EQ(reader.size(), 205);
+  EXPECT_LE(reader.segmentCount(), MessageCatalog::maxSegments);
+
+  CatalogQuery query{};
+  query.messageId = "1002@example.com";
+  auto found = reader.search(query);
+  ASSERT_EQ(found.size(), 1);
+  EXPECT_EQ(found[0].accepted, 2002);
+  EXPECT_EQ(found[0].size, 1102);
+
+  query = CatalogQuery{};
+  query.from = 1010;
+  query.to = 1019;
+  query.limit = 3;
+  found = reader.search(query);
+  ASSERT_EQ(found.size(), 3);
+  EXPECT_EQ(found[0].accepted, 1019);
+  EXPECT_EQ(found[2].accepted, 1017);
+
+  query = CatalogQuery{};
+  query.sender = "odd@example.com";
+  query.limit = 1000;
+  EXPECT_EQ(reader.search(query).size(), 102);
+
+  fs::remove_all(directory);
+}
+
+TEST(MessageCatalog, ignoresWhatACrashLeftTwice) {
+  std::string directory = temporarySpool("crash");
+  const std::string copy = directory + ".log";
+  std::string sealed{};
+  {
+    MessageCatalog catalog{directory, 1000, std::chrono::hours{1}};
+    for (int i = 0; i < 20; ++i) {
+      catalog.append(catalogEntry(i));
+    }
+  }
+  for (const auto &entry : fs::directory_iterator{directory}) {
+    if (entry.path().filename().string().starts_with("log.")) {
+      sealed = entry.path().string();
+    }
+  }
+  ASSERT_FALSE(sealed.empty());
+  fs::copy_file(sealed, copy);
+
+  {
+    MessageCatalog catalog{directory, 1000, std::chrono::hours{1}};
+    compactAll(catalog, directory);
+    ASSERT_FALSE(fs::exists(sealed));
+
+    // The log is back, as if the compaction crashed before removing it
+    fs::rename(copy, sealed);
+    EXPECT_EQ(CatalogReader{directory}.size(), 20);
+    EXPECT_EQ(CatalogReader{directory}.segmentCount(), 1);
+    compactAll(catalog, directory);
+  }
+  EXPECT_FALSE(fs::exists(sealed));
+  EXPECT_EQ(CatalogReader{directory}.size(), 20);
+
+  fs::remove_all(directory);
+}
+
+TEST(HeaderIndex, indexesTheFieldsAsTheyArrive) {
+  HeaderIndex index{};
+  for (std::string_view piece : {"From: a@example.com\r\n", "Subj", "ect: hi\r\n", "X-Note: folded\r\n",
+                                 "\tline\r\n", "date:\tToday\r\n", "from: again\r\n", "\r\n", "To: body\r\n"}) {
+    index.append(piece);
+  }
+
+  EXPECT_TRUE(index.complete());
+  ASSERT_EQ(index.fields().size(), 5);
+  EXPECT_EQ(index.find(Header::From), "a@example.com");
+  EXPECT_EQ(index.find(Header::Subject), "hi");
+  EXPECT_EQ(index.find(Header::Date), "Today");
+  EXPECT_EQ(index.find(Header::To), std::nullopt);
+  EXPECT_EQ(index.find("x-note"), "folded\r\n\tline");
+  EXPECT_EQ(index.find("Missing"), std::nullopt);
+
+  // Offsets are those of the message
+  const HeaderField &note = index.fields()[2];
+  EXPECT_EQ(note.offset, 34);
+  EXPECT_EQ(index.name(note), "X-Note");
+
+  // A message without a header section
+  HeaderIndex none{};
+  none.append("just text\r\n");
+  EXPECT_TRUE(none.complete());
+  EXPECT_TRUE(none.fields().empty());
+}
+
+TEST(DedupIndex, forgetsAfterTheWindow) {
+  std::string path = temporarySpool("window");
+  std::string key = DedupIndex::key("1@example.com", 0x1234, "a@example.com");
+  EXPECT_TRUE(DedupIndex::key("has space@example.com", 0x1234, "").empty());
+  EXPECT_NE(DedupIndex::key("1@example.com", 0x1234, "b@example.com"), key);
+  {
+    DedupIndex index{path, std::chrono::seconds{60}};
+    std::time_t now = std::time(nullptr);
+    index.insert(DedupIndex::key("2@example.com", 0x1234, ""), now - 61);
+    index.insert(key, now - 59);
+    EXPECT_TRUE(index.contains(key, now));
+    EXPECT_EQ(index.size(), 1);
+    EXPECT_FALSE(index.contains(key, now + 1));
+  }
+
+  DedupIndex reopened{path, std::chrono::seconds{60}};
+  EXPECT_EQ(reopened.size(), 1);
+  EXPECT_TRUE(reopened.contains(key));
+
+  fs::remove(path);
+}
@@ -0,0 +1,78 @@
+#include "compression.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static void load(const std::filesystem::path &path, std::vector<std::string> &samples) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error("cannot open " + path.string());
+  }
+  samples.emplace_back(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+}
+
+/**
+ * @brief Train a compression dictionary for `miniSMTP --compress-dictionary`.
+ *
+ * @details The samples are plain messages, e.g. those in the cur/ of a
+ * mailbox, or directories of them. A few thousand recent messages are
+ * plenty. The dictionary replaces the output file atomically.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <dictionary> <message or directory>...\n";
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  try {
+    namespace fs = std::filesystem;
+    std::vector<std::string> samples{};
+    size_t bytes = 0;
+    for (int i = 2; i < argc; ++i) {
+      if (!fs::is_directory(argv[i])) {
+        load(argv[i], samples);
+      } else {
+        for (const auto &entry : fs::recursive_directory_iterator{argv[i]}) {
+          if (entry.is_regular_file()) {
+            load(entry.path(), samples);
+          }
+        }
+      }
+    }
+    for (const auto &sample : samples) {
+      bytes += sample.size();
+    }
+
+    Dictionary dictionary = Dictionary::train(samples);
+    const std::string output = argv[1];
+    const std::string partial = output + ".tmp";
+    {
+      std::ofstream file{partial, std::ios::binary | std::ios::trunc};
+      file.write(dictionary.data.data(), static_cast<std::streamsize>(dictionary.data.size()));
+      if (!file.flush()) {
+        throw std::runtime_error("cannot write " + partial);
+      }
+    }
+    fs::rename(partial, output);
+
+    char id[16];
+    std::snprintf(id, sizeof(id), "%08x", dictionary.id);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "Trained dictionary " << id << " of " << dictionary.data.size() << " bytes from " << samples.size()
+              << " messages, " << bytes << " bytes, into " << output << " in " << elapsed.count() << " ms\n";
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
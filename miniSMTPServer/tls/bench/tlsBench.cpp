@@ -0,0 +1,115 @@
+#include "tlsContext.hpp"
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+using ClientContext = std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)>;
+using Session = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+/**
+ * @brief A server context with a fresh self-signed P-256 certificate.
+ *
+ */
+static TlsContext &server() {
+  static TlsContext *context = [] {
+    const std::string certificate = "/tmp/tlsBench." + std::to_string(::getpid()) + ".crt";
+    const std::string key = "/tmp/tlsBench." + std::to_string(::getpid()) + ".key";
+    writeSelfSigned(certificate, key);
+    auto *created = new TlsContext{certificate, key};
+    std::remove(certificate.c_str());
+    std::remove(key.c_str());
+    return created;
+  }();
+  return *context;
+}
+
+static ClientContext client(int version, bool tickets) {
+  ClientContext context{SSL_CTX_new(TLS_client_method()), SSL_CTX_free};
+  SSL_CTX_set_min_proto_version(context.get(), version);
+  SSL_CTX_set_max_proto_version(context.get(), version);
+  if (!tickets) {
+    SSL_CTX_set_options(context.get(), SSL_OP_NO_TICKET);
+  }
+  return context;
+}
+
+/**
+ * @brief One handshake over a memory BIO pair, resuming `previous` if there is one.
+ *
+ * @param[out] serverTime what the server side of the handshake took, the client is not counted
+ * @return Session what the client may resume with next time
+ */
+static Session handshake(SSL_CTX *clientContext, SSL_SESSION *previous, std::chrono::nanoseconds &serverTime) {
+  TlsSession serverEnd = server().create();
+  TlsSession clientEnd{SSL_new(clientContext)};
+  SSL_set_connect_state(clientEnd.get());
+  if (previous != nullptr) {
+    SSL_set_session(clientEnd.get(), previous);
+  }
+
+  BIO *clientBio = nullptr;
+  BIO *serverBio = nullptr;
+  BIO_new_bio_pair(&clientBio, 0, &serverBio, 0);
+  SSL_set_bio(clientEnd.get(), clientBio, clientBio);
+  SSL_set_bio(serverEnd.get(), serverBio, serverBio);
+
+  for (int round = 0; round < 16; ++round) {
+    int clientDone = SSL_do_handshake(clientEnd.get());
+    auto start = std::chrono::steady_clock::now();
+    int serverDone = SSL_do_handshake(serverEnd.get());
+    serverTime += std::chrono::steady_clock::now() - start;
+    if (clientDone == 1 && serverDone == 1) {
+      char byte = 0;
+      SSL_read(clientEnd.get(), &byte, 1);
+      // OpenSSL forgets the sessions of connections closed without close_notify
+      SSL_shutdown(clientEnd.get());
+      SSL_shutdown(serverEnd.get());
+      if (previous != nullptr && SSL_session_reused(clientEnd.get()) != 1) {
+        throw std::runtime_error("the session was not resumed");
+      }
+      return Session{SSL_get1_session(clientEnd.get()), SSL_SESSION_free};
+    }
+  }
+  throw std::runtime_error("handshake: " + tlsError());
+}
+
+// Only the server side is timed, so handshakes/s is what one core of the
+// server sustains
+static void run(benchmark::State &state, SSL_CTX *clientContext, SSL_SESSION *previous) {
+  for (auto _ : state) {
+    std::chrono::nanoseconds serverTime{};
+    Session session = handshake(clientContext, previous, serverTime);
+    benchmark::DoNotOptimize(session.get());
+    state.SetIterationTime(std::chrono::duration<double>(serverTime).count());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_FullHandshake(benchmark::State &state) {
+  ClientContext context = client(static_cast<int>(state.range(0)), true);
+  run(state, context.get(), nullptr);
+}
+BENCHMARK(BM_FullHandshake)->Arg(TLS1_2_VERSION)->Arg(TLS1_3_VERSION)->UseManualTime();
+
+static void BM_TicketResumedHandshake(benchmark::State &state) {
+  ClientContext context = client(static_cast<int>(state.range(0)), true);
+  std::chrono::nanoseconds unused{};
+  Session ticket = handshake(context.get(), nullptr, unused);
+  run(state, context.get(), ticket.get());
+}
+BENCHMARK(BM_TicketResumedHandshake)->Arg(TLS1_2_VERSION)->Arg(TLS1_3_VERSION)->UseManualTime();
+
+static void BM_CacheResumedHandshake(benchmark::State &state) {
+  ClientContext context = client(TLS1_2_VERSION, false);
+  std::chrono::nanoseconds unused{};
+  Session cached = handshake(context.get(), nullptr, unused);
+  run(state, context.get(), cached.get());
+}
+BENCHMARK(BM_CacheResumedHandshake)->UseManualTime();
@@ -0,0 +1,135 @@
+#include "tlsContext.hpp"
+
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <memory>
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+using ClientContext = std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)>;
+using Session = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+class TlsContextTest : public ::testing::Test {
+protected:
+  std::string certificate = "/tmp/tlsContextTest." + std::to_string(::getpid()) + ".crt";
+  std::string key = "/tmp/tlsContextTest." + std::to_string(::getpid()) + ".key";
+
+  void SetUp() override { writeSelfSigned(certificate, key); }
+
+  void TearDown() override {
+    std::remove(certificate.c_str());
+    std::remove(key.c_str());
+  }
+
+  //! Handshake with `server` over a memory BIO pair, resuming `previous` if there is one
+  static Session connect(TlsContext &server, SSL_CTX *client, SSL_SESSION *previous, bool &resumed) {
+    TlsSession serverEnd = server.create();
+    TlsSession clientEnd{SSL_new(client)};
+    SSL_set_connect_state(clientEnd.get());
+    if (previous != nullptr) {
+      SSL_set_session(clientEnd.get(), previous);
+    }
+
+    BIO *clientBio = nullptr;
+    BIO *serverBio = nullptr;
+    BIO_new_bio_pair(&clientBio, 0, &serverBio, 0);
+    SSL_set_bio(clientEnd.get(), clientBio, clientBio);
+    SSL_set_bio(serverEnd.get(), serverBio, serverBio);
+
+    for (int round = 0; round < 16; ++round) {
+      int clientDone = SSL_do_handshake(clientEnd.get());
+      int serverDone = SSL_do_handshake(serverEnd.get());
+      if (clientDone == 1 && serverDone == 1) {
+        // A TLS 1.3 ticket comes after the handshake, reading picks it up
+        char byte = 0;
+        SSL_read(clientEnd.get(), &byte, 1);
+        // OpenSSL forgets the sessions of connections closed without close_notify
+        SSL_shutdown(clientEnd.get());
+        SSL_shutdown(serverEnd.get());
+        resumed = SSL_session_reused(clientEnd.get()) == 1;
+        return Session{SSL_get1_session(clientEnd.get()), SSL_SESSION_free};
+      }
+    }
+    throw std::runtime_error("handshake: " + tlsError());
+  }
+
+  static ClientContext client(int version) {
+    ClientContext context{SSL_CTX_new(TLS_client_method()), SSL_CTX_free};
+    SSL_CTX_set_min_proto_version(context.get(), version);
+    SSL_CTX_set_max_proto_version(context.get(), version);
+    return context;
+  }
+};
+
+TEST_F(TlsContextTest, resumesWithATicket) {
+  TlsContext server{certificate, key};
+  ClientContext tls13 = client(TLS1_3_VERSION);
+
+  bool resumed = true;
+  Session first = connect(server, tls13.get(), nullptr, resumed);
+  EXPECT_FALSE(resumed);
+  ASSERT_EQ(SSL_SESSION_has_ticket(first.get()), 1);
+
+  Session second = connect(server, tls13.get(), first.get(), resumed);
+  EXPECT_TRUE(resumed);
+}
+
+TEST_F(TlsContextTest, resumesFromTheCacheWithoutTickets) {
+  TlsContext server{certificate, key};
+  ClientContext tls12 = client(TLS1_2_VERSION);
+  SSL_CTX_set_options(tls12.get(), SSL_OP_NO_TICKET);
+
+  bool resumed = true;
+  Session first = connect(server, tls12.get(), nullptr, resumed);
+  EXPECT_FALSE(resumed);
+  EXPECT_EQ(SSL_SESSION_has_ticket(first.get()), 0);
+
+  connect(server, tls12.get(), first.get(), resumed);
+  EXPECT_TRUE(resumed);
+  EXPECT_EQ(SSL_CTX_sess_hits(server.native()), 1);
+}
+
+TEST_F(TlsContextTest, ticketsOutliveOneRotation) {
+  TlsContext server{certificate, key};
+  ClientContext tls13 = client(TLS1_3_VERSION);
+
+  bool resumed = true;
+  Session ticket = connect(server, tls13.get(), nullptr, resumed);
+
+  server.rotate();
+  Session renewed = connect(server, tls13.get(), ticket.get(), resumed);
+  EXPECT_TRUE(resumed);
+
+  // The key of `ticket` is gone, the renewed one is from the previous key
+  server.rotate();
+  connect(server, tls13.get(), ticket.get(), resumed);
+  EXPECT_FALSE(resumed);
+  connect(server, tls13.get(), renewed.get(), resumed);
+  EXPECT_TRUE(resumed);
+}
+
+TEST_F(TlsContextTest, ticketsFromAnotherServerGetAFullHandshake) {
+  TlsContext server{certificate, key};
+  TlsContext other{certificate, key};
+  ClientContext tls13 = client(TLS1_3_VERSION);
+
+  bool resumed = true;
+  Session ticket = connect(other, tls13.get(), nullptr, resumed);
+  connect(server, tls13.get(), ticket.get(), resumed);
+  EXPECT_FALSE(resumed);
+}
+
+TEST_F(TlsContextTest, rejectsAKeyThatDoesNotMatch) {
+  std::string otherCertificate = "/tmp/tlsContextTest.other." + std::to_string(::getpid()) + ".crt";
+  std::string otherKey = "/tmp/tlsContextTest.other." + std::to_string(::getpid()) + ".key";
+  writeSelfSigned(otherCertificate, otherKey);
+
+  EXPECT_THROW(TlsContext(certificate, otherKey), std::runtime_error);
+  EXPECT_THROW(TlsContext("/nonexistent.crt", key), std::runtime_error);
+
+  std::remove(otherCertificate.c_str());
+  std::remove(otherKey.c_str());
+}
@@ -0,0 +1,165 @@
+#include "tlsContext.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdexcept>
+#include <unistd.h>
+
+void TlsFree::operator()(SSL *ssl) const { SSL_free(ssl); }
+
+std::string tlsError() {
+  std::string message{};
+  while (unsigned long code = ERR_get_error()) {
+    char text[256];
+    ERR_error_string_n(code, text, sizeof(text));
+    message += message.empty() ? "" : ", ";
+    message += text;
+  }
+  return message.empty() ? "unknown error" : message;
+}
+
+static void check(bool ok, const std::string &what) {
+  if (!ok) {
+    throw std::runtime_error(what + ": " + tlsError());
+  }
+}
+
+TlsContext::TlsContext(const std::string &certificate, const std::string &key, std::chrono::seconds r)
+    : context{SSL_CTX_new(TLS_server_method()), SSL_CTX_free}
+    , cipher{EVP_CIPHER_fetch(nullptr, "AES-256-CBC", nullptr), EVP_CIPHER_free}
+    , rotation{r} {
+  check(context != nullptr && cipher != nullptr, "SSL_CTX_new");
+  SSL_CTX *ctx = context.get();
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  check(SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) == 1, "certificate " + certificate);
+  check(SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) == 1, "private key " + key);
+  check(SSL_CTX_check_private_key(ctx) == 1, "private key " + key);
+
+  // AsyncSocket retries a write with what is left of it, from a buffer
+  // that may have moved. Idle connections give their record buffers back.
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+  // Sessions resumed by id, from TLS 1.2 clients without tickets
+  static constexpr unsigned char id[] = "miniSMTP";
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx, cacheSize);
+  SSL_CTX_set_session_id_context(ctx, id, sizeof(id) - 1);
+  SSL_CTX_set_timeout(ctx, static_cast<long>(2 * rotation.count()));
+
+  // Our sessions are short, one ticket is enough to come back with
+  SSL_CTX_set_num_tickets(ctx, 1);
+  SSL_CTX_set_app_data(ctx, this);
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket);
+
+  std::lock_guard lock{mutex};
+  rotateLocked();
+}
+
+void TlsContext::rotateLocked() {
+  TicketKey key{};
+  check(RAND_bytes(key.name.data(), key.name.size()) == 1 && RAND_bytes(key.aes.data(), key.aes.size()) == 1 &&
+            RAND_bytes(key.hmac.data(), key.hmac.size()) == 1,
+        "RAND_bytes");
+
+  keys.insert(keys.begin(), key);
+  while (keys.size() > 2) {
+    OPENSSL_cleanse(&keys.back(), sizeof(TicketKey));
+    keys.pop_back();
+  }
+  rotated = std::chrono::steady_clock::now();
+}
+
+void TlsContext::rotate() {
+  std::lock_guard lock{mutex};
+  rotateLocked();
+}
+
+int TlsContext::ticket(SSL *ssl,
+                       unsigned char *name,
+                       unsigned char *iv,
+                       EVP_CIPHER_CTX *cipherContext,
+                       EVP_MAC_CTX *mac,
+                       int encrypt) {
+  auto *self = static_cast<TlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+
+  try {
+    std::lock_guard lock{self->mutex};
+    if (std::chrono::steady_clock::now() - self->rotated >= self->rotation) {
+      self->rotateLocked();
+    }
+
+    auto key = self->keys.begin();
+    if (encrypt) {
+      std::memcpy(name, key->name.data(), key->name.size());
+      check(RAND_bytes(iv, EVP_CIPHER_get_iv_length(self->cipher.get())) == 1, "RAND_bytes");
+    } else {
+      key = std::find_if(self->keys.begin(), self->keys.end(), [name](const TicketKey &candidate) {
+        return std::memcmp(candidate.name.data(), name, candidate.name.size()) == 0;
+      });
+      // Expired, or from another server, the client gets a full handshake
+      if (key == self->keys.end()) {
+        return 0;
+      }
+    }
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key->hmac.data(), key->hmac.size()),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+        OSSL_PARAM_construct_end(),
+    };
+    check(EVP_CipherInit_ex2(cipherContext, self->cipher.get(), key->aes.data(), iv, encrypt, nullptr) == 1 &&
+              EVP_MAC_CTX_set_params(mac, params) == 1,
+          "ticket key");
+
+    // 2 makes OpenSSL renew a ticket encrypted with the previous key
+    return key == self->keys.begin() ? 1 : 2;
+  } catch (const std::exception &) {
+    return -1;
+  }
+}
+
+TlsSession TlsContext::create() {
+  TlsSession session{SSL_new(context.get())};
+  check(session != nullptr, "SSL_new");
+  SSL_set_accept_state(session.get());
+  return session;
+}
+
+void writeSelfSigned(const std::string &certificate, const std::string &key, const std::string &name) {
+  std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> pkey{EVP_EC_gen("P-256"), EVP_PKEY_free};
+  check(pkey != nullptr, "EVP_EC_gen");
+
+  std::unique_ptr<X509, decltype(&X509_free)> x509{X509_new(), X509_free};
+  check(x509 != nullptr, "X509_new");
+  X509_set_version(x509.get(), X509_VERSION_3);
+  ASN1_INTEGER_set(X509_get_serialNumber(x509.get()), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509.get()), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509.get()), 365L * 24 * 3600);
+  X509_NAME *subject = X509_get_subject_name(x509.get());
+  X509_NAME_add_entry_by_txt(
+      subject, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>(name.c_str()), -1, -1, 0);
+  X509_set_issuer_name(x509.get(), subject);
+  X509_set_pubkey(x509.get(), pkey.get());
+  check(X509_sign(x509.get(), pkey.get(), EVP_sha256()) > 0, "X509_sign");
+
+  std::unique_ptr<FILE, decltype(&std::fclose)> file{std::fopen(certificate.c_str(), "w"), std::fclose};
+  check(file != nullptr && PEM_write_X509(file.get(), x509.get()) == 1, "write " + certificate);
+  // Only the owner may read the private key
+  int fd = ::open(key.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  file.reset(fd < 0 ? nullptr : ::fdopen(fd, "w"));
+  check(file != nullptr &&
+            PEM_write_PrivateKey(file.get(), pkey.get(), nullptr, nullptr, 0, nullptr, nullptr) == 1,
+        "write " + key);
+}
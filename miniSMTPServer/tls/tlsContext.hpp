@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ssl_st;
+struct ssl_ctx_st;
+struct evp_cipher_st;
+struct evp_cipher_ctx_st;
+struct evp_mac_ctx_st;
+
+//! Frees an OpenSSL connection
+struct TlsFree {
+  void operator()(ssl_st *ssl) const;
+};
+
+/**
+ * @brief One TLS connection, see `TlsContext::create`.
+ *
+ */
+using TlsSession = std::unique_ptr<ssl_st, TlsFree>;
+
+/**
+ * @brief The server side of TLS: the certificate, the session cache and the session-ticket keys.
+ *
+ * @details A full handshake costs a signature with the private key, a
+ * resumed one skips it and the certificate. A resumed TLS 1.3 handshake still
+ * does the (EC)DHE key exchange, which keeps it forward secret. Clients
+ * resume with a session ticket, which the server encrypts with its ticket
+ * key, or with a session id that the server finds in its cache. Both the
+ * cache and the keys live here and are shared by every connection, and every
+ * thread, created from this context.
+ *
+ * The ticket key is rotated every `rotation`. The previous key still
+ * decrypts, and its tickets are renewed, so a ticket is good for at least
+ * one and at most two rotations. An old key that leaks cannot decrypt the
+ * sessions of the current one.
+ */
+class TlsContext {
+private:
+  //! A session-ticket key, named so the ticket says which key encrypted it
+  struct TicketKey {
+    std::array<unsigned char, 16> name{};
+    std::array<unsigned char, 32> aes{};
+    std::array<unsigned char, 32> hmac{};
+  };
+
+  std::unique_ptr<ssl_ctx_st, void (*)(ssl_ctx_st *)> context;
+  std::unique_ptr<evp_cipher_st, void (*)(evp_cipher_st *)> cipher;  //!< Fetched once, not for every ticket
+  std::chrono::seconds rotation;
+
+  std::mutex mutex{};                               //!< Guards the keys, tickets are issued from any thread
+  std::vector<TicketKey> keys{};                    //!< The current key first, then the previous one
+  std::chrono::steady_clock::time_point rotated{};  //!< When the current key was made
+
+  //! Encrypt a new ticket or find the key of a received one, see SSL_CTX_set_tlsext_ticket_key_evp_cb(3)
+  static int ticket(ssl_st *ssl,
+                    unsigned char *name,
+                    unsigned char *iv,
+                    evp_cipher_ctx_st *cipherContext,
+                    evp_mac_ctx_st *mac,
+                    int encrypt);
+
+  //! Make a new current key, the caller holds `mutex`
+  void rotateLocked();
+
+public:
+  //! How many sessions the cache holds for clients resuming with a session id
+  static constexpr long cacheSize = 20 * 1024;
+
+  /**
+   * @brief Load the certificate chain and the private key.
+   *
+   * @param[in] certificate PEM file with the certificate, then its chain
+   * @param[in] key PEM file with the private key
+   * @param[in] rotation how long a ticket key encrypts new tickets
+   */
+  TlsContext(const std::string &certificate,
+             const std::string &key,
+             std::chrono::seconds rotation = std::chrono::hours{1});
+
+  //! A server connection, ready for a file descriptor or BIOs and the handshake
+  TlsSession create();
+
+  //! Start encrypting new tickets with a new key, e.g. when the old one may have leaked
+  void rotate();
+
+  //! The underlying context, e.g. to make a client with the same settings in tests
+  ssl_ctx_st *native() const { return context.get(); }
+
+  TlsContext(const TlsContext &other) = delete;
+  TlsContext &operator=(const TlsContext &other) = delete;
+};
+
+/**
+ * @brief Write a self-signed certificate and its key, for tests and benchmarks.
+ *
+ * @param[in] certificate where to write the PEM certificate
+ * @param[in] key where to write the PEM private key
+ * @param[in] name the common name
+ */
+void writeSelfSigned(const std::string &certificate, const std::string &key, const std::string &name = "localhost");
+
+/**
+ * @brief The error queue of OpenSSL as one message, which empties it.
+ *
+ */
+std::string tlsError();
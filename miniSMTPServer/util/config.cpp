@@ -0,0 +1,244 @@
+#include "config.hpp"
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+static void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  -a, --address <address>       listen on the IPv4 or IPv6 <address>, 127.0.0.1 by default,\n"
+            << "                                :: for every address\n"
+            << "  -p, --port <port>             listen on <port>, 9400 by default\n"
+            << "      --backlog <n>             queue at most <n> connections waiting to be accepted, 1024 by default\n"
+            << "      --nagle                   let Nagle's algorithm delay small replies, off by default\n"
+            << "      --rcvbuf <bytes>          size the receive buffer of every connection, autotuned by default\n"
+            << "      --sndbuf <bytes>          size the send buffer of every connection, autotuned by default\n"
+            << "  -r, --recipients <file>       only accept RCPT for the addresses indexed in <file>\n"
+            << "  -s, --spool <directory>       store accepted messages in <directory>\n"
+            << "      --dedup-window <seconds>  acknowledge but drop a message spooled again within <seconds>,\n"
+            << "                                86400 by default, 0 to keep every copy\n"
+            << "  -R, --relay <host:port>       relay the spooled messages to <host:port>, needs --spool\n"
+            << "  -m, --mailboxes <directory>   deliver the spooled messages to the mailboxes in <directory>,\n"
+            << "                                needs --spool, not with --relay\n"
+            << "      --relay-connections <n>   open at most <n> sessions to the next hop, 4 by default\n"
+            << "      --relay-retry <seconds>   wait <seconds> before retrying a deferred message, 60 by default\n"
+            << "      --helo <name>             say EHLO <name> to the next hop, 127.0.0.1 by default\n"
+            << "  -H, --handover <path>         take the listening socket over from the miniSMTP serving <path>,\n"
+            << "                                then serve <path> to hand it over to the next one\n"
+            << "      --drain <seconds>         after a handover, give the sessions <seconds> to finish, 30 by default\n"
+            << "      --tls-certificate <file>  offer STARTTLS with the PEM certificate chain in <file>\n"
+            << "      --tls-key <file>          the PEM private key of the certificate, needs --tls-certificate\n"
+            << "      --ticket-rotation <seconds>\n"
+            << "                                encrypt session tickets with a new key every <seconds>, 3600 by default\n"
+            << "      --require-headers         reject messages without a Date or From field, needs --spool\n"
+            << "      --filter-threads <n>      run the content filters on <n> threads, 2 by default,\n"
+            << "                                0 to run them on the event loop\n"
+            << "      --filter-deadline <ms>    defer a message whose filters take longer than <ms>, 10000 by default\n"
+            << "      --capture <file>          record every session into the transcript <file>, for replayTranscript\n"
+            << "      --compress <level>        compress the spooled bodies at zlib <level>, 1 for speed to 9 for ratio,\n"
+            << "                                needs --spool\n"
+            << "      --compress-dictionary <file>\n"
+            << "                                compress with the dictionary trainDictionary wrote to <file>,\n"
+            << "                                needs --compress\n"
+            << "      --catalog                 record who sent every accepted message, when and to whom,\n"
+            << "                                for queryCatalog, needs --spool\n"
+            << "  -h, --help                    show this message\n";
+}
+
+static unsigned long number(const char *program, const char *value) {
+  try {
+    size_t end = 0;
+    unsigned long result = std::stoul(value, &end);
+    if (value[end] == '\0') {
+      return result;
+    }
+  } catch (const std::exception &) {
+  }
+  std::cerr << program << ": invalid number " << value << "\n";
+  std::exit(EXIT_FAILURE);
+}
+
+// A number which must fit in what it is stored in, not wrap around
+static unsigned long atMost(const char *program, const char *value, unsigned long limit) {
+  unsigned long result = number(program, value);
+  if (result > limit) {
+    std::cerr << program << ": " << value << " is above " << limit << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+  return result;
+}
+
+static uint16_t port(const char *program, const char *value) {
+  return static_cast<uint16_t>(atMost(program, value, UINT16_MAX));
+}
+
+Config parseConfig(int argc, char *argv[]) {
+  enum {
+    relayConnections = 256,
+    relayRetry,
+    helo,
+    drain,
+    backlog,
+    nagle,
+    rcvbuf,
+    sndbuf,
+    tlsCertificate,
+    tlsKey,
+    ticketRotation,
+    dedupWindow,
+    requireHeaders,
+    filterThreads,
+    filterDeadline,
+    capture,
+    compress,
+    compressDictionary,
+    catalog,
+  };
+
+  static const struct option options[] = {
+      {"address", required_argument, nullptr, 'a'},
+      {"port", required_argument, nullptr, 'p'},
+      {"backlog", required_argument, nullptr, backlog},
+      {"nagle", no_argument, nullptr, nagle},
+      {"rcvbuf", required_argument, nullptr, rcvbuf},
+      {"sndbuf", required_argument, nullptr, sndbuf},
+      {"recipients", required_argument, nullptr, 'r'},
+      {"spool", required_argument, nullptr, 's'},
+      {"dedup-window", required_argument, nullptr, dedupWindow},
+      {"relay", required_argument, nullptr, 'R'},
+      {"mailboxes", required_argument, nullptr, 'm'},
+      {"relay-connections", required_argument, nullptr, relayConnections},
+      {"relay-retry", required_argument, nullptr, relayRetry},
+      {"helo", required_argument, nullptr, helo},
+      {"handover", required_argument, nullptr, 'H'},
+      {"drain", required_argument, nullptr, drain},
+      {"tls-certificate", required_argument, nullptr, tlsCertificate},
+      {"tls-key", required_argument, nullptr, tlsKey},
+      {"ticket-rotation", required_argument, nullptr, ticketRotation},
+      {"require-headers", no_argument, nullptr, requireHeaders},
+      {"filter-threads", required_argument, nullptr, filterThreads},
+      {"filter-deadline", required_argument, nullptr, filterDeadline},
+      {"capture", required_argument, nullptr, capture},
+      {"compress", required_argument, nullptr, compress},
+      {"compress-dictionary", required_argument, nullptr, compressDictionary},
+      {"catalog", no_argument, nullptr, catalog},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  Config config{};
+  int option = 0;
+  while ((option = getopt_long(argc, argv, "a:p:r:s:R:m:H:h", options, nullptr)) != -1) {
+    switch (option) {
+      case 'a':
+        config.listen.address = optarg;
+        break;
+      case 'p':
+        config.listen.port = port(argv[0], optarg);
+        break;
+      case backlog:
+        config.listen.backlog = static_cast<int>(atMost(argv[0], optarg, INT_MAX));
+        break;
+      case nagle:
+        config.listen.nodelay = false;
+        break;
+      case rcvbuf:
+        config.listen.rcvbuf = static_cast<int>(atMost(argv[0], optarg, INT_MAX));
+        break;
+      case sndbuf:
+        config.listen.sndbuf = static_cast<int>(atMost(argv[0], optarg, INT_MAX));
+        break;
+      case 'r':
+        config.recipients = optarg;
+        break;
+      case 's':
+        config.spool = optarg;
+        break;
+      case dedupWindow:
+        config.dedupWindow = number(argv[0], optarg);
+        break;
+      case 'R': {
+        std::string relay = optarg;
+        size_t colon = relay.rfind(':');
+        if (colon == 0 || colon == std::string::npos) {
+          usage(argv[0]);
+          std::exit(EXIT_FAILURE);
+        }
+        config.relay = relay.substr(0, colon);
+        config.relayPort = port(argv[0], relay.c_str() + colon + 1);
+        break;
+      }
+      case 'm':
+        config.mailboxes = optarg;
+        break;
+      case relayConnections:
+        config.relayConnections = number(argv[0], optarg);
+        break;
+      case relayRetry:
+        config.relayRetry = number(argv[0], optarg);
+        break;
+      case helo:
+        config.helo = optarg;
+        break;
+      case 'H':
+        config.handover = optarg;
+        break;
+      case drain:
+        config.drain = number(argv[0], optarg);
+        break;
+      case tlsCertificate:
+        config.tlsCertificate = optarg;
+        break;
+      case tlsKey:
+        config.tlsKey = optarg;
+        break;
+      case ticketRotation:
+        config.ticketRotation = number(argv[0], optarg);
+        break;
+      case requireHeaders:
+        config.requireHeaders = true;
+        break;
+      case filterThreads:
+        config.filterThreads = number(argv[0], optarg);
+        break;
+      case filterDeadline:
+        config.filterDeadline = number(argv[0], optarg);
+        break;
+      case capture:
+        config.capture = optarg;
+        break;
+      case compress:
+        config.compression = number(argv[0], optarg);
+        break;
+      case compressDictionary:
+        config.dictionary = optarg;
+        break;
+      case catalog:
+        config.catalog = true;
+        break;
+      case 'h':
+        usage(argv[0]);
+        std::exit(EXIT_SUCCESS);
+      default:
+        usage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if (optind != argc || (!config.relay.empty() && config.spool.empty()) ||
+      (!config.mailboxes.empty() && (config.spool.empty() || !config.relay.empty())) ||
+      (!config.relay.empty() && config.relayPort == 0) || config.relayConnections == 0 ||
+      config.tlsCertificate.empty() != config.tlsKey.empty() || config.ticketRotation == 0 ||
+      (config.requireHeaders && config.spool.empty()) || config.filterDeadline == 0 || config.compression > 9 ||
+      (config.compression > 0 && config.spool.empty()) || (!config.dictionary.empty() && config.compression == 0) ||
+      (config.catalog && config.spool.empty())) {
+    usage(argv[0]);
+    std::exit(EXIT_FAILURE);
+  }
+
+  return config;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Runtime options of miniSMTP, parsed from the command line.
+ *
+ */
+struct Config {
+  SocketOptions listen{};           //!< Where to listen and how to set the sockets up
+  std::string recipients{};         //!< Recipient index file, empty to accept every well-formed RCPT
+  std::string spool{};              //!< Spool directory, empty to discard accepted messages
+  std::string relay{};              //!< Host of the next hop, empty to keep messages in the spool
+  uint16_t relayPort = 0;           //!< Port of the next hop
+  std::string mailboxes{};          //!< Directory of the local mailboxes, empty to keep messages in the spool
+  unsigned dedupWindow = 86400;     //!< Seconds a spooled message is remembered to drop it if sent again, 0 never
+  size_t relayConnections = 4;      //!< Concurrent sessions to the next hop
+  unsigned relayRetry = 60;         //!< Seconds before the first retry of a deferred message
+  std::string helo = "127.0.0.1";   //!< The name the relay sends with EHLO
+  std::string handover{};           //!< Control socket for hot restarts, empty to disable them
+  unsigned drain = 30;              //!< Seconds the sessions have to finish after a handover
+  std::string tlsCertificate{};     //!< PEM certificate chain offered with STARTTLS, empty to disable it
+  std::string tlsKey{};             //!< PEM private key of `tlsCertificate`
+  unsigned ticketRotation = 3600;   //!< Seconds a session-ticket key encrypts new tickets
+  bool requireHeaders = false;      //!< Reject messages without a Date or From field
+  size_t filterThreads = 2;         //!< Threads running the content filters, 0 to run them on the event loop
+  unsigned filterDeadline = 10000;  //!< Milliseconds the filters have before a message is deferred
+  std::string capture{};            //!< Transcript file recording every session, empty to record none
+  unsigned compression = 0;         //!< zlib level 1 to 9 the spool compresses bodies at, 0 to store them as they are
+  std::string dictionary{};         //!< Dictionary from trainDictionary the bodies are compressed with, empty for none
+  bool catalog = false;             //!< Record every accepted message in the catalog of the spool, for queryCatalog
+};
+
+/**
+ * @brief Parse the command line into a `Config`.
+ * @details Print the usage and exit when an option is unknown or `--help` is given.
+ *
+ * @param[in] argc the argument count of `main`
+ * @param[in] argv the arguments of `main`
+ * @return Config the parsed options
+ */
+Config parseConfig(int argc, char *argv[]);
@@ -0,0 +1,29 @@
+#include "files.hpp"
+
+#include "socket.hpp"
+#include "util.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+std::string uniqueId() {
+  static std::atomic<unsigned> counter{0};
+  auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+  char id[64];
+  std::snprintf(id,
+                sizeof(id),
+                "%016llx.%x.%x",
+                static_cast<unsigned long long>(now.count()),
+                static_cast<unsigned>(::getpid()),
+                counter++);
+  return id;
+}
+
+void syncDirectory(const std::string &path) {
+  FileDescriptor file{SystemCall("open " + path, ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))};
+  SystemCall("fsync " + path, ::fsync(file.fd_num()));
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+/**
+ * @brief A name no other call of any process gives, e.g. for a new file
+ *
+ * @details The time in microseconds, the process id and a counter, in hex,
+ * so the names sort by when they were made.
+ */
+std::string uniqueId();
+
+/**
+ * @brief [fsync(2)](\ref man2::fsync) the directory at `path`, making
+ * the entries created, renamed or removed in it durable
+ *
+ */
+void syncDirectory(const std::string &path);
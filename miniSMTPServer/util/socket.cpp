@@ -2,16 +2,24 @@
 
 #include "util.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <climits>
 #include <cstddef>
 #include <cstring>
 #include <exception>
+#include <fcntl.h>
 #include <iostream>
 #include <memory>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdexcept>
 #include <string>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 FileDescriptor::FDWrapper::FDWrapper(const int f) : fd{f} {
@@ -64,24 +72,79 @@ std::string FileDescriptor::read(const size_t limit) {
   return ret;
 }
 
-size_t FileDescriptor::write(const char *str) {
-  size_t bytes_written = 0;
-  bytes_written = SystemCall("write", ::write(fd_num(), str, strlen(str)));
+size_t FileDescriptor::write(const char *str) { return write(std::string_view{str}); }
 
-  if (bytes_written == 0 && strlen(str) != 0) {
-    throw std::runtime_error("write() returned 0 given non-empty input");
+size_t FileDescriptor::write(const std::string &str) { return write(std::string_view{str}); }
+
+size_t FileDescriptor::write(std::string_view str) {
+  size_t total_written = 0;
+  while (total_written < str.size()) {
+    const size_t bytes_written =
+        SystemCall("write", ::write(fd_num(), str.data() + total_written, str.size() - total_written));
+
+    if (bytes_written == 0) {
+      throw std::runtime_error("write() returned 0 given non-empty input");
+    }
+
+    if (bytes_written > str.size() - total_written) {
+      throw std::runtime_error("write() wrote more than requested");
+    }
+
+    total_written += bytes_written;
+  }
+
+  return total_written;
+}
+
+size_t FileDescriptor::write(const std::vector<std::string_view> &buffers) {
+  std::vector<iovec> pieces{};
+  size_t total = 0;
+  for (std::string_view buffer : buffers) {
+    if (!buffer.empty()) {
+      pieces.push_back(iovec{const_cast<char *>(buffer.data()), buffer.size()});
+      total += buffer.size();
+    }
   }
 
-  if (bytes_written > strlen(str)) {
-    throw std::runtime_error("write() wrote more than requested");
+  size_t total_written = 0;
+  size_t first = 0;
+  while (total_written < total) {
+    const int count = static_cast<int>(std::min(pieces.size() - first, size_t{IOV_MAX}));
+    const size_t bytes_written = SystemCall("writev", ::writev(fd_num(), pieces.data() + first, count));
+    if (bytes_written == 0) {
+      throw std::runtime_error("writev() returned 0 given non-empty input");
+    }
+    total_written += bytes_written;
+
+    // Skip what was written, the last piece may have gone in part
+    size_t left = bytes_written;
+    while (first < pieces.size() && left >= pieces[first].iov_len) {
+      left -= pieces[first].iov_len;
+      ++first;
+    }
+    if (left > 0) {
+      pieces[first].iov_base = static_cast<char *>(pieces[first].iov_base) + left;
+      pieces[first].iov_len -= left;
+    }
   }
 
-  return bytes_written;
+  return total_written;
+}
+
+void FileDescriptor::set_blocking(const bool blocking_state) {
+  int flags = SystemCall("fcntl", ::fcntl(fd_num(), F_GETFL));
+  if (blocking_state) {
+    flags ^= (flags & O_NONBLOCK);
+  } else {
+    flags |= O_NONBLOCK;
+  }
+  SystemCall("fcntl", ::fcntl(fd_num(), F_SETFL, flags));
 }
 
-size_t FileDescriptor::write(const std::string &str) { return write(str.c_str()); }
+TCPSocket::TCPSocket() : TCPSocket{AF_INET} {}
 
-TCPSocket::TCPSocket() : FileDescriptor{SystemCall("socket", ::socket(AF_INET, SOCK_STREAM, 0))} {}
+TCPSocket::TCPSocket(int domain)
+    : FileDescriptor{SystemCall("socket", ::socket(domain, SOCK_STREAM | SOCK_CLOEXEC, 0))} {}
 
 TCPSocket::TCPSocket(FileDescriptor &&fd) : FileDescriptor(std::move(fd)) {}
 
@@ -92,17 +155,191 @@ void TCPSocket::setsockopt(const int level, const int option, const option_type
 
 void TCPSocket::set_reuseaddr() { setsockopt(SOL_SOCKET, SO_REUSEADDR, int(true)); }
 
-void TCPSocket::bind(int port) {
-  struct sockaddr_in address;
+void TCPSocket::set_nodelay(const bool nodelay) { setsockopt(IPPROTO_TCP, TCP_NODELAY, int(nodelay)); }
 
-  address.sin_family = AF_INET;
-  address.sin_port = htons(port);
-  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
-  SystemCall("bind", ::bind(fd_num(), (struct sockaddr *)&address, sizeof(address)));
+void TCPSocket::set_buffers(const int rcvbuf, const int sndbuf) {
+  if (rcvbuf > 0) {
+    setsockopt(SOL_SOCKET, SO_RCVBUF, rcvbuf);
+  }
+  if (sndbuf > 0) {
+    setsockopt(SOL_SOCKET, SO_SNDBUF, sndbuf);
+  }
+}
+
+void TCPSocket::bind(int port) { bind("127.0.0.1", static_cast<uint16_t>(port)); }
+
+void TCPSocket::bind(const std::string &host, uint16_t port) {
+  struct sockaddr_storage address {};
+  socklen_t length = 0;
+
+  auto *ipv4 = reinterpret_cast<struct sockaddr_in *>(&address);
+  auto *ipv6 = reinterpret_cast<struct sockaddr_in6 *>(&address);
+  if (inet_pton(AF_INET, host.c_str(), &ipv4->sin_addr) == 1) {
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_port = htons(port);
+    length = sizeof(*ipv4);
+  } else if (inet_pton(AF_INET6, host.c_str(), &ipv6->sin6_addr) == 1) {
+    ipv6->sin6_family = AF_INET6;
+    ipv6->sin6_port = htons(port);
+    length = sizeof(*ipv6);
+  } else {
+    throw std::runtime_error("not an IPv4 or IPv6 address: " + host);
+  }
+  SystemCall("bind " + host, ::bind(fd_num(), (struct sockaddr *)&address, length));
 }
 
 void TCPSocket::listen(const int backlog) { SystemCall("listen", ::listen(fd_num(), backlog)); }
 
+void TCPSocket::connect(const std::string &host, uint16_t port) {
+  struct addrinfo hints {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *result = nullptr;
+  if (int error = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result); error != 0) {
+    throw std::runtime_error("getaddrinfo " + host + ": " + gai_strerror(error));
+  }
+  std::unique_ptr<struct addrinfo, decltype(&::freeaddrinfo)> addresses{result, ::freeaddrinfo};
+
+  SystemCall("connect", ::connect(fd_num(), addresses->ai_addr, addresses->ai_addrlen));
+}
+
 TCPSocket TCPSocket::accept() {
-  return TCPSocket(FileDescriptor(SystemCall("accept", ::accept(fd_num(), nullptr, nullptr))));
+  return TCPSocket(FileDescriptor(SystemCall("accept", ::accept4(fd_num(), nullptr, nullptr, SOCK_CLOEXEC))));
+}
+
+uint16_t TCPSocket::local_port() const {
+  struct sockaddr_storage address {};
+  socklen_t length = sizeof(address);
+  SystemCall("getsockname", ::getsockname(fd_num(), (struct sockaddr *)&address, &length));
+  // The port is at the same offset in sockaddr_in and sockaddr_in6
+  return ntohs(reinterpret_cast<struct sockaddr_in *>(&address)->sin_port);
+}
+
+std::string TCPSocket::peer_address() const {
+  struct sockaddr_storage address {};
+  socklen_t length = sizeof(address);
+  SystemCall("getpeername", ::getpeername(fd_num(), (struct sockaddr *)&address, &length));
+
+  char text[INET6_ADDRSTRLEN] = {};
+  const void *numeric = address.ss_family == AF_INET6
+                            ? static_cast<const void *>(&reinterpret_cast<struct sockaddr_in6 *>(&address)->sin6_addr)
+                            : static_cast<const void *>(&reinterpret_cast<struct sockaddr_in *>(&address)->sin_addr);
+  if (::inet_ntop(address.ss_family, numeric, text, sizeof(text)) == nullptr) {
+    throw unix_error("inet_ntop");
+  }
+  return text;
+}
+
+void TCPSocket::set_timeout(std::chrono::milliseconds timeout) {
+  struct timeval value {};
+  value.tv_sec = timeout.count() / 1000;
+  value.tv_usec = (timeout.count() % 1000) * 1000;
+  setsockopt(SOL_SOCKET, SO_RCVTIMEO, value);
+  setsockopt(SOL_SOCKET, SO_SNDTIMEO, value);
+}
+
+TCPSocket listenOn(const SocketOptions &options) {
+  TCPSocket socket{options.address.find(':') == std::string::npos ? AF_INET : AF_INET6};
+  socket.set_reuseaddr();
+  socket.set_nodelay(options.nodelay);
+  // Before listen(2), the window scale offered to clients depends on the receive buffer
+  socket.set_buffers(options.rcvbuf, options.sndbuf);
+  socket.bind(options.address, options.port);
+  socket.listen(options.backlog);
+  return socket;
+}
+
+static struct sockaddr_un unixAddress(const std::string &path) {
+  struct sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("unix socket path too long: " + path);
+  }
+  path.copy(address.sun_path, path.size());
+  return address;
+}
+
+UnixSocket::UnixSocket() : FileDescriptor{SystemCall("socket", ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))} {}
+
+UnixSocket::UnixSocket(FileDescriptor &&fd) : FileDescriptor(std::move(fd)) {}
+
+void UnixSocket::bind(const std::string &path) {
+  struct sockaddr_un address = unixAddress(path);
+  SystemCall("bind " + path, ::bind(fd_num(), (struct sockaddr *)&address, sizeof(address)));
+}
+
+void UnixSocket::listen(const int backlog) { SystemCall("listen", ::listen(fd_num(), backlog)); }
+
+void UnixSocket::connect(const std::string &path) {
+  struct sockaddr_un address = unixAddress(path);
+  SystemCall("connect " + path, ::connect(fd_num(), (struct sockaddr *)&address, sizeof(address)));
+}
+
+UnixSocket UnixSocket::accept() {
+  return UnixSocket(FileDescriptor(SystemCall("accept", ::accept4(fd_num(), nullptr, nullptr, SOCK_CLOEXEC))));
+}
+
+// At most this many descriptors travel in one message
+static constexpr size_t maxFds = 16;
+
+void UnixSocket::send_fds(const std::vector<int> &fds) {
+  if (fds.empty() || fds.size() > maxFds) {
+    throw std::runtime_error("cannot send " + std::to_string(fds.size()) + " descriptors");
+  }
+
+  // At least one byte of data has to go with the descriptors
+  char byte = 0;
+  struct iovec data {};
+  data.iov_base = &byte;
+  data.iov_len = 1;
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * maxFds)]{};
+  struct msghdr message {};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+
+  SystemCall("sendmsg", ::sendmsg(fd_num(), &message, MSG_NOSIGNAL));
+}
+
+std::vector<FileDescriptor> UnixSocket::receive_fds() {
+  char byte = 0;
+  struct iovec data {};
+  data.iov_base = &byte;
+  data.iov_len = 1;
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * maxFds)]{};
+  struct msghdr message {};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  std::vector<FileDescriptor> fds{};
+  if (SystemCall("recvmsg", ::recvmsg(fd_num(), &message, MSG_CMSG_CLOEXEC)) == 0) {
+    return fds;
+  }
+  for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; ++i) {
+      int fd = 0;
+      std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+      fds.emplace_back(fd);
+    }
+  }
+  if (message.msg_flags & MSG_CTRUNC) {
+    throw std::runtime_error("recvmsg: descriptors truncated");
+  }
+  return fds;
 }
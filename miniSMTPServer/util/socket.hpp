@@ -1,7 +1,12 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <limits>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
 class FileDescriptor {
   /**
@@ -62,9 +67,18 @@ public:
   //! Write a string, possibly blocking until all is written
   size_t write(const std::string &str);
 
+  //! Write a buffer, possibly blocking until all is written
+  size_t write(std::string_view str);
+
+  //! Write the buffers in order with [writev(2)](\ref man2::writev), possibly blocking until all is written
+  size_t write(const std::vector<std::string_view> &buffers);
+
   //! Close the underlying file descriptor
   void close() { internal_fd->close(); }
 
+  //! Set blocking(true) or non-blocking(false) with [fcntl(2)](\ref man2::fcntl)
+  void set_blocking(const bool blocking_state);
+
   //! Copy a FileDescriptor explicitly, increasing the FDWrapper refcount
   FileDescriptor duplicate() const;
 
@@ -80,26 +94,99 @@ public:
   FileDescriptor &operator=(FileDescriptor &&other) = default;
 };
 
+/**
+ * @brief How a listening socket, and the connections it accepts, are set up.
+ *
+ */
+struct SocketOptions {
+  std::string address = "127.0.0.1";  //!< IPv4 or IPv6 address to bind, "::" for every address of both
+  uint16_t port = 9400;                //!< The port to bind, 0 for any
+  int backlog = 1024;                  //!< Connections the kernel queues until they are accepted
+  bool nodelay = true;                 //!< Disable Nagle's algorithm, replies leave as soon as they are written
+  int rcvbuf = 0;                      //!< SO_RCVBUF in bytes, 0 to leave it to the kernel's autotuning
+  int sndbuf = 0;                      //!< SO_SNDBUF in bytes, 0 to leave it to the kernel's autotuning
+};
+
 class TCPSocket : public FileDescriptor {
 public:
-  //! Construct via [socket(2)](\ref man2::socket)
+  //! Construct an IPv4 socket via [socket(2)](\ref man2::socket)
   TCPSocket();
 
+  //! Construct a socket of `domain`, AF_INET or AF_INET6
+  explicit TCPSocket(int domain);
+
   explicit TCPSocket(FileDescriptor &&fd);
 
   //! Wrapper around [setsockopt(2)](\ref man2::setsockopt)
   template <typename option_type>
   void setsockopt(const int level, const int option, const option_type &option_value);
 
-  //! Bind a socket to a specified address with [bind(2)](\ref man2::bind), usually for listen/accept
+  //! Bind a socket to 127.0.0.1:`port` with [bind(2)](\ref man2::bind), usually for listen/accept
   void bind(int port = 9400);
 
+  //! Bind a socket to `address`:`port`, `address` is a numeric IPv4 or IPv6 address
+  void bind(const std::string &address, uint16_t port);
+
   //! Mark a socket as listening for incoming connections
   void listen(const int backlog = 16);
 
+  //! Connect to `host`:`port` with [connect(2)](\ref man2::connect), `host` is a name or an IPv4 address
+  void connect(const std::string &host, uint16_t port);
+
   //! Accept a new incoming connection
   TCPSocket accept();
 
+  //! The port the socket is bound to, useful after binding port 0
+  uint16_t local_port() const;
+
+  //! The numeric address of the peer via [getpeername(2)](\ref man2::getpeername)
+  std::string peer_address() const;
+
+  //! Fail blocking reads and writes that take longer than `timeout` via [SO_RCVTIMEO](\ref man7::socket)
+  void set_timeout(std::chrono::milliseconds timeout);
+
   //! Allow local address to be reused sooner via [SO_REUSEADDR](\ref man7::socket)
   void set_reuseaddr();
+
+  //! Disable(true) or enable(false) Nagle's algorithm via [TCP_NODELAY](\ref man7::tcp)
+  void set_nodelay(const bool nodelay);
+
+  //! Size the kernel buffers via [SO_RCVBUF and SO_SNDBUF](\ref man7::socket), 0 keeps the default
+  void set_buffers(const int rcvbuf, const int sndbuf);
+};
+
+/**
+ * @brief A socket bound and listening as `options` says.
+ * @details The options set on a listening socket are inherited by the
+ * connections it accepts, so they are applied once, here.
+ *
+ * @param[in] options where to listen and how to set the socket up
+ * @return TCPSocket the listening socket
+ */
+TCPSocket listenOn(const SocketOptions &options);
+
+class UnixSocket : public FileDescriptor {
+public:
+  //! Construct a stream socket in the [unix(7)](\ref man7::unix) domain
+  UnixSocket();
+
+  explicit UnixSocket(FileDescriptor &&fd);
+
+  //! Bind to the filesystem path `path`, which must not exist
+  void bind(const std::string &path);
+
+  //! Mark a socket as listening for incoming connections
+  void listen(const int backlog = 16);
+
+  //! Connect to the socket bound to `path`
+  void connect(const std::string &path);
+
+  //! Accept a new incoming connection
+  UnixSocket accept();
+
+  //! Send duplicates of the descriptors `fds` with [SCM_RIGHTS](\ref man7::unix)
+  void send_fds(const std::vector<int> &fds);
+
+  //! Receive the descriptors sent with `send_fds`, nothing if the peer has closed
+  std::vector<FileDescriptor> receive_fds();
 };
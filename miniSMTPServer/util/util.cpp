@@ -13,3 +13,17 @@ int SystemCall(const char *attempt, const int return_value, const int errno_mask
 int SystemCall(const std::string &attempt, const int return_value, const int errno_mask) {
   return SystemCall(attempt.c_str(), return_value, errno_mask);
 }
+
+uint64_t hashIgnoringCase(std::string_view value) noexcept {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (char c : value) {
+    h ^= static_cast<unsigned char>((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c);
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
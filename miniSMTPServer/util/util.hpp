@@ -4,7 +4,9 @@
 #pragma once
 
 #include <cerrno>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <system_error>
 
 /**
@@ -61,3 +63,12 @@ int SystemCall(const char *attempt, const int return_value, const int errno_mask
  *
  */
 int SystemCall(const std::string &attempt, const int return_value, const int errno_mask = 0);
+
+/**
+ * @brief Hash a string ignoring the case of ASCII letters, e.g. an address
+ *
+ * @details FNV-1a over the lower-cased bytes, followed by the murmur3
+ * finalizer so that the top bits are well mixed.
+ */
+uint64_t hashIgnoringCase(std::string_view value) noexcept;
+